@@ -0,0 +1,235 @@
+// apps/bm25_cli.cpp
+// 从 SQLite documents 表构建 C++ BM25 索引并查询，对照 python/BM25.py 的结果。
+// --save 把索引写成 mmap 格式；--index 直接打开已保存的索引，不再读数据库；
+// --segments 打开 ingest_cli --segments 维护的段目录（--merge-all 把它压成一个段）。
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include <sqlite3.h>
+
+#include "bm25_index.h"
+#include "bm25_segments.h"
+
+// ---------- tiny arg parser ----------
+static const char *get_arg(int &i, int argc, char **argv)
+{
+    if (i + 1 >= argc)
+        return nullptr;
+    return argv[++i];
+}
+
+static void win32_enable_utf8_console()
+{
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
+#endif
+}
+
+// 表结构见 python/SQLite.py::init_schema：documents(id INTEGER PRIMARY KEY, ..., text TEXT, ...)
+static bool build_from_sqlite(const std::string &db_path, const std::string &table, const std::string &col,
+                              bm25_builder &builder)
+{
+    sqlite3 *db = nullptr;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+    {
+        std::cerr << "Failed to open db: " << db_path << "\n";
+        if (db)
+            sqlite3_close(db);
+        return false;
+    }
+
+    const std::string sql = "SELECT id, " + col + " FROM " + table + " ORDER BY id";
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        std::cerr << "Failed to prepare: " << sqlite3_errmsg(db) << "\n";
+        sqlite3_close(db);
+        return false;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const int64_t id = sqlite3_column_int64(stmt, 0);
+        const unsigned char *text = sqlite3_column_text(stmt, 1);
+        builder.add_document(id, text ? (const char *)text : "");
+    }
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    win32_enable_utf8_console();
+
+    std::string db_path = "data/documents.db";
+    std::string table = "documents";
+    std::string col = "text";
+    std::string query;
+    std::string save_path;
+    std::string index_path;
+    std::string segments_dir;
+    bool verify = false;
+    bool merge_all = false;
+    tokenize_options tokenize;
+    int top_k = 5;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        const char *v = nullptr;
+        if (a == "--db" || a == "--table" || a == "--col" || a == "--query" || a == "-q" || a == "--topk" ||
+            a == "--save" || a == "--index" || a == "--segments" || a == "--cjk")
+        {
+            v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for " << a << "\n";
+                return 2;
+            }
+        }
+
+        if (a == "--db")
+            db_path = v;
+        else if (a == "--table")
+            table = v;
+        else if (a == "--col")
+            col = v;
+        else if (a == "--query" || a == "-q")
+            query = v;
+        else if (a == "--topk")
+            top_k = std::atoi(v);
+        else if (a == "--save")
+            save_path = v;
+        else if (a == "--index")
+            index_path = v;
+        else if (a == "--segments")
+            segments_dir = v;
+        else if (a == "--cjk")
+        {
+            if (!tokenize_parse_cjk(v, tokenize.cjk))
+            {
+                std::cerr << "Unknown --cjk mode: " << v << " (unigram|bigram|both)\n";
+                return 2;
+            }
+        }
+        else if (a == "--verify")
+            verify = true;
+        else if (a == "--merge-all")
+            merge_all = true;
+        else if (a == "--help" || a == "-h")
+        {
+            std::cout
+                << "Usage:\n"
+                << "  bm25_cli [--db data/documents.db] [--table documents] [--col text]\n"
+                << "           [--cjk unigram|bigram|both] [--save <index.bin>] [--query <text>] [--topk 5]\n"
+                << "  bm25_cli --index <index.bin> [--verify] [--query <text>] [--topk 5]\n"
+                << "  bm25_cli --segments <dir> [--merge-all] [--query <text>] [--topk 5]\n";
+            return 0;
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << a << "\n";
+            return 2;
+        }
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    auto t0 = clock::now();
+    std::string err;
+    if (!segments_dir.empty())
+    {
+        bm25_segments segs;
+        if (!segs.open(segments_dir, err))
+        {
+            std::cerr << "Failed to open segments: " << err << "\n";
+            return 3;
+        }
+        if (merge_all && !segs.merge_all(err))
+        {
+            std::cerr << "Failed to merge segments: " << err << "\n";
+            return 4;
+        }
+        auto t1 = clock::now();
+        std::cerr << "[bm25] segments=" << segs.n_segments() << " docs=" << segs.size() << " deleted=" << segs.n_deleted()
+                  << " open_ms=" << std::chrono::duration<double, std::milli>(t1 - t0).count() << "\n";
+        if (query.empty())
+            return 0;
+
+        auto t2 = clock::now();
+        std::vector<bm25_hit> hits = segs.search(query, (size_t)std::max(top_k, 1));
+        auto t3 = clock::now();
+        for (const auto &h : hits)
+            std::printf("%lld\t%.4f\n", (long long)h.doc_key, h.score);
+        std::cerr << "[bm25] query_us=" << std::chrono::duration<double, std::micro>(t3 - t2).count() << "\n";
+        return 0;
+    }
+
+    bm25_index index;
+    if (!index_path.empty())
+    {
+        if (!index.open(index_path, err))
+        {
+            std::cerr << "Failed to open index: " << err << "\n";
+            return 3;
+        }
+    }
+    else
+    {
+        bm25_builder builder(tokenize);
+        if (!build_from_sqlite(db_path, table, col, builder))
+            return 3;
+        index = builder.build();
+    }
+    auto t1 = clock::now();
+
+    std::cerr << "[bm25] docs=" << index.size() << " terms=" << index.n_terms()
+              << " avgdl=" << index.avgdl() << (index_path.empty() ? " build_ms=" : " open_ms=")
+              << std::chrono::duration<double, std::milli>(t1 - t0).count() << "\n";
+
+    if (verify && !index.verify(err))
+    {
+        std::cerr << "Index verification failed: " << err << "\n";
+        return 4;
+    }
+
+    if (!save_path.empty())
+    {
+        if (!index.save(save_path, err))
+        {
+            std::cerr << "Failed to save index: " << err << "\n";
+            return 4;
+        }
+        std::cerr << "[bm25] saved " << save_path << "\n";
+    }
+
+    if (query.empty())
+        return 0;
+
+    auto t2 = clock::now();
+    std::vector<bm25_hit> hits = index.search(query, (size_t)std::max(top_k, 1));
+    auto t3 = clock::now();
+
+    for (const auto &h : hits)
+        std::printf("%lld\t%.4f\n", (long long)h.doc_key, h.score);
+    std::cerr << "[bm25] query_us=" << std::chrono::duration<double, std::micro>(t3 - t2).count() << "\n";
+    return 0;
+}
@@ -0,0 +1,295 @@
+// apps/embed_cli.cpp
+// 向量化工具：
+//   入库：读 SQLite documents 表，多序列批量求 embedding，建 HNSW 向量索引并落盘；
+//   查询：--index 打开已保存的索引，把 --query 向量化后检索，输出 documents.id。
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include <sqlite3.h>
+
+#include "llama.h"
+#include "llm_embed.h"
+#include "vector_index.h"
+
+// ---------- tiny arg parser ----------
+static const char *get_arg(int &i, int argc, char **argv)
+{
+    if (i + 1 >= argc)
+        return nullptr;
+    return argv[++i];
+}
+
+static void win32_enable_utf8_console()
+{
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
+#endif
+}
+
+struct doc_row
+{
+    int64_t id;
+    std::string text;
+};
+
+static bool load_rows(const std::string &db_path, const std::string &table, const std::string &col,
+                      std::vector<doc_row> &rows)
+{
+    sqlite3 *db = nullptr;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+    {
+        std::cerr << "Failed to open db: " << db_path << "\n";
+        if (db)
+            sqlite3_close(db);
+        return false;
+    }
+
+    const std::string sql = "SELECT id, " + col + " FROM " + table + " ORDER BY id";
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        std::cerr << "Failed to prepare: " << sqlite3_errmsg(db) << "\n";
+        sqlite3_close(db);
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const unsigned char *text = sqlite3_column_text(stmt, 1);
+        rows.push_back({sqlite3_column_int64(stmt, 0), text ? (const char *)text : ""});
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    win32_enable_utf8_console();
+
+    llm_embed_params eparams;
+    vector_index_params vparams;
+    std::string db_path = "data/documents.db";
+    std::string table = "documents";
+    std::string col = "text";
+    std::string out_path = "data/vectors.idx";
+    std::string index_path;
+    std::string query;
+    std::string storage = "f16";
+    int chunk = 256; // 每次 embed_batch 的文本数
+    int top_k = 5;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        const char *v = nullptr;
+        if (a == "--model" || a == "-m" || a == "--db" || a == "--table" || a == "--col" || a == "--out" ||
+            a == "--index" || a == "--query" || a == "-q" || a == "--batch" || a == "--seqs" ||
+            a == "--threads" || a == "--chunk" || a == "--storage" || a == "--M" || a == "--efc" || a == "--topk")
+        {
+            v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for " << a << "\n";
+                return 2;
+            }
+        }
+
+        if (a == "--model" || a == "-m")
+            eparams.model_path = v;
+        else if (a == "--db")
+            db_path = v;
+        else if (a == "--table")
+            table = v;
+        else if (a == "--col")
+            col = v;
+        else if (a == "--out")
+            out_path = v;
+        else if (a == "--index")
+            index_path = v;
+        else if (a == "--query" || a == "-q")
+            query = v;
+        else if (a == "--batch")
+            eparams.n_batch = std::atoi(v);
+        else if (a == "--seqs")
+            eparams.n_seq_max = std::atoi(v);
+        else if (a == "--threads")
+            eparams.n_threads = std::atoi(v);
+        else if (a == "--chunk")
+            chunk = std::max(1, std::atoi(v));
+        else if (a == "--storage")
+            storage = v;
+        else if (a == "--M")
+            vparams.M = (uint32_t)std::atoi(v);
+        else if (a == "--efc")
+            vparams.ef_construction = (uint32_t)std::atoi(v);
+        else if (a == "--topk")
+            top_k = std::atoi(v);
+        else if (a == "--help" || a == "-h")
+        {
+            std::cout
+                << "Usage:\n"
+                << "  embed_cli --model <embed.gguf> [--db data/documents.db] [--table documents] [--col text]\n"
+                << "            [--out data/vectors.idx] [--storage f32|f16|i8] [--M 16] [--efc 200]\n"
+                << "            [--batch 2048] [--seqs 32] [--threads 0] [--chunk 256]\n"
+                << "  embed_cli --model <embed.gguf> --index data/vectors.idx --query <text> [--topk 5]\n";
+            return 0;
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << a << "\n";
+            return 2;
+        }
+    }
+
+    if (eparams.model_path.empty())
+    {
+        std::cerr << "Error: --model is required\n";
+        return 2;
+    }
+    if (storage == "f32")
+        vparams.storage = vec_storage::f32;
+    else if (storage == "f16")
+        vparams.storage = vec_storage::f16;
+    else if (storage == "i8")
+        vparams.storage = vec_storage::i8;
+    else
+    {
+        std::cerr << "Unknown storage: " << storage << " (f32|f16|i8)\n";
+        return 2;
+    }
+    vparams.metric = vec_metric::ip; // embedding 已归一化
+
+    using clock = std::chrono::steady_clock;
+    llama_backend_init();
+
+    int rc = 0;
+    {
+        llm_embedder embedder;
+        std::string err;
+        if (!embedder.load(eparams, err))
+        {
+            std::cerr << err << "\n";
+            llama_backend_free();
+            return 3;
+        }
+
+        if (!index_path.empty())
+        {
+            // ------- 查询 -------
+            vector_index index;
+            std::vector<float> q;
+            if (!index.open(index_path, err))
+            {
+                std::cerr << "Failed to open index: " << err << "\n";
+                rc = 3;
+            }
+            else if ((int)index.dim() != embedder.n_embd())
+            {
+                std::cerr << "Index dim " << index.dim() << " does not match model n_embd " << embedder.n_embd() << "\n";
+                rc = 3;
+            }
+            else
+            {
+                auto t0 = clock::now();
+                if (!embedder.embed(query, q, err))
+                {
+                    std::cerr << err << "\n";
+                    rc = 5;
+                }
+                else
+                {
+                    auto t1 = clock::now();
+                    const std::vector<vec_hit> hits = index.search(q.data(), (size_t)std::max(top_k, 1));
+                    auto t2 = clock::now();
+                    for (const auto &h : hits)
+                        std::printf("%lld\t%.4f\n", (long long)h.doc_key, -h.distance);
+                    std::cerr << "[embed] embed_ms=" << std::chrono::duration<double, std::milli>(t1 - t0).count()
+                              << " search_us=" << std::chrono::duration<double, std::micro>(t2 - t1).count() << "\n";
+                }
+            }
+        }
+        else
+        {
+            // ------- 入库 -------
+            std::vector<doc_row> rows;
+            if (!load_rows(db_path, table, col, rows))
+            {
+                rc = 3;
+            }
+            else
+            {
+                vparams.dim = (uint32_t)embedder.n_embd();
+                vector_index index;
+                if (!index.init(vparams, err))
+                {
+                    std::cerr << err << "\n";
+                    rc = 2;
+                }
+
+                auto t0 = clock::now();
+                double embed_ms = 0.0;
+                std::vector<std::string> texts;
+                std::vector<float> vecs;
+                for (size_t start = 0; rc == 0 && start < rows.size(); start += (size_t)chunk)
+                {
+                    const size_t end = std::min(rows.size(), start + (size_t)chunk);
+                    texts.clear();
+                    for (size_t i = start; i < end; ++i)
+                        texts.push_back(rows[i].text);
+
+                    auto te = clock::now();
+                    if (!embedder.embed_batch(texts, vecs, err))
+                    {
+                        std::cerr << err << "\n";
+                        rc = 5;
+                        break;
+                    }
+                    embed_ms += std::chrono::duration<double, std::milli>(clock::now() - te).count();
+
+                    for (size_t i = start; i < end; ++i)
+                        index.add(rows[i].id, vecs.data() + (i - start) * vparams.dim, err);
+
+                    const double secs = std::chrono::duration<double>(clock::now() - t0).count();
+                    std::cerr << "\r[embed] " << end << "/" << rows.size() << " docs, "
+                              << (int)((double)end / std::max(secs, 1e-9)) << " docs/s" << std::flush;
+                }
+                std::cerr << "\n";
+
+                if (rc == 0)
+                {
+                    const double total_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+                    std::cerr << "[embed] n=" << index.size() << " dim=" << index.dim() << " embed_ms=" << embed_ms
+                              << " index_ms=" << (total_ms - embed_ms) << " truncated=" << embedder.n_truncated() << "\n";
+                    if (!index.save(out_path, err))
+                    {
+                        std::cerr << "Failed to save index: " << err << "\n";
+                        rc = 4;
+                    }
+                    else
+                    {
+                        std::cerr << "[embed] saved " << out_path << "\n";
+                    }
+                }
+            }
+        }
+    }
+
+    llama_backend_free();
+    return rc;
+}
@@ -1,11 +1,653 @@
+// apps/infer_demo.cpp
+// 整条 RAG 链路的基准：把一批问题依次跑过 检索 → 取证据 → prefill → decode，
+// 报告各阶段延迟分位数、token 速度与峰值 RSS。升级 llama.cpp 或改索引前后各跑一次，对比 --json 的输出。
+//
+// 问题来源：--queries 文本文件（每行一个问题；.jsonl 时取每行的 "query" 字段），或 --runs-db 里 rag_cli.py 写的 runs 表。
+// 不给 --model 时只测检索与取证据。答案缓存不参与；证据块缓存照常开启，--chunk-cache-mb 0 测冷读。
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <sqlite3.h>
+
 #include "llama.h"
+#include "evidence_pack.h"
+#include "json_lite.h"
+#include "llm_engine.h"
+#include "metrics.h"
+#include "rag_pipeline.h"
+
+static const char *get_arg(int &i, int argc, char **argv)
+{
+    if (i + 1 >= argc)
+        return nullptr;
+    return argv[++i];
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+static double ms_since(bench_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - t0).count();
+}
+
+// 进程峰值常驻内存（字节）
+static size_t peak_rss_bytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return (size_t)pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return (size_t)ru.ru_maxrss; // macOS 上单位是字节
+#else
+    return (size_t)ru.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static bool ends_with(const std::string &s, const std::string &suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool load_queries_file(const std::string &path, std::vector<std::string> &out, std::string &err)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+    {
+        err = "failed to open " + path;
+        return false;
+    }
+    const bool jsonl = ends_with(path, ".jsonl");
+    std::string line;
+    size_t lineno = 0;
+    while (std::getline(f, line))
+    {
+        ++lineno;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            continue;
+        if (!jsonl)
+        {
+            out.push_back(line);
+            continue;
+        }
+        json_value v;
+        std::string jerr;
+        if (!json_parse(line, v, jerr) || !v.is_object())
+        {
+            err = path + ":" + std::to_string(lineno) + ": " + (jerr.empty() ? "not a JSON object" : jerr);
+            return false;
+        }
+        const std::string q = v.get_string("query");
+        if (!q.empty())
+            out.push_back(q);
+    }
+    return true;
+}
+
+static bool load_queries_runs(const std::string &db_path, std::vector<std::string> &out, std::string &err)
+{
+    sqlite3 *db = nullptr;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+    {
+        err = "failed to open " + db_path + (db ? std::string(": ") + sqlite3_errmsg(db) : "");
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT query FROM runs ORDER BY rowid", -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        err = std::string("failed to read runs: ") + sqlite3_errmsg(db);
+        sqlite3_close(db);
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const unsigned char *q = sqlite3_column_text(stmt, 0);
+        if (q && *q)
+            out.emplace_back((const char *)q, (size_t)sqlite3_column_bytes(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return true;
+}
+
+// 一条问题的测量结果
+struct bench_sample
+{
+    double search_ms = 0.0;
+    double fetch_ms = 0.0;
+    double retrieve_ms = 0.0; // 整个 retrieve()：召回 + 取证据 + 重排与闸门
+    double cross_ms = 0.0;    // 其中交叉编码器打分的部分（--rerank-model）
+    bool cross_ran = false;   // 过了闸门、跑了交叉编码器（不论是否超时）
+    bool reranked = false;    // 交叉编码器在预算内算完
+    bool generated = false;   // 闸门通过并完成了生成
+    double pack_ms = 0.0;     // 按预算装证据（取缓存 token / 现场 tokenize）
+    int n_evidence = 0;       // 装进 prompt 的证据 token 数
+    double queue_ms = 0.0;
+    double template_ms = 0.0; // 渲染聊天模板
+    double tokenize_ms = 0.0; // 切 token、拼证据 token
+    double prefill_ms = 0.0;  // 从接纳到第一个 token
+    double decode_ms = 0.0;   // 第一个 token 之后
+    double total_ms = 0.0;
+    int n_prefill = 0;        // 实际 prefill 的 token 数（不含复用的前缀）
+    int n_gen = 0;
+    double kv_seq_kib = 0.0;  // 结束时该序列实际占用的 KV
+    double prefill_tps = 0.0;
+    double decode_tps = 0.0;
+};
 
-int main()
+struct bench_stat
 {
-    std::cout << "infer_demo: llama backend init...\n";
+    size_t n = 0;
+    double mean = 0.0, p50 = 0.0, p90 = 0.0, p99 = 0.0, max = 0.0;
+};
+
+// 最近秩分位数
+static bench_stat summarize(std::vector<double> v)
+{
+    bench_stat st;
+    st.n = v.size();
+    if (v.empty())
+        return st;
+    std::sort(v.begin(), v.end());
+    auto pct = [&](double p)
+    {
+        size_t rank = (size_t)(p * (double)v.size() + 0.999999);
+        rank = std::min(std::max<size_t>(rank, 1), v.size());
+        return v[rank - 1];
+    };
+    double sum = 0.0;
+    for (double x : v)
+        sum += x;
+    st.mean = sum / (double)v.size();
+    st.p50 = pct(0.50);
+    st.p90 = pct(0.90);
+    st.p99 = pct(0.99);
+    st.max = v.back();
+    return st;
+}
+
+static json_value stat_json(const bench_stat &st)
+{
+    json_value v = json_value::make_object();
+    v.set("n", json_value::make_number((double)st.n));
+    v.set("mean", json_value::make_number(st.mean));
+    v.set("p50", json_value::make_number(st.p50));
+    v.set("p90", json_value::make_number(st.p90));
+    v.set("p99", json_value::make_number(st.p99));
+    v.set("max", json_value::make_number(st.max));
+    return v;
+}
+
+static void print_usage()
+{
+    std::cerr
+        << "Usage:\n"
+        << "  infer_demo (--queries <q.txt|q.jsonl> | --runs-db <db>) [--db data/documents.db] [--table documents]\n"
+        << "             [--index bm25.idx] [--vec-index vectors.idx --embed-model <embed.gguf>] [--rag-k 5]\n"
+        << "             [--rerank-model <reranker.gguf> [--rerank-top-n 8] [--rerank-budget-ms 80] [--rerank-keep 3]]\n"
+        << "             [--model <path.gguf>]   不给时只测检索与取证据\n"
+        << "             [--n 64] [--ctx 2048] [--batch 512] [--threads <n>] [--threads-batch <n>] [--no-grammar]\n"
+        << "             [--cache-type-k f16|q8_0|q4_0] [--cache-type-v f16|q8_0|q4_0] [--flash-attn] [--ctx-overflow fail|truncate|shift]\n"
+        << "             [--chunk-cache-mb 64] [--evidence-budget <tokens>] [--warmup 2] [--repeat 1] [--limit <n>] [--json]\n"
+        << "  --evidence-budget：证据的 token 上限，0（默认）按 --ctx / --n 自动，-1 不限\n"
+        << "             [--trace <trace.json>]   每条问题的 search / fetch / rerank / pack / template / tokenize / prefill / decode 写成 Chrome trace\n"
+        << "  --warmup：先把前 N 条问题跑一遍不计入结果；--repeat：整批重复的次数\n";
+}
+
+int main(int argc, char **argv)
+{
+    std::string model_path;
+    std::string queries_path;
+    std::string runs_db;
+    rag_params rparams;
+    std::string rag_fusion = "rrf";
+    int rag_k = 5;
+    int chunk_cache_mb = 64;
+    int evidence_budget = 0;
+    llm_engine_params eparams;
+    int n_predict = 64;
+    bool use_grammar = true;
+    int warmup = 2;
+    int repeat = 1;
+    int limit = 0;
+    bool json_out = false;
+    std::string trace_file;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string a = argv[i];
+        // 除开关型参数外都带一个值
+        if (a == "--json")
+        {
+            json_out = true;
+            continue;
+        }
+        if (a == "--no-grammar")
+        {
+            use_grammar = false;
+            continue;
+        }
+        if (a == "--flash-attn" || a == "-fa")
+        {
+            eparams.flash_attn = true;
+            continue;
+        }
+        if (a == "--help" || a == "-h")
+        {
+            print_usage();
+            return 0;
+        }
+        const char *v = get_arg(i, argc, argv);
+        if (!v)
+        {
+            std::cerr << "Missing value for " << a << "\n";
+            return 2;
+        }
+        if (a == "--model" || a == "-m")
+            model_path = v;
+        else if (a == "--queries")
+            queries_path = v;
+        else if (a == "--runs-db")
+            runs_db = v;
+        else if (a == "--db")
+            rparams.db_path = v;
+        else if (a == "--table")
+            rparams.table = v;
+        else if (a == "--index")
+            rparams.index_path = v;
+        else if (a == "--vec-index")
+            rparams.vector_index_path = v;
+        else if (a == "--embed-model")
+            rparams.embed_model_path = v;
+        else if (a == "--fusion")
+            rag_fusion = v;
+        else if (a == "--rerank-model")
+            rparams.rerank_model_path = v;
+        else if (a == "--rerank-top-n")
+            rparams.rerank_top_n = (size_t)std::max(1, std::atoi(v));
+        else if (a == "--rerank-budget-ms")
+            rparams.rerank_budget_ms = std::max(0, std::atoi(v));
+        else if (a == "--rerank-keep")
+            rparams.rerank_keep = (size_t)std::max(0, std::atoi(v));
+        else if (a == "--rag-k")
+            rag_k = std::atoi(v);
+        else if (a == "--chunk-cache-mb")
+            chunk_cache_mb = std::atoi(v);
+        else if (a == "--evidence-budget")
+            evidence_budget = std::atoi(v);
+        else if (a == "--trace")
+            trace_file = v;
+        else if (a == "--n")
+            n_predict = std::atoi(v);
+        else if (a == "--ctx")
+            eparams.n_ctx = std::atoi(v);
+        else if (a == "--batch")
+            eparams.n_batch = std::atoi(v);
+        else if (a == "--threads" || a == "-t")
+            eparams.n_threads = std::atoi(v);
+        else if (a == "--threads-batch" || a == "-tb")
+            eparams.n_threads_batch = std::atoi(v);
+        else if (a == "--cache-type-k" || a == "-ctk" || a == "--cache-type-v" || a == "-ctv")
+        {
+            const bool is_k = a == "--cache-type-k" || a == "-ctk";
+            if (!llm_parse_kv_type(v, is_k ? eparams.type_k : eparams.type_v))
+            {
+                std::cerr << "Unknown KV cache type: " << v << "\n";
+                return 2;
+            }
+        }
+        else if (a == "--ctx-overflow")
+        {
+            if (!llm_parse_overflow(v, eparams.overflow))
+            {
+                std::cerr << "Unknown --ctx-overflow: " << v << " (fail|truncate|shift)\n";
+                return 2;
+            }
+        }
+        else if (a == "--warmup")
+            warmup = std::max(0, std::atoi(v));
+        else if (a == "--repeat")
+            repeat = std::max(1, std::atoi(v));
+        else if (a == "--limit")
+            limit = std::max(0, std::atoi(v));
+        else
+        {
+            std::cerr << "Unknown arg: " << a << "\n";
+            print_usage();
+            return 2;
+        }
+    }
+
+    std::vector<std::string> queries;
+    std::string err;
+    if (queries_path.empty() == runs_db.empty())
+    {
+        std::cerr << "Give exactly one of --queries / --runs-db\n";
+        print_usage();
+        return 2;
+    }
+    if (!(queries_path.empty() ? load_queries_runs(runs_db, queries, err) : load_queries_file(queries_path, queries, err)))
+    {
+        std::cerr << err << "\n";
+        return 2;
+    }
+    if (limit > 0 && queries.size() > (size_t)limit)
+        queries.resize((size_t)limit);
+    if (queries.empty())
+    {
+        std::cerr << "no queries\n";
+        return 2;
+    }
+    if (!trace_file.empty())
+    {
+        std::string err;
+        if (!trace_open(trace_file, err))
+        {
+            std::cerr << err << "\n";
+            return 2;
+        }
+    }
+
     llama_backend_init();
+
+    int rc = 0;
+    {
+        const auto t_load = bench_clock::now();
+        llm_engine engine;
+        const bool with_llm = !model_path.empty();
+        if (with_llm)
+        {
+            eparams.model_path = model_path;
+            eparams.n_parallel = 1;
+            if (!engine.load(eparams, err))
+            {
+                std::cerr << err << "\n";
+                llama_backend_free();
+                return 3;
+            }
+        }
+
+        rparams.top_k = (size_t)std::max(rag_k, 1);
+        rparams.hybrid.fusion = rag_fusion == "weighted" ? hybrid_fusion::weighted : hybrid_fusion::rrf;
+        rparams.chunk_cache_bytes = (size_t)std::max(chunk_cache_mb, 0) << 20;
+        rag_pipeline rag;
+        if (!rag.open(rparams, err))
+        {
+            std::cerr << err << "\n";
+            llama_backend_free();
+            return 3;
+        }
+        evidence_packer packer;
+        if (with_llm)
+        {
+            evidence_pack_params pparams;
+            pparams.budget_tokens =
+                evidence_budget == 0 ? evidence_auto_budget(engine.params().n_ctx, n_predict) : evidence_budget;
+            if (!packer.open(engine, rparams.db_path, pparams, err))
+            {
+                std::cerr << err << "\n";
+                llama_backend_free();
+                return 3;
+            }
+        }
+        const double load_ms = ms_since(t_load);
+
+        llm_request defaults;
+        defaults.n_predict = n_predict;
+
+        auto run_one = [&](const std::string &query, bench_sample &s) -> bool
+        {
+            const auto t0 = bench_clock::now();
+            const uint64_t tid = trace_enabled() ? trace_next_id() : 0;
+            rag_retrieval rr;
+            if (!rag.retrieve(query, rr, err, tid))
+                return false;
+            s.retrieve_ms = ms_since(t0);
+            s.search_ms = rr.search_ms;
+            s.fetch_ms = rr.fetch_ms;
+            s.cross_ms = rr.cross_rerank_ms;
+            s.cross_ran = rag.rerank_enabled() && rr.gate == rag_gate::ok;
+            s.reranked = rr.reranked;
+            if (with_llm && rr.gate == rag_gate::ok)
+            {
+                llm_request req = defaults;
+                req.question = query;
+                req.trace_id = tid;
+                const auto tp = bench_clock::now();
+                evidence_pack_stats pst;
+                packer.pack(rr, req, pst);
+                s.pack_ms = ms_since(tp);
+                trace_span("pack", "rag", tid, tp, bench_clock::now());
+                s.n_evidence = pst.n_tokens;
+                if (use_grammar)
+                    req.grammar = rag_citation_grammar(rr.evidence, rag_grammar_chars(req.n_predict));
+                const auto t1 = bench_clock::now();
+                const llm_result res = engine.generate(req);
+                const double gen_ms = ms_since(t1);
+                if (!res.ok)
+                {
+                    err = res.error;
+                    rc = res.error_code;
+                    return false;
+                }
+                s.generated = true;
+                s.queue_ms = res.queue_ms;
+                s.template_ms = res.template_ms;
+                s.tokenize_ms = res.tokenize_ms;
+                s.prefill_ms = std::max(0.0, res.ttft_ms - res.queue_ms);
+                s.decode_ms = std::max(0.0, gen_ms - res.ttft_ms);
+                s.n_prefill = res.n_prompt_tokens - res.n_cached_tokens;
+                s.n_gen = res.n_gen_tokens;
+                s.kv_seq_kib = res.kv_seq_bytes / 1024.0;
+                s.prefill_tps = res.prefill_tps;
+                s.decode_tps = res.decode_tps;
+            }
+            s.total_ms = ms_since(t0);
+            trace_span("query", "bench", tid, t0, bench_clock::now());
+            return true;
+        };
+
+        // 预热：缺页、权重与索引进 cache、公共前缀 KV 建好
+        const size_t n_warm = std::min((size_t)warmup, queries.size());
+        for (size_t i = 0; i < n_warm && rc == 0; ++i)
+        {
+            bench_sample s;
+            if (!run_one(queries[i], s))
+            {
+                std::cerr << "warmup failed: " << err << "\n";
+                rc = rc ? rc : 3;
+            }
+        }
+
+        std::vector<bench_sample> samples;
+        samples.reserve(queries.size() * (size_t)repeat);
+        const auto t_run = bench_clock::now();
+        for (int r = 0; r < repeat && rc == 0; ++r)
+        {
+            for (const auto &q : queries)
+            {
+                bench_sample s;
+                if (!run_one(q, s))
+                {
+                    std::cerr << "query failed: " << err << "\n";
+                    rc = rc ? rc : 3;
+                    break;
+                }
+                samples.push_back(s);
+            }
+        }
+        const double wall_ms = ms_since(t_run);
+
+        if (rc == 0)
+        {
+            std::vector<double> search, fetch, retrieve, cross, pack, evidence, queue, templ, tokenize, prefill, decode, total,
+                prefill_tps, decode_tps, kv_seq;
+            double sum_prefill_ms = 0.0, sum_decode_ms = 0.0;
+            long long sum_prefill_tok = 0, sum_decode_tok = 0;
+            size_t n_generated = 0, n_cross = 0, n_reranked = 0;
+            for (const auto &s : samples)
+            {
+                search.push_back(s.search_ms);
+                fetch.push_back(s.fetch_ms);
+                retrieve.push_back(s.retrieve_ms);
+                if (s.cross_ran)
+                {
+                    ++n_cross;
+                    n_reranked += s.reranked ? 1 : 0;
+                    cross.push_back(s.cross_ms);
+                }
+                total.push_back(s.total_ms);
+                if (!s.generated)
+                    continue;
+                ++n_generated;
+                pack.push_back(s.pack_ms);
+                kv_seq.push_back(s.kv_seq_kib);
+                evidence.push_back(s.n_evidence);
+                queue.push_back(s.queue_ms);
+                templ.push_back(s.template_ms);
+                tokenize.push_back(s.tokenize_ms);
+                prefill.push_back(s.prefill_ms);
+                decode.push_back(s.decode_ms);
+                if (s.prefill_tps > 0.0)
+                    prefill_tps.push_back(s.prefill_tps);
+                if (s.decode_tps > 0.0)
+                    decode_tps.push_back(s.decode_tps);
+                sum_prefill_ms += s.prefill_ms;
+                sum_decode_ms += s.decode_ms;
+                sum_prefill_tok += s.n_prefill;
+                sum_decode_tok += std::max(0, s.n_gen - 1); // 第一个 token 算在 prefill 里
+            }
+
+            const std::vector<std::pair<const char *, bench_stat>> stages = {
+                {"search_ms", summarize(search)},   {"fetch_ms", summarize(fetch)},
+                {"retrieve_ms", summarize(retrieve)}, {"cross_ms", summarize(cross)},
+                {"pack_ms", summarize(pack)},
+                {"evidence_tok", summarize(evidence)}, {"queue_ms", summarize(queue)},
+                {"template_ms", summarize(templ)},  {"tokenize_ms", summarize(tokenize)},
+                {"prefill_ms", summarize(prefill)}, {"decode_ms", summarize(decode)},
+                {"total_ms", summarize(total)},     {"prefill_tps", summarize(prefill_tps)},
+                {"decode_tps", summarize(decode_tps)}, {"kv_seq_kib", summarize(kv_seq)},
+            };
+            // 预留的 KV（按超参估算）：整个上下文与平均到每条序列
+            const double kv_mib = with_llm ? engine.kv_bytes() / 1048576.0 : 0.0;
+            const double agg_prefill_tps = sum_prefill_ms > 0.0 ? sum_prefill_tok * 1000.0 / sum_prefill_ms : 0.0;
+            const double agg_decode_tps = sum_decode_ms > 0.0 ? sum_decode_tok * 1000.0 / sum_decode_ms : 0.0;
+            const double qps = wall_ms > 0.0 ? samples.size() * 1000.0 / wall_ms : 0.0;
+            const size_t rss = peak_rss_bytes();
+            const chunk_cache_stats cst = rag.cache() ? rag.cache()->stats() : chunk_cache_stats();
+
+            if (json_out)
+            {
+                json_value out = json_value::make_object();
+                json_value cfg = json_value::make_object();
+                cfg.set("model", json_value::make_string(model_path));
+                cfg.set("db", json_value::make_string(rparams.db_path));
+                cfg.set("hybrid", json_value::make_bool(rag.hybrid_enabled()));
+                cfg.set("rag_k", json_value::make_number((double)rparams.top_k));
+                if (rag.rerank_enabled())
+                {
+                    cfg.set("rerank_model", json_value::make_string(rparams.rerank_model_path));
+                    cfg.set("rerank_top_n", json_value::make_number((double)rparams.rerank_top_n));
+                    cfg.set("rerank_budget_ms", json_value::make_number(rparams.rerank_budget_ms));
+                    cfg.set("rerank_keep", json_value::make_number((double)rparams.rerank_keep));
+                }
+                cfg.set("n_predict", json_value::make_number(n_predict));
+                cfg.set("grammar", json_value::make_bool(use_grammar));
+                cfg.set("chunk_cache_mb", json_value::make_number(chunk_cache_mb));
+                if (with_llm)
+                {
+                    cfg.set("evidence_budget", json_value::make_number(packer.params().budget_tokens));
+                    cfg.set("evidence_token_cache", json_value::make_bool(packer.has_cache()));
+                    cfg.set("n_threads", json_value::make_number(engine.params().n_threads));
+                    cfg.set("cache_type_k", json_value::make_string(ggml_type_name(engine.params().type_k)));
+                    cfg.set("cache_type_v", json_value::make_string(ggml_type_name(engine.params().type_v)));
+                    cfg.set("flash_attn", json_value::make_bool(engine.params().flash_attn));
+                    cfg.set("n_ctx", json_value::make_number(engine.params().n_ctx));
+                    cfg.set("n_threads_batch", json_value::make_number(engine.params().n_threads_batch));
+                }
+                cfg.set("system_info", json_value::make_string(llama_print_system_info()));
+                out.set("config", cfg);
+                out.set("n_queries", json_value::make_number((double)queries.size()));
+                out.set("warmup", json_value::make_number((double)n_warm));
+                out.set("repeat", json_value::make_number(repeat));
+                out.set("n_samples", json_value::make_number((double)samples.size()));
+                out.set("n_generated", json_value::make_number((double)n_generated));
+                if (rag.rerank_enabled())
+                {
+                    out.set("n_rerank", json_value::make_number((double)n_cross));
+                    out.set("n_rerank_fallback", json_value::make_number((double)(n_cross - n_reranked)));
+                }
+                out.set("load_ms", json_value::make_number(load_ms));
+                out.set("wall_ms", json_value::make_number(wall_ms));
+                out.set("qps", json_value::make_number(qps));
+                json_value st = json_value::make_object();
+                for (const auto &kv : stages)
+                    st.set(kv.first, stat_json(kv.second));
+                out.set("stages", st);
+                out.set("prefill_tps", json_value::make_number(agg_prefill_tps));
+                out.set("decode_tps", json_value::make_number(agg_decode_tps));
+                out.set("kv_reserved_mib", json_value::make_number(kv_mib));
+                out.set("chunk_cache_hits", json_value::make_number((double)cst.hits));
+                out.set("chunk_cache_misses", json_value::make_number((double)cst.misses));
+                out.set("peak_rss_bytes", json_value::make_number((double)rss));
+                std::cout << json_dump(out) << "\n";
+            }
+            else
+            {
+                std::printf("queries=%zu warmup=%zu repeat=%d samples=%zu generated=%zu\n", queries.size(), n_warm,
+                            repeat, samples.size(), n_generated);
+                std::printf("load=%.1fms wall=%.1fms qps=%.2f\n\n", load_ms, wall_ms, qps);
+                std::printf("%-12s %6s %10s %10s %10s %10s %10s\n", "stage", "n", "mean", "p50", "p90", "p99", "max");
+                for (const auto &kv : stages)
+                {
+                    const bench_stat &s = kv.second;
+                    std::printf("%-12s %6zu %10.2f %10.2f %10.2f %10.2f %10.2f\n", kv.first, s.n, s.mean, s.p50, s.p90,
+                                s.p99, s.max);
+                }
+                std::printf("\nprefill %.1f tok/s, decode %.1f tok/s (aggregate)\n", agg_prefill_tps, agg_decode_tps);
+                if (with_llm)
+                    std::printf("kv cache: %s/%s, %.1f MiB reserved per sequence of %d tokens\n",
+                                ggml_type_name(engine.params().type_k), ggml_type_name(engine.params().type_v), kv_mib,
+                                engine.params().n_ctx);
+                if (rag.rerank_enabled())
+                    std::printf("cross-encoder: %zu runs, %zu fell back to the heuristic (budget %d ms)\n", n_cross,
+                                n_cross - n_reranked, rparams.rerank_budget_ms);
+                std::printf("chunk cache: %llu hits / %llu misses\n", (unsigned long long)cst.hits,
+                            (unsigned long long)cst.misses);
+                std::printf("peak RSS: %.1f MB\n", rss / (1024.0 * 1024.0));
+            }
+        }
+    }
+
+    trace_close();
     llama_backend_free();
-    std::cout << "infer_demo: OK\n";
-    return 0;
+    return rc;
 }
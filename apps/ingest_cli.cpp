@@ -0,0 +1,191 @@
+// apps/ingest_cli.cpp
+// 入库工具：python/ingest.py 的原生多线程版本（流水线见 src/ingest.h）。
+// 参数与 ingest.py 对应：--docs_dir / --db / --bm25 / --rebuild；额外可以顺带建向量索引。
+// --segments 改为增量更新 BM25 段目录：只为本次新增/改动的文件写一个小段，旧版本记墓碑。
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include "llama.h"
+#include "ingest.h"
+
+// ---------- tiny arg parser ----------
+static const char *get_arg(int &i, int argc, char **argv)
+{
+    if (i + 1 >= argc)
+        return nullptr;
+    return argv[++i];
+}
+
+static void win32_enable_utf8_console()
+{
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
+#endif
+}
+
+static void print_usage()
+{
+    std::cout
+        << "Usage:\n"
+        << "  ingest_cli --docs_dir <dir> [--db data/documents.db] [--bm25 data/bm25.idx] [--rebuild]\n"
+        << "             [--segments data/bm25_segments [--max-segments 8] [--merge-factor 4] [--max-deleted 0.3]]\n"
+        << "             [--vec-out data/vectors.idx --embed-model <embed.gguf> [--storage f32|f16|i8]]\n"
+        << "             [--threads <n>] [--index-threads <n>] [--queue 4096] [--commit-rows 20000]\n"
+        << "             [--chunk-size 900] [--chunk-overlap 150] [--embed-batch 256] [--cjk unigram|bigram|both]\n"
+        << "             [--token-model <llm.gguf>]   按生成模型的词表预先切好每行的 token（llm_cli 装证据时直接用）\n"
+        << "  只支持 .txt / .md；.pdf 仍用 python/ingest.py\n"
+        << "  内容没变的文件会跳过（--rebuild 强制重新入库）；同一个库请固定用 --bm25 或 --segments 其中一种\n";
+}
+
+int main(int argc, char **argv)
+{
+    win32_enable_utf8_console();
+
+    ingest_params params;
+    std::string storage = "f16";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string a = argv[i];
+        if (a == "--rebuild")
+        {
+            params.rebuild = true;
+            continue;
+        }
+        if (a == "--help" || a == "-h")
+        {
+            print_usage();
+            return 0;
+        }
+        const char *v = get_arg(i, argc, argv);
+        if (!v)
+        {
+            std::cerr << "Missing value for " << a << "\n";
+            return 2;
+        }
+        if (a == "--docs_dir" || a == "--docs-dir")
+            params.docs_dir = v;
+        else if (a == "--db")
+            params.db_path = v;
+        else if (a == "--bm25")
+            params.bm25_path = v;
+        else if (a == "--segments")
+            params.segments_dir = v;
+        else if (a == "--max-segments")
+            params.merge.max_segments = (size_t)std::max(1, std::atoi(v));
+        else if (a == "--merge-factor")
+            params.merge.merge_factor = (size_t)std::max(2, std::atoi(v));
+        else if (a == "--max-deleted")
+            params.merge.max_deleted_ratio = (float)std::atof(v);
+        else if (a == "--vec-out")
+            params.vector_path = v;
+        else if (a == "--embed-model")
+            params.embed_model_path = v;
+        else if (a == "--storage")
+            storage = v;
+        else if (a == "--token-model")
+            params.token_model_path = v;
+        else if (a == "--threads")
+            params.n_parse_threads = std::atoi(v);
+        else if (a == "--index-threads")
+            params.n_index_threads = std::atoi(v);
+        else if (a == "--queue")
+            params.queue_rows = (size_t)std::max(1, std::atoi(v));
+        else if (a == "--commit-rows")
+            params.commit_rows = (size_t)std::max(1, std::atoi(v));
+        else if (a == "--chunk-size")
+            params.chunk_size = (size_t)std::max(1, std::atoi(v));
+        else if (a == "--chunk-overlap")
+            params.chunk_overlap = (size_t)std::max(0, std::atoi(v));
+        else if (a == "--cjk")
+        {
+            if (!tokenize_parse_cjk(v, params.tokenize.cjk))
+            {
+                std::cerr << "Unknown --cjk mode: " << v << " (unigram|bigram|both)\n";
+                return 2;
+            }
+        }
+        else if (a == "--embed-batch")
+            params.embed_batch = std::max(1, std::atoi(v));
+        else
+        {
+            std::cerr << "Unknown argument: " << a << "\n";
+            return 2;
+        }
+    }
+
+    if (params.docs_dir.empty())
+    {
+        std::cerr << "Error: --docs_dir is required\n";
+        return 2;
+    }
+    if (params.chunk_overlap >= params.chunk_size)
+    {
+        std::cerr << "Error: --chunk-overlap must be < --chunk-size\n";
+        return 2;
+    }
+    if (!params.segments_dir.empty() && (!params.bm25_path.empty() || !params.vector_path.empty()))
+    {
+        std::cerr << "Error: --segments cannot be combined with --bm25 / --vec-out\n";
+        return 2;
+    }
+    if (!params.vector_path.empty() && params.embed_model_path.empty())
+    {
+        std::cerr << "Error: --vec-out needs --embed-model\n";
+        return 2;
+    }
+    if (storage == "f32")
+        params.vector.storage = vec_storage::f32;
+    else if (storage == "f16")
+        params.vector.storage = vec_storage::f16;
+    else if (storage == "i8")
+        params.vector.storage = vec_storage::i8;
+    else
+    {
+        std::cerr << "Unknown storage: " << storage << " (f32|f16|i8)\n";
+        return 2;
+    }
+    params.vector.metric = vec_metric::ip; // embedding 已归一化
+
+    llama_backend_init();
+    ingest_stats st;
+    std::string err;
+    const bool ok = ingest_run(params, st, err);
+    llama_backend_free();
+
+    std::cerr << "[ingest] files=" << st.n_files << " unchanged=" << st.n_unchanged << " removed=" << st.n_removed
+              << " skipped=" << st.n_skipped << " chunks=" << st.n_chunks << " indexed=" << st.n_indexed
+              << " embedded=" << st.n_embedded << "\n";
+    if (st.n_invalid_utf8)
+        std::cerr << "[ingest] warning: " << st.n_invalid_utf8 << " file(s) had invalid UTF-8 bytes (dropped)\n";
+    std::cerr << "[ingest] tokenizer=" << tokenize_isa() << " pipeline_ms=" << st.pipeline_ms << " merge_ms=" << st.merge_ms << " save_ms=" << st.save_ms
+              << "\n";
+    if (!ok)
+    {
+        std::cerr << err << "\n";
+        return 3;
+    }
+    if (!params.bm25_path.empty())
+        std::cerr << "[ingest] bm25 saved: " << params.bm25_path << "\n";
+    if (!params.segments_dir.empty())
+        std::cerr << "[ingest] segments updated: " << params.segments_dir << " (segments=" << st.n_segments
+                  << " tombstones=" << st.n_tombstones << " merged=" << st.n_merged << ")\n";
+    if (!params.vector_path.empty())
+        std::cerr << "[ingest] vectors saved: " << params.vector_path << "\n";
+    if (!params.token_model_path.empty())
+        std::cerr << "[ingest] chunk tokens updated: " << st.n_token_rows << " row(s), token_ms=" << st.token_ms << "\n";
+    return 0;
+}
@@ -6,8 +6,12 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #ifdef _WIN32
 #ifndef NOMINMAX
@@ -20,6 +24,17 @@
 #endif
 
 #include "llama.h"
+#include "llm_engine.h"
+#include "answer_cache.h"
+#include "chunk_cache.h"
+#include "cpu_tuning.h"
+#include "evidence_pack.h"
+#include "evidence_store.h"
+#include "json_lite.h"
+#include "llm_pool.h"
+#include "metrics.h"
+#include "rag_pipeline.h"
+#include "rag_service.h"
 
 // 只有当你要用 --db/--ids 从 SQLite 取证据时才需要
 #include <sqlite3.h>
@@ -41,97 +56,6 @@ static void win32_enable_utf8_console()
 #endif
 }
 
-// ---------- stop sequence detector ----------
-static bool ends_with_any(const std::string &s, const std::vector<std::string> &stops)
-{
-    for (const auto &t : stops)
-    {
-        if (t.empty())
-            continue;
-        if (s.size() >= t.size() && s.compare(s.size() - t.size(), t.size(), t) == 0)
-            return true;
-    }
-    return false;
-}
-
-static void trim_at_stop_first_occurrence(std::string &s, const std::vector<std::string> &stops)
-{
-    size_t cut = std::string::npos;
-    for (const auto &t : stops)
-    {
-        if (t.empty())
-            continue;
-        size_t pos = s.find(t);
-        if (pos != std::string::npos)
-            cut = std::min(cut, pos);
-    }
-    if (cut != std::string::npos)
-        s.resize(cut);
-}
-
-// ---------- force "one sentence" postprocess ----------
-static size_t find_first_sentence_end_zh(const std::string &s)
-{
-    static const std::vector<std::string> ends = {u8"。", u8"！", u8"？"};
-    size_t best = std::string::npos;
-    for (const auto &e : ends)
-    {
-        size_t p = s.find(e);
-        if (p != std::string::npos)
-        {
-            size_t endpos = p + e.size();
-            best = (best == std::string::npos) ? endpos : std::min(best, endpos);
-        }
-    }
-    size_t nl = s.find('\n');
-    if (nl != std::string::npos)
-    {
-        best = (best == std::string::npos) ? nl : std::min(best, nl);
-    }
-    return best;
-}
-
-static void normalize_one_sentence(std::string &s)
-{
-    s.erase(std::remove(s.begin(), s.end(), '\r'), s.end());
-
-    size_t cut = find_first_sentence_end_zh(s);
-    if (cut != std::string::npos)
-        s.resize(cut);
-
-    auto is_ws = [](unsigned char c)
-    { return c == ' ' || c == '\t' || c == '\n'; };
-    while (!s.empty() && is_ws((unsigned char)s.front()))
-        s.erase(s.begin());
-    while (!s.empty() && is_ws((unsigned char)s.back()))
-        s.pop_back();
-
-    for (char &c : s)
-    {
-        if (c == '\n' || c == '\t')
-            c = ' ';
-    }
-
-    std::string out;
-    out.reserve(s.size());
-    bool prev_space = false;
-    for (char c : s)
-    {
-        bool sp = (c == ' ');
-        if (sp)
-        {
-            if (!prev_space)
-                out.push_back(c);
-        }
-        else
-        {
-            out.push_back(c);
-        }
-        prev_space = sp;
-    }
-    s.swap(out);
-}
-
 // ---------- file utils ----------
 static bool read_all_text(const std::string &path, std::string &out)
 {
@@ -172,63 +96,354 @@ static std::vector<int64_t> parse_ids_csv(const std::string &s)
 // 假设你的表结构是：documents(id INTEGER PRIMARY KEY, filename TEXT, content TEXT)
 // 或者 chunks(id INTEGER PRIMARY KEY, doc TEXT, chunk_idx INT, content TEXT)
 // 你可以通过 --table 指定表名（默认 documents），--col 指定内容列（默认 content）。
-static std::string load_context_from_sqlite_by_ids(
-    const std::string &db_path,
-    const std::string &table,
-    const std::string &content_col,
-    const std::vector<int64_t> &ids)
+// 连接与预编译语句由 evidence_store 常驻复用，证据按 ids 的顺序拼接。
+static std::string load_context_from_sqlite_by_ids(evidence_store &store, const std::vector<int64_t> &ids)
 {
+    std::string ctx;
     if (ids.empty())
-        return "";
+        return ctx;
 
-    sqlite3 *db = nullptr;
-    if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK)
+    std::vector<evidence_row> rows;
+    std::string err;
+    if (!store.fetch(ids, rows, err))
     {
-        if (db)
-            sqlite3_close(db);
-        return "";
+        std::cerr << "Warning: evidence fetch failed: " << err << "\n";
+        return ctx;
     }
+    format_evidence(rows, ctx);
+    return ctx;
+}
+
+// ---------- --serve: JSON-lines over stdin/stdout ----------
+// 每行一个请求（JSON 对象），每个请求回一行结果。stdout 只写协议数据，日志一律走 stderr。
+struct serve_options
+{
+    evidence_store *evidence = nullptr; // 由读线程独占使用
+    rag_service *service = nullptr;     // 非空时支持 "query" 字段：进程内检索后再生成（见 rag_service.h）
+    const rag_pipeline *rag = nullptr;  // 只用来报证据缓存的统计
+    const answer_cache *answers = nullptr;
+};
+
+static json_value cache_stats_json(const chunk_cache_stats &st)
+{
+    json_value v = json_value::make_object();
+    v.set("hits", json_value::make_number((double)st.hits));
+    v.set("misses", json_value::make_number((double)st.misses));
+    v.set("evictions", json_value::make_number((double)st.evictions));
+    v.set("entries", json_value::make_number((double)st.entries));
+    v.set("bytes", json_value::make_number((double)st.bytes));
+    v.set("capacity", json_value::make_number((double)st.capacity));
+    return v;
+}
 
-    // 构造 IN (?, ?, ?) 占位符
-    std::ostringstream ph;
-    for (size_t i = 0; i < ids.size(); ++i)
+static void write_json_line(const json_value &v)
+{
+    // 每个写出线程一块复用的行缓冲（流式 delta 一条请求就有几十行）
+    thread_local std::string line;
+    line.clear();
+    json_dump_to(v, line);
+    line.push_back('\n');
+    std::fwrite(line.data(), 1, line.size(), stdout);
+    std::fflush(stdout);
+}
+
+static json_value pool_stats_json(const llm_pool_stats &st)
+{
+    json_value v = json_value::make_object();
+    v.set("queued", json_value::make_number((double)st.n_queued));
+    v.set("running", json_value::make_number((double)st.n_running));
+    v.set("done", json_value::make_number((double)st.n_done));
+    v.set("shed", json_value::make_number((double)st.n_shed));
+    v.set("expired", json_value::make_number((double)st.n_expired));
+    v.set("weights_mb", json_value::make_number((double)(st.weights_bytes >> 20)));
+    v.set("kv_mb", json_value::make_number((double)(st.kv_bytes >> 20)));
+    json_value ctxs = json_value::make_array();
+    for (const auto &c : st.contexts)
     {
-        if (i)
-            ph << ",";
-        ph << "?";
+        json_value cv = json_value::make_object();
+        cv.set("model", json_value::make_string(c.model));
+        cv.set("parallel", json_value::make_number(c.n_parallel));
+        cv.set("running", json_value::make_number(c.n_running));
+        cv.set("done", json_value::make_number((double)c.n_done));
+        cv.set("kv_mb", json_value::make_number((double)(c.kv_bytes >> 20)));
+        ctxs.arr.push_back(cv);
     }
+    v.set("contexts", ctxs);
+    return v;
+}
 
-    std::string sql =
-        "SELECT id, " + content_col +
-        " FROM " + table +
-        " WHERE id IN (" + ph.str() + ")";
+// 已在别处统计好的量（池子、KV、缓存）登记成导出时才读的回调；返回的 id 要在池子与缓存销毁前注销
+static std::vector<uint64_t> register_serve_metrics(llm_pool &pool, const serve_options &opt)
+{
+    metrics_registry &reg = metrics();
+    std::vector<uint64_t> ids;
+    ids.push_back(reg.add_callback("llm_pool_queue_depth", "Requests waiting in the pool queue", metric_type::gauge, {},
+                                   [&pool]()
+                                   { return (double)pool.stats().n_queued; }));
+    ids.push_back(reg.add_callback("llm_pool_running", "Requests running on a context", metric_type::gauge, {},
+                                   [&pool]()
+                                   { return (double)pool.stats().n_running; }));
+    ids.push_back(reg.add_callback("llm_pool_shed_total", "Requests rejected because the queue was full",
+                                   metric_type::counter, {}, [&pool]()
+                                   { return (double)pool.stats().n_shed; }));
+    ids.push_back(reg.add_callback("llm_pool_expired_total", "Requests that hit their deadline while queued",
+                                   metric_type::counter, {}, [&pool]()
+                                   { return (double)pool.stats().n_expired; }));
+    ids.push_back(reg.add_callback("llm_weights_bytes", "Model weights resident for the pool", metric_type::gauge, {},
+                                   [&pool]()
+                                   { return (double)pool.stats().weights_bytes; }));
 
-    sqlite3_stmt *stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    const llm_pool_stats st = pool.stats();
+    for (size_t i = 0; i < st.contexts.size(); ++i)
     {
-        sqlite3_close(db);
-        return "";
+        const metric_labels labels = {{"model", st.contexts[i].model}, {"context", std::to_string(i)}};
+        ids.push_back(reg.add_callback("llm_kv_used_cells", "KV cache cells in use", metric_type::gauge, labels,
+                                       [&pool, i]()
+                                       { return (double)pool.stats().contexts[i].kv_used_cells; }));
+        ids.push_back(reg.add_callback("llm_kv_cells", "KV cache size in cells", metric_type::gauge, labels,
+                                       [&pool, i]()
+                                       { return (double)pool.stats().contexts[i].kv_cells; }));
+        ids.push_back(reg.add_callback("llm_kv_reserved_bytes", "KV cache memory reserved", metric_type::gauge, labels,
+                                       [&pool, i]()
+                                       { return (double)pool.stats().contexts[i].kv_bytes; }));
     }
 
-    for (size_t i = 0; i < ids.size(); ++i)
+    auto add_cache = [&](const char *name, const chunk_cache *c)
+    {
+        const metric_labels labels = {{"cache", name}};
+        ids.push_back(reg.add_callback("rag_chunk_cache_hits_total", "Evidence chunk cache hits", metric_type::counter,
+                                       labels, [c]()
+                                       { return (double)c->stats().hits; }));
+        ids.push_back(reg.add_callback("rag_chunk_cache_misses_total", "Evidence chunk cache misses",
+                                       metric_type::counter, labels, [c]()
+                                       { return (double)c->stats().misses; }));
+        ids.push_back(reg.add_callback("rag_chunk_cache_bytes", "Evidence chunk cache size", metric_type::gauge, labels,
+                                       [c]()
+                                       { return (double)c->stats().bytes; }));
+    };
+    if (opt.rag && opt.rag->cache())
+        add_cache("rag", opt.rag->cache());
+    if (opt.evidence && opt.evidence->cache())
+        add_cache("ids", opt.evidence->cache());
+    if (const answer_cache *answers = opt.answers)
     {
-        sqlite3_bind_int64(stmt, (int)i + 1, ids[i]);
+        ids.push_back(reg.add_callback("rag_answer_cache_total", "Answer cache lookups by result", metric_type::counter,
+                                       {{"result", "exact"}}, [answers]()
+                                       { return (double)answers->stats().exact_hits; }));
+        ids.push_back(reg.add_callback("rag_answer_cache_total", "Answer cache lookups by result", metric_type::counter,
+                                       {{"result", "near"}}, [answers]()
+                                       { return (double)answers->stats().near_hits; }));
+        ids.push_back(reg.add_callback("rag_answer_cache_total", "Answer cache lookups by result", metric_type::counter,
+                                       {{"result", "miss"}}, [answers]()
+                                       { return (double)answers->stats().misses; }));
     }
+    return ids;
+}
 
-    std::ostringstream ctx;
-    while (sqlite3_step(stmt) == SQLITE_ROW)
+static int run_serve_loop(llm_pool &pool, const llm_request &defaults, const serve_options &opt)
+{
     {
-        int64_t id = sqlite3_column_int64(stmt, 0);
-        const unsigned char *content = sqlite3_column_text(stmt, 1);
-        if (content)
-        {
-            ctx << "[证据#" << id << "] " << (const char *)content << "\n";
-        }
+        const llm_pool_stats st = pool.stats();
+        int n_slots = 0;
+        for (const auto &c : st.contexts)
+            n_slots += c.n_parallel;
+        std::cerr << "llm_cli: serving on stdin/stdout (one JSON request per line, " << st.contexts.size()
+                  << " context(s), " << n_slots << " parallel, weights " << (st.weights_bytes >> 20) << " MiB, KV "
+                  << (st.kv_bytes >> 20) << " MiB)\n";
     }
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return ctx.str();
+    // 结果由调度线程写出，解析错误由读线程写出，两边共用一把锁
+    std::mutex out_mtx;
+    auto emit = [&out_mtx](const json_value &v)
+    {
+        std::lock_guard<std::mutex> lk(out_mtx);
+        write_json_line(v);
+    };
+
+    const std::vector<uint64_t> metric_ids = register_serve_metrics(pool, opt);
+    pool.start();
+
+    // 读线程：解析请求并提交给池子；多个请求会被派到各上下文连续批处理，结果可能乱序返回，按 "id" 对应
+    std::thread reader([&]()
+                       {
+        std::string line;
+        while (std::getline(std::cin, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty())
+                continue;
+
+            json_value resp = json_value::make_object();
+
+            json_value rq;
+            std::string err;
+            if (!json_parse(line, rq, err) || !rq.is_object())
+            {
+                resp.set("ok", json_value::make_bool(false));
+                resp.set("error", json_value::make_string("bad request: " + (err.empty() ? "expected object" : err)));
+                emit(resp);
+                continue;
+            }
+            if (const json_value *id = rq.find("id"))
+                resp.set("id", *id);
+
+            const std::string cmd = rq.get_string("cmd");
+            if (cmd == "quit")
+            {
+                resp.set("ok", json_value::make_bool(true));
+                emit(resp);
+                break;
+            }
+            if (cmd == "ping")
+            {
+                resp.set("ok", json_value::make_bool(true));
+                emit(resp);
+                continue;
+            }
+            if (cmd == "metrics")
+            {
+                // Prometheus 文本格式，原样放在一个字符串字段里
+                resp.set("ok", json_value::make_bool(true));
+                resp.set("metrics", json_value::make_string(metrics().render()));
+                emit(resp);
+                continue;
+            }
+            if (cmd == "stats")
+            {
+                resp.set("ok", json_value::make_bool(true));
+                if (opt.evidence && opt.evidence->cache())
+                    resp.set("ids_cache", cache_stats_json(opt.evidence->cache()->stats()));
+                if (opt.rag && opt.rag->cache())
+                    resp.set("rag_cache", cache_stats_json(opt.rag->cache()->stats()));
+                resp.set("pool", pool_stats_json(pool.stats()));
+                if (opt.answers)
+                {
+                    const answer_cache_stats st = opt.answers->stats();
+                    json_value v = json_value::make_object();
+                    v.set("exact_hits", json_value::make_number((double)st.exact_hits));
+                    v.set("near_hits", json_value::make_number((double)st.near_hits));
+                    v.set("misses", json_value::make_number((double)st.misses));
+                    v.set("entries", json_value::make_number((double)st.entries));
+                    resp.set("answer_cache", v);
+                }
+                emit(resp);
+                continue;
+            }
+
+            // "model" 选池子里的模型（--pool-model 的名字，默认主模型），"priority" 大的先调度
+            llm_pool_request pr;
+            pr.model = rq.get_string("model");
+            pr.priority = (int)rq.get_number("priority", 0);
+            if (!pool.engine(pr.model))
+            {
+                resp.set("ok", json_value::make_bool(false));
+                resp.set("error", json_value::make_string("unknown model: " + pr.model));
+                emit(resp);
+                continue;
+            }
+
+            llm_request req = defaults;
+            req.trace_id = trace_enabled() ? trace_next_id() : 0;
+            const uint64_t tid = req.trace_id;
+            const auto t_read = std::chrono::steady_clock::now();
+            req.question = rq.get_string("prompt", defaults.question);
+            req.evidence = rq.get_string("context");
+            req.n_predict = (int)rq.get_number("n", defaults.n_predict);
+            req.temp = (float)rq.get_number("temp", defaults.temp);
+            req.top_k = (int)rq.get_number("topk", defaults.top_k);
+            req.top_p = (float)rq.get_number("topp", defaults.top_p);
+            req.seed = (int)rq.get_number("seed", defaults.seed);
+            req.policy.deadline_ms = (int)rq.get_number("deadline_ms", defaults.policy.deadline_ms);
+            req.policy.max_tokens = (int)rq.get_number("max_tokens", defaults.policy.max_tokens);
+            req.policy.one_sentence = rq.get_bool("one_sentence", defaults.policy.one_sentence);
+            req.grammar = rq.get_string("grammar", defaults.grammar); // 自定义 GBNF（"query" 请求默认用引用约束）
+            if (const json_value *stop = rq.find("stop"))
+            {
+                // 自定义停止串，替换默认的一组
+                for (const auto &v : stop->arr)
+                {
+                    if (v.is_string() && !v.str.empty())
+                        req.stops.push_back(v.str);
+                }
+            }
+
+            // "stream":true：生成过程中先逐段回 {"id":..,"delta":"..."}，最后仍回一行完整结果
+            llm_delta_fn on_delta;
+            if (rq.get_bool("stream", false))
+            {
+                const json_value *rid = rq.find("id");
+                const json_value id_value = rid ? *rid : json_value::make_null();
+                on_delta = [id_value, &emit](const std::string &delta)
+                {
+                    json_value ev = json_value::make_object();
+                    ev.set("id", id_value);
+                    ev.set("delta", json_value::make_string(delta));
+                    emit(ev);
+                };
+            }
+
+            // "query"：检索 + 闸门 + 生成全部在进程内完成
+            const std::string query = rq.get_string("query");
+            if (!query.empty())
+            {
+                if (!opt.service)
+                {
+                    resp.set("ok", json_value::make_bool(false));
+                    resp.set("error", json_value::make_string("\"query\" given but llm_cli was started without --db/--index"));
+                    emit(resp);
+                    continue;
+                }
+                opt.service->answer(query, pr, req, [resp, tid, t_read, &emit](const rag_answer &a) mutable
+                                    {
+                    rag_answer_to_json(a, resp);
+                    trace_span("request", "serve", tid, t_read, std::chrono::steady_clock::now());
+                    emit(resp); }, on_delta);
+                continue;
+            }
+
+            const json_value *ids = rq.find("ids");
+            if (req.evidence.empty() && ids && ids->is_array() && !ids->arr.empty())
+            {
+                if (!opt.evidence)
+                {
+                    resp.set("ok", json_value::make_bool(false));
+                    resp.set("error", json_value::make_string("\"ids\" given but llm_cli was started without --db"));
+                    emit(resp);
+                    continue;
+                }
+                std::vector<int64_t> id_list;
+                for (const auto &v : ids->arr)
+                {
+                    if (v.is_number())
+                        id_list.push_back((int64_t)v.num);
+                }
+                req.evidence = load_context_from_sqlite_by_ids(*opt.evidence, id_list);
+            }
+
+            pool.submit(pr, req, [resp, tid, t_read, &emit](const llm_result &r) mutable
+                          {
+                resp.set("ok", json_value::make_bool(r.ok));
+                if (r.ok)
+                {
+                    resp.set("answer", json_value::make_string(r.answer));
+                    llm_result_to_json(r, resp);
+                }
+                else
+                {
+                    resp.set("error", json_value::make_string(r.error));
+                    resp.set("code", json_value::make_number(r.error_code));
+                }
+                trace_span("request", "serve", tid, t_read, std::chrono::steady_clock::now());
+                emit(resp); }, on_delta);
+        } });
+
+    // stdin 关闭或收到 quit：读线程退出，处理完已提交的请求后返回
+    reader.join();
+    pool.stop();
+    for (uint64_t id : metric_ids)
+        metrics().remove_callback(id);
+    return 0;
 }
 
 int main(int argc, char **argv)
@@ -245,23 +460,56 @@ int main(int argc, char **argv)
     std::string sqlite_col = "content";     // --col
     std::string ids_csv;                    // --ids
 
+    // 进程内检索：--query 给出问题，BM25 索引来自 --index 或现场从 --db 构建
+    std::string rag_query;  // --query
+    std::string rag_index;  // --index
+    int rag_k = 5;          // --rag-k
+    std::string rag_vec_index;   // --vec-index：与 --embed-model 一起给出时走混合检索
+    std::string rag_embed_model; // --embed-model
+    std::string rag_fusion = "rrf"; // --fusion rrf|weighted
+    std::string rerank_model;       // --rerank-model：交叉编码器重排（rank pooling 的 GGUF）
+    int rerank_top_n = 8;           // --rerank-top-n：送去打分的候选数
+    int rerank_budget_ms = 80;      // --rerank-budget-ms：超时退回启发式排序，0 不限
+    int rerank_keep = 3;            // --rerank-keep：重排成功后最多保留的证据数，0 不限
+    int chunk_cache_mb = 64;        // --chunk-cache-mb：证据块内存缓存，0 关闭
+    int answer_cache_size = 1024;   // --answer-cache：答案缓存条数，0 关闭
+    std::string answer_cache_db;    // --answer-cache-db：答案缓存持久化到该 SQLite 文件
+    float semantic_cache = 0.0f;    // --semantic-cache：近似查找的余弦阈值（需混合检索提供查询向量）
+    int evidence_budget = 0;        // --evidence-budget：--query 证据的 token 上限，0 = 按 --ctx / --n 自动，-1 不限
+
     int n_predict = 64;
     int n_ctx = 2048;
     int n_batch = 512;
+    int n_parallel = 1;
+    ggml_type cache_type_k = GGML_TYPE_F16; // --cache-type-k / -ctk
+    ggml_type cache_type_v = GGML_TYPE_F16; // --cache-type-v / -ctv
+    bool flash_attn = false;                // --flash-attn / -fa
+    llm_overflow ctx_overflow = llm_overflow::fail; // --ctx-overflow fail|truncate|shift
+    int n_contexts = 1;                   // --contexts：--serve 时主模型的上下文数（共用一份权重）
+    std::vector<std::string> pool_models; // --pool-model name=path[:contexts]，可重复
+    int max_queue = 64;                   // --max-queue：排队上限，超过即拒绝
+    int mem_budget_mb = 0;                // --mem-budget-mb：权重 + KV 上限，0 不限
+    std::string draft_model; // --draft-model：同词表的小模型，启用投机解码
+    int n_draft = 8;         // --draft：每步起草的 token 数
+    int n_threads = 0;       // --threads：decode 线程数，0 = 可用 CPU 的一半
+    int n_threads_batch = 0; // --threads-batch：prefill 线程数，0 = 全部可用 CPU
+    bool auto_threads = false;
+    bool use_mmap = true;
+    bool use_mlock = false;
+    std::string numa;     // --numa：off / distribute / isolate / numactl / mirror
+    std::string cpu_list; // --cpus：绑核，如 0-7,16-23
     float temp = 0.2f;
     int top_k = 40;
     float top_p = 0.9f;
     int seed = 42;
     bool debug_prompt = false;
-
-    std::vector<std::string> stops = {
-        "\nHuman:", "\nUser:", "\nassistant:", "\nAssistant:",
-        "<|endoftext|>", "</s>", "<|im_end|>", "<|eot_id|>",
-        "\n\n"};
-    stops.push_back(u8"。");
-    stops.push_back(u8"！");
-    stops.push_back(u8"？");
-    stops.push_back("\n");
+    bool serve = false; // --serve：常驻进程，stdin/stdout JSON-lines
+    bool stream = false; // --stream：一次性模式下边生成边输出
+    llm_answer_policy policy; // --max-tokens / --deadline-ms / --multi-sentence
+    bool use_grammar = true;  // --no-grammar：--query 不做约束解码，退回“生成后检查引用 + 摘录兜底”
+    std::string grammar_file; // --grammar-file：--prompt 模式下的 GBNF
+    std::string trace_file;   // --trace：逐请求的阶段追踪（Chrome trace JSON）
+    std::string metrics_out;  // --metrics-out：退出时把指标写成 Prometheus 文本文件
 
     for (int i = 1; i < argc; ++i)
     {
@@ -337,6 +585,156 @@ int main(int argc, char **argv)
             }
             ids_csv = v;
         }
+        else if (a == "--query" || a == "-q")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --query\n";
+                return 2;
+            }
+            rag_query = v;
+        }
+        else if (a == "--index")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --index\n";
+                return 2;
+            }
+            rag_index = v;
+        }
+        else if (a == "--vec-index")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --vec-index\n";
+                return 2;
+            }
+            rag_vec_index = v;
+        }
+        else if (a == "--embed-model")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --embed-model\n";
+                return 2;
+            }
+            rag_embed_model = v;
+        }
+        else if (a == "--fusion")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --fusion\n";
+                return 2;
+            }
+            rag_fusion = v;
+        }
+        else if (a == "--rerank-model")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --rerank-model\n";
+                return 2;
+            }
+            rerank_model = v;
+        }
+        else if (a == "--rerank-top-n")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --rerank-top-n\n";
+                return 2;
+            }
+            rerank_top_n = std::max(1, std::atoi(v));
+        }
+        else if (a == "--rerank-budget-ms")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --rerank-budget-ms\n";
+                return 2;
+            }
+            rerank_budget_ms = std::max(0, std::atoi(v));
+        }
+        else if (a == "--rerank-keep")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --rerank-keep\n";
+                return 2;
+            }
+            rerank_keep = std::max(0, std::atoi(v));
+        }
+        else if (a == "--chunk-cache-mb")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --chunk-cache-mb\n";
+                return 2;
+            }
+            chunk_cache_mb = std::atoi(v);
+        }
+        else if (a == "--answer-cache")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --answer-cache\n";
+                return 2;
+            }
+            answer_cache_size = std::atoi(v);
+        }
+        else if (a == "--evidence-budget")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --evidence-budget\n";
+                return 2;
+            }
+            evidence_budget = std::atoi(v);
+        }
+        else if (a == "--answer-cache-db")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --answer-cache-db\n";
+                return 2;
+            }
+            answer_cache_db = v;
+        }
+        else if (a == "--semantic-cache")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --semantic-cache\n";
+                return 2;
+            }
+            semantic_cache = (float)std::atof(v);
+        }
+        else if (a == "--rag-k")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --rag-k\n";
+                return 2;
+            }
+            rag_k = std::atoi(v);
+        }
         else if (a == "--n" || a == "-n")
         {
             const char *v = get_arg(i, argc, argv);
@@ -367,6 +765,151 @@ int main(int argc, char **argv)
             }
             n_batch = std::atoi(v);
         }
+        else if (a == "--cache-type-k" || a == "-ctk" || a == "--cache-type-v" || a == "-ctv")
+        {
+            const char *v = get_arg(i, argc, argv);
+            const bool is_k = a == "--cache-type-k" || a == "-ctk";
+            if (!v || !llm_parse_kv_type(v, is_k ? cache_type_k : cache_type_v))
+            {
+                std::cerr << a << " expects f32|f16|bf16|q8_0|q5_1|q5_0|q4_1|q4_0\n";
+                return 2;
+            }
+        }
+        else if (a == "--flash-attn" || a == "-fa")
+        {
+            flash_attn = true;
+        }
+        else if (a == "--ctx-overflow")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v || !llm_parse_overflow(v, ctx_overflow))
+            {
+                std::cerr << "--ctx-overflow expects fail|truncate|shift\n";
+                return 2;
+            }
+        }
+        else if (a == "--contexts")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --contexts\n";
+                return 2;
+            }
+            n_contexts = std::max(1, std::atoi(v));
+        }
+        else if (a == "--pool-model")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v || !std::strchr(v, '='))
+            {
+                std::cerr << "--pool-model expects name=path.gguf[:contexts]\n";
+                return 2;
+            }
+            pool_models.push_back(v);
+        }
+        else if (a == "--max-queue")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --max-queue\n";
+                return 2;
+            }
+            max_queue = std::max(1, std::atoi(v));
+        }
+        else if (a == "--mem-budget-mb")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --mem-budget-mb\n";
+                return 2;
+            }
+            mem_budget_mb = std::max(0, std::atoi(v));
+        }
+        else if (a == "--parallel" || a == "-np")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --parallel\n";
+                return 2;
+            }
+            n_parallel = std::atoi(v);
+        }
+        else if (a == "--draft-model" || a == "-md")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --draft-model\n";
+                return 2;
+            }
+            draft_model = v;
+        }
+        else if (a == "--draft")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --draft\n";
+                return 2;
+            }
+            n_draft = std::atoi(v);
+        }
+        else if (a == "--threads" || a == "-t")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --threads\n";
+                return 2;
+            }
+            n_threads = std::atoi(v);
+        }
+        else if (a == "--threads-batch" || a == "-tb")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --threads-batch\n";
+                return 2;
+            }
+            n_threads_batch = std::atoi(v);
+        }
+        else if (a == "--auto-threads")
+        {
+            auto_threads = true;
+        }
+        else if (a == "--no-mmap")
+        {
+            use_mmap = false;
+        }
+        else if (a == "--mlock")
+        {
+            use_mlock = true;
+        }
+        else if (a == "--numa")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --numa\n";
+                return 2;
+            }
+            numa = v;
+        }
+        else if (a == "--cpus")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --cpus\n";
+                return 2;
+            }
+            cpu_list = v;
+        }
         else if (a == "--temp")
         {
             const char *v = get_arg(i, argc, argv);
@@ -411,6 +954,72 @@ int main(int argc, char **argv)
         {
             debug_prompt = true;
         }
+        else if (a == "--serve")
+        {
+            serve = true;
+        }
+        else if (a == "--stream")
+        {
+            stream = true;
+        }
+        else if (a == "--max-tokens")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --max-tokens\n";
+                return 2;
+            }
+            policy.max_tokens = std::atoi(v);
+        }
+        else if (a == "--deadline-ms")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --deadline-ms\n";
+                return 2;
+            }
+            policy.deadline_ms = std::atoi(v);
+        }
+        else if (a == "--multi-sentence")
+        {
+            policy.one_sentence = false;
+        }
+        else if (a == "--no-grammar")
+        {
+            use_grammar = false;
+        }
+        else if (a == "--grammar-file")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --grammar-file\n";
+                return 2;
+            }
+            grammar_file = v;
+        }
+        else if (a == "--trace")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --trace\n";
+                return 2;
+            }
+            trace_file = v;
+        }
+        else if (a == "--metrics-out")
+        {
+            const char *v = get_arg(i, argc, argv);
+            if (!v)
+            {
+                std::cerr << "Missing value for --metrics-out\n";
+                return 2;
+            }
+            metrics_out = v;
+        }
         else if (a == "--help" || a == "-h")
         {
             std::cout
@@ -418,11 +1027,49 @@ int main(int argc, char **argv)
                 << "  llm_cli --model <path.gguf> [--prompt <text>]\n"
                 << "          [--context-file <context.txt>]\n"
                 << "          [--db <documents.db> --table <table> --col <content_col> --ids 1,2,3]\n"
-                << "          [--n <tokens>] [--ctx <n>] [--batch <n>]\n"
-                << "          [--temp <f>] [--topk <k>] [--topp <p>] [--seed <n>] [--debug-prompt]\n\n"
+                << "          [--query <text> [--db data/documents.db] [--index bm25.idx] [--rag-k 5]]\n"
+                << "          [--vec-index vectors.idx --embed-model <embed.gguf> [--fusion rrf|weighted]]\n"
+                << "          [--rerank-model <reranker.gguf> [--rerank-top-n 8] [--rerank-budget-ms 80] [--rerank-keep 3]]\n"
+                << "                      交叉编码器重排：过了闸门的前 N 条与问题成对打分（一次 decode），超过预算退回启发式排序；\n"
+                << "                      重排成功时证据最多留 --rerank-keep 条\n"
+                << "          [--chunk-cache-mb 64]   证据块 LRU 缓存（按 documents.id），0 关闭\n"
+                << "          [--answer-cache 1024] [--answer-cache-db cache.db] [--semantic-cache 0.95]\n"
+                << "                      --query 的答案缓存：问题 + 证据 id + 模型 + 采样参数相同则不再解码\n"
+                << "          [--evidence-budget <tokens>]   --query 证据按 final 分数装入的 token 上限（0 自动，-1 不限）；\n"
+                << "                      正文 token 取自 ingest_cli --token-model 预先切好的 chunk_tokens 表\n"
+                << "          [--n <tokens>] [--ctx <n>] [--batch <n>] [--parallel <n>]\n"
+                << "          [--draft-model <small.gguf> [--draft 8]]   投机解码：草稿模型须与 --model 同一词表\n"
+                << "          [--threads <n>] [--threads-batch <n>] [--auto-threads]\n"
+                << "                      decode / prefill 线程数（默认可用 CPU 的一半 / 全部）；--auto-threads 启动时实测挑最快的\n"
+                << "          [--cpus 0-7,16-23] [--numa distribute|isolate|numactl|mirror] [--no-mmap] [--mlock]\n"
+                << "                      绑核与 NUMA 策略；--mlock 把模型锁在内存里，避免被换出后首个请求变慢\n"
+                << "          [--temp <f>] [--topk <k>] [--topp <p>] [--seed <n>] [--debug-prompt]\n"
+                << "          [--max-tokens <n>] [--deadline-ms <ms>] [--multi-sentence]\n"
+                << "                      回答策略：token 预算；一句话写完即停（默认）；超过延迟上限就返回已生成部分\n"
+                << "          [--no-grammar]   --query 默认用 GBNF 约束为 “【定义】一句话[chunk:N]。”，N 只能是送进去的证据\n"
+                << "          [--grammar-file <g.gbnf>]   --prompt 模式的自定义语法（serve 请求里用 \"grammar\" 字段）\n"
+                << "          [--stream]  边生成边输出原始文本（不做单句规整）；结束后在 stderr 打印 TTFT / prefill / decode 速度\n"
+                << "          [--serve]   常驻模式：模型只加载一次，从 stdin 逐行读 JSON 请求，向 stdout 逐行写 JSON 结果\n"
+                << "          [--cache-type-k f16|q8_0|q4_0] [--cache-type-v f16|q8_0|q4_0] [--flash-attn]\n"
+                << "                      KV cache 量化：q8_0 约为 f16 的一半，q4_0 约 0.28；V 量化必须同时给 --flash-attn\n"
+                << "          [--ctx-overflow fail|truncate|shift]   prompt 超长时报错 / 从证据末尾截断 / 截断且生成写满时做 context shift\n"
+                << "          [--contexts <n>] [--pool-model name=path.gguf[:n]] [--max-queue 64] [--mem-budget-mb <mb>]\n"
+                << "                      --serve 的上下文池：同一模型的多个上下文共用 mmap 的权重，各有一份 KV；请求带 \"model\" 选模型、\n"
+                << "                      \"priority\" 排队优先级；排队超过 --max-queue 时拒绝（code 9）；每个上下文各用 --threads 个线程\n"
+                << "          [--trace <trace.json>]   每条请求的检索 / 排队 / 模板 / tokenize / prefill / decode 各段写成 Chrome trace\n"
+                << "          [--metrics-out <file.prom>]   退出时写出全部指标（Prometheus 文本格式）；--serve 中随时可用 {\"cmd\":\"metrics\"}\n\n"
                 << "Examples:\n"
                 << "  llm_cli --model models\\qwen2.5-3b-instruct-q5_k_m.gguf --prompt \"解释LR(0)项目集\" --context-file context.txt\n"
-                << "  llm_cli --model models\\qwen2.5-3b-instruct-q5_k_m.gguf --prompt \"...\" --db documents.db --table documents --col content --ids 1,2,3\n";
+                << "  llm_cli --model models\\qwen2.5-3b-instruct-q5_k_m.gguf --prompt \"...\" --db documents.db --table documents --col content --ids 1,2,3\n"
+                << "  llm_cli --model models\\qwen2.5-3b-instruct-q5_k_m.gguf --query \"什么是 LR(0) 项目集\" --index data\\bm25.idx\n"
+                << "  llm_cli --model models\\qwen2.5-3b-instruct-q5_k_m.gguf --serve --db documents.db\n"
+                << "    stdin : {\"id\":1,\"prompt\":\"...\",\"ids\":[1,2,3],\"n\":64,\"temp\":0.2}\n"
+                << "    stdout: {\"id\":1,\"ok\":true,\"answer\":\"...\",\"n_prompt\":123,\"n_gen\":20}\n"
+                << "    stdin : {\"id\":2,\"query\":\"...\"}   （需要 --db 或 --index；回包另带 chunks / reason）\n"
+                << "    stdin : {\"cmd\":\"stats\"}   证据缓存的命中/未命中计数、池子的排队/在跑/拒绝数与各上下文的 KV\n"
+                << "    stdin : {\"cmd\":\"metrics\"}   回包的 \"metrics\" 为 Prometheus 文本：各阶段延迟直方图、回答 reason 计数、队列与 KV 占用\n"
+                << "    stdin : {\"id\":3,\"prompt\":\"...\",\"stream\":true,\"stop\":[\"\\n\\n\"]}   stop 可选，替换默认停止串\n"
+                << "    stdout: {\"id\":3,\"delta\":\"...\"} ... 最后一行为完整结果（另带 ttft_ms / prefill_tps / decode_tps）\n";
             return 0;
         }
     }
@@ -433,219 +1080,375 @@ int main(int argc, char **argv)
         return 2;
     }
 
+    llm_request defaults;
+    defaults.question = user_question;
+    defaults.n_predict = n_predict;
+    defaults.temp = temp;
+    defaults.top_k = top_k;
+    defaults.top_p = top_p;
+    defaults.seed = seed;
+    defaults.debug_prompt = debug_prompt;
+    defaults.policy = policy;
+    if (!grammar_file.empty() && !read_all_text(grammar_file, defaults.grammar))
+    {
+        std::cerr << "Error: failed to read grammar-file: " << grammar_file << "\n";
+        return 2;
+    }
+
+    evidence_store_params evidence_params;
+    evidence_params.db_path = sqlite_db;
+    evidence_params.table = sqlite_table;
+    evidence_params.text_col = sqlite_col;
+
     // ------- 0) load evidence context -------
-    std::string evidence;
-    if (!context_file.empty())
+    if (!serve)
     {
-        if (!read_all_text(context_file, evidence))
+        if (!context_file.empty())
         {
-            std::cerr << "Warning: failed to read context-file: " << context_file << "\n";
+            if (!read_all_text(context_file, defaults.evidence))
+            {
+                std::cerr << "Warning: failed to read context-file: " << context_file << "\n";
+            }
         }
-    }
-    else if (!sqlite_db.empty() && !ids_csv.empty())
-    {
-        auto ids = parse_ids_csv(ids_csv);
-        evidence = load_context_from_sqlite_by_ids(sqlite_db, sqlite_table, sqlite_col, ids);
-        if (evidence.empty())
+        else if (!sqlite_db.empty() && !ids_csv.empty())
         {
-            std::cerr << "Warning: no evidence loaded from sqlite (check db/table/col/ids).\n";
+            auto ids = parse_ids_csv(ids_csv);
+            evidence_store store;
+            std::string err;
+            if (store.open(evidence_params, err))
+                defaults.evidence = load_context_from_sqlite_by_ids(store, ids);
+            else
+                std::cerr << "Warning: " << err << "\n";
+            if (defaults.evidence.empty())
+            {
+                std::cerr << "Warning: no evidence loaded from sqlite (check db/table/col/ids).\n";
+            }
         }
     }
 
-    // 1) init backend
-    llama_backend_init();
-
-    // 2) load model
-    llama_model_params mparams = llama_model_default_params();
-    llama_model *model = llama_load_model_from_file(model_path.c_str(), mparams);
-    if (!model)
-    {
-        std::cerr << "Failed to load model: " << model_path << "\n";
-        llama_backend_free();
-        return 3;
-    }
-
-    // 3) context
-    llama_context_params cparams = llama_context_default_params();
-    cparams.n_ctx = n_ctx;
-    cparams.n_batch = n_batch;
-
-    llama_context *ctx = llama_new_context_with_model(model, cparams);
-    if (!ctx)
-    {
-        std::cerr << "Failed to create context\n";
-        llama_free_model(model);
-        llama_backend_free();
-        return 3;
-    }
-
-    // 4) system + user prompt (注入证据)
-    std::string system = u8"你是计算机专业课程助教，只能用中文回答。"
-                         u8"输出必须满足："
-                         u8"（1）只输出一句话；（2）必须是定义式；（3）不得出现“好的/请/根据/无法/示例”等套话；"
-                         u8"（4）不得输出换行；（5）不得输出多余标点。";
-
-    std::string user;
-    if (!evidence.empty())
-    {
-        user = u8"以下是检索到的资料证据（回答必须基于这些证据，且不得编造）：\n";
-        user += evidence;
-        user += u8"\n请按以下格式回答：\n【定义】LR(0)项目集：<一句话定义>。\n问题：";
-        user += user_question;
-    }
-    else
-    {
-        user = u8"请按以下格式回答：\n【定义】LR(0)项目集：<一句话定义>。\n问题：";
-        user += user_question;
-    }
-
-    std::vector<llama_chat_message> msgs;
-    msgs.push_back({"system", system.c_str()});
-    msgs.push_back({"user", user.c_str()});
-
-    std::string prompt;
-    prompt.resize(64 * 1024);
-
-    int pn = llama_chat_apply_template(
-        nullptr, // use template stored in GGUF metadata
-        msgs.data(),
-        (int)msgs.size(),
-        true, // add assistant prefix
-        prompt.data(),
-        (int)prompt.size());
-    if (pn < 0)
-    {
-        std::cerr << "llama_chat_apply_template failed\n";
-        llama_free(ctx);
-        llama_free_model(model);
-        llama_backend_free();
-        return 6;
-    }
-    prompt.resize(pn);
-
-    if (debug_prompt)
+    // 0) CPU 绑核要在任何工作线程创建之前做，线程会继承掩码
+    if (!cpu_list.empty())
     {
-        std::cerr << "\n[DEBUG PROMPT]\n"
-                  << prompt.substr(0, 1200) << "\n[/DEBUG PROMPT]\n";
-    }
-
-    // 5) tokenize
-    const llama_vocab *vocab = llama_model_get_vocab(model);
-
-    std::vector<llama_token> tokens;
-    tokens.resize(prompt.size() + 64);
-
-    int n_prompt = llama_tokenize(
-        vocab,
-        prompt.c_str(),
-        (int)prompt.size(),
-        tokens.data(),
-        (int)tokens.size(),
-        true, // add_special
-        false // parse_special
-    );
-    if (n_prompt < 0)
-    {
-        std::cerr << "Tokenize failed\n";
-        llama_free(ctx);
-        llama_free_model(model);
-        llama_backend_free();
-        return 4;
+        std::vector<int> cpus;
+        std::string err;
+        if (!cpu_parse_list(cpu_list, cpus, err) || !cpu_set_affinity(cpus, err))
+        {
+            std::cerr << "--cpus: " << err << "\n";
+            return 2;
+        }
     }
-    tokens.resize(n_prompt);
-
-    // 6) eval prompt
-    llama_batch batch = llama_batch_init(n_batch, 0, 1);
-    batch.n_tokens = 0;
-
-    for (int i = 0; i < (int)tokens.size(); ++i)
+    ggml_numa_strategy numa_strategy = GGML_NUMA_STRATEGY_DISABLED;
+    if (!numa.empty() && !cpu_parse_numa(numa, numa_strategy))
     {
-        batch.token[batch.n_tokens] = tokens[i];
-        batch.pos[batch.n_tokens] = i;
-        batch.seq_id[batch.n_tokens][0] = 0;
-        batch.n_seq_id[batch.n_tokens] = 1;
-        batch.logits[batch.n_tokens] = false;
-        batch.n_tokens++;
+        std::cerr << "Unknown --numa strategy: " << numa << "\n";
+        return 2;
     }
-    batch.logits[batch.n_tokens - 1] = true;
 
-    if (llama_decode(ctx, batch) != 0)
+    if (!trace_file.empty())
     {
-        std::cerr << "llama_decode(prompt) failed\n";
-        llama_batch_free(batch);
-        llama_free(ctx);
-        llama_free_model(model);
-        llama_backend_free();
-        return 5;
+        std::string err;
+        if (!trace_open(trace_file, err))
+        {
+            std::cerr << err << "\n";
+            return 2;
+        }
     }
 
-    // 7) sampler chain
-    llama_sampler *smpl = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(smpl, llama_sampler_init_top_k(top_k));
-    llama_sampler_chain_add(smpl, llama_sampler_init_top_p(top_p, 1));
-    llama_sampler_chain_add(smpl, llama_sampler_init_temp(temp));
-    llama_sampler_chain_add(smpl, llama_sampler_init_dist((uint32_t)seed));
-
-    // 8) generation
-    std::cout << "\n--- model output ---\n";
+    // 1) init backend
+    llama_backend_init();
+    if (numa_strategy != GGML_NUMA_STRATEGY_DISABLED)
+        llama_numa_init(numa_strategy);
 
-    int n_cur = (int)tokens.size();
-    std::string out;
-    out.reserve((size_t)n_predict * 6);
+    // 2) load model + 3) context
+    llm_engine_params eparams;
+    eparams.model_path = model_path;
+    eparams.n_ctx = n_ctx;
+    eparams.n_batch = n_batch;
+    eparams.n_parallel = serve ? n_parallel : 1;
+    eparams.draft_model_path = draft_model;
+    eparams.n_draft = n_draft;
+    eparams.n_threads = n_threads;
+    eparams.n_threads_batch = n_threads_batch;
+    eparams.use_mmap = use_mmap;
+    eparams.use_mlock = use_mlock;
+    eparams.type_k = cache_type_k;
+    eparams.type_v = cache_type_v;
+    eparams.flash_attn = flash_attn;
+    eparams.overflow = ctx_overflow;
 
-    for (int i = 0; i < n_predict; ++i)
+    int rc = 0;
     {
-        llama_token id = llama_sampler_sample(smpl, ctx, -1);
-        llama_sampler_accept(smpl, id);
-
-        if (id == llama_token_eos(vocab))
-            break;
+        llm_engine engine;
+        std::string err;
+        if (!engine.load(eparams, err))
+        {
+            std::cerr << err << "\n";
+            llama_backend_free();
+            return 3;
+        }
+        if (auto_threads)
+        {
+            std::vector<llm_thread_probe> probes;
+            if (!engine.autotune_threads({}, probes, err))
+            {
+                std::cerr << "Warning: --auto-threads failed: " << err << "\n";
+            }
+            else
+            {
+                for (const auto &p : probes)
+                    std::cerr << "[threads] " << p.n_threads << ": prefill " << p.prefill_tps << " tok/s, decode "
+                              << p.decode_tps << " tok/s\n";
+            }
+        }
+        std::cerr << "[threads] decode " << engine.params().n_threads << ", prefill " << engine.params().n_threads_batch
+                  << (use_mlock ? ", mlock" : "") << (use_mmap ? "" : ", no-mmap") << "\n";
+        std::fprintf(stderr, "[kv] k=%s v=%s flash_attn=%s: %.1f MiB for %d sequence(s) of %d, %.1f MiB per sequence\n",
+                     ggml_type_name(cache_type_k), ggml_type_name(cache_type_v), flash_attn ? "on" : "off",
+                     engine.kv_bytes() / 1048576.0, engine.params().n_parallel, engine.params().n_ctx,
+                     engine.kv_bytes() / 1048576.0 / engine.params().n_parallel);
 
-        char buf[4096];
-        int nb = llama_token_to_piece(vocab, id, buf, (int)sizeof(buf), 0, true);
-        if (nb <= 0)
-            break;
+        rag_params rparams;
+        if (!sqlite_db.empty())
+            rparams.db_path = sqlite_db;
+        rparams.table = sqlite_table;
+        rparams.index_path = rag_index;
+        rparams.top_k = (size_t)std::max(rag_k, 1);
+        rparams.vector_index_path = rag_vec_index;
+        rparams.embed_model_path = rag_embed_model;
+        rparams.hybrid.fusion = rag_fusion == "weighted" ? hybrid_fusion::weighted : hybrid_fusion::rrf;
+        rparams.rerank_model_path = rerank_model;
+        rparams.rerank_top_n = (size_t)rerank_top_n;
+        rparams.rerank_budget_ms = rerank_budget_ms;
+        rparams.rerank_keep = (size_t)rerank_keep;
+        const size_t cache_bytes = (size_t)std::max(chunk_cache_mb, 0) << 20;
+        rparams.chunk_cache_bytes = cache_bytes;
+        rag_pipeline rag;
 
-        out.append(buf, buf + nb);
+        evidence_pack_params pparams;
+        pparams.budget_tokens = evidence_budget == 0 ? evidence_auto_budget(n_ctx, n_predict) : evidence_budget;
+        evidence_packer packer;
+        const bool want_rag = !rag_query.empty() || (serve && (!sqlite_db.empty() || !rag_index.empty() || !rag_vec_index.empty()));
+        const bool packer_ok = want_rag && packer.open(engine, rparams.db_path, pparams, err);
 
-        if (ends_with_any(out, stops))
+        answer_cache answers;
+        bool answers_ok = false;
+        if (answer_cache_size > 0)
         {
-            trim_at_stop_first_occurrence(out, stops);
-            break;
+            answer_cache_params ap;
+            ap.max_entries = (size_t)answer_cache_size;
+            ap.near_dup_threshold = semantic_cache;
+            ap.db_path = answer_cache_db;
+            answers_ok = answers.open(ap, err);
+            if (!answers_ok)
+                std::cerr << "Warning: answer cache disabled: " << err << "\n";
         }
 
-        batch.n_tokens = 0;
-        batch.token[batch.n_tokens] = id;
-        batch.pos[batch.n_tokens] = n_cur++;
-        batch.seq_id[batch.n_tokens][0] = 0;
-        batch.n_seq_id[batch.n_tokens] = 1;
-        batch.logits[batch.n_tokens] = true;
-        batch.n_tokens++;
+        if (serve)
+        {
+            serve_options sopt;
+            evidence_store store;
+            std::unique_ptr<chunk_cache> ids_cache;
+            if (!sqlite_db.empty())
+            {
+                if (store.open(evidence_params, err))
+                {
+                    sopt.evidence = &store;
+                    if (cache_bytes)
+                    {
+                        ids_cache.reset(new chunk_cache(cache_bytes));
+                        store.set_cache(ids_cache.get());
+                    }
+                }
+                else
+                    std::cerr << "Warning: \"ids\" requests disabled: " << err << "\n";
+            }
+            const bool rag_ok = want_rag && rag.open(rparams, err);
+            if (want_rag && !rag_ok)
+                std::cerr << "Warning: \"query\" requests disabled: " << err << "\n";
+            if (rag_ok)
+                sopt.rag = &rag;
+            if (answers_ok)
+                sopt.answers = &answers;
 
-        if (llama_decode(ctx, batch) != 0)
-            break;
-    }
+            llm_pool_params pp;
+            pp.max_queue = (size_t)max_queue;
+            pp.mem_budget_bytes = (size_t)mem_budget_mb << 20;
+            llm_pool pool(pp);
+            bool pool_ok = pool.add_engine("main", engine, err) && pool.add_contexts("main", n_contexts - 1, err);
+            for (size_t k = 0; pool_ok && k < pool_models.size(); ++k)
+            {
+                // name=path[:contexts]；其余参数与主模型相同，不带草稿模型
+                const std::string &spec = pool_models[k];
+                const size_t eq = spec.find('=');
+                const std::string name = spec.substr(0, eq);
+                std::string path = spec.substr(eq + 1);
+                int n = 1;
+                const size_t colon = path.rfind(':');
+                if (colon != std::string::npos && colon + 1 < path.size() &&
+                    path.find_first_not_of("0123456789", colon + 1) == std::string::npos)
+                {
+                    n = std::max(1, std::atoi(path.c_str() + colon + 1));
+                    path.resize(colon);
+                }
+                llm_engine_params mp = eparams;
+                mp.model_path = path;
+                mp.draft_model_path.clear();
+                mp.n_threads = engine.params().n_threads;
+                mp.n_threads_batch = engine.params().n_threads_batch;
+                pool_ok = pool.add_model(name, mp, err) && pool.add_contexts(name, n - 1, err);
+            }
+            if (!pool_ok)
+            {
+                std::cerr << err << "\n";
+                rc = 3;
+            }
+            else
+            {
+                rag_service_params sp;
+                sp.grammar = use_grammar;
+                rag_service service(pool, sp);
+                if (rag_ok)
+                {
+                    service.set_pipeline(&rag, packer_ok ? &packer : nullptr);
+                    sopt.service = &service;
+                }
+                if (answers_ok)
+                    service.set_answer_cache(&answers);
+                rc = run_serve_loop(pool, defaults, sopt);
+            }
+        }
+        else if (!rag_query.empty())
+        {
+            rag_retrieval rr;
+            const uint64_t tid = trace_enabled() ? trace_next_id() : 0;
+            if (!rag.open(rparams, err) || !rag.retrieve(rag_query, rr, err, tid))
+            {
+                std::cerr << err << "\n";
+                rc = 3;
+            }
+            else
+            {
+                std::cerr << "=== HITS ===\n";
+                for (const auto &h : rr.hits)
+                {
+                    std::fprintf(stderr, "final=%.3f bm25=%.3f cov=%.3f chunk=%lld title=%s\n",
+                                 h.final_score, h.bm25, h.cov, (long long)h.doc_key, h.title.c_str());
+                }
+                if (rag.rerank_enabled() && rr.gate == rag_gate::ok)
+                    std::fprintf(stderr, "(cross-encoder: %s, %.1f ms)\n",
+                                 rr.reranked ? "reranked" : "fell back to heuristic", rr.cross_rerank_ms);
 
-    trim_at_stop_first_occurrence(out, stops);
-    normalize_one_sentence(out);
+                std::string answer = u8"证据不足";
+                std::string reason = rag_gate_name(rr.gate);
+                bool from_cache = false;
+                if (rr.gate == rag_gate::ok)
+                {
+                    llm_request req = defaults;
+                    req.question = rag_query;
+                    req.trace_id = tid;
+                    evidence_pack_stats pst;
+                    if (packer_ok)
+                    {
+                        packer.pack(rr, req, pst);
+                        std::fprintf(stderr, "(evidence: %d tokens, %d chunks, %d cached, %d truncated, %d dropped)\n",
+                                     pst.n_tokens, pst.n_chunks, pst.n_cached, pst.n_truncated, pst.n_dropped);
+                    }
+                    else
+                        req.evidence = rr.evidence_text;
+                    if (use_grammar)
+                        req.grammar = rag_citation_grammar(rr.evidence, rag_grammar_chars(req.n_predict));
 
-    {
-        const std::string key = u8"LR(0)";
-        size_t p = out.find(key);
-        if (p != std::string::npos && p > 0)
+                    const answer_cache_key akey = rag_answer_key(answer_cache_model_id(engine.params().model_path), req, rr);
+                    answer_cache_entry cached;
+                    const answer_cache_hit h = answers_ok ? answers.lookup(akey, rr.query_vec, cached) : answer_cache_hit::miss;
+                    if (h != answer_cache_hit::miss)
+                    {
+                        answer = cached.answer;
+                        reason = cached.reason;
+                        from_cache = true;
+                        std::cerr << "(answer cache hit: " << (h == answer_cache_hit::exact ? "exact" : "near") << ")\n";
+                    }
+                    else
+                    {
+                        llm_result res = engine.generate(req);
+                        if (!res.ok)
+                        {
+                            std::cerr << res.error << "\n";
+                            rc = res.error_code;
+                        }
+                        else
+                        {
+                            answer = res.answer;
+                            reason = rag_finalize_answer(rag_query, rr, answer);
+                            std::fprintf(stderr,
+                                         "(ttft=%.1fms prefill=%.1f tok/s decode=%.1f tok/s draft=%d/%d kv=%.1f KiB"
+                                         " truncated=%d shifts=%d)\n",
+                                         res.ttft_ms, res.prefill_tps, res.decode_tps, res.n_draft_accepted,
+                                         res.n_draft_tokens, res.kv_seq_bytes / 1024.0, res.n_truncated_tokens,
+                                         res.n_ctx_shifts);
+                            if (answers_ok && rag_answer_cacheable(res))
+                                answers.store(akey, rr.query_vec, {answer, reason});
+                        }
+                    }
+                }
+                if (rc == 0)
+                {
+                    rag_count_answer(reason, from_cache);
+                    std::cout << "\n--- model output ---\n";
+                    std::cout << answer << "\n--- end ---\n";
+                    std::cerr << "(reason=" << reason << ")\n";
+                }
+            }
+        }
+        else
         {
-            out = out.substr(p);
-            normalize_one_sentence(out);
+            // 4) ~ 8) prompt / tokenize / prefill / generation
+            llm_delta_fn on_delta;
+            if (stream)
+            {
+                std::cout << "\n--- model output ---\n";
+                std::cout.flush();
+                on_delta = [](const std::string &delta)
+                {
+                    std::cout << delta;
+                    std::cout.flush();
+                };
+            }
+            llm_request req = defaults;
+            req.trace_id = trace_enabled() ? trace_next_id() : 0;
+            llm_result res = engine.generate(req, on_delta);
+            if (!res.ok)
+            {
+                std::cerr << res.error << "\n";
+                rc = res.error_code;
+            }
+            else
+            {
+                if (stream)
+                    std::cout << "\n--- end ---\n";
+                else
+                {
+                    std::cout << "\n--- model output ---\n";
+                    std::cout << res.answer << "\n--- end ---\n";
+                }
+                std::fprintf(stderr,
+                             "(ttft=%.1fms prefill=%.1f tok/s decode=%.1f tok/s draft=%d/%d kv=%.1f KiB truncated=%d"
+                             " shifts=%d)\n",
+                             res.ttft_ms, res.prefill_tps, res.decode_tps, res.n_draft_accepted, res.n_draft_tokens,
+                             res.kv_seq_bytes / 1024.0, res.n_truncated_tokens, res.n_ctx_shifts);
+            }
         }
     }
 
-    std::cout << out << "\n--- end ---\n";
-
     // 9) cleanup
-    llama_batch_free(batch);
-    llama_sampler_free(smpl);
-    llama_free(ctx);
-    llama_free_model(model);
+    trace_close();
+    if (!metrics_out.empty())
+    {
+        std::ofstream mf(metrics_out, std::ios::binary);
+        mf << metrics().render();
+        if (!mf)
+            std::cerr << "Warning: failed to write --metrics-out: " << metrics_out << "\n";
+    }
     llama_backend_free();
-    return 0;
+    return rc;
 }
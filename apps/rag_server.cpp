@@ -0,0 +1,704 @@
+// apps/rag_server.cpp
+// 原生 HTTP 服务：替代 python/Flask.py → rag_cli.py → llm_cli 子进程 → 截取 "--- model output ---" 的链路。
+// 模型、上下文池、检索链路与答案缓存都常驻在进程里，请求直接走 rag_service（与 llm_cli --serve 的 "query" 相同）。
+//
+//   GET  /health            {"ok":true,"pipeline":true}
+//   GET  /metrics           Prometheus 文本（metrics.h 的全部指标，另加 http_requests_total / http_request_seconds）
+//   POST /search            {"query":"...","text":false}  → 检索结果、闸门与送进 prompt 的证据 id，不生成
+//   POST /answer            {"query":"...","model":"","priority":0,"deadline_ms":0,"max_tokens":0,"stream":false,
+//                            "n":64,"temp":0.2,"topk":40,"topp":0.9,"seed":42}（采样参数可选，缺省取启动参数）
+//                           → 与 llm_cli --serve 的 "query" 回包字段相同；"stream":true 时回 SSE：
+//                             event: delta  data: {"delta":"..."}   ...   event: done  data: <完整回包>
+//   POST /ingest            {"rebuild":false}  → 对启动时给的 --docs-dir 入库，完成后换上重新打开的检索链路
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include "llama.h"
+#include "answer_cache.h"
+#include "evidence_pack.h"
+#include "http_server.h"
+#include "ingest.h"
+#include "json_lite.h"
+#include "llm_engine.h"
+#include "llm_pool.h"
+#include "metrics.h"
+#include "rag_pipeline.h"
+#include "rag_service.h"
+
+// ---------- tiny arg parser ----------
+static const char *get_arg(int &i, int argc, char **argv)
+{
+    if (i + 1 >= argc)
+        return nullptr;
+    return argv[++i];
+}
+
+static void win32_enable_utf8_console()
+{
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
+#endif
+}
+
+static void print_usage()
+{
+    std::cout
+        << "Usage:\n"
+        << "  rag_server --model <path.gguf> [--db data/documents.db] [--index data/bm25.idx|data/bm25_segments]\n"
+        << "             [--vec-index vectors.idx --embed-model <embed.gguf>] [--rag-k 5]\n"
+        << "             [--rerank-model <reranker.gguf> [--rerank-top-n 8] [--rerank-budget-ms 80] [--rerank-keep 3]]\n"
+        << "             [--host 127.0.0.1] [--port 8080] [--workers 4] [--max-body-mb 8]\n"
+        << "             [--contexts 1] [--parallel 1] [--max-queue 64] [--ctx 2048] [--batch 512] [--n 64]\n"
+        << "             [--threads <n>] [--threads-batch <n>] [--cache-type-k f16|q8_0|q4_0] [--cache-type-v ...]\n"
+        << "             [--flash-attn] [--ctx-overflow fail|truncate|shift] [--max-tokens <n>] [--deadline-ms <ms>]\n"
+        << "             [--chunk-cache-mb 64] [--answer-cache 1024] [--answer-cache-db cache.db] [--semantic-cache 0.95]\n"
+        << "             [--evidence-budget <tokens>] [--no-grammar] [--docs-dir <dir>] [--trace <trace.json>]\n"
+        << "  POST /search、/answer（\"stream\":true 为 SSE）、/ingest（只对 --docs-dir 入库）；GET /health、/metrics\n"
+        << "  默认只监听本机；对外暴露请放在反向代理（TLS、鉴权）后面\n";
+}
+
+static std::atomic<bool> g_stop{false};
+
+static void on_signal(int)
+{
+    g_stop.store(true);
+}
+
+// 当前在用的检索链路；/ingest 之后整体换掉
+struct pipeline_slot
+{
+    std::mutex mtx;
+    std::unique_ptr<rag_pipeline> rag;
+    std::unique_ptr<evidence_packer> packer;
+};
+
+static bool open_pipeline(const rag_params &rparams, const llm_engine &engine, const evidence_pack_params &pparams,
+                          std::unique_ptr<rag_pipeline> &rag, std::unique_ptr<evidence_packer> &packer,
+                          std::string &err)
+{
+    rag.reset(new rag_pipeline());
+    if (!rag->open(rparams, err))
+    {
+        rag.reset();
+        return false;
+    }
+    packer.reset(new evidence_packer());
+    std::string perr;
+    if (!packer->open(engine, rparams.db_path, pparams, perr))
+    {
+        std::cerr << "Warning: evidence packing disabled: " << perr << "\n";
+        packer.reset();
+    }
+    return true;
+}
+
+static void reply_json(const std::shared_ptr<http_response> &resp, int status, const json_value &v,
+                       const http_headers &extra = {})
+{
+    std::string body;
+    json_dump_to(v, body);
+    resp->send(status, "application/json; charset=utf-8", body, extra);
+}
+
+static void reply_error(const std::shared_ptr<http_response> &resp, int status, const std::string &msg)
+{
+    json_value v = json_value::make_object();
+    v.set("ok", json_value::make_bool(false));
+    v.set("error", json_value::make_string(msg));
+    reply_json(resp, status, v);
+}
+
+// 请求体须是 JSON 对象
+static bool parse_body(const http_request &req, const std::shared_ptr<http_response> &resp, json_value &rq)
+{
+    std::string err;
+    if (req.body.empty())
+        rq = json_value::make_object();
+    else if (!json_parse(req.body, rq, err) || !rq.is_object())
+    {
+        reply_error(resp, 400, "bad request: " + (err.empty() ? "expected object" : err));
+        return false;
+    }
+    return true;
+}
+
+// 排队满 503、超时 504、检索链路的问题 500；闸门不通过仍是 200（回答为“证据不足”）
+static int answer_status(const rag_answer &a)
+{
+    if (a.ok)
+        return 200;
+    switch (a.error_code)
+    {
+    case 8:
+        return 504;
+    case 9:
+        return 503;
+    }
+    return 500;
+}
+
+static json_value hits_json(const std::vector<rag_hit> &hits, bool with_text)
+{
+    json_value arr = json_value::make_array();
+    for (const auto &h : hits)
+    {
+        json_value v = json_value::make_object();
+        v.set("chunk", json_value::make_number((double)h.doc_key));
+        v.set("title", json_value::make_string(h.title));
+        v.set("final", json_value::make_number(h.final_score));
+        v.set("bm25", json_value::make_number(h.bm25));
+        v.set("retrieval", json_value::make_number(h.retrieval));
+        v.set("cov", json_value::make_number(h.cov));
+        v.set("title_hit", json_value::make_bool(h.title_hit));
+        if (h.rerank > 0.0f)
+            v.set("rerank", json_value::make_number(h.rerank));
+        if (with_text)
+            v.set("text", json_value::make_string(h.text));
+        arr.arr.push_back(v);
+    }
+    return arr;
+}
+
+// 池子与缓存的量登记成导出时才读的回调；返回的 id 要在它们销毁前注销
+static std::vector<uint64_t> register_server_metrics(llm_pool &pool, pipeline_slot &slot, const answer_cache *answers)
+{
+    metrics_registry &reg = metrics();
+    std::vector<uint64_t> ids;
+    ids.push_back(reg.add_callback("llm_pool_queue_depth", "Requests waiting in the pool queue", metric_type::gauge, {},
+                                   [&pool]()
+                                   { return (double)pool.stats().n_queued; }));
+    ids.push_back(reg.add_callback("llm_pool_running", "Requests running on a context", metric_type::gauge, {},
+                                   [&pool]()
+                                   { return (double)pool.stats().n_running; }));
+    ids.push_back(reg.add_callback("llm_pool_shed_total", "Requests rejected because the queue was full",
+                                   metric_type::counter, {}, [&pool]()
+                                   { return (double)pool.stats().n_shed; }));
+    ids.push_back(reg.add_callback("llm_pool_expired_total", "Requests that hit their deadline while queued",
+                                   metric_type::counter, {}, [&pool]()
+                                   { return (double)pool.stats().n_expired; }));
+    const llm_pool_stats st = pool.stats();
+    for (size_t i = 0; i < st.contexts.size(); ++i)
+    {
+        const metric_labels labels = {{"model", st.contexts[i].model}, {"context", std::to_string(i)}};
+        ids.push_back(reg.add_callback("llm_kv_used_cells", "KV cache cells in use", metric_type::gauge, labels,
+                                       [&pool, i]()
+                                       { return (double)pool.stats().contexts[i].kv_used_cells; }));
+        ids.push_back(reg.add_callback("llm_kv_cells", "KV cache size in cells", metric_type::gauge, labels,
+                                       [&pool, i]()
+                                       { return (double)pool.stats().contexts[i].kv_cells; }));
+    }
+
+    // 入库后缓存跟着检索链路换掉，每次导出时去当前的那个上读
+    auto chunk_stat = [&slot](uint64_t chunk_cache_stats::*field)
+    {
+        return [&slot, field]()
+        {
+            std::lock_guard<std::mutex> lk(slot.mtx);
+            const chunk_cache *c = slot.rag ? slot.rag->cache() : nullptr;
+            return c ? (double)(c->stats().*field) : 0.0;
+        };
+    };
+    const metric_labels rag_labels = {{"cache", "rag"}};
+    ids.push_back(reg.add_callback("rag_chunk_cache_hits_total", "Evidence chunk cache hits", metric_type::counter,
+                                   rag_labels, chunk_stat(&chunk_cache_stats::hits)));
+    ids.push_back(reg.add_callback("rag_chunk_cache_misses_total", "Evidence chunk cache misses", metric_type::counter,
+                                   rag_labels, chunk_stat(&chunk_cache_stats::misses)));
+
+    if (answers)
+    {
+        ids.push_back(reg.add_callback("rag_answer_cache_total", "Answer cache lookups by result", metric_type::counter,
+                                       {{"result", "exact"}}, [answers]()
+                                       { return (double)answers->stats().exact_hits; }));
+        ids.push_back(reg.add_callback("rag_answer_cache_total", "Answer cache lookups by result", metric_type::counter,
+                                       {{"result", "near"}}, [answers]()
+                                       { return (double)answers->stats().near_hits; }));
+        ids.push_back(reg.add_callback("rag_answer_cache_total", "Answer cache lookups by result", metric_type::counter,
+                                       {{"result", "miss"}}, [answers]()
+                                       { return (double)answers->stats().misses; }));
+    }
+    return ids;
+}
+
+int main(int argc, char **argv)
+{
+    win32_enable_utf8_console();
+
+    std::string model_path;
+    rag_params rparams;
+    int rag_k = 5;
+    http_server_params hp;
+    int max_body_mb = 8;
+    int n_predict = 64;
+    int n_ctx = 2048;
+    int n_batch = 512;
+    int n_parallel = 1;
+    int n_contexts = 1;
+    int max_queue = 64;
+    int n_threads = 0;
+    int n_threads_batch = 0;
+    ggml_type cache_type_k = GGML_TYPE_F16;
+    ggml_type cache_type_v = GGML_TYPE_F16;
+    bool flash_attn = false;
+    llm_overflow ctx_overflow = llm_overflow::fail;
+    llm_answer_policy policy;
+    int chunk_cache_mb = 64;
+    int answer_cache_size = 1024;
+    std::string answer_cache_db;
+    float semantic_cache = 0.0f;
+    int evidence_budget = 0;
+    bool use_grammar = true;
+    std::string docs_dir;
+    std::string trace_file;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string a = argv[i];
+        if (a == "--flash-attn" || a == "-fa")
+        {
+            flash_attn = true;
+            continue;
+        }
+        if (a == "--no-grammar")
+        {
+            use_grammar = false;
+            continue;
+        }
+        if (a == "--help" || a == "-h")
+        {
+            print_usage();
+            return 0;
+        }
+        const char *v = get_arg(i, argc, argv);
+        if (!v)
+        {
+            std::cerr << "Missing value for " << a << "\n";
+            return 2;
+        }
+        if (a == "--model" || a == "-m")
+            model_path = v;
+        else if (a == "--db")
+            rparams.db_path = v;
+        else if (a == "--index")
+            rparams.index_path = v;
+        else if (a == "--vec-index")
+            rparams.vector_index_path = v;
+        else if (a == "--embed-model")
+            rparams.embed_model_path = v;
+        else if (a == "--rag-k")
+            rag_k = std::atoi(v);
+        else if (a == "--rerank-model")
+            rparams.rerank_model_path = v;
+        else if (a == "--rerank-top-n")
+            rparams.rerank_top_n = (size_t)std::max(1, std::atoi(v));
+        else if (a == "--rerank-budget-ms")
+            rparams.rerank_budget_ms = std::max(0, std::atoi(v));
+        else if (a == "--rerank-keep")
+            rparams.rerank_keep = (size_t)std::max(0, std::atoi(v));
+        else if (a == "--host")
+            hp.host = v;
+        else if (a == "--port")
+            hp.port = std::atoi(v);
+        else if (a == "--workers")
+            hp.n_workers = std::max(1, std::atoi(v));
+        else if (a == "--max-body-mb")
+            max_body_mb = std::max(1, std::atoi(v));
+        else if (a == "--n" || a == "-n")
+            n_predict = std::atoi(v);
+        else if (a == "--ctx")
+            n_ctx = std::atoi(v);
+        else if (a == "--batch")
+            n_batch = std::atoi(v);
+        else if (a == "--parallel" || a == "-np")
+            n_parallel = std::max(1, std::atoi(v));
+        else if (a == "--contexts")
+            n_contexts = std::max(1, std::atoi(v));
+        else if (a == "--max-queue")
+            max_queue = std::max(1, std::atoi(v));
+        else if (a == "--threads" || a == "-t")
+            n_threads = std::atoi(v);
+        else if (a == "--threads-batch" || a == "-tb")
+            n_threads_batch = std::atoi(v);
+        else if (a == "--cache-type-k" || a == "-ctk" || a == "--cache-type-v" || a == "-ctv")
+        {
+            const bool is_k = a == "--cache-type-k" || a == "-ctk";
+            if (!llm_parse_kv_type(v, is_k ? cache_type_k : cache_type_v))
+            {
+                std::cerr << a << " expects f32|f16|bf16|q8_0|q5_1|q5_0|q4_1|q4_0\n";
+                return 2;
+            }
+        }
+        else if (a == "--ctx-overflow")
+        {
+            if (!llm_parse_overflow(v, ctx_overflow))
+            {
+                std::cerr << "--ctx-overflow expects fail|truncate|shift\n";
+                return 2;
+            }
+        }
+        else if (a == "--max-tokens")
+            policy.max_tokens = std::atoi(v);
+        else if (a == "--deadline-ms")
+            policy.deadline_ms = std::atoi(v);
+        else if (a == "--chunk-cache-mb")
+            chunk_cache_mb = std::atoi(v);
+        else if (a == "--answer-cache")
+            answer_cache_size = std::atoi(v);
+        else if (a == "--answer-cache-db")
+            answer_cache_db = v;
+        else if (a == "--semantic-cache")
+            semantic_cache = (float)std::atof(v);
+        else if (a == "--evidence-budget")
+            evidence_budget = std::atoi(v);
+        else if (a == "--docs-dir" || a == "--docs_dir")
+            docs_dir = v;
+        else if (a == "--trace")
+            trace_file = v;
+        else
+        {
+            std::cerr << "Unknown argument: " << a << "\n";
+            print_usage();
+            return 2;
+        }
+    }
+
+    if (model_path.empty())
+    {
+        std::cerr << "Error: --model is required\n";
+        return 2;
+    }
+    rparams.top_k = (size_t)std::max(rag_k, 1);
+    rparams.chunk_cache_bytes = (size_t)std::max(chunk_cache_mb, 0) << 20;
+    hp.max_body_bytes = (size_t)max_body_mb << 20;
+
+    std::string err;
+    if (!trace_file.empty() && !trace_open(trace_file, err))
+    {
+        std::cerr << err << "\n";
+        return 2;
+    }
+
+    llama_backend_init();
+
+    int rc = 0;
+    {
+        llm_engine_params eparams;
+        eparams.model_path = model_path;
+        eparams.n_ctx = n_ctx;
+        eparams.n_batch = n_batch;
+        eparams.n_parallel = n_parallel;
+        eparams.n_threads = n_threads;
+        eparams.n_threads_batch = n_threads_batch;
+        eparams.type_k = cache_type_k;
+        eparams.type_v = cache_type_v;
+        eparams.flash_attn = flash_attn;
+        eparams.overflow = ctx_overflow;
+
+        llm_engine engine;
+        if (!engine.load(eparams, err))
+        {
+            std::cerr << err << "\n";
+            llama_backend_free();
+            return 3;
+        }
+
+        llm_pool_params pp;
+        pp.max_queue = (size_t)max_queue;
+        llm_pool pool(pp);
+        if (!pool.add_engine("main", engine, err) || !pool.add_contexts("main", n_contexts - 1, err))
+        {
+            std::cerr << err << "\n";
+            llama_backend_free();
+            return 3;
+        }
+
+        answer_cache answers;
+        bool answers_ok = false;
+        if (answer_cache_size > 0)
+        {
+            answer_cache_params ap;
+            ap.max_entries = (size_t)answer_cache_size;
+            ap.near_dup_threshold = semantic_cache;
+            ap.db_path = answer_cache_db;
+            answers_ok = answers.open(ap, err);
+            if (!answers_ok)
+                std::cerr << "Warning: answer cache disabled: " << err << "\n";
+        }
+
+        evidence_pack_params pparams;
+        pparams.budget_tokens = evidence_budget == 0 ? evidence_auto_budget(n_ctx, n_predict) : evidence_budget;
+
+        rag_service_params sp;
+        sp.grammar = use_grammar;
+        rag_service service(pool, sp);
+        if (answers_ok)
+            service.set_answer_cache(&answers);
+
+        pipeline_slot slot;
+        if (open_pipeline(rparams, engine, pparams, slot.rag, slot.packer, err))
+            service.set_pipeline(slot.rag.get(), slot.packer.get());
+        else
+            std::cerr << "Warning: /search and /answer disabled until /ingest succeeds: " << err << "\n";
+
+        llm_request defaults;
+        defaults.n_predict = n_predict;
+        defaults.policy = policy;
+
+        http_server server(hp);
+
+        server.route("GET", "/health", [&service](const http_request &, std::shared_ptr<http_response> resp)
+                     {
+            json_value v = json_value::make_object();
+            v.set("ok", json_value::make_bool(true));
+            v.set("pipeline", json_value::make_bool(service.has_pipeline()));
+            reply_json(resp, 200, v); });
+
+        server.route("GET", "/metrics", [](const http_request &, std::shared_ptr<http_response> resp)
+                     { resp->send(200, "text/plain; version=0.0.4; charset=utf-8", metrics().render()); });
+
+        server.route("POST", "/search", [&service](const http_request &req, std::shared_ptr<http_response> resp)
+                     {
+            json_value rq;
+            if (!parse_body(req, resp, rq))
+                return;
+            const std::string query = rq.get_string("query");
+            if (query.empty())
+            {
+                reply_error(resp, 400, "\"query\" is required");
+                return;
+            }
+            const uint64_t tid = trace_enabled() ? trace_next_id() : 0;
+            rag_retrieval rr;
+            std::string err;
+            if (!service.search(query, rr, err, tid))
+            {
+                reply_error(resp, service.has_pipeline() ? 500 : 503, err.empty() ? "retrieve failed" : err);
+                return;
+            }
+            json_value v = json_value::make_object();
+            v.set("ok", json_value::make_bool(true));
+            v.set("gate", json_value::make_string(rag_gate_name(rr.gate)));
+            v.set("reranked", json_value::make_bool(rr.reranked));
+            v.set("hits", hits_json(rr.hits, rq.get_bool("text", false)));
+            json_value ev = json_value::make_array();
+            for (const auto &h : rr.evidence)
+                ev.arr.push_back(json_value::make_number((double)h.doc_key));
+            v.set("evidence", ev);
+            v.set("search_ms", json_value::make_number(rr.search_ms));
+            v.set("fetch_ms", json_value::make_number(rr.fetch_ms));
+            if (rr.reranked || rr.cross_rerank_ms > 0.0)
+                v.set("cross_rerank_ms", json_value::make_number(rr.cross_rerank_ms));
+            reply_json(resp, 200, v); });
+
+        server.route("POST", "/answer", [&service, &pool, &defaults](const http_request &req, std::shared_ptr<http_response> resp)
+                     {
+            json_value rq;
+            if (!parse_body(req, resp, rq))
+                return;
+            const std::string query = rq.get_string("query");
+            if (query.empty())
+            {
+                reply_error(resp, 400, "\"query\" is required");
+                return;
+            }
+            llm_pool_request pr;
+            pr.model = rq.get_string("model");
+            pr.priority = (int)rq.get_number("priority", 0);
+            if (!pool.engine(pr.model))
+            {
+                reply_error(resp, 400, "unknown model: " + pr.model);
+                return;
+            }
+
+            llm_request lr = defaults;
+            lr.trace_id = trace_enabled() ? trace_next_id() : 0;
+            lr.n_predict = (int)rq.get_number("n", defaults.n_predict);
+            lr.temp = (float)rq.get_number("temp", defaults.temp);
+            lr.top_k = (int)rq.get_number("topk", defaults.top_k);
+            lr.top_p = (float)rq.get_number("topp", defaults.top_p);
+            lr.seed = (int)rq.get_number("seed", defaults.seed);
+            lr.policy.deadline_ms = (int)rq.get_number("deadline_ms", defaults.policy.deadline_ms);
+            lr.policy.max_tokens = (int)rq.get_number("max_tokens", defaults.policy.max_tokens);
+            lr.policy.one_sentence = rq.get_bool("one_sentence", defaults.policy.one_sentence);
+            const uint64_t tid = lr.trace_id;
+            const auto t0 = std::chrono::steady_clock::now();
+
+            if (!rq.get_bool("stream", false))
+            {
+                service.answer(query, pr, lr, [resp, tid, t0](const rag_answer &a)
+                               {
+                    json_value v = json_value::make_object();
+                    rag_answer_to_json(a, v);
+                    reply_json(resp, answer_status(a), v, a.error_code == 9 ? http_headers{{"Retry-After", "1"}} : http_headers{});
+                    trace_span("request", "http", tid, t0, std::chrono::steady_clock::now()); });
+                return;
+            }
+
+            // SSE：第一段 delta 到了才写响应头，这样排队被拒、检索出错仍能回真实的状态码
+            auto on_delta = [resp](const std::string &delta)
+            {
+                if (!resp->started())
+                    resp->begin_stream(200, "text/event-stream; charset=utf-8", {{"Cache-Control", "no-cache"}});
+                json_value ev = json_value::make_object();
+                ev.set("delta", json_value::make_string(delta));
+                resp->write(http_sse_event("delta", json_dump(ev)));
+            };
+            service.answer(query, pr, lr, [resp, tid, t0](const rag_answer &a)
+                           {
+                json_value v = json_value::make_object();
+                rag_answer_to_json(a, v);
+                if (!resp->started() && !a.ok)
+                    reply_json(resp, answer_status(a), v, a.error_code == 9 ? http_headers{{"Retry-After", "1"}} : http_headers{});
+                else
+                {
+                    if (!resp->started())
+                        resp->begin_stream(200, "text/event-stream; charset=utf-8", {{"Cache-Control", "no-cache"}});
+                    resp->write(http_sse_event("done", json_dump(v)));
+                    resp->end();
+                }
+                trace_span("request", "http", tid, t0, std::chrono::steady_clock::now()); }, on_delta);
+        });
+
+        // 入库只对启动时给定的目录做，请求体不能指定路径；同一时间只跑一个
+        std::mutex ingest_mtx;
+        server.route("POST", "/ingest", [&](const http_request &req, std::shared_ptr<http_response> resp)
+                     {
+            json_value rq;
+            if (!parse_body(req, resp, rq))
+                return;
+            if (docs_dir.empty())
+            {
+                reply_error(resp, 501, "rag_server was started without --docs-dir");
+                return;
+            }
+            std::unique_lock<std::mutex> lk(ingest_mtx, std::try_to_lock);
+            if (!lk.owns_lock())
+            {
+                reply_error(resp, 409, "an ingest is already running");
+                return;
+            }
+
+            ingest_params ip;
+            ip.docs_dir = docs_dir;
+            ip.db_path = rparams.db_path;
+            ip.rebuild = rq.get_bool("rebuild", false);
+            std::error_code ec;
+            if (!rparams.index_path.empty())
+            {
+                if (std::filesystem::is_directory(std::filesystem::u8path(rparams.index_path), ec))
+                    ip.segments_dir = rparams.index_path;
+                else
+                    ip.bm25_path = rparams.index_path;
+            }
+            if (ip.segments_dir.empty() && !rparams.vector_index_path.empty() && !rparams.embed_model_path.empty())
+            {
+                ip.vector_path = rparams.vector_index_path;
+                ip.embed_model_path = rparams.embed_model_path;
+            }
+            ip.token_model_path = model_path; // 新行的 token 预先切好，装证据时不必现场 tokenize
+
+            ingest_stats st;
+            std::string err;
+            if (!ingest_run(ip, st, err))
+            {
+                reply_error(resp, 500, err);
+                return;
+            }
+
+            // 先在锁外打开新链路（可能要现建 BM25），再整体换上；旧的在 set_pipeline 返回后已没人在用
+            std::unique_ptr<rag_pipeline> rag;
+            std::unique_ptr<evidence_packer> packer;
+            if (!open_pipeline(rparams, engine, pparams, rag, packer, err))
+            {
+                reply_error(resp, 500, "ingest done but reopening the pipeline failed: " + err);
+                return;
+            }
+            std::unique_ptr<rag_pipeline> old_rag;
+            std::unique_ptr<evidence_packer> old_packer;
+            {
+                std::lock_guard<std::mutex> slk(slot.mtx);
+                service.set_pipeline(rag.get(), packer.get());
+                old_rag = std::move(slot.rag);
+                old_packer = std::move(slot.packer);
+                slot.rag = std::move(rag);
+                slot.packer = std::move(packer);
+            }
+
+            json_value v = json_value::make_object();
+            v.set("ok", json_value::make_bool(true));
+            v.set("files", json_value::make_number((double)st.n_files));
+            v.set("unchanged", json_value::make_number((double)st.n_unchanged));
+            v.set("removed", json_value::make_number((double)st.n_removed));
+            v.set("chunks", json_value::make_number((double)st.n_chunks));
+            v.set("indexed", json_value::make_number((double)st.n_indexed));
+            v.set("embedded", json_value::make_number((double)st.n_embedded));
+            v.set("segments", json_value::make_number((double)st.n_segments));
+            v.set("pipeline_ms", json_value::make_number(st.pipeline_ms));
+            reply_json(resp, 200, v); });
+
+        if (!server.listen(err))
+        {
+            std::cerr << err << "\n";
+            rc = 2;
+        }
+        else
+        {
+            const std::vector<uint64_t> metric_ids = register_server_metrics(pool, slot, answers_ok ? &answers : nullptr);
+            pool.start();
+
+            std::signal(SIGINT, on_signal);
+            std::signal(SIGTERM, on_signal);
+            // 信号处理里只置标志，由这个线程去叫停服务端
+            std::atomic<bool> done{false};
+            std::thread watcher([&]()
+                                {
+                while (!done.load())
+                {
+                    if (g_stop.load())
+                    {
+                        server.stop();
+                        break;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                } });
+
+            const llm_pool_stats st = pool.stats();
+            std::cerr << "rag_server: listening on http://" << hp.host << ":" << server.port() << " ("
+                      << st.contexts.size() << " context(s), " << hp.n_workers << " workers, KV "
+                      << (st.kv_bytes >> 20) << " MiB)\n";
+            server.run();
+
+            done.store(true);
+            watcher.join();
+            pool.stop(); // 等已提交的生成做完，回调里的响应写到已关闭的连接上会被丢弃
+            for (uint64_t id : metric_ids)
+                metrics().remove_callback(id);
+            std::cerr << "rag_server: stopped\n";
+        }
+    }
+
+    trace_close();
+    llama_backend_free();
+    return rc;
+}
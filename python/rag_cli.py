@@ -32,25 +32,68 @@ HARD_TERMS = {
 
 _CITE_RE = re.compile(r"\[chunk:\d+\]")
 
-def extract_model_output(text: str) -> str:
-    if not text:
-        return ""
-    a = text.find("--- model output ---")
-    b = text.find("--- end ---")
-    if a != -1 and b != -1 and b > a:
-        return text[a + len("--- model output ---"):b].strip()
-    return text.strip()
+class LlmServer:
+    """
+    常驻的 llm_cli --serve 进程：模型只加载一次，之后每个问题走一行 JSON。
+    进程意外退出时，下一次调用会自动重启。
+    """
 
-def call_llm(prompt: str) -> str:
-    if not LLM_EXE.exists():
-        raise RuntimeError(f"找不到 llm_cli.exe: {LLM_EXE}")
-    if not MODEL.exists():
-        raise RuntimeError(f"找不到模型: {MODEL}")
+    def __init__(self, exe: Path, model: Path):
+        self.exe = exe
+        self.model = model
+        self.proc: subprocess.Popen | None = None
+        self.next_id = 0
+
+    def _ensure_started(self) -> subprocess.Popen:
+        if self.proc is not None and self.proc.poll() is None:
+            return self.proc
+        if not self.exe.exists():
+            raise RuntimeError(f"找不到 llm_cli.exe: {self.exe}")
+        if not self.model.exists():
+            raise RuntimeError(f"找不到模型: {self.model}")
+        self.proc = subprocess.Popen(
+            [str(self.exe), "-m", str(self.model), "--serve"],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+            text=True,
+            encoding="utf-8",
+            errors="ignore",
+            bufsize=1,
+        )
+        return self.proc
+
+    def ask(self, prompt: str, **params) -> str:
+        proc = self._ensure_started()
+        self.next_id += 1
+        req = {"id": self.next_id, "prompt": prompt}
+        req.update(params)
+        proc.stdin.write(json.dumps(req, ensure_ascii=False) + "\n")
+        proc.stdin.flush()
+        line = proc.stdout.readline()
+        if not line:
+            self.proc = None
+            raise RuntimeError("llm_cli --serve 进程已退出")
+        resp = json.loads(line)
+        if not resp.get("ok"):
+            raise RuntimeError(f"llm_cli 出错: {resp.get('error')}")
+        return (resp.get("answer") or "").strip()
+
+    def close(self) -> None:
+        if self.proc is not None and self.proc.poll() is None:
+            try:
+                self.proc.stdin.write(json.dumps({"cmd": "quit"}) + "\n")
+                self.proc.stdin.flush()
+                self.proc.wait(timeout=5)
+            except Exception:
+                self.proc.kill()
+        self.proc = None
+
+
+_LLM_SERVER = LlmServer(LLM_EXE, MODEL)
 
-    cmd = [str(LLM_EXE), "-m", str(MODEL), "-p", prompt]
-    r = subprocess.run(cmd, capture_output=True, text=True, encoding="utf-8", errors="ignore")
-    raw = ((r.stdout or "") + "\n" + (r.stderr or "")).strip()
-    return extract_model_output(raw)
+def call_llm(prompt: str) -> str:
+    return _LLM_SERVER.ask(prompt)
 
 def save_run(query: str, topk: int, chunk_ids: List[int], prompt: str, answer: str):
     conn = sqlite3.connect(DB_PATH)
@@ -240,4 +283,7 @@ def main():
         print(f"\n(saved to runs, reason={reason})\n")
 
 if __name__ == "__main__":
-    main()
+    try:
+        main()
+    finally:
+        _LLM_SERVER.close()
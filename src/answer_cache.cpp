@@ -0,0 +1,334 @@
+// src/answer_cache.cpp
+#include "answer_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+#include <sqlite3.h>
+
+#include "vec_kernels.h"
+
+namespace
+{
+constexpr uint64_t k_fnv_offset = 1469598103934665603ull;
+constexpr uint64_t k_fnv_prime = 1099511628211ull;
+
+inline void fnv_bytes(uint64_t &h, const void *p, size_t n)
+{
+    const unsigned char *b = (const unsigned char *)p;
+    for (size_t i = 0; i < n; ++i)
+    {
+        h ^= b[i];
+        h *= k_fnv_prime;
+    }
+}
+
+template <class T>
+inline void fnv_pod(uint64_t &h, const T &v)
+{
+    fnv_bytes(h, &v, sizeof(v));
+}
+
+inline void fnv_str(uint64_t &h, const std::string &s)
+{
+    const uint64_t n = s.size();
+    fnv_pod(h, n); // 带长度，避免相邻字段拼接后撞键
+    fnv_bytes(h, s.data(), s.size());
+}
+
+uint64_t context_hash(const answer_cache_key &k)
+{
+    std::vector<int64_t> ids = k.chunk_ids;
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    uint64_t h = k_fnv_offset;
+    const uint64_t n = ids.size();
+    fnv_pod(h, n);
+    for (int64_t id : ids)
+        fnv_pod(h, id);
+    fnv_str(h, k.model);
+    fnv_pod(h, k.temp);
+    fnv_pod(h, k.top_k);
+    fnv_pod(h, k.top_p);
+    fnv_pod(h, k.seed);
+    fnv_pod(h, k.n_predict);
+    fnv_pod(h, k.max_tokens);
+    fnv_pod(h, k.one_sentence);
+    fnv_str(h, k.grammar);
+    return h;
+}
+
+uint64_t exact_hash(uint64_t ctx, const answer_cache_key &k)
+{
+    uint64_t h = ctx;
+    fnv_str(h, answer_cache_normalize(k.query));
+    return h;
+}
+
+bool ends_with(const std::string &s, const char *suffix)
+{
+    const size_t n = std::strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+std::string ids_json(std::vector<int64_t> ids)
+{
+    std::sort(ids.begin(), ids.end());
+    std::string out = "[";
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if (i)
+            out += ",";
+        out += std::to_string(ids[i]);
+    }
+    out += "]";
+    return out;
+}
+} // namespace
+
+std::string answer_cache_normalize(const std::string &query)
+{
+    std::string out;
+    out.reserve(query.size());
+    bool space = false;
+    for (unsigned char c : query)
+    {
+        if (std::isspace(c))
+        {
+            space = !out.empty();
+            continue;
+        }
+        if (space)
+            out.push_back(' ');
+        space = false;
+        out.push_back((char)std::tolower(c));
+    }
+
+    static const char *const k_trailing[] = {"?", ".", "!", u8"？", u8"。", u8"！"};
+    for (bool trimmed = true; trimmed;)
+    {
+        trimmed = false;
+        for (const char *t : k_trailing)
+        {
+            if (ends_with(out, t))
+            {
+                out.erase(out.size() - std::strlen(t));
+                trimmed = true;
+            }
+        }
+        while (!out.empty() && out.back() == ' ')
+            out.pop_back();
+    }
+    return out;
+}
+
+std::string answer_cache_model_id(const std::string &model_path)
+{
+    std::ifstream f(model_path, std::ios::binary | std::ios::ate);
+    const long long size = f ? (long long)f.tellg() : -1;
+    return model_path + ":" + std::to_string(size);
+}
+
+answer_cache::~answer_cache()
+{
+    close();
+}
+
+bool answer_cache::open(const answer_cache_params &params, std::string &err)
+{
+    close();
+    params_ = params;
+    if (params_.db_path.empty())
+        return true;
+
+    if (sqlite3_open_v2(params_.db_path.c_str(), &db_, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK)
+    {
+        err = "failed to open answer cache db: " + params_.db_path + (db_ ? std::string(": ") + sqlite3_errmsg(db_) : "");
+        close();
+        return false;
+    }
+    const char *schema = "CREATE TABLE IF NOT EXISTS answer_cache ("
+                         " key INTEGER PRIMARY KEY,"
+                         " ctx INTEGER NOT NULL,"
+                         " query TEXT NOT NULL,"
+                         " chunk_ids_json TEXT NOT NULL,"
+                         " answer TEXT NOT NULL,"
+                         " reason TEXT NOT NULL,"
+                         " query_vec BLOB,"
+                         " created_at INTEGER NOT NULL);";
+    char *msg = nullptr;
+    if (sqlite3_exec(db_, schema, nullptr, nullptr, &msg) != SQLITE_OK)
+    {
+        err = std::string("failed to create answer_cache table: ") + (msg ? msg : "");
+        sqlite3_free(msg);
+        close();
+        return false;
+    }
+    if (!load_db(err))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool answer_cache::load_db(std::string &err)
+{
+    // 最新的 max_entries 条；按时间从旧到新插入，最新的落在 LRU 头部
+    const std::string sql = "SELECT key, ctx, answer, reason, query_vec FROM ("
+                            " SELECT * FROM answer_cache ORDER BY created_at DESC LIMIT " +
+                            std::to_string(params_.max_entries) + ") ORDER BY created_at ASC";
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        err = std::string("failed to prepare: ") + sqlite3_errmsg(db_);
+        return false;
+    }
+    std::lock_guard<std::mutex> lk(mtx_);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        item it;
+        it.key = (uint64_t)sqlite3_column_int64(stmt, 0);
+        it.ctx = (uint64_t)sqlite3_column_int64(stmt, 1);
+        const unsigned char *answer = sqlite3_column_text(stmt, 2);
+        const unsigned char *reason = sqlite3_column_text(stmt, 3);
+        if (answer)
+            it.entry.answer.assign((const char *)answer, (size_t)sqlite3_column_bytes(stmt, 2));
+        if (reason)
+            it.entry.reason.assign((const char *)reason, (size_t)sqlite3_column_bytes(stmt, 3));
+        const void *blob = sqlite3_column_blob(stmt, 4);
+        const size_t nb = (size_t)sqlite3_column_bytes(stmt, 4);
+        if (blob && nb % sizeof(float) == 0)
+        {
+            it.query_vec.resize(nb / sizeof(float));
+            std::memcpy(it.query_vec.data(), blob, nb);
+        }
+        insert_locked(std::move(it));
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+void answer_cache::close()
+{
+    if (db_)
+        sqlite3_close(db_);
+    db_ = nullptr;
+    std::lock_guard<std::mutex> lk(mtx_);
+    lru_.clear();
+    map_.clear();
+    stats_ = answer_cache_stats();
+}
+
+void answer_cache::insert_locked(item it)
+{
+    auto found = map_.find(it.key);
+    if (found != map_.end())
+    {
+        lru_.erase(found->second);
+        map_.erase(found);
+    }
+    const uint64_t key = it.key;
+    lru_.push_front(std::move(it));
+    map_.emplace(key, lru_.begin());
+    while (lru_.size() > params_.max_entries && !lru_.empty())
+    {
+        map_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+}
+
+answer_cache_hit answer_cache::lookup(const answer_cache_key &key, const std::vector<float> &query_vec,
+                                      answer_cache_entry &out)
+{
+    const uint64_t ctx = context_hash(key);
+    const uint64_t k = exact_hash(ctx, key);
+
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = map_.find(k);
+    if (it != map_.end())
+    {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        out = it->second->entry;
+        ++stats_.exact_hits;
+        return answer_cache_hit::exact;
+    }
+
+    if (params_.near_dup_threshold > 0.0f && !query_vec.empty())
+    {
+        // 只在同一证据集 + 采样参数下比较；条目数有上限，线性扫描即可
+        auto best = lru_.end();
+        float best_sim = params_.near_dup_threshold;
+        for (auto cur = lru_.begin(); cur != lru_.end(); ++cur)
+        {
+            if (cur->ctx != ctx || cur->query_vec.size() != query_vec.size())
+                continue;
+            const float sim = vec_dot_f32(cur->query_vec.data(), query_vec.data(), query_vec.size());
+            if (sim >= best_sim)
+            {
+                best_sim = sim;
+                best = cur;
+            }
+        }
+        if (best != lru_.end())
+        {
+            lru_.splice(lru_.begin(), lru_, best);
+            out = best->entry;
+            ++stats_.near_hits;
+            return answer_cache_hit::near;
+        }
+    }
+    ++stats_.misses;
+    return answer_cache_hit::miss;
+}
+
+void answer_cache::store(const answer_cache_key &key, const std::vector<float> &query_vec,
+                         const answer_cache_entry &entry)
+{
+    if (params_.max_entries == 0)
+        return;
+
+    item it;
+    it.ctx = context_hash(key);
+    it.key = exact_hash(it.ctx, key);
+    it.query_vec = query_vec;
+    it.entry = entry;
+
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (db_)
+    {
+        sqlite3_stmt *stmt = nullptr;
+        const char *sql = "INSERT OR REPLACE INTO answer_cache(key, ctx, query, chunk_ids_json, answer, reason, query_vec, created_at)"
+                          " VALUES(?,?,?,?,?,?,?,?)";
+        if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            const std::string ids = ids_json(key.chunk_ids);
+            sqlite3_bind_int64(stmt, 1, (sqlite3_int64)it.key);
+            sqlite3_bind_int64(stmt, 2, (sqlite3_int64)it.ctx);
+            sqlite3_bind_text(stmt, 3, key.query.data(), (int)key.query.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 4, ids.data(), (int)ids.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 5, entry.answer.data(), (int)entry.answer.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 6, entry.reason.data(), (int)entry.reason.size(), SQLITE_STATIC);
+            if (query_vec.empty())
+                sqlite3_bind_null(stmt, 7);
+            else
+                sqlite3_bind_blob(stmt, 7, query_vec.data(), (int)(query_vec.size() * sizeof(float)), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 8, (sqlite3_int64)std::time(nullptr));
+            sqlite3_step(stmt); // 持久化失败不影响内存里的缓存
+        }
+        sqlite3_finalize(stmt);
+    }
+    insert_locked(std::move(it));
+}
+
+answer_cache_stats answer_cache::stats() const
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    answer_cache_stats st = stats_;
+    st.entries = lru_.size();
+    return st;
+}
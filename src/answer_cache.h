@@ -0,0 +1,103 @@
+// src/answer_cache.h
+// 生成前先查的答案缓存。
+// - 精确键：归一化后的问题 + 排序后的证据 id + 模型文件 + 采样参数（temp/top_k/top_p/seed/n_predict）与长度策略的哈希；
+//   固定 seed、低温度时同一组输入的输出是确定的，命中即可跳过整段解码；
+// - 近似查找（可选）：证据集与采样参数完全相同、仅问题措辞不同时，按查询向量的余弦相似度判断是否复用；
+// - 持久化（可选）：写入 SQLite 的 answer_cache 表，下次启动时载入。rag_cli.py 的 runs 表缺少模型与采样参数，无法构成精确键，不从那里读。
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct sqlite3;
+
+struct answer_cache_params
+{
+    size_t max_entries = 1024;
+    float near_dup_threshold = 0.0f; // > 0 时启用近似查找（查询向量已 L2 归一化，阈值即余弦）
+    std::string db_path;             // 非空时持久化
+};
+
+struct answer_cache_key
+{
+    std::string query;
+    std::vector<int64_t> chunk_ids; // 顺序无关
+    std::string model;              // 见 answer_cache_model_id
+    float temp = 0.0f;
+    int top_k = 0;
+    float top_p = 0.0f;
+    int seed = 0;
+    int n_predict = 0;
+    int max_tokens = 0;        // llm_policy::max_tokens
+    bool one_sentence = false; // llm_policy::one_sentence
+    std::string grammar; // 约束解码的 GBNF（为空表示不约束）
+};
+
+struct answer_cache_entry
+{
+    std::string answer;
+    std::string reason;
+};
+
+struct answer_cache_stats
+{
+    uint64_t exact_hits = 0;
+    uint64_t near_hits = 0;
+    uint64_t misses = 0;
+    size_t entries = 0;
+};
+
+enum class answer_cache_hit
+{
+    miss,
+    exact,
+    near,
+};
+
+class answer_cache
+{
+public:
+    answer_cache() = default;
+    ~answer_cache();
+
+    answer_cache(const answer_cache &) = delete;
+    answer_cache &operator=(const answer_cache &) = delete;
+
+    bool open(const answer_cache_params &params, std::string &err);
+    void close();
+
+    // 线程安全。query_vec 可为空（此时只做精确查找）
+    answer_cache_hit lookup(const answer_cache_key &key, const std::vector<float> &query_vec, answer_cache_entry &out);
+    void store(const answer_cache_key &key, const std::vector<float> &query_vec, const answer_cache_entry &entry);
+
+    answer_cache_stats stats() const;
+    const answer_cache_params &params() const { return params_; }
+
+private:
+    struct item
+    {
+        uint64_t key;
+        uint64_t ctx; // 证据集 + 模型 + 采样参数
+        std::vector<float> query_vec;
+        answer_cache_entry entry;
+    };
+
+    void insert_locked(item it);
+    bool load_db(std::string &err);
+
+    answer_cache_params params_;
+    mutable std::mutex mtx_;
+    std::list<item> lru_; // 头部最新
+    std::unordered_map<uint64_t, std::list<item>::iterator> map_;
+    answer_cache_stats stats_;
+    sqlite3 *db_ = nullptr;
+};
+
+// 小写 ASCII、合并空白、去掉首尾空白和结尾的问号/句号
+std::string answer_cache_normalize(const std::string &query);
+// 模型路径 + 文件大小；换了同名文件也能区分开
+std::string answer_cache_model_id(const std::string &model_path);
@@ -0,0 +1,755 @@
+// src/bm25_index.cpp
+#include "bm25_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "text_tokenize.h"
+
+namespace
+{
+constexpr uint32_t k_block_size = 128;
+
+// ---------- varint (LEB128) ----------
+inline void put_varint(std::vector<uint8_t> &out, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+inline uint32_t get_varint(const uint8_t *&p)
+{
+    uint32_t v = *p & 0x7F;
+    int shift = 7;
+    while (*p++ & 0x80)
+    {
+        v |= (uint32_t)(*p & 0x7F) << shift;
+        shift += 7;
+    }
+    return v;
+}
+
+// 单个词对一篇文档的贡献；构建期的上界与查询期的打分必须用同一个式子，保证上界不被浮点误差突破
+inline float term_score(float idf, uint32_t tf, float norm, float k1)
+{
+    const float f = (float)tf;
+    return idf * (f * (k1 + 1.0f) / (f + norm));
+}
+
+// 按 doc 序号递增遍历一个词的倒排，支持借助跳表 advance
+struct posting_cursor
+{
+    const uint8_t *base = nullptr;
+    const uint8_t *p = nullptr;
+    const bm25_skip *skips = nullptr;
+    uint32_t n_blocks = 0;
+    uint32_t df = 0;
+    uint32_t block = 0;
+    uint32_t left = 0; // 当前块中未读的条数
+    uint32_t doc = 0;
+    uint32_t tf = 0;
+    bool done = false;
+
+    void load_block(uint32_t b)
+    {
+        block = b;
+        p = base + skips[b].offset;
+        doc = b ? skips[b - 1].last_doc : 0;
+        left = std::min(k_block_size, df - b * k_block_size);
+    }
+
+    void next()
+    {
+        if (left == 0)
+        {
+            if (block + 1 >= n_blocks)
+            {
+                done = true;
+                return;
+            }
+            load_block(block + 1);
+        }
+        doc += get_varint(p);
+        tf = get_varint(p);
+        --left;
+    }
+
+    void advance(uint32_t target)
+    {
+        if (done || doc >= target)
+            return;
+        if (skips[block].last_doc < target)
+        {
+            // 目标不在当前块：在后续块的 last_doc 上二分
+            const bm25_skip *first = skips + block + 1;
+            const bm25_skip *last = skips + n_blocks;
+            const bm25_skip *it = std::lower_bound(first, last, target, [](const bm25_skip &s, uint32_t t)
+                                                   { return s.last_doc < t; });
+            if (it == last)
+            {
+                done = true;
+                return;
+            }
+            load_block((uint32_t)(it - skips));
+            next();
+        }
+        while (!done && doc < target)
+            next();
+    }
+};
+
+struct query_term
+{
+    posting_cursor cur;
+    float idf = 0.0f;
+    float weight = 0.0f; // 查询中出现次数（BM25Okapi 对重复查询词逐次累加）
+    float ub = 0.0f;     // weight * max_score
+};
+
+// 堆顶是当前 top-k 里最差的一项：分数低者更差，同分时 doc 序号大者更差
+struct worse_first
+{
+    bool operator()(const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b) const
+    {
+        if (a.first != b.first)
+            return a.first > b.first;
+        return a.second < b.second;
+    }
+};
+
+// 构建期持有的数组；build() 结束后 bm25_index 里的视图都指向这里
+struct bm25_storage
+{
+    std::vector<char> term_blob;
+    std::vector<uint32_t> term_offsets;
+    std::vector<bm25_term> terms;
+    std::vector<uint8_t> postings;
+    std::vector<bm25_skip> skips;
+    std::vector<int64_t> doc_keys;
+    std::vector<uint32_t> doc_lens;
+    std::vector<float> doc_norms;
+};
+
+// 上界是否已不可能超过阈值；留一点余量吸收求和顺序不同带来的浮点误差
+inline bool cannot_beat(float ub, float theta)
+{
+    return ub + 1e-4f * (1.0f + std::fabs(theta)) <= theta;
+}
+
+// MaxScore top-k。qt 的 ub 已填好；norm_of(d) 给出文档 d 的长度归一项，dead 非空时跳过其中标记的文档。
+// 返回按分数降序（同分按 doc 序号升序）的 (score, doc)
+template <class NormFn>
+std::vector<std::pair<float, uint32_t>> maxscore_topk(std::vector<query_term> &qt, size_t top_k, float k1,
+                                                      NormFn norm_of, const std::vector<bool> *dead)
+{
+    for (auto &q : qt)
+    {
+        q.cur.load_block(0);
+        q.cur.next();
+    }
+
+    // MaxScore：按上界升序排列；前 n_ne 个词的上界之和不超过阈值，称为非必要词，
+    // 只包含非必要词的文档不可能进入 top-k，因此候选文档只从必要词的倒排里产生
+    std::sort(qt.begin(), qt.end(), [](const query_term &a, const query_term &b)
+              { return a.ub < b.ub; });
+    const size_t n = qt.size();
+    std::vector<float> prefix_ub(n);
+    float acc = 0.0f;
+    for (size_t i = 0; i < n; ++i)
+    {
+        acc += qt[i].ub;
+        prefix_ub[i] = acc;
+    }
+
+    std::vector<std::pair<float, uint32_t>> heap;
+    heap.reserve(top_k + 1);
+    float theta = -std::numeric_limits<float>::infinity();
+    size_t n_ne = 0;
+
+    while (true)
+    {
+        uint32_t d = std::numeric_limits<uint32_t>::max();
+        for (size_t i = n_ne; i < n; ++i)
+        {
+            if (!qt[i].cur.done)
+                d = std::min(d, qt[i].cur.doc);
+        }
+        if (d == std::numeric_limits<uint32_t>::max())
+            break;
+        if (dead && (*dead)[d])
+        {
+            // 已删除：必要词的游标越过它即可，非必要词下次 advance 时自然跳过
+            for (size_t i = n_ne; i < n; ++i)
+            {
+                if (!qt[i].cur.done && qt[i].cur.doc == d)
+                    qt[i].cur.next();
+            }
+            continue;
+        }
+
+        const float norm = norm_of(d);
+        float score = 0.0f;
+        for (size_t i = n_ne; i < n; ++i)
+        {
+            posting_cursor &c = qt[i].cur;
+            if (!c.done && c.doc == d)
+            {
+                score += qt[i].weight * term_score(qt[i].idf, c.tf, norm, k1);
+                c.next();
+            }
+        }
+
+        // 非必要词从上界大的往小的补分；一旦补满也赢不了阈值就提前放弃
+        const bool full = heap.size() >= top_k;
+        bool pruned = false;
+        for (size_t i = n_ne; i-- > 0;)
+        {
+            if (full && cannot_beat(score + prefix_ub[i], theta))
+            {
+                pruned = true;
+                break;
+            }
+            posting_cursor &c = qt[i].cur;
+            c.advance(d);
+            if (!c.done && c.doc == d)
+                score += qt[i].weight * term_score(qt[i].idf, c.tf, norm, k1);
+        }
+        if (pruned)
+            continue;
+
+        if (!full)
+        {
+            heap.emplace_back(score, d);
+            std::push_heap(heap.begin(), heap.end(), worse_first());
+        }
+        else if (score > heap.front().first)
+        {
+            std::pop_heap(heap.begin(), heap.end(), worse_first());
+            heap.back() = {score, d};
+            std::push_heap(heap.begin(), heap.end(), worse_first());
+        }
+        else
+        {
+            continue;
+        }
+
+        if (heap.size() >= top_k)
+        {
+            theta = heap.front().first;
+            while (n_ne < n && cannot_beat(prefix_ub[n_ne], theta))
+                ++n_ne;
+        }
+    }
+
+    std::sort(heap.begin(), heap.end(), [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b)
+              { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+    return heap;
+}
+} // namespace
+
+// ---------- builder ----------
+void bm25_builder::add_document(int64_t doc_key, const std::string &text)
+{
+    tokenize_zh_en(text, arena_, tokenize_);
+    add_terms(doc_key, arena_.tokens);
+}
+
+void bm25_builder::add_tokens(int64_t doc_key, const std::vector<std::string> &tokens)
+{
+    add_terms(doc_key, tokens);
+}
+
+void bm25_builder::add_tokens(int64_t doc_key, const std::vector<std::string_view> &tokens)
+{
+    add_terms(doc_key, tokens);
+}
+
+template <typename Tokens>
+void bm25_builder::add_terms(int64_t doc_key, const Tokens &tokens)
+{
+    const uint32_t doc = (uint32_t)doc_keys_.size();
+    doc_keys_.push_back(doc_key);
+    doc_lens_.push_back((uint32_t)tokens.size());
+
+    for (const auto &t : tokens)
+    {
+        key_.assign(t.data(), t.size());
+        auto it = term_ids_.find(key_);
+        uint32_t tid;
+        if (it == term_ids_.end())
+        {
+            tid = (uint32_t)terms_.size();
+            term_ids_.emplace(key_, tid);
+            terms_.push_back(key_);
+            postings_.emplace_back();
+        }
+        else
+        {
+            tid = it->second;
+        }
+        auto &pl = postings_[tid];
+        if (!pl.empty() && pl.back().first == doc)
+            pl.back().second++;
+        else
+            pl.emplace_back(doc, 1);
+    }
+}
+
+bm25_builder bm25_builder::merge_shards(std::vector<bm25_builder> &shards)
+{
+    struct doc_ref
+    {
+        int64_t key;
+        uint32_t shard;
+        uint32_t doc;
+    };
+    std::vector<doc_ref> refs;
+    size_t n_docs = 0;
+    for (const auto &sh : shards)
+        n_docs += sh.doc_keys_.size();
+    refs.reserve(n_docs);
+    for (uint32_t s = 0; s < (uint32_t)shards.size(); ++s)
+    {
+        for (uint32_t d = 0; d < (uint32_t)shards[s].doc_keys_.size(); ++d)
+            refs.push_back({shards[s].doc_keys_[d], s, d});
+    }
+    std::sort(refs.begin(), refs.end(), [](const doc_ref &a, const doc_ref &b)
+              { return a.key < b.key; });
+
+    bm25_builder out(shards.empty() ? tokenize_options() : shards[0].tokenize_);
+    out.doc_keys_.reserve(n_docs);
+    out.doc_lens_.reserve(n_docs);
+    std::vector<std::vector<uint32_t>> remap(shards.size());
+    for (size_t s = 0; s < shards.size(); ++s)
+        remap[s].resize(shards[s].doc_keys_.size());
+    for (uint32_t i = 0; i < (uint32_t)refs.size(); ++i)
+    {
+        const doc_ref &r = refs[i];
+        remap[r.shard][r.doc] = i;
+        out.doc_keys_.push_back(r.key);
+        out.doc_lens_.push_back(shards[r.shard].doc_lens_[r.doc]);
+    }
+
+    for (size_t s = 0; s < shards.size(); ++s)
+    {
+        bm25_builder &sh = shards[s];
+        for (size_t t = 0; t < sh.terms_.size(); ++t)
+        {
+            auto it = out.term_ids_.find(sh.terms_[t]);
+            uint32_t tid;
+            if (it == out.term_ids_.end())
+            {
+                tid = (uint32_t)out.terms_.size();
+                out.term_ids_.emplace(sh.terms_[t], tid);
+                out.terms_.push_back(std::move(sh.terms_[t]));
+                out.postings_.emplace_back();
+            }
+            else
+            {
+                tid = it->second;
+            }
+            auto &dst = out.postings_[tid];
+            for (const auto &p : sh.postings_[t])
+                dst.emplace_back(remap[s][p.first], p.second);
+            std::vector<std::pair<uint32_t, uint32_t>>().swap(sh.postings_[t]); // 边合并边释放
+        }
+        sh = bm25_builder();
+    }
+    shards.clear();
+
+    // 同一篇文档只在一个分片里，排序后每个 doc 仍只出现一次
+    for (auto &pl : out.postings_)
+    {
+        if (!std::is_sorted(pl.begin(), pl.end()))
+            std::sort(pl.begin(), pl.end());
+    }
+    return out;
+}
+
+void bm25_builder::add_index(const bm25_index &index, const std::vector<bool> *dead)
+{
+    // 旧 doc 序号 -> 本 builder 中的序号；已删除的为 UINT32_MAX
+    const size_t n = index.doc_keys_.size();
+    std::vector<uint32_t> remap(n, UINT32_MAX);
+    for (uint32_t d = 0; d < (uint32_t)n; ++d)
+    {
+        if (dead && (*dead)[d])
+            continue;
+        remap[d] = (uint32_t)doc_keys_.size();
+        doc_keys_.push_back(index.doc_keys_[d]);
+        doc_lens_.push_back(index.doc_lens_[d]);
+    }
+
+    for (size_t t = 0; t < index.terms_.size(); ++t)
+    {
+        const bm25_term &info = index.terms_[t];
+        posting_cursor c;
+        c.base = index.postings_.data() + info.post_off;
+        c.skips = index.skips_.data() + info.skip_off;
+        c.n_blocks = info.n_blocks;
+        c.df = info.df;
+        if (info.n_blocks == 0)
+            continue;
+        c.load_block(0);
+        std::vector<std::pair<uint32_t, uint32_t>> *pl = nullptr;
+        for (c.next(); !c.done; c.next())
+        {
+            const uint32_t d = remap[c.doc];
+            if (d == UINT32_MAX)
+                continue;
+            if (!pl)
+            {
+                const std::string term(index.term_at(t));
+                auto it = term_ids_.find(term);
+                if (it == term_ids_.end())
+                {
+                    it = term_ids_.emplace(term, (uint32_t)terms_.size()).first;
+                    terms_.push_back(term);
+                    postings_.emplace_back();
+                }
+                pl = &postings_[it->second];
+            }
+            pl->emplace_back(d, c.tf);
+        }
+    }
+}
+
+bm25_index bm25_builder::build(const bm25_params &params) const
+{
+    bm25_index idx;
+    idx.params_ = params;
+    idx.tokenize_ = tokenize_;
+
+    auto st = std::make_shared<bm25_storage>();
+    st->doc_keys = doc_keys_;
+    st->doc_lens = doc_lens_;
+
+    const size_t n_docs = doc_keys_.size();
+    uint64_t total_len = 0;
+    for (uint32_t l : doc_lens_)
+        total_len += l;
+    idx.total_len_ = total_len;
+    idx.avgdl_ = n_docs ? (float)((double)total_len / (double)n_docs) : 0.0f;
+
+    st->doc_norms.resize(n_docs);
+    for (size_t d = 0; d < n_docs; ++d)
+    {
+        const float rel = idx.avgdl_ > 0.0f ? (float)doc_lens_[d] / idx.avgdl_ : 0.0f;
+        st->doc_norms[d] = params.k1 * (1.0f - params.b + params.b * rel);
+    }
+
+    // IDF：与 BM25Okapi._calc_idf 相同，负值替换为 epsilon * 平均 IDF
+    const size_t n_terms = terms_.size();
+    std::vector<double> idf(n_terms);
+    double idf_sum = 0.0;
+    for (size_t t = 0; t < n_terms; ++t)
+    {
+        const double df = (double)postings_[t].size();
+        idf[t] = std::log((double)n_docs - df + 0.5) - std::log(df + 0.5);
+        idf_sum += idf[t];
+    }
+    const double eps = n_terms ? params.epsilon * (idf_sum / (double)n_terms) : 0.0;
+    for (auto &v : idf)
+    {
+        if (v < 0.0)
+            v = eps;
+    }
+
+    // 词典按字节序排列，查询时二分查找
+    std::vector<uint32_t> order(n_terms);
+    for (uint32_t t = 0; t < n_terms; ++t)
+        order[t] = t;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+              { return terms_[a] < terms_[b]; });
+
+    st->terms.reserve(n_terms);
+    st->term_offsets.reserve(n_terms + 1);
+    st->term_offsets.push_back(0);
+
+    for (uint32_t t : order)
+    {
+        const auto &pl = postings_[t];
+        st->term_blob.insert(st->term_blob.end(), terms_[t].begin(), terms_[t].end());
+        st->term_offsets.push_back((uint32_t)st->term_blob.size());
+
+        bm25_term info{};
+        info.df = (uint32_t)pl.size();
+        info.idf = (float)idf[t];
+        info.post_off = st->postings.size();
+        info.skip_off = (uint32_t)st->skips.size();
+
+        std::vector<uint8_t> &out = st->postings;
+        float max_score = -std::numeric_limits<float>::infinity();
+        uint32_t prev = 0;
+        for (size_t i = 0; i < pl.size(); ++i)
+        {
+            if (i % k_block_size == 0)
+                st->skips.push_back({0, (uint32_t)(out.size() - info.post_off)});
+
+            const uint32_t doc = pl[i].first;
+            const uint32_t tf = pl[i].second;
+            put_varint(out, doc - prev);
+            put_varint(out, tf);
+            prev = doc;
+            st->skips.back().last_doc = doc;
+
+            info.max_tf = std::max(info.max_tf, tf);
+            max_score = std::max(max_score, term_score(info.idf, tf, st->doc_norms[doc], params.k1));
+        }
+        info.max_score = pl.empty() ? 0.0f : max_score;
+        info.post_len = (uint32_t)(out.size() - info.post_off);
+        info.n_blocks = (uint32_t)st->skips.size() - info.skip_off;
+        st->terms.push_back(info);
+    }
+
+    idx.term_blob_ = st->term_blob;
+    idx.term_offsets_ = st->term_offsets;
+    idx.terms_ = st->terms;
+    idx.postings_ = st->postings;
+    idx.skips_ = st->skips;
+    idx.doc_keys_ = st->doc_keys;
+    idx.doc_lens_ = st->doc_lens;
+    idx.doc_norms_ = st->doc_norms;
+    idx.storage_ = std::move(st);
+    return idx;
+}
+
+// ---------- index ----------
+int64_t bm25_index::find_term(const std::string &term) const
+{
+    size_t lo = 0, hi = terms_.size();
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        const char *s = term_blob_.data() + term_offsets_[mid];
+        const size_t n = term_offsets_[mid + 1] - term_offsets_[mid];
+        const int c = term.compare(0, std::string::npos, s, n);
+        if (c == 0)
+            return (int64_t)mid;
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+std::vector<bm25_hit> bm25_index::search(const std::string &query, size_t top_k) const
+{
+    return search_tokens(tokenize_zh_en(query, tokenize_), top_k);
+}
+
+std::vector<bm25_hit> bm25_index::search_tokens(const std::vector<std::string> &query_tokens, size_t top_k) const
+{
+    std::vector<bm25_hit> hits;
+    if (top_k == 0 || doc_keys_.empty())
+        return hits;
+
+    // 合并重复查询词，记录出现次数
+    std::vector<query_term> qt;
+    std::vector<int64_t> qt_ids;
+    for (const auto &tok : query_tokens)
+    {
+        const int64_t tid = find_term(tok);
+        if (tid < 0)
+            continue;
+        auto it = std::find(qt_ids.begin(), qt_ids.end(), tid);
+        if (it != qt_ids.end())
+        {
+            qt[it - qt_ids.begin()].weight += 1.0f;
+            continue;
+        }
+        const bm25_term &info = terms_[tid];
+        query_term q;
+        q.cur.base = postings_.data() + info.post_off;
+        q.cur.skips = skips_.data() + info.skip_off;
+        q.cur.n_blocks = info.n_blocks;
+        q.cur.df = info.df;
+        q.idf = info.idf;
+        q.weight = 1.0f;
+        qt.push_back(q);
+        qt_ids.push_back(tid);
+    }
+    if (qt.empty())
+        return hits;
+
+    for (size_t i = 0; i < qt.size(); ++i)
+        qt[i].ub = qt[i].weight * std::max(0.0f, terms_[qt_ids[i]].max_score);
+
+    const array_view<float> norms = doc_norms_;
+    const auto heap = maxscore_topk(qt, top_k, params_.k1, [&](uint32_t d)
+                                    { return norms[d]; }, nullptr);
+    hits.reserve(heap.size());
+    for (const auto &h : heap)
+        hits.push_back({doc_keys_[h.second], h.first});
+    return hits;
+}
+
+std::vector<bm25_hit> bm25_index::search_scored(const std::vector<bm25_scored_term> &query_terms, float avgdl,
+                                                const std::vector<bool> *dead, size_t top_k) const
+{
+    std::vector<bm25_hit> hits;
+    if (top_k == 0 || doc_keys_.empty() || avgdl <= 0.0f)
+        return hits;
+
+    // 长度归一项只与 dl 有关、随 dl 单调增；dl = 0 时最小，用它给出对任意文档都成立的上界
+    const float k1 = params_.k1, b = params_.b;
+    const float min_norm = k1 * (1.0f - b);
+    std::vector<query_term> qt;
+    for (const auto &t : query_terms)
+    {
+        const int64_t tid = find_term(t.term);
+        if (tid < 0)
+            continue;
+        const bm25_term &info = terms_[tid];
+        query_term q;
+        q.cur.base = postings_.data() + info.post_off;
+        q.cur.skips = skips_.data() + info.skip_off;
+        q.cur.n_blocks = info.n_blocks;
+        q.cur.df = info.df;
+        q.idf = t.idf;
+        q.weight = t.weight;
+        q.ub = t.weight * std::max(0.0f, term_score(t.idf, info.max_tf, min_norm, k1));
+        qt.push_back(q);
+    }
+    if (qt.empty())
+        return hits;
+
+    // 与 build() 相同的式子，只是 avgdl 换成全局值
+    const array_view<uint32_t> lens = doc_lens_;
+    const auto heap = maxscore_topk(qt, top_k, k1, [&](uint32_t d)
+                                    {
+                                        const float rel = (float)lens[d] / avgdl;
+                                        return k1 * (1.0f - b + b * rel); }, dead);
+    hits.reserve(heap.size());
+    for (const auto &h : heap)
+        hits.push_back({doc_keys_[h.second], h.first});
+    return hits;
+}
+
+std::string_view bm25_index::term_at(size_t i) const
+{
+    return std::string_view(term_blob_.data() + term_offsets_[i], term_offsets_[i + 1] - term_offsets_[i]);
+}
+
+// ---------- on-disk format ----------
+bool bm25_index::save(const std::string &path, std::string &err) const
+{
+    bm25_meta meta{};
+    meta.n_docs = (uint32_t)doc_keys_.size();
+    meta.n_terms = (uint32_t)terms_.size();
+    meta.avgdl = avgdl_;
+    meta.k1 = params_.k1;
+    meta.b = params_.b;
+    meta.epsilon = params_.epsilon;
+    meta.total_len = total_len_;
+
+    index_file_writer w;
+    w.add("META", &meta, sizeof(meta));
+    w.add("TERMSTR", term_blob_.data(), term_blob_.size());
+    w.add("TERMOFF", term_offsets_.data(), term_offsets_.size() * sizeof(uint32_t));
+    w.add("TERMS", terms_.data(), terms_.size() * sizeof(bm25_term));
+    w.add("POSTINGS", postings_.data(), postings_.size());
+    w.add("SKIPS", skips_.data(), skips_.size() * sizeof(bm25_skip));
+    w.add("DOCKEYS", doc_keys_.data(), doc_keys_.size() * sizeof(int64_t));
+    w.add("DOCLENS", doc_lens_.data(), doc_lens_.size() * sizeof(uint32_t));
+    w.add("DOCNORMS", doc_norms_.data(), doc_norms_.size() * sizeof(float));
+    // 默认分词不写这一段，旧索引与新索引逐字节相同
+    const uint32_t tok_mode = (uint32_t)tokenize_.cjk;
+    if (tokenize_.cjk != tokenize_cjk::unigram)
+        w.add("TOKENIZE", &tok_mode, sizeof(tok_mode));
+    return w.write(path, k_index_kind_bm25, err);
+}
+
+bool bm25_index::open(const std::string &path, std::string &err)
+{
+    index_file_reader r;
+    if (!r.open(path, k_index_kind_bm25, err))
+        return false;
+
+    array_view<bm25_meta> meta;
+    bm25_index idx;
+    if (!r.get("META", meta, err) || meta.size() != 1 ||
+        !r.get("TERMSTR", idx.term_blob_, err) ||
+        !r.get("TERMOFF", idx.term_offsets_, err) ||
+        !r.get("TERMS", idx.terms_, err) ||
+        !r.get("POSTINGS", idx.postings_, err) ||
+        !r.get("SKIPS", idx.skips_, err) ||
+        !r.get("DOCKEYS", idx.doc_keys_, err) ||
+        !r.get("DOCLENS", idx.doc_lens_, err) ||
+        !r.get("DOCNORMS", idx.doc_norms_, err))
+    {
+        if (err.empty())
+            err = "bad META section";
+        return false;
+    }
+
+    const bm25_meta &m = meta[0];
+    if (idx.terms_.size() != m.n_terms || idx.term_offsets_.size() != (size_t)m.n_terms + 1 ||
+        idx.doc_keys_.size() != m.n_docs || idx.doc_lens_.size() != m.n_docs || idx.doc_norms_.size() != m.n_docs ||
+        idx.term_offsets_[m.n_terms] != idx.term_blob_.size())
+    {
+        err = "inconsistent section sizes: " + path;
+        return false;
+    }
+
+    idx.params_.k1 = m.k1;
+    idx.params_.b = m.b;
+    idx.params_.epsilon = m.epsilon;
+    array_view<uint32_t> tok;
+    std::string tok_err; // 可选区段，缺省为单字切分
+    if (r.get("TOKENIZE", tok, tok_err) && !tok.empty())
+    {
+        if (tok[0] > (uint32_t)tokenize_cjk::both)
+        {
+            err = "unknown tokenizer mode in " + path;
+            return false;
+        }
+        idx.tokenize_.cjk = (tokenize_cjk)tok[0];
+    }
+    idx.avgdl_ = m.avgdl;
+    idx.total_len_ = m.total_len;
+
+    // 词典和文档表每次查询都会碰到，提前读进 page cache；倒排按需缺页
+    auto mapping = r.mapping();
+    const uint8_t *base = mapping->data();
+    mapping->advise_willneed((size_t)((const uint8_t *)idx.term_blob_.data() - base), idx.term_blob_.size());
+    mapping->advise_willneed((size_t)((const uint8_t *)idx.terms_.data() - base), idx.terms_.size() * sizeof(bm25_term));
+    mapping->advise_willneed((size_t)((const uint8_t *)idx.doc_norms_.data() - base), idx.doc_norms_.size() * sizeof(float));
+
+    idx.storage_ = mapping;
+    *this = std::move(idx);
+    return true;
+}
+
+bool bm25_index::verify(std::string &err) const
+{
+    for (size_t t = 0; t < terms_.size(); ++t)
+    {
+        const bm25_term &info = terms_[t];
+        if (term_offsets_[t] > term_offsets_[t + 1] ||
+            info.post_off > postings_.size() || info.post_len > postings_.size() - info.post_off ||
+            info.skip_off > skips_.size() || info.n_blocks > skips_.size() - info.skip_off ||
+            info.n_blocks != (info.df + k_block_size - 1) / k_block_size)
+        {
+            err = "corrupt term entry " + std::to_string(t);
+            return false;
+        }
+        for (uint32_t b = 0; b < info.n_blocks; ++b)
+        {
+            const bm25_skip &sk = skips_[info.skip_off + b];
+            if (sk.offset >= info.post_len || sk.last_doc >= doc_keys_.size())
+            {
+                err = "corrupt skip entry for term " + std::to_string(t);
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,174 @@
+// src/bm25_index.h
+// C++ BM25 检索：替代 python/BM25.py 里 pickle 持久化的 rank_bm25.BM25Okapi。
+//
+// - 打分公式与 BM25Okapi 一致（k1/b/epsilon 以及负 IDF 的处理方式相同），
+//   分词使用同一套 tokenize_zh_en，分数可以和 Python 侧直接比较。
+// - 倒排表按 doc 序号做差分 + varint 压缩，每 128 条一个块，块首带跳表项。
+// - 构建时预计算 IDF、每篇文档的长度归一项、每个词的最大贡献，
+//   查询用 MaxScore 做 top-k，不需要对全部文档逐个打分。
+// - save() 写成 index_file 格式；open() 直接 mmap，所有数组都是指向映射区的视图。
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "index_file.h"
+#include "text_tokenize.h"
+
+struct bm25_params
+{
+    float k1 = 1.5f;
+    float b = 0.75f;
+    float epsilon = 0.25f;
+};
+
+struct bm25_hit
+{
+    int64_t doc_key = 0; // SQLite documents.id
+    float score = 0.0f;
+};
+
+// 每个倒排块的跳表项
+struct bm25_skip
+{
+    uint32_t last_doc; // 块内最后一个 doc 序号
+    uint32_t offset;   // 块在该词倒排数据中的字节偏移
+};
+
+// 词典项：定长 POD，方便整块落盘
+struct bm25_term
+{
+    uint32_t df;        // 文档频率
+    uint32_t max_tf;    // 倒排中的最大词频
+    float idf;          // 已按 epsilon 规则修正后的 IDF
+    float max_score;    // 单次出现时该词对任一文档的最大贡献（MaxScore 上界）
+    uint64_t post_off;  // 倒排数据在 postings 区的起始偏移
+    uint32_t post_len;  // 倒排数据字节数
+    uint32_t skip_off;  // 第一个跳表项的下标
+    uint32_t n_blocks;  // 跳表项个数
+    uint32_t reserved;
+};
+
+static_assert(sizeof(bm25_skip) == 8, "bm25_skip layout");
+static_assert(sizeof(bm25_term) == 40, "bm25_term layout");
+
+// 落盘的 META 区段
+struct bm25_meta
+{
+    uint32_t n_docs;
+    uint32_t n_terms;
+    float avgdl;
+    float k1;
+    float b;
+    float epsilon;
+    uint64_t total_len;
+};
+
+// 分段检索时由调用方按全局统计算好的查询词
+struct bm25_scored_term
+{
+    std::string term;
+    float idf = 0.0f;
+    float weight = 1.0f; // 查询中出现次数
+};
+
+class bm25_index;
+
+class bm25_builder
+{
+public:
+    bm25_builder() = default;
+    // 分词方式会写进索引，查询时按同样方式切分
+    explicit bm25_builder(const tokenize_options &tokenize) : tokenize_(tokenize) {}
+
+    // doc_key 通常是 documents.id；文档按加入顺序编号
+    void add_document(int64_t doc_key, const std::string &text);
+    void add_tokens(int64_t doc_key, const std::vector<std::string> &tokens);
+    void add_tokens(int64_t doc_key, const std::vector<std::string_view> &tokens);
+
+    size_t size() const { return doc_keys_.size(); }
+    const tokenize_options &tokenize() const { return tokenize_; }
+
+    // 合并多线程各自构建的分片：文档按 doc_key 重新编号，结果与按 doc_key 顺序逐篇 add 完全相同，
+    // 所以 build() 出来的索引与分片数、文档到达顺序无关。doc_key 不能跨分片重复；shards 会被清空
+    static bm25_builder merge_shards(std::vector<bm25_builder> &shards);
+
+    // 把已有索引里未删除的文档（dead 按 doc 序号标记，可为空）解码回来追加进本 builder，段合并用
+    void add_index(const bm25_index &index, const std::vector<bool> *dead = nullptr);
+
+    bm25_index build(const bm25_params &params = bm25_params()) const;
+
+private:
+    template <typename Tokens>
+    void add_terms(int64_t doc_key, const Tokens &tokens);
+
+    tokenize_options tokenize_;
+    token_arena arena_; // add_document 复用的分词缓冲
+    std::string key_;   // 词典查找用，避免每个词分配一次
+    std::unordered_map<std::string, uint32_t> term_ids_;
+    std::vector<std::string> terms_;
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> postings_; // term -> (doc, tf)，doc 递增
+    std::vector<int64_t> doc_keys_;
+    std::vector<uint32_t> doc_lens_;
+};
+
+class bm25_index
+{
+public:
+    size_t size() const { return doc_keys_.size(); }
+    size_t n_terms() const { return terms_.size(); }
+    float avgdl() const { return avgdl_; }
+    const bm25_params &params() const { return params_; }
+    const tokenize_options &tokenize() const { return tokenize_; }
+
+    // 与 python/BM25.py::search 相同的语义：返回 (documents.id, score)，按分数降序；
+    // 不包含任何查询词的文档不会出现在结果里
+    std::vector<bm25_hit> search(const std::string &query, size_t top_k) const;
+    std::vector<bm25_hit> search_tokens(const std::vector<std::string> &query_tokens, size_t top_k) const;
+
+    // 词典查找；不存在返回 -1
+    int64_t find_term(const std::string &term) const;
+
+    // ---- 分段索引（bm25_segments）用 ----
+    uint64_t total_len() const { return total_len_; }
+    array_view<int64_t> doc_keys() const { return doc_keys_; }
+    std::string_view term_at(size_t i) const; // 第 i 个词（字节序）
+    uint32_t term_df(size_t i) const { return terms_[i].df; }
+    // 用调用方给出的全局 idf 和 avgdl 打分（长度归一项现算），跳过 dead 中标记的 doc 序号；
+    // 单段且无删除时与 search_tokens 的结果相同
+    std::vector<bm25_hit> search_scored(const std::vector<bm25_scored_term> &query_terms, float avgdl,
+                                        const std::vector<bool> *dead, size_t top_k) const;
+
+    bool save(const std::string &path, std::string &err) const;
+    // mmap 打开；只校验文件头和各区段长度，O(1)，不读倒排
+    bool open(const std::string &path, std::string &err);
+    // 完整校验所有偏移（bm25_cli --verify 使用）
+    bool verify(std::string &err) const;
+
+private:
+    friend class bm25_builder;
+
+    bm25_params params_;
+    tokenize_options tokenize_;
+    float avgdl_ = 0.0f;
+    uint64_t total_len_ = 0;
+
+    // 持有底层内存：构建得到的 vector 集合，或 index_file 的映射
+    std::shared_ptr<const void> storage_;
+
+    // 词典：按字典序排列，term_offsets_[i]..term_offsets_[i+1] 是第 i 个词在 term_blob_ 中的字节
+    array_view<char> term_blob_;
+    array_view<uint32_t> term_offsets_;
+    array_view<bm25_term> terms_;
+
+    array_view<uint8_t> postings_;
+    array_view<bm25_skip> skips_;
+
+    array_view<int64_t> doc_keys_;  // doc 序号 -> documents.id
+    array_view<uint32_t> doc_lens_; // 文档 token 数
+    array_view<float> doc_norms_;   // k1 * (1 - b + b * dl / avgdl)
+};
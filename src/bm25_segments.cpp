@@ -0,0 +1,491 @@
+// src/bm25_segments.cpp
+#include "bm25_segments.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <queue>
+#include <sstream>
+#include <unordered_set>
+
+#include "json_lite.h"
+#include "text_tokenize.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+const char *const k_manifest = "MANIFEST";
+
+std::string segment_file_name(uint64_t n)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "seg_%06llu.bm25", (unsigned long long)n);
+    return buf;
+}
+
+std::string join_path(const std::string &dir, const std::string &file)
+{
+    return (fs::u8path(dir) / fs::u8path(file)).u8string();
+}
+
+// doc_key 所在的 doc 序号；不存在返回 -1。段都是按 doc_key 升序构建的（merge_shards / 按 id 顺序 add）
+int64_t find_doc(const array_view<int64_t> &keys, int64_t key)
+{
+    const int64_t *it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it != keys.end() && *it == key)
+        return it - keys.begin();
+    return -1;
+}
+} // namespace
+
+bool bm25_segments::open(const std::string &path, std::string &err, bool create)
+{
+    close();
+    std::error_code ec;
+    const fs::path p = fs::u8path(path);
+    if (!fs::is_directory(p, ec) && !create)
+    {
+        auto s = std::make_shared<segment>();
+        if (!s->index.open(path, err))
+            return false;
+        segs_.push_back(std::move(s));
+        refresh_stats();
+        return true;
+    }
+
+    if (create)
+        fs::create_directories(p, ec);
+    dir_ = path;
+    const std::string manifest = join_path(dir_, k_manifest);
+    std::ifstream f(fs::u8path(manifest), std::ios::binary);
+    if (!f)
+        return true; // 新目录：空索引
+
+    std::stringstream ss;
+    ss << f.rdbuf();
+    json_value root;
+    if (!json_parse(ss.str(), root, err) || !root.is_object())
+    {
+        err = "bad manifest " + manifest + (err.empty() ? "" : ": " + err);
+        dir_.clear();
+        return false;
+    }
+    next_seg_ = (uint64_t)root.get_number("next_seg", 1);
+    const json_value *segs = root.find("segments");
+    if (segs && segs->is_array())
+    {
+        for (const auto &js : segs->arr)
+        {
+            auto s = std::make_shared<segment>();
+            s->file = js.get_string("file");
+            if (s->file.empty() || !s->index.open(join_path(dir_, s->file), err))
+            {
+                err = "failed to open segment " + s->file + (err.empty() ? "" : ": " + err);
+                close();
+                return false;
+            }
+            const json_value *dead = js.find("deleted");
+            if (dead && dead->is_array())
+            {
+                for (const auto &k : dead->arr)
+                    s->tombstones.push_back((int64_t)k.num);
+            }
+            std::sort(s->tombstones.begin(), s->tombstones.end());
+            mark_dead(*s);
+            if (!segs_.empty() && s->index.tokenize().cjk != segs_[0]->index.tokenize().cjk)
+            {
+                err = "segment " + s->file + " uses a different tokenizer mode";
+                close();
+                return false;
+            }
+            segs_.push_back(std::move(s));
+        }
+    }
+    refresh_stats();
+    return true;
+}
+
+void bm25_segments::reset(bm25_index index)
+{
+    close();
+    auto s = std::make_shared<segment>();
+    s->index = std::move(index);
+    segs_.push_back(std::move(s));
+    refresh_stats();
+}
+
+void bm25_segments::close()
+{
+    dir_.clear();
+    next_seg_ = 1;
+    segs_.clear();
+    refresh_stats();
+}
+
+size_t bm25_segments::size() const
+{
+    size_t n = 0;
+    for (const auto &s : segs_)
+        n += s->index.size() - s->n_dead;
+    return n;
+}
+
+size_t bm25_segments::n_deleted() const
+{
+    size_t n = 0;
+    for (const auto &s : segs_)
+        n += s->n_dead;
+    return n;
+}
+
+tokenize_options bm25_segments::tokenize() const
+{
+    return segs_.empty() ? tokenize_options() : segs_[0]->index.tokenize();
+}
+
+int64_t bm25_segments::max_key() const
+{
+    int64_t k = 0;
+    for (const auto &s : segs_)
+    {
+        for (int64_t key : s->index.doc_keys())
+            k = std::max(k, key);
+    }
+    return k;
+}
+
+void bm25_segments::mark_dead(segment &s) const
+{
+    const array_view<int64_t> keys = s.index.doc_keys();
+    s.dead.assign(keys.size(), false);
+    s.n_dead = 0;
+    for (int64_t k : s.tombstones)
+    {
+        const int64_t d = find_doc(keys, k);
+        if (d >= 0 && !s.dead[(size_t)d])
+        {
+            s.dead[(size_t)d] = true;
+            ++s.n_dead;
+        }
+    }
+}
+
+void bm25_segments::refresh_stats()
+{
+    n_docs_all_ = 0;
+    uint64_t total_len = 0;
+    for (const auto &s : segs_)
+    {
+        n_docs_all_ += s->index.size();
+        total_len += s->index.total_len();
+    }
+    avgdl_ = n_docs_all_ ? (float)((double)total_len / (double)n_docs_all_) : 0.0f;
+    params_ = segs_.empty() ? bm25_params() : segs_.front()->index.params();
+
+    // 与 bm25_builder::build 相同的 epsilon 规则，只是平均 IDF 取所有段词典的并集：按字节序多路归并
+    eps_idf_ = 0.0;
+    // 单段无墓碑时 search_tokens 直接走段内的预计算 idf，用不到；单段有墓碑仍要算
+    if (segs_.empty() || (segs_.size() == 1 && segs_[0]->n_dead == 0))
+        return;
+    using cursor = std::pair<std::string_view, size_t>; // (当前词, 段)
+    auto greater = [](const cursor &a, const cursor &b)
+    { return a.first > b.first; };
+    std::priority_queue<cursor, std::vector<cursor>, decltype(greater)> heap(greater);
+    std::vector<size_t> pos(segs_.size(), 0);
+    for (size_t i = 0; i < segs_.size(); ++i)
+    {
+        if (segs_[i]->index.n_terms())
+            heap.push({segs_[i]->index.term_at(0), i});
+    }
+    const double n = (double)n_docs_all_;
+    double idf_sum = 0.0;
+    uint64_t n_terms = 0;
+    while (!heap.empty())
+    {
+        const std::string_view term = heap.top().first;
+        double df = 0.0;
+        while (!heap.empty() && heap.top().first == term)
+        {
+            const size_t i = heap.top().second;
+            heap.pop();
+            df += segs_[i]->index.term_df(pos[i]);
+            if (++pos[i] < segs_[i]->index.n_terms())
+                heap.push({segs_[i]->index.term_at(pos[i]), i});
+        }
+        idf_sum += std::log(n - df + 0.5) - std::log(df + 0.5);
+        ++n_terms;
+    }
+    eps_idf_ = n_terms ? params_.epsilon * (idf_sum / (double)n_terms) : 0.0;
+}
+
+std::vector<bm25_hit> bm25_segments::search(const std::string &query, size_t top_k) const
+{
+    return search_tokens(tokenize_zh_en(query, tokenize()), top_k);
+}
+
+std::vector<bm25_hit> bm25_segments::search_tokens(const std::vector<std::string> &query_tokens, size_t top_k) const
+{
+    if (segs_.empty() || top_k == 0)
+        return {};
+    // 单段无墓碑：全局统计就是段内统计，直接用构建期预计算好的 idf 与长度归一
+    if (segs_.size() == 1 && segs_[0]->n_dead == 0)
+        return segs_[0]->index.search_tokens(query_tokens, top_k);
+
+    std::vector<bm25_scored_term> terms;
+    for (const auto &tok : query_tokens)
+    {
+        auto it = std::find_if(terms.begin(), terms.end(), [&](const bm25_scored_term &t)
+                               { return t.term == tok; });
+        if (it != terms.end())
+            it->weight += 1.0f;
+        else
+            terms.push_back({tok, 0.0f, 1.0f});
+    }
+    const double n = (double)n_docs_all_;
+    std::vector<bm25_scored_term> scored;
+    for (auto &t : terms)
+    {
+        double df = 0.0;
+        for (const auto &s : segs_)
+        {
+            const int64_t tid = s->index.find_term(t.term);
+            if (tid >= 0)
+                df += s->index.term_df((size_t)tid);
+        }
+        if (df == 0.0)
+            continue;
+        double idf = std::log(n - df + 0.5) - std::log(df + 0.5);
+        if (idf < 0.0)
+            idf = eps_idf_;
+        t.idf = (float)idf;
+        scored.push_back(std::move(t));
+    }
+    if (scored.empty())
+        return {};
+
+    std::vector<bm25_hit> hits;
+    for (const auto &s : segs_)
+    {
+        const std::vector<bm25_hit> part = s->index.search_scored(scored, avgdl_, s->n_dead ? &s->dead : nullptr, top_k);
+        hits.insert(hits.end(), part.begin(), part.end());
+    }
+    std::sort(hits.begin(), hits.end(), [](const bm25_hit &a, const bm25_hit &b)
+              { return a.score != b.score ? a.score > b.score : a.doc_key < b.doc_key; });
+    if (hits.size() > top_k)
+        hits.resize(top_k);
+    return hits;
+}
+
+bool bm25_segments::write_manifest(std::string &err) const
+{
+    json_value root = json_value::make_object();
+    root.set("version", json_value::make_number(1));
+    root.set("next_seg", json_value::make_number((double)next_seg_));
+    json_value arr = json_value::make_array();
+    for (const auto &s : segs_)
+    {
+        json_value js = json_value::make_object();
+        js.set("file", json_value::make_string(s->file));
+        js.set("n_docs", json_value::make_number((double)s->index.size()));
+        json_value dead = json_value::make_array();
+        for (int64_t k : s->tombstones)
+            dead.arr.push_back(json_value::make_number((double)k));
+        js.set("deleted", std::move(dead));
+        arr.arr.push_back(std::move(js));
+    }
+    root.set("segments", std::move(arr));
+
+    const std::string path = join_path(dir_, k_manifest);
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(fs::u8path(tmp), std::ios::binary | std::ios::trunc);
+        const std::string text = json_dump(root) + "\n";
+        if (!f || !f.write(text.data(), (std::streamsize)text.size()) || !f.flush())
+        {
+            err = "failed to write " + tmp;
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(fs::u8path(tmp), fs::u8path(path), ec);
+    if (ec)
+    {
+        err = "failed to replace " + path + ": " + ec.message();
+        return false;
+    }
+    return true;
+}
+
+void bm25_segments::remove_unreferenced() const
+{
+    // 已被合并掉的段；仍被别的进程映射时（Windows 上）删除会失败，留到下次
+    std::unordered_set<std::string> live;
+    for (const auto &s : segs_)
+        live.insert(s->file);
+    std::error_code ec;
+    for (fs::directory_iterator it(fs::u8path(dir_), ec), end; !ec && it != end; it.increment(ec))
+    {
+        const std::string name = it->path().filename().u8string();
+        if (name.rfind("seg_", 0) == 0 && name.size() > 5 && name.compare(name.size() - 5, 5, ".bm25") == 0 &&
+            !live.count(name))
+        {
+            std::error_code rm_ec;
+            fs::remove(it->path(), rm_ec);
+        }
+    }
+}
+
+bool bm25_segments::add_segment(const bm25_builder &builder, const std::vector<int64_t> &deleted_keys, std::string &err)
+{
+    if (dir_.empty())
+    {
+        err = "add_segment needs a segment directory";
+        return false;
+    }
+
+    if (!segs_.empty() && builder.size() && builder.tokenize().cjk != tokenize().cjk)
+    {
+        err = "new segment uses a different tokenizer mode than " + dir_;
+        return false;
+    }
+
+    std::shared_ptr<segment> added;
+    if (builder.size())
+    {
+        added = std::make_shared<segment>();
+        added->file = segment_file_name(next_seg_);
+        if (!builder.build(params_).save(join_path(dir_, added->file), err) ||
+            !added->index.open(join_path(dir_, added->file), err))
+            return false;
+        mark_dead(*added);
+    }
+
+    // 墓碑只落在确实含有该 doc_key 的段上；用副本修改，MANIFEST 写成功后再替换，失败时内存状态不变
+    std::vector<std::shared_ptr<segment>> next = segs_;
+    for (auto &s : next)
+    {
+        std::vector<int64_t> hit;
+        for (int64_t k : deleted_keys)
+        {
+            if (find_doc(s->index.doc_keys(), k) >= 0 && !std::binary_search(s->tombstones.begin(), s->tombstones.end(), k))
+                hit.push_back(k);
+        }
+        if (hit.empty())
+            continue;
+        auto copy = std::make_shared<segment>(*s);
+        copy->tombstones.insert(copy->tombstones.end(), hit.begin(), hit.end());
+        std::sort(copy->tombstones.begin(), copy->tombstones.end());
+        copy->tombstones.erase(std::unique(copy->tombstones.begin(), copy->tombstones.end()), copy->tombstones.end());
+        mark_dead(*copy);
+        s = std::move(copy);
+    }
+    if (added)
+        next.push_back(added);
+
+    std::swap(segs_, next);
+    const uint64_t prev_next_seg = next_seg_;
+    if (added)
+        ++next_seg_;
+    if (!write_manifest(err))
+    {
+        std::swap(segs_, next);
+        next_seg_ = prev_next_seg;
+        return false;
+    }
+    refresh_stats();
+    return true;
+}
+
+bool bm25_segments::rewrite(const std::vector<size_t> &which, std::string &err)
+{
+    std::vector<bm25_builder> parts(which.size(), bm25_builder(tokenize()));
+    for (size_t j = 0; j < which.size(); ++j)
+    {
+        const segment &s = *segs_[which[j]];
+        parts[j].add_index(s.index, s.n_dead ? &s.dead : nullptr);
+    }
+    const bm25_builder merged = bm25_builder::merge_shards(parts);
+
+    std::shared_ptr<segment> out;
+    if (merged.size())
+    {
+        out = std::make_shared<segment>();
+        out->file = segment_file_name(next_seg_);
+        if (!merged.build(params_).save(join_path(dir_, out->file), err) ||
+            !out->index.open(join_path(dir_, out->file), err))
+            return false;
+        mark_dead(*out);
+    }
+
+    std::vector<std::shared_ptr<segment>> next;
+    for (size_t i = 0; i < segs_.size(); ++i)
+    {
+        if (std::find(which.begin(), which.end(), i) == which.end())
+            next.push_back(segs_[i]);
+    }
+    if (out)
+        next.push_back(out);
+
+    std::swap(segs_, next);
+    const uint64_t prev_next_seg = next_seg_;
+    if (out)
+        ++next_seg_;
+    if (!write_manifest(err))
+    {
+        std::swap(segs_, next);
+        next_seg_ = prev_next_seg;
+        return false;
+    }
+    refresh_stats();
+    remove_unreferenced();
+    return true;
+}
+
+bool bm25_segments::merge(const bm25_merge_policy &policy, size_t &merged, std::string &err)
+{
+    merged = 0;
+    if (dir_.empty())
+        return true;
+
+    // 1) 墓碑过多的段单独重写，把删除真正清掉
+    for (size_t i = 0; i < segs_.size();)
+    {
+        const segment &s = *segs_[i];
+        if (s.n_dead && (float)s.n_dead > policy.max_deleted_ratio * (float)s.index.size())
+        {
+            if (!rewrite({i}, err))
+                return false;
+            ++merged;
+            continue; // rewrite 把结果放到末尾，i 现在指向下一个段
+        }
+        ++i;
+    }
+
+    // 2) 段太多时合并最小的几个；大段很少参与，单次入库的代价与总量无关
+    while (segs_.size() > std::max<size_t>(policy.max_segments, 1))
+    {
+        std::vector<size_t> order(segs_.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                  { return segs_[a]->index.size() - segs_[a]->n_dead < segs_[b]->index.size() - segs_[b]->n_dead; });
+        order.resize(std::min(order.size(), std::max<size_t>(policy.merge_factor, 2)));
+        if (!rewrite(order, err))
+            return false;
+        merged += order.size();
+    }
+    return true;
+}
+
+bool bm25_segments::merge_all(std::string &err)
+{
+    if (dir_.empty() || (segs_.size() <= 1 && n_deleted() == 0))
+        return true;
+    std::vector<size_t> all(segs_.size());
+    for (size_t i = 0; i < all.size(); ++i)
+        all[i] = i;
+    return rewrite(all, err);
+}
@@ -0,0 +1,80 @@
+// src/bm25_segments.h
+// 分段 BM25：入库不再每次整表重建，而是把新增/改动的文档写成一个小段，旧版本用墓碑标记删除，段在之后合并。
+//
+// - 目录布局：MANIFEST（JSON，记录段文件和每段的墓碑 doc_key）+ 若干 seg_<n>.bm25（普通 bm25_index 文件）。
+//   MANIFEST 先写临时文件再 rename，读者要么看到旧的、要么看到新的一组段；被合并掉的段文件随后删除。
+// - 打分用全局统计：N、avgdl、每个查询词的 df 都按所有段求和，负 IDF 的 epsilon 规则用所有段的词典并集求平均。
+//   与 Lucene 一样，墓碑文档在合并前仍计入这些统计（只是不会被返回），合并后与整表重建的分数完全一致。
+// - 也可以直接打开单个 bm25_index 文件（或内存里建好的索引），此时就是一个没有墓碑的段。
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bm25_index.h"
+
+struct bm25_merge_policy
+{
+    size_t max_segments = 8;        // 段数超过它就合并最小的 merge_factor 个
+    size_t merge_factor = 4;
+    float max_deleted_ratio = 0.3f; // 某段墓碑比例超过它就单独重写
+};
+
+class bm25_segments
+{
+public:
+    // 打开段目录（没有 MANIFEST 时视为空索引，create 为 true 时建目录），或单个 bm25_index 文件
+    bool open(const std::string &path, std::string &err, bool create = false);
+    // 单段、无墓碑（rag_pipeline 现场建索引时用）
+    void reset(bm25_index index);
+    void close();
+
+    bool is_dir() const { return !dir_.empty(); }
+    size_t n_segments() const { return segs_.size(); }
+    size_t size() const; // 未删除的文档数
+    size_t n_deleted() const;
+    // 所有段（含墓碑）里最大的 doc_key；documents.id 自增不复用，大于它的行都还没进索引
+    int64_t max_key() const;
+    // 各段共用的分词方式（空索引时为默认）；查询按它切分
+    tokenize_options tokenize() const;
+
+    // 与 bm25_index::search 相同的语义与返回形式（同分按 doc_key 升序）
+    std::vector<bm25_hit> search(const std::string &query, size_t top_k) const;
+    std::vector<bm25_hit> search_tokens(const std::vector<std::string> &query_tokens, size_t top_k) const;
+
+    // ---- 写入（只对段目录有效；调用方负责同一目录只有一个写者） ----
+    // 把 builder 写成新段，并给 deleted_keys 中仍在旧段里的文档打墓碑；builder 为空时只记墓碑
+    bool add_segment(const bm25_builder &builder, const std::vector<int64_t> &deleted_keys, std::string &err);
+    // 按策略合并一轮；没有需要合并的段时什么都不做。merged 返回本轮重写的段数
+    bool merge(const bm25_merge_policy &policy, size_t &merged, std::string &err);
+    // 合并成一个段并清掉全部墓碑
+    bool merge_all(std::string &err);
+
+private:
+    struct segment
+    {
+        std::string file; // 段目录下的文件名；单文件模式下为空
+        bm25_index index;
+        std::vector<int64_t> tombstones; // 升序
+        std::vector<bool> dead;          // 按 doc 序号
+        size_t n_dead = 0;
+    };
+
+    void mark_dead(segment &s) const;
+    void refresh_stats();
+    bool write_manifest(std::string &err) const;
+    bool rewrite(const std::vector<size_t> &which, std::string &err);
+    void remove_unreferenced() const;
+
+    std::string dir_;
+    uint64_t next_seg_ = 1;
+    std::vector<std::shared_ptr<segment>> segs_;
+
+    // 全局统计（含墓碑文档）
+    uint64_t n_docs_all_ = 0;
+    float avgdl_ = 0.0f;
+    double eps_idf_ = 0.0;  // epsilon * 平均 IDF
+    bm25_params params_;
+};
@@ -0,0 +1,63 @@
+// src/bounded_queue.h
+// 多生产者/多消费者的有界队列：满时 push 阻塞，给流水线的上游施加背压，内存占用不随输入规模增长。
+// close() 之后 push 直接丢弃，pop 取完剩余元素后返回 false。
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+template <class T>
+class bounded_queue
+{
+public:
+    explicit bounded_queue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+    bounded_queue(const bounded_queue &) = delete;
+    bounded_queue &operator=(const bounded_queue &) = delete;
+
+    // 返回 false 表示队列已关闭、元素被丢弃
+    bool push(T v)
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_full_.wait(lk, [&] { return closed_ || items_.size() < capacity_; });
+        if (closed_)
+            return false;
+        items_.push_back(std::move(v));
+        lk.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T &out)
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_empty_.wait(lk, [&] { return closed_ || !items_.empty(); });
+        if (items_.empty())
+            return false;
+        out = std::move(items_.front());
+        items_.pop_front();
+        lk.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    std::mutex mtx_;
+    std::condition_variable not_full_, not_empty_;
+    std::deque<T> items_;
+    bool closed_ = false;
+};
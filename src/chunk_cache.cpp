@@ -0,0 +1,94 @@
+// src/chunk_cache.cpp
+#include "chunk_cache.h"
+
+namespace
+{
+// 粗略的单项内存开销：字符串本身 + 节点/哈希表/shared_ptr 的固定部分
+inline size_t row_cost(const evidence_row &r)
+{
+    return r.text.size() + r.title.size() + 128;
+}
+} // namespace
+
+chunk_cache::chunk_cache(size_t capacity_bytes, size_t n_shards)
+    : capacity_(capacity_bytes), shards_(n_shards ? n_shards : 1)
+{
+    shard_capacity_ = capacity_ / shards_.size();
+}
+
+std::shared_ptr<const evidence_row> chunk_cache::get(int64_t id)
+{
+    shard &s = shard_for(id);
+    std::lock_guard<std::mutex> lk(s.mtx);
+    auto it = s.map.find(id);
+    if (it == s.map.end())
+    {
+        ++s.misses;
+        return nullptr;
+    }
+    ++s.hits;
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    return it->second->row;
+}
+
+void chunk_cache::put(std::shared_ptr<const evidence_row> row)
+{
+    if (!row)
+        return;
+    const size_t cost = row_cost(*row);
+    if (cost > shard_capacity_)
+        return; // 单项比整个分片还大，不缓存
+
+    shard &s = shard_for(row->id);
+    std::lock_guard<std::mutex> lk(s.mtx);
+    auto it = s.map.find(row->id);
+    if (it != s.map.end())
+    {
+        s.bytes -= it->second->cost;
+        s.lru.erase(it->second);
+        s.map.erase(it);
+    }
+
+    const int64_t id = row->id;
+    s.lru.push_front({std::move(row), cost});
+    s.map.emplace(id, s.lru.begin());
+    s.bytes += cost;
+    ++s.inserts;
+
+    while (s.bytes > shard_capacity_ && !s.lru.empty())
+    {
+        const entry &victim = s.lru.back();
+        s.bytes -= victim.cost;
+        s.map.erase(victim.row->id);
+        s.lru.pop_back();
+        ++s.evictions;
+    }
+}
+
+void chunk_cache::clear()
+{
+    for (auto &s : shards_)
+    {
+        std::lock_guard<std::mutex> lk(s.mtx);
+        s.lru.clear();
+        s.map.clear();
+        s.bytes = 0;
+    }
+}
+
+chunk_cache_stats chunk_cache::stats() const
+{
+    chunk_cache_stats st;
+    st.capacity = capacity_;
+    for (const auto &s : shards_)
+    {
+        std::lock_guard<std::mutex> lk(s.mtx);
+        st.hits += s.hits;
+        st.misses += s.misses;
+        st.inserts += s.inserts;
+        st.evictions += s.evictions;
+        st.entries += s.map.size();
+        st.bytes += s.bytes;
+    }
+    return st;
+}
@@ -0,0 +1,64 @@
+// src/chunk_cache.h
+// 证据块的内存缓存：按 documents.id 缓存正文与标题，按字节数限容，LRU 淘汰。
+// 分成若干分片，各分片一把锁，多个工作线程（各自持有 evidence_store）可以共用同一个缓存。
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "evidence_store.h"
+
+struct chunk_cache_stats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t capacity = 0;
+};
+
+class chunk_cache
+{
+public:
+    explicit chunk_cache(size_t capacity_bytes, size_t n_shards = 16);
+
+    chunk_cache(const chunk_cache &) = delete;
+    chunk_cache &operator=(const chunk_cache &) = delete;
+
+    // 未命中返回 nullptr；命中会把该项移到 LRU 头部
+    std::shared_ptr<const evidence_row> get(int64_t id);
+    void put(std::shared_ptr<const evidence_row> row);
+    void clear();
+
+    chunk_cache_stats stats() const;
+
+private:
+    struct entry
+    {
+        std::shared_ptr<const evidence_row> row;
+        size_t cost;
+    };
+    struct shard
+    {
+        mutable std::mutex mtx;
+        std::list<entry> lru; // 头部最新
+        std::unordered_map<int64_t, std::list<entry>::iterator> map;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;
+    };
+
+    shard &shard_for(int64_t id) { return shards_[(size_t)((uint64_t)id * 0x9E3779B97F4A7C15ull >> 32) % shards_.size()]; }
+
+    size_t capacity_;
+    size_t shard_capacity_;
+    std::vector<shard> shards_;
+};
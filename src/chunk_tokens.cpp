@@ -0,0 +1,248 @@
+// src/chunk_tokens.cpp
+#include "chunk_tokens.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <sqlite3.h>
+
+namespace
+{
+constexpr size_t k_update_batch = 2048; // 每批读出、tokenize、写回的行数
+
+bool exec_sql(sqlite3 *db, const char *sql, std::string &err)
+{
+    char *msg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &msg) != SQLITE_OK)
+    {
+        err = std::string(sql) + ": " + (msg ? msg : sqlite3_errmsg(db));
+        sqlite3_free(msg);
+        return false;
+    }
+    return true;
+}
+} // namespace
+
+std::string llm_vocab_id(const llama_vocab *vocab)
+{
+    const int32_t n = llama_vocab_n_tokens(vocab);
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&h](const char *p, size_t len)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            h ^= (unsigned char)p[i];
+            h *= 1099511628211ull;
+        }
+    };
+    char buf[256];
+    for (llama_token t = 0; t < n; ++t)
+    {
+        const int nb = llama_token_to_piece(vocab, t, buf, (int)sizeof(buf), 0, true);
+        if (nb > 0)
+            mix(buf, (size_t)nb);
+        mix("\0", 1); // 分隔，避免相邻 token 拼起来撞车
+    }
+    char out[48];
+    std::snprintf(out, sizeof(out), "%d-%016llx", (int)n, (unsigned long long)h);
+    return out;
+}
+
+bool llm_tokenize_append(const llama_vocab *vocab, const char *text, size_t len, bool add_special,
+                         std::vector<llama_token> &out)
+{
+    const size_t base = out.size();
+    out.resize(base + len / 2 + 16);
+    int n = llama_tokenize(vocab, text, (int)len, out.data() + base, (int)(out.size() - base), add_special,
+                           false /* parse_special */);
+    if (n < 0 && n != INT32_MIN)
+    {
+        out.resize(base + (size_t)-n);
+        n = llama_tokenize(vocab, text, (int)len, out.data() + base, (int)(out.size() - base), add_special, false);
+    }
+    if (n < 0)
+    {
+        out.resize(base);
+        return false;
+    }
+    out.resize(base + (size_t)n);
+    return true;
+}
+
+bool chunk_tokens_update(const std::string &db_path, const llama_vocab *vocab, int n_threads, chunk_tokens_stats &st,
+                         std::string &err)
+{
+    st = chunk_tokens_stats();
+    sqlite3 *db = nullptr;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK)
+    {
+        err = "failed to open db: " + db_path + (db ? std::string(": ") + sqlite3_errmsg(db) : "");
+        sqlite3_close(db);
+        return false;
+    }
+    if (!exec_sql(db,
+                  "CREATE TABLE IF NOT EXISTS chunk_tokens ("
+                  " id INTEGER PRIMARY KEY,"
+                  " vocab TEXT NOT NULL,"
+                  " n_tokens INTEGER NOT NULL,"
+                  " tokens BLOB NOT NULL);",
+                  err) ||
+        !exec_sql(db, "DELETE FROM chunk_tokens WHERE id NOT IN (SELECT id FROM documents);", err))
+    {
+        sqlite3_close(db);
+        return false;
+    }
+    st.n_removed = (size_t)sqlite3_changes(db);
+
+    const std::string vid = llm_vocab_id(vocab);
+    sqlite3_stmt *sel = nullptr, *ins = nullptr;
+    if (sqlite3_prepare_v2(db,
+                           "SELECT d.id, d.text FROM documents d LEFT JOIN chunk_tokens t ON t.id = d.id"
+                           " WHERE d.id > ? AND (t.id IS NULL OR t.vocab <> ?) ORDER BY d.id LIMIT ?",
+                           -1, &sel, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO chunk_tokens (id, vocab, n_tokens, tokens) VALUES (?, ?, ?, ?)",
+                           -1, &ins, nullptr) != SQLITE_OK)
+    {
+        err = std::string("failed to prepare: ") + sqlite3_errmsg(db);
+        sqlite3_finalize(sel);
+        sqlite3_close(db);
+        return false;
+    }
+
+    const size_t n_workers = (size_t)std::max(1, n_threads);
+    std::vector<int64_t> ids;
+    std::vector<std::string> texts;
+    std::vector<std::vector<llama_token>> toks;
+    int64_t after = 0;
+    bool ok = true;
+    while (ok)
+    {
+        // 按 id 翻页：每批重新查询，不在未结束的 SELECT 上写同一张表
+        ids.clear();
+        texts.clear();
+        sqlite3_reset(sel);
+        sqlite3_bind_int64(sel, 1, after);
+        sqlite3_bind_text(sel, 2, vid.data(), (int)vid.size(), SQLITE_STATIC);
+        sqlite3_bind_int64(sel, 3, (sqlite3_int64)k_update_batch);
+        while (sqlite3_step(sel) == SQLITE_ROW)
+        {
+            ids.push_back(sqlite3_column_int64(sel, 0));
+            const unsigned char *t = sqlite3_column_text(sel, 1);
+            texts.emplace_back(t ? (const char *)t : "", (size_t)sqlite3_column_bytes(sel, 1));
+        }
+        if (ids.empty())
+            break;
+        after = ids.back();
+
+        toks.resize(ids.size());
+        std::vector<char> failed(ids.size(), 0);
+        auto work = [&](size_t t)
+        {
+            for (size_t i = t; i < ids.size(); i += n_workers)
+            {
+                toks[i].clear();
+                failed[i] = !llm_tokenize_append(vocab, texts[i].data(), texts[i].size(), false, toks[i]);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < n_workers; ++t)
+            pool.emplace_back(work, t);
+        work(0);
+        for (auto &th : pool)
+            th.join();
+
+        if (!exec_sql(db, "BEGIN", err))
+            break;
+        for (size_t i = 0; i < ids.size() && ok; ++i)
+        {
+            if (failed[i])
+                continue; // tokenize 失败的行不缓存，查询时现场切
+            sqlite3_reset(ins);
+            sqlite3_bind_int64(ins, 1, ids[i]);
+            sqlite3_bind_text(ins, 2, vid.data(), (int)vid.size(), SQLITE_STATIC);
+            sqlite3_bind_int64(ins, 3, (sqlite3_int64)toks[i].size());
+            sqlite3_bind_blob(ins, 4, toks[i].empty() ? "" : (const void *)toks[i].data(),
+                              (int)(toks[i].size() * sizeof(llama_token)), SQLITE_STATIC);
+            if (sqlite3_step(ins) != SQLITE_DONE)
+            {
+                err = std::string("insert failed: ") + sqlite3_errmsg(db);
+                ok = false;
+                break;
+            }
+            ++st.n_added;
+        }
+        std::string txn_err;
+        if (!exec_sql(db, ok ? "COMMIT" : "ROLLBACK", txn_err) && ok)
+        {
+            err = txn_err;
+            ok = false;
+        }
+    }
+    sqlite3_finalize(sel);
+    sqlite3_finalize(ins);
+    sqlite3_close(db);
+    return ok && err.empty();
+}
+
+// ---------- chunk_token_store ----------
+chunk_token_store::~chunk_token_store()
+{
+    close();
+}
+
+bool chunk_token_store::open(const std::string &db_path, const std::string &vocab_id, std::string &err)
+{
+    close();
+    vocab_id_ = vocab_id;
+    const int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_SHAREDCACHE;
+    if (sqlite3_open_v2(db_path.c_str(), &db_, flags, nullptr) != SQLITE_OK)
+    {
+        err = "failed to open db: " + db_path + (db_ ? std::string(": ") + sqlite3_errmsg(db_) : "");
+        close();
+        return false;
+    }
+    if (sqlite3_prepare_v3(db_, "SELECT tokens FROM chunk_tokens WHERE id = ? AND vocab = ?", -1,
+                           SQLITE_PREPARE_PERSISTENT, &stmt_, nullptr) != SQLITE_OK)
+    {
+        err = std::string("no token cache: ") + sqlite3_errmsg(db_);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void chunk_token_store::close()
+{
+    if (stmt_)
+        sqlite3_finalize(stmt_);
+    stmt_ = nullptr;
+    if (db_)
+        sqlite3_close(db_);
+    db_ = nullptr;
+}
+
+bool chunk_token_store::get(int64_t id, std::vector<llama_token> &out)
+{
+    out.clear();
+    if (!stmt_)
+        return false;
+    sqlite3_reset(stmt_);
+    sqlite3_bind_int64(stmt_, 1, id);
+    sqlite3_bind_text(stmt_, 2, vocab_id_.data(), (int)vocab_id_.size(), SQLITE_STATIC);
+    bool found = false;
+    if (sqlite3_step(stmt_) == SQLITE_ROW)
+    {
+        const size_t nb = (size_t)sqlite3_column_bytes(stmt_, 0);
+        if (nb % sizeof(llama_token) == 0)
+        {
+            out.resize(nb / sizeof(llama_token));
+            if (nb)
+                std::memcpy(out.data(), sqlite3_column_blob(stmt_, 0), nb);
+            found = true;
+        }
+    }
+    sqlite3_reset(stmt_);
+    return found;
+}
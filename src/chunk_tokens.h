@@ -0,0 +1,60 @@
+// src/chunk_tokens.h
+// 证据块的 token 缓存：入库时把每个 documents 行按生成模型的词表切好，存进同库的 chunk_tokens 表，
+// 查询时装证据直接取现成的 token（见 evidence_pack.h），不必每次把整段证据重新 tokenize。
+//
+//   chunk_tokens(id INTEGER PRIMARY KEY, vocab TEXT, n_tokens INTEGER, tokens BLOB)
+//
+// - id 即 documents.id；tokens 是 int32 数组（add_special=false，不含 BOS），n_tokens 单独存一列方便统计；
+// - vocab 是词表指纹（llm_vocab_id），换了词表的模型后旧行自然失效，下次入库时重算。
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// 词表指纹：token 数 + 所有 token 文本的 FNV-1a 64。同一词表的不同量化版本得到相同的值
+std::string llm_vocab_id(const llama_vocab *vocab);
+
+// 先按常见压缩比估大小，不够时按 llama_tokenize 返回的准确个数重试；结果追加到 out 末尾
+bool llm_tokenize_append(const llama_vocab *vocab, const char *text, size_t len, bool add_special,
+                         std::vector<llama_token> &out);
+
+struct chunk_tokens_stats
+{
+    size_t n_added = 0;   // 新算（或因词表变化重算）的行
+    size_t n_removed = 0; // documents 里已不存在、被清掉的行
+};
+
+// 给 documents 里还没有 token（或词表不同）的行补上，并清掉对应 documents 行已删除的缓存。
+// 按 id 分批读出，n_threads 个线程并行 tokenize，每批一个事务写回
+bool chunk_tokens_update(const std::string &db_path, const llama_vocab *vocab, int n_threads, chunk_tokens_stats &st,
+                         std::string &err);
+
+// 查询侧的只读连接；非线程安全，一个线程一个实例
+class chunk_token_store
+{
+public:
+    chunk_token_store() = default;
+    ~chunk_token_store();
+
+    chunk_token_store(const chunk_token_store &) = delete;
+    chunk_token_store &operator=(const chunk_token_store &) = delete;
+
+    // 库里没有 chunk_tokens 表时返回 false（调用方退回现场 tokenize）
+    bool open(const std::string &db_path, const std::string &vocab_id, std::string &err);
+    void close();
+    bool is_open() const { return db_ != nullptr; }
+
+    // 没有预计算或词表不一致时返回 false
+    bool get(int64_t id, std::vector<llama_token> &out);
+
+private:
+    sqlite3 *db_ = nullptr;
+    sqlite3_stmt *stmt_ = nullptr;
+    std::string vocab_id_;
+};
@@ -0,0 +1,124 @@
+// src/cpu_tuning.cpp
+#include "cpu_tuning.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+bool cpu_parse_list(const std::string &spec, std::vector<int> &cpus, std::string &err)
+{
+    cpus.clear();
+    size_t i = 0;
+    while (i < spec.size())
+    {
+        size_t j = spec.find(',', i);
+        if (j == std::string::npos)
+            j = spec.size();
+        const std::string part = spec.substr(i, j - i);
+        i = j + 1;
+        if (part.empty())
+            continue;
+
+        char *end = nullptr;
+        const long lo = std::strtol(part.c_str(), &end, 10);
+        long hi = lo;
+        if (end != part.c_str() && *end == '-')
+            hi = std::strtol(end + 1, &end, 10);
+        if (end == part.c_str() || *end != '\0' || lo < 0 || hi < lo || hi > 4095)
+        {
+            err = "bad cpu list item: " + part;
+            return false;
+        }
+        for (long c = lo; c <= hi; ++c)
+            cpus.push_back((int)c);
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    if (cpus.empty())
+    {
+        err = "empty cpu list";
+        return false;
+    }
+    return true;
+}
+
+bool cpu_set_affinity(const std::vector<int> &cpus, std::string &err)
+{
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int c : cpus)
+    {
+        if (c >= (int)(sizeof(DWORD_PTR) * 8))
+        {
+            err = "cpu " + std::to_string(c) + " is outside processor group 0";
+            return false;
+        }
+        mask |= (DWORD_PTR)1 << c;
+    }
+    if (!SetThreadAffinityMask(GetCurrentThread(), mask))
+    {
+        err = "SetThreadAffinityMask failed";
+        return false;
+    }
+    return true;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+    {
+        if (c >= CPU_SETSIZE)
+        {
+            err = "cpu " + std::to_string(c) + " exceeds CPU_SETSIZE";
+            return false;
+        }
+        CPU_SET(c, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+        err = "sched_setaffinity failed (cpus not online or not permitted?)";
+        return false;
+    }
+    return true;
+#else
+    (void)cpus;
+    err = "cpu affinity is not supported on this platform";
+    return false;
+#endif
+}
+
+bool cpu_parse_numa(const std::string &name, ggml_numa_strategy &out)
+{
+    if (name == "off" || name == "none")
+        out = GGML_NUMA_STRATEGY_DISABLED;
+    else if (name == "distribute")
+        out = GGML_NUMA_STRATEGY_DISTRIBUTE;
+    else if (name == "isolate")
+        out = GGML_NUMA_STRATEGY_ISOLATE;
+    else if (name == "numactl")
+        out = GGML_NUMA_STRATEGY_NUMACTL;
+    else if (name == "mirror")
+        out = GGML_NUMA_STRATEGY_MIRROR;
+    else
+        return false;
+    return true;
+}
+
+int cpu_count_available()
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        return std::max(1, CPU_COUNT(&set));
+#endif
+    return (int)std::max(1u, std::thread::hardware_concurrency());
+}
@@ -0,0 +1,21 @@
+// src/cpu_tuning.h
+// CPU 侧的部署参数：CPU 绑核与 NUMA 策略的解析和设置。线程数与 mmap/mlock 见 llm_engine_params。
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ggml.h"
+
+// 解析 "0-7,16-23" 形式的 CPU 列表（升序去重）
+bool cpu_parse_list(const std::string &spec, std::vector<int> &cpus, std::string &err);
+
+// 把调用线程绑到这些 CPU；之后由它创建的线程（llama/ggml 的工作线程）继承同样的掩码，
+// 所以要在加载模型、启动任何工作线程之前调用。Windows 上只支持第一个处理器组（0-63）
+bool cpu_set_affinity(const std::vector<int> &cpus, std::string &err);
+
+// "off" / "distribute" / "isolate" / "numactl" / "mirror"
+bool cpu_parse_numa(const std::string &name, ggml_numa_strategy &out);
+
+// 当前进程可用的逻辑 CPU 数（已考虑绑核），至少为 1
+int cpu_count_available();
@@ -0,0 +1,121 @@
+// src/evidence_pack.cpp
+#include "evidence_pack.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+
+namespace
+{
+// 截断处可能落在一个多字节字符中间：去掉末尾不完整的 UTF-8 序列
+void trim_partial_utf8(std::string &s)
+{
+    size_t i = s.size();
+    size_t n_cont = 0;
+    while (i > 0 && n_cont < 3 && ((unsigned char)s[i - 1] & 0xC0) == 0x80)
+    {
+        --i;
+        ++n_cont;
+    }
+    if (i == 0)
+        return;
+    const unsigned char lead = (unsigned char)s[i - 1];
+    const size_t need = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+    if (need > n_cont)
+        s.resize(i - 1);
+}
+} // namespace
+
+bool evidence_packer::open(const llm_engine &engine, const std::string &db_path, const evidence_pack_params &params,
+                           std::string &err)
+{
+    engine_ = &engine;
+    params_ = params;
+    if (!engine.vocab())
+    {
+        err = "evidence_packer: model not loaded";
+        return false;
+    }
+    std::string store_err;
+    if (!store_.open(db_path, engine.vocab_id(), store_err))
+    {
+        std::cerr << "[WARN] evidence token cache unavailable (" << store_err
+                  << "), tokenizing evidence per request; run ingest_cli --token-model to precompute\n";
+    }
+    return true;
+}
+
+void evidence_packer::pack(rag_retrieval &rr, llm_request &req, evidence_pack_stats &st)
+{
+    st = evidence_pack_stats();
+    req.evidence.clear();
+    req.evidence_pieces.clear();
+    if (!engine_ || rr.evidence.empty())
+        return;
+
+    // retrieve 已按 final_score 排好序；这里再稳定排一次，不依赖上游的顺序
+    std::vector<size_t> order(rr.evidence.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return rr.evidence[a].final_score > rr.evidence[b].final_score; });
+
+    static const std::string sep_text = "\n\n";
+    engine_->tokenize(sep_text, false, sep_);
+    const int n_sep = (int)sep_.size();
+    const int budget = params_.budget_tokens > 0 ? params_.budget_tokens : INT32_MAX;
+
+    std::vector<rag_hit> kept;
+    std::string kept_text;
+    int used = 0;
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        rag_hit &h = rr.evidence[order[k]];
+        const std::string head_text = "[chunk:" + std::to_string(h.doc_key) + "] " + h.title + "\n";
+        engine_->tokenize(head_text, false, head_);
+        const bool cached = store_.is_open() && store_.get(h.doc_key, body_);
+        if (!cached)
+            engine_->tokenize(h.text, false, body_);
+
+        const int room = budget - used - (int)head_.size() - n_sep;
+        const int n_body = (int)body_.size();
+        if (n_body > room)
+        {
+            // 第一条无论如何要放（截断），后面的只在剩余预算够 min_tail_tokens 时才截断放入
+            if (room <= 0 || (!kept.empty() && room < params_.min_tail_tokens))
+            {
+                ++st.n_dropped;
+                continue;
+            }
+            body_.resize((size_t)room);
+            engine_->detokenize(body_.data(), body_.size(), h.text);
+            trim_partial_utf8(h.text);
+            ++st.n_truncated;
+        }
+
+        llm_evidence_piece head;
+        head.text = head_text;
+        head.tokens = head_;
+        llm_evidence_piece body;
+        body.text = h.text;
+        body.tokens = body_;
+        llm_evidence_piece sep;
+        sep.text = sep_text;
+        sep.tokens = sep_;
+        req.evidence_pieces.push_back(std::move(head));
+        req.evidence_pieces.push_back(std::move(body));
+        req.evidence_pieces.push_back(std::move(sep));
+
+        used += (int)head_.size() + (int)body_.size() + n_sep;
+        st.n_cached += cached ? 1 : 0;
+        ++st.n_chunks;
+        kept_text += head_text;
+        kept_text += h.text;
+        kept_text += sep_text;
+        kept.push_back(std::move(h));
+    }
+
+    st.n_tokens = used;
+    rr.evidence = std::move(kept);
+    rr.evidence_text = std::move(kept_text);
+}
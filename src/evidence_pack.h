@@ -0,0 +1,62 @@
+// src/evidence_pack.h
+// 按 token 预算装证据：retrieve 给出的证据按 final_score 从高到低放进 prompt，
+// 放得下的整条放入，放不下的截断一条、其余丢弃，保证每个请求的 prefill 长度有上限。
+//
+// - 正文 token 优先取 chunk_tokens 表里入库时预先切好的（ingest_cli --token-model），没有的现场 tokenize；
+// - 每条证据拆成 "[chunk:N] title\n" / 正文 / "\n\n" 三段，作为 llm_evidence_piece 交给 llm_engine，
+//   引擎直接拼接 token，不再把整段证据文本重新 tokenize；
+// - 装好后 rr.evidence / rr.evidence_text 改写成实际放进 prompt 的内容（截断的那条是 detokenize 后的文本），
+//   引用约束和兜底摘录都只会用到模型真正看到的证据。
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "chunk_tokens.h"
+#include "llm_engine.h"
+#include "rag_pipeline.h"
+
+struct evidence_pack_params
+{
+    int budget_tokens = 0;    // 证据部分的 token 上限；<= 0 时不限
+    int min_tail_tokens = 32; // 剩余预算不到它时不再截断塞进半条，直接丢弃
+};
+
+struct evidence_pack_stats
+{
+    int n_tokens = 0;     // 装进去的证据 token 数（含每条的标题行与分隔）
+    int n_chunks = 0;     // 装进去的条数（含截断的）
+    int n_cached = 0;     // 正文 token 来自 chunk_tokens 的条数
+    int n_truncated = 0;
+    int n_dropped = 0;
+};
+
+// 非线程安全：内部复用一个 chunk_token_store 连接，一个线程一个实例
+class evidence_packer
+{
+public:
+    // chunk_tokens 表不存在或打不开时只打印警告，之后全部现场 tokenize
+    bool open(const llm_engine &engine, const std::string &db_path, const evidence_pack_params &params,
+              std::string &err);
+
+    // 把 rr.evidence 装进 req.evidence_pieces（并清空 req.evidence），同时改写 rr
+    void pack(rag_retrieval &rr, llm_request &req, evidence_pack_stats &st);
+
+    const evidence_pack_params &params() const { return params_; }
+    // 装出来的 token 只对同一词表的模型有效
+    bool compatible(const llm_engine &engine) const { return engine_ && engine_->vocab_id() == engine.vocab_id(); }
+    bool has_cache() const { return store_.is_open(); }
+
+private:
+    const llm_engine *engine_ = nullptr;
+    evidence_pack_params params_;
+    chunk_token_store store_;
+    std::vector<llama_token> head_, body_, sep_;
+};
+
+// 自动预算：上下文减去生成长度和模板/问题的余量（只用于 --evidence-budget 0）
+inline int evidence_auto_budget(int n_ctx, int n_predict)
+{
+    const int b = n_ctx - n_predict - 384;
+    return b < 256 ? 256 : b;
+}
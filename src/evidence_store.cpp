@@ -0,0 +1,200 @@
+// src/evidence_store.cpp
+#include "evidence_store.h"
+
+#include "chunk_cache.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <sqlite3.h>
+
+evidence_store::~evidence_store()
+{
+    close();
+}
+
+bool evidence_store::open(const evidence_store_params &params, std::string &err)
+{
+    close();
+    params_ = params;
+
+    // 一个线程一个连接，关掉 SQLite 自己的互斥；shared cache 让同进程的多个连接共用页缓存
+    const int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_SHAREDCACHE;
+    if (sqlite3_open_v2(params_.db_path.c_str(), &db_, flags, nullptr) != SQLITE_OK)
+    {
+        err = "failed to open db: " + params_.db_path + (db_ ? std::string(": ") + sqlite3_errmsg(db_) : "");
+        close();
+        return false;
+    }
+
+    const std::string pragmas = "PRAGMA query_only = 1;"
+                                "PRAGMA mmap_size = " + std::to_string(params_.mmap_size) + ";"
+                                "PRAGMA cache_size = -" + std::to_string(params_.cache_kib) + ";"
+                                "PRAGMA read_uncommitted = 1;";
+    char *msg = nullptr;
+    if (sqlite3_exec(db_, pragmas.c_str(), nullptr, nullptr, &msg) != SQLITE_OK)
+    {
+        // pragma 只是优化，失败了照常工作
+        sqlite3_free(msg);
+    }
+
+    stmts_.assign(8, nullptr); // 1..64
+    // 先准备一次最小的桶，尽早发现表名/列名错误
+    if (!statement(1, err))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void evidence_store::close()
+{
+    for (sqlite3_stmt *s : stmts_)
+    {
+        if (s)
+            sqlite3_finalize(s);
+    }
+    stmts_.clear();
+    if (db_)
+        sqlite3_close(db_);
+    db_ = nullptr;
+}
+
+sqlite3_stmt *evidence_store::statement(size_t bucket, std::string &err)
+{
+    size_t slot = 0;
+    while (((size_t)1 << slot) < bucket)
+        ++slot;
+    if (stmts_[slot])
+        return stmts_[slot];
+
+    std::string sql = "SELECT id, " + (params_.title_col.empty() ? std::string("NULL") : params_.title_col) + ", " +
+                      params_.text_col + " FROM " + params_.table + " WHERE id IN (";
+    for (size_t i = 0; i < bucket; ++i)
+        sql += i ? ",?" : "?";
+    sql += ")";
+
+    if (sqlite3_prepare_v3(db_, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmts_[slot], nullptr) != SQLITE_OK)
+    {
+        err = std::string("failed to prepare: ") + sqlite3_errmsg(db_);
+        stmts_[slot] = nullptr;
+        return nullptr;
+    }
+    return stmts_[slot];
+}
+
+bool evidence_store::fetch(const std::vector<int64_t> &ids, std::vector<evidence_row> &out, std::string &err)
+{
+    out.clear();
+    if (!db_)
+    {
+        err = "evidence store is not open";
+        return false;
+    }
+
+    // 去重并记住请求顺序
+    std::vector<int64_t> uniq;
+    uniq.reserve(ids.size());
+    {
+        std::unordered_set<int64_t> seen;
+        for (int64_t id : ids)
+        {
+            if (seen.insert(id).second)
+                uniq.push_back(id);
+        }
+    }
+    std::vector<evidence_row> rows(uniq.size());
+    std::vector<bool> found(uniq.size(), false);
+
+    // 先查缓存，只有未命中的 id 才去 SQLite
+    std::vector<int64_t> miss;
+    std::unordered_map<int64_t, size_t> order;
+    miss.reserve(uniq.size());
+    for (size_t i = 0; i < uniq.size(); ++i)
+    {
+        std::shared_ptr<const evidence_row> hit = cache_ ? cache_->get(uniq[i]) : nullptr;
+        if (hit)
+        {
+            rows[i] = *hit;
+            found[i] = true;
+            continue;
+        }
+        miss.push_back(uniq[i]);
+        order.emplace(uniq[i], i);
+    }
+
+    for (size_t start = 0; start < miss.size(); start += k_max_bucket)
+    {
+        const size_t n = std::min(k_max_bucket, miss.size() - start);
+        size_t bucket = 1;
+        while (bucket < n)
+            bucket <<= 1;
+
+        sqlite3_stmt *stmt = statement(bucket, err);
+        if (!stmt)
+            return false;
+        sqlite3_reset(stmt);
+        for (size_t i = 0; i < bucket; ++i)
+        {
+            if (i < n)
+                sqlite3_bind_int64(stmt, (int)i + 1, miss[start + i]);
+            else
+                sqlite3_bind_null(stmt, (int)i + 1); // id IN (..., NULL) 不匹配任何行
+        }
+
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            const int64_t id = sqlite3_column_int64(stmt, 0);
+            auto it = order.find(id);
+            if (it == order.end())
+                continue;
+            evidence_row &r = rows[it->second];
+            r.id = id;
+            const unsigned char *title = sqlite3_column_text(stmt, 1);
+            const unsigned char *text = sqlite3_column_text(stmt, 2);
+            if (title)
+                r.title.assign((const char *)title, (size_t)sqlite3_column_bytes(stmt, 1));
+            if (text)
+                r.text.assign((const char *)text, (size_t)sqlite3_column_bytes(stmt, 2));
+            found[it->second] = true;
+            if (cache_)
+                cache_->put(std::make_shared<const evidence_row>(r));
+        }
+        if (rc != SQLITE_DONE)
+        {
+            err = std::string("sqlite step failed: ") + sqlite3_errmsg(db_);
+            sqlite3_reset(stmt);
+            return false;
+        }
+        sqlite3_reset(stmt);
+    }
+
+    out.reserve(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        if (found[i])
+            out.push_back(std::move(rows[i]));
+    }
+    return true;
+}
+
+void format_evidence(const std::vector<evidence_row> &rows, std::string &out)
+{
+    out.clear();
+    size_t n = 0;
+    for (const auto &r : rows)
+        n += r.text.size() + 32;
+    out.reserve(n);
+    for (const auto &r : rows)
+    {
+        out += u8"[证据#";
+        out += std::to_string(r.id);
+        out += "] ";
+        out += r.text;
+        out += "\n";
+    }
+}
@@ -0,0 +1,68 @@
+// src/evidence_store.h
+// 按 documents.id 取证据文本的常驻读连接。
+// - 每个工作线程持有一个 evidence_store：只读连接，打开时设置 mmap_size / query_only，整个进程生命周期内复用；
+// - `WHERE id IN (?, ...)` 的语句按 id 个数分桶（1/2/4/.../64）缓存，多出来的占位符绑定 NULL；
+// - 结果按请求的 id 顺序返回（SQLite 的 IN 不保证顺序）；
+// - 可挂一个 chunk_cache（多个实例共用），命中的 id 不再查库。
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class chunk_cache;
+struct sqlite3;
+struct sqlite3_stmt;
+
+struct evidence_store_params
+{
+    std::string db_path;
+    std::string table = "documents";
+    std::string text_col = "text";
+    std::string title_col;            // 为空时不取标题
+    int64_t mmap_size = 256ll << 20;  // PRAGMA mmap_size
+    int cache_kib = 16 << 10;         // PRAGMA cache_size（KiB）
+};
+
+struct evidence_row
+{
+    int64_t id = 0;
+    std::string title;
+    std::string text;
+};
+
+class evidence_store
+{
+public:
+    evidence_store() = default;
+    ~evidence_store();
+
+    evidence_store(const evidence_store &) = delete;
+    evidence_store &operator=(const evidence_store &) = delete;
+
+    bool open(const evidence_store_params &params, std::string &err);
+    void close();
+    bool is_open() const { return db_ != nullptr; }
+
+    // 缓存按 id 区分条目，只应在表/列配置相同的实例之间共用；传 nullptr 关闭
+    void set_cache(chunk_cache *cache) { cache_ = cache; }
+    chunk_cache *cache() const { return cache_; }
+
+    // 非线程安全：一个线程一个实例。找不到的 id 直接跳过；重复的 id 只返回一次
+    bool fetch(const std::vector<int64_t> &ids, std::vector<evidence_row> &out, std::string &err);
+
+    const evidence_store_params &params() const { return params_; }
+
+private:
+    static constexpr size_t k_max_bucket = 64;
+
+    sqlite3_stmt *statement(size_t bucket, std::string &err);
+
+    evidence_store_params params_;
+    sqlite3 *db_ = nullptr;
+    chunk_cache *cache_ = nullptr;
+    std::vector<sqlite3_stmt *> stmts_; // 下标 log2(bucket)
+};
+
+// llm_cli 的证据格式："[证据#id] text\n" 逐条拼接
+void format_evidence(const std::vector<evidence_row> &rows, std::string &out);
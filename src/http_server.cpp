@@ -0,0 +1,935 @@
+// src/http_server.cpp
+#include "http_server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "metrics.h"
+
+namespace
+{
+using clock_type = std::chrono::steady_clock;
+
+#ifdef _WIN32
+using socket_t = SOCKET;
+const socket_t k_invalid = INVALID_SOCKET;
+void sock_close(socket_t s)
+{
+    closesocket(s);
+}
+bool sock_nonblock(socket_t s)
+{
+    u_long on = 1;
+    return ioctlsocket(s, FIONBIO, &on) == 0;
+}
+int sock_poll(pollfd *fds, size_t n, int timeout_ms)
+{
+    return WSAPoll(fds, (ULONG)n, timeout_ms);
+}
+bool sock_would_block()
+{
+    const int e = WSAGetLastError();
+    return e == WSAEWOULDBLOCK || e == WSAEINTR;
+}
+#else
+using socket_t = int;
+const socket_t k_invalid = -1;
+void sock_close(socket_t s)
+{
+    ::close(s);
+}
+bool sock_nonblock(socket_t s)
+{
+    const int fl = fcntl(s, F_GETFL, 0);
+    return fl >= 0 && fcntl(s, F_SETFL, fl | O_NONBLOCK) == 0;
+}
+int sock_poll(pollfd *fds, size_t n, int timeout_ms)
+{
+    return ::poll(fds, (nfds_t)n, timeout_ms);
+}
+bool sock_would_block()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+#endif
+
+#ifdef MSG_NOSIGNAL
+const int k_send_flags = MSG_NOSIGNAL; // 对端已关闭时不要 SIGPIPE
+#else
+const int k_send_flags = 0;
+#endif
+
+socket_t to_sock(intptr_t fd)
+{
+    return (socket_t)fd;
+}
+
+// 返回写出的字节数；0 表示暂时写不进去；-1 表示连接已坏
+long sock_send(socket_t s, const char *p, size_t n)
+{
+    const auto r = ::send(s, p, (int)std::min<size_t>(n, 1 << 30), k_send_flags);
+    if (r >= 0)
+        return (long)r;
+    return sock_would_block() ? 0 : -1;
+}
+
+void init_sockets()
+{
+#ifdef _WIN32
+    static const bool ok = []()
+    {
+        WSADATA wsa;
+        return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+    }();
+    (void)ok;
+#endif
+}
+
+// 回环上的一对已连接 socket：工作线程往 [1] 写一个字节，把 poll 中的 I/O 线程叫醒（Windows 上没有 pipe 可 poll）
+bool make_wake_pair(socket_t out[2])
+{
+    socket_t l = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (l == k_invalid)
+        return false;
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    a.sin_port = 0;
+    socklen_t len = sizeof(a);
+    bool ok = ::bind(l, (sockaddr *)&a, sizeof(a)) == 0 && ::listen(l, 1) == 0 &&
+              ::getsockname(l, (sockaddr *)&a, &len) == 0;
+    out[0] = out[1] = k_invalid;
+    if (ok)
+    {
+        out[1] = ::socket(AF_INET, SOCK_STREAM, 0);
+        ok = out[1] != k_invalid && ::connect(out[1], (sockaddr *)&a, sizeof(a)) == 0;
+    }
+    if (ok)
+    {
+        out[0] = ::accept(l, nullptr, nullptr);
+        ok = out[0] != k_invalid && sock_nonblock(out[0]) && sock_nonblock(out[1]);
+    }
+    sock_close(l);
+    if (!ok)
+    {
+        if (out[0] != k_invalid)
+            sock_close(out[0]);
+        if (out[1] != k_invalid)
+            sock_close(out[1]);
+    }
+    return ok;
+}
+
+const char *status_text(int status)
+{
+    switch (status)
+    {
+    case 100:
+        return "Continue";
+    case 200:
+        return "OK";
+    case 202:
+        return "Accepted";
+    case 204:
+        return "No Content";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 408:
+        return "Request Timeout";
+    case 409:
+        return "Conflict";
+    case 413:
+        return "Payload Too Large";
+    case 429:
+        return "Too Many Requests";
+    case 431:
+        return "Request Header Fields Too Large";
+    case 500:
+        return "Internal Server Error";
+    case 501:
+        return "Not Implemented";
+    case 503:
+        return "Service Unavailable";
+    case 504:
+        return "Gateway Timeout";
+    }
+    return status < 400 ? "OK" : "Error";
+}
+
+std::string status_head(int status, const std::string &content_type, bool keep_alive, const http_headers &extra)
+{
+    std::string h = "HTTP/1.1 " + std::to_string(status) + " " + status_text(status) + "\r\n";
+    if (!content_type.empty())
+        h += "Content-Type: " + content_type + "\r\n";
+    h += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    for (const auto &kv : extra)
+        h += kv.first + ": " + kv.second + "\r\n";
+    return h;
+}
+
+std::string json_error_body(const std::string &msg)
+{
+    std::string s = "{\"ok\":false,\"error\":\"";
+    for (char c : msg)
+    {
+        if (c == '"' || c == '\\')
+            s += '\\';
+        s += (unsigned char)c < 0x20 ? ' ' : c;
+    }
+    s += "\"}";
+    return s;
+}
+
+std::string lower(std::string s)
+{
+    for (char &c : s)
+        c = (char)std::tolower((unsigned char)c);
+    return s;
+}
+
+std::string trim(const std::string &s)
+{
+    size_t b = 0, e = s.size();
+    while (b < e && (s[b] == ' ' || s[b] == '\t'))
+        ++b;
+    while (e > b && (s[e - 1] == ' ' || s[e - 1] == '\t' || s[e - 1] == '\r'))
+        --e;
+    return s.substr(b, e - b);
+}
+
+int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+std::string url_decode(const std::string &s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '+')
+            out += ' ';
+        else if (s[i] == '%' && i + 2 < s.size() && hex_value(s[i + 1]) >= 0 && hex_value(s[i + 2]) >= 0)
+        {
+            out += (char)(hex_value(s[i + 1]) * 16 + hex_value(s[i + 2]));
+            i += 2;
+        }
+        else
+            out += s[i];
+    }
+    return out;
+}
+} // namespace
+
+// 工作线程与 I/O 线程之间的唤醒；服务端销毁后 fd 置空，晚到的响应只是不再叫醒谁
+struct http_waker
+{
+    std::mutex mtx;
+    socket_t fd = k_invalid;
+    std::atomic<bool> pending{false};
+
+    void notify()
+    {
+        if (pending.exchange(true))
+            return; // I/O 线程还没处理上一次唤醒
+        std::lock_guard<std::mutex> lk(mtx);
+        if (fd != k_invalid)
+            sock_send(fd, "x", 1);
+    }
+};
+
+// 一个连接上当前响应的输出：工作线程写进 out，I/O 线程取走发出去
+struct http_conn_state
+{
+    std::mutex mtx;
+    std::string out;
+    bool response_done = false; // 当前响应的最后一个字节已经进了 out
+    bool closed = false;        // 连接已断开，之后的写入丢弃
+    std::shared_ptr<http_waker> waker;
+};
+
+// ---------- http_request ----------
+const std::string *http_request::header(const std::string &lower_name) const
+{
+    for (const auto &kv : headers)
+    {
+        if (kv.first == lower_name)
+            return &kv.second;
+    }
+    return nullptr;
+}
+
+std::string http_request::param(const std::string &name, const std::string &def) const
+{
+    size_t i = 0;
+    while (i <= query.size())
+    {
+        size_t amp = query.find('&', i);
+        if (amp == std::string::npos)
+            amp = query.size();
+        const std::string kv = query.substr(i, amp - i);
+        const size_t eq = kv.find('=');
+        if (url_decode(kv.substr(0, eq)) == name)
+            return eq == std::string::npos ? std::string() : url_decode(kv.substr(eq + 1));
+        i = amp + 1;
+    }
+    return def;
+}
+
+// ---------- http_response ----------
+http_response::http_response(std::shared_ptr<http_conn_state> conn, std::string route, bool keep_alive)
+    : conn_(std::move(conn)), route_(std::move(route)), keep_alive_(keep_alive), t_start_(clock_type::now())
+{
+}
+
+http_response::~http_response()
+{
+    std::unique_lock<std::mutex> lk(conn_->mtx);
+    if (state_ == 1)
+    {
+        lk.unlock();
+        end();
+    }
+    else if (state_ == 0)
+    {
+        lk.unlock();
+        send(500, "application/json", json_error_body("handler did not respond"));
+    }
+}
+
+void http_response::append_locked(const std::string &bytes)
+{
+    if (!conn_->closed)
+        conn_->out += bytes;
+}
+
+void http_response::finish_locked(int status)
+{
+    state_ = 2;
+    conn_->response_done = true;
+    const double secs = std::chrono::duration<double>(clock_type::now() - t_start_).count();
+    metrics()
+        .counter("http_requests_total", "HTTP requests by route and status",
+                 {{"route", route_}, {"code", std::to_string(status)}})
+        .inc();
+    metrics()
+        .histogram("http_request_seconds", "HTTP request latency until the last byte is queued", {{"route", route_}})
+        .observe(secs);
+}
+
+void http_response::send(int status, const std::string &content_type, const std::string &body,
+                         const http_headers &extra)
+{
+    {
+        std::lock_guard<std::mutex> lk(conn_->mtx);
+        if (state_ != 0)
+            return;
+        status_ = status;
+        std::string msg = status_head(status, content_type, keep_alive_, extra);
+        msg += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        msg += body;
+        append_locked(msg);
+        finish_locked(status);
+    }
+    conn_->waker->notify();
+}
+
+void http_response::begin_stream(int status, const std::string &content_type, const http_headers &extra)
+{
+    {
+        std::lock_guard<std::mutex> lk(conn_->mtx);
+        if (state_ != 0)
+            return;
+        status_ = status;
+        state_ = 1;
+        std::string msg = status_head(status, content_type, keep_alive_, extra);
+        msg += "Transfer-Encoding: chunked\r\n\r\n";
+        append_locked(msg);
+    }
+    conn_->waker->notify();
+}
+
+void http_response::write(const std::string &data)
+{
+    if (data.empty())
+        return; // 空块就是结束标记，不能单独发
+    {
+        std::lock_guard<std::mutex> lk(conn_->mtx);
+        if (state_ != 1)
+            return;
+        char size[20];
+        std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+        append_locked(size);
+        append_locked(data);
+        append_locked("\r\n");
+    }
+    conn_->waker->notify();
+}
+
+void http_response::end()
+{
+    {
+        std::lock_guard<std::mutex> lk(conn_->mtx);
+        if (state_ != 1)
+            return;
+        append_locked("0\r\n\r\n");
+        finish_locked(status_);
+    }
+    conn_->waker->notify();
+}
+
+bool http_response::closed() const
+{
+    std::lock_guard<std::mutex> lk(conn_->mtx);
+    return conn_->closed;
+}
+
+bool http_response::started() const
+{
+    std::lock_guard<std::mutex> lk(conn_->mtx);
+    return state_ != 0;
+}
+
+// ---------- http_server ----------
+struct http_server::connection
+{
+    socket_t fd = k_invalid;
+    std::string remote;
+    std::string in;   // 读到、还没解析的字节
+    std::string wbuf; // 待发的字节（从 st->out 取来的）
+    size_t woff = 0;
+    std::shared_ptr<http_conn_state> st;
+    bool busy = false;        // 有请求在处理或响应还没写完
+    bool close_after = false; // 写完手头的内容就关
+    bool dead = false;
+    bool sent_continue = false;
+    clock_type::time_point last;
+};
+
+http_server::http_server(const http_server_params &params) : params_(params)
+{
+    init_sockets();
+    waker_ = std::make_shared<http_waker>();
+}
+
+http_server::~http_server()
+{
+    stop();
+    if (listen_fd_ != -1)
+        sock_close(to_sock(listen_fd_));
+    if (wake_rd_ != -1)
+        sock_close(to_sock(wake_rd_));
+    std::lock_guard<std::mutex> lk(waker_->mtx);
+    if (waker_->fd != k_invalid)
+        sock_close(waker_->fd);
+    waker_->fd = k_invalid;
+}
+
+void http_server::route(const std::string &method, const std::string &path, http_handler handler)
+{
+    routes_.push_back({method, path, std::move(handler)});
+}
+
+bool http_server::listen(std::string &err)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *res = nullptr;
+    const std::string port = std::to_string(params_.port);
+    if (getaddrinfo(params_.host.empty() ? nullptr : params_.host.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+    {
+        err = "cannot resolve " + params_.host;
+        return false;
+    }
+    socket_t s = k_invalid;
+    for (addrinfo *ai = res; ai; ai = ai->ai_next)
+    {
+        s = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == k_invalid)
+            continue;
+#ifndef _WIN32
+        // 重启时不必等 TIME_WAIT（Windows 上 SO_REUSEADDR 允许抢占端口，不设）
+        const int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+#endif
+        if (::bind(s, ai->ai_addr, (int)ai->ai_addrlen) == 0 && ::listen(s, 128) == 0)
+            break;
+        sock_close(s);
+        s = k_invalid;
+    }
+    freeaddrinfo(res);
+    if (s == k_invalid || !sock_nonblock(s))
+    {
+        err = "cannot listen on " + params_.host + ":" + port;
+        if (s != k_invalid)
+            sock_close(s);
+        return false;
+    }
+    sockaddr_storage ss{};
+    socklen_t len = sizeof(ss);
+    if (::getsockname(s, (sockaddr *)&ss, &len) == 0)
+        port_ = ntohs(ss.ss_family == AF_INET6 ? ((sockaddr_in6 *)&ss)->sin6_port : ((sockaddr_in *)&ss)->sin_port);
+
+    socket_t wake[2];
+    if (!make_wake_pair(wake))
+    {
+        err = "cannot create wakeup socket";
+        sock_close(s);
+        return false;
+    }
+    listen_fd_ = (intptr_t)s;
+    wake_rd_ = (intptr_t)wake[0];
+    std::lock_guard<std::mutex> lk(waker_->mtx);
+    waker_->fd = wake[1];
+    return true;
+}
+
+void http_server::stop()
+{
+    stopping_.store(true);
+    waker_->pending.store(false);
+    waker_->notify();
+}
+
+bool http_server::accept_one()
+{
+    sockaddr_storage ss{};
+    socklen_t len = sizeof(ss);
+    socket_t s = ::accept(to_sock(listen_fd_), (sockaddr *)&ss, &len);
+    if (s == k_invalid)
+        return false;
+    if (conns_.size() >= params_.max_connections || !sock_nonblock(s))
+    {
+        sock_close(s);
+        return true;
+    }
+    const int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on)); // 流式的小块不要攒着发
+#ifdef SO_NOSIGPIPE
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, (const char *)&on, sizeof(on));
+#endif
+    std::unique_ptr<connection> c(new connection());
+    c->fd = s;
+    char host[INET6_ADDRSTRLEN] = "";
+    if (ss.ss_family == AF_INET)
+        inet_ntop(AF_INET, &((sockaddr_in *)&ss)->sin_addr, host, sizeof(host));
+    else if (ss.ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &((sockaddr_in6 *)&ss)->sin6_addr, host, sizeof(host));
+    c->remote = host;
+    c->st = std::make_shared<http_conn_state>();
+    c->st->waker = waker_;
+    c->last = clock_type::now();
+    conns_.push_back(std::move(c));
+    return true;
+}
+
+void http_server::on_readable(connection &c)
+{
+    char buf[16384];
+    for (;;)
+    {
+        const auto n = ::recv(c.fd, buf, (int)sizeof(buf), 0);
+        if (n > 0)
+        {
+            c.in.append(buf, (size_t)n);
+            c.last = clock_type::now();
+            // 头与体的上限之外再多就不收了，try_dispatch 会回错误
+            if (c.in.size() > params_.max_header_bytes + params_.max_body_bytes)
+                break;
+            continue;
+        }
+        if (n < 0 && sock_would_block())
+            break;
+        c.dead = true; // 对端关闭或出错
+        return;
+    }
+    try_dispatch(c);
+}
+
+void http_server::flush(connection &c)
+{
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lk(c.st->mtx);
+        if (!c.st->out.empty())
+        {
+            if (c.woff == c.wbuf.size())
+            {
+                c.wbuf.swap(c.st->out);
+                c.woff = 0;
+            }
+            else
+                c.wbuf += c.st->out;
+            c.st->out.clear();
+        }
+        done = c.st->response_done;
+    }
+    while (c.woff < c.wbuf.size())
+    {
+        const long n = sock_send(c.fd, c.wbuf.data() + c.woff, c.wbuf.size() - c.woff);
+        if (n < 0)
+        {
+            c.dead = true;
+            return;
+        }
+        if (n == 0)
+            return; // 等 POLLOUT
+        c.woff += (size_t)n;
+        c.last = clock_type::now();
+    }
+    c.wbuf.clear();
+    c.woff = 0;
+    if (c.busy && done)
+    {
+        {
+            std::lock_guard<std::mutex> lk(c.st->mtx);
+            c.st->response_done = false;
+        }
+        c.busy = false;
+        if (!c.close_after)
+            try_dispatch(c); // 管线化发来的下一个请求
+    }
+    if (!c.busy && c.close_after && c.wbuf.empty())
+        c.dead = true;
+}
+
+void http_server::try_dispatch(connection &c)
+{
+    if (c.busy || c.close_after || c.dead)
+        return;
+
+    auto fail = [&](int status, const std::string &msg)
+    {
+        c.wbuf += status_head(status, "application/json", false, {});
+        const std::string body = json_error_body(msg);
+        c.wbuf += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        c.close_after = true;
+        c.in.clear();
+    };
+
+    const size_t hdr_end = c.in.find("\r\n\r\n");
+    if (hdr_end == std::string::npos)
+    {
+        if (c.in.size() > params_.max_header_bytes)
+            fail(431, "request headers too large");
+        return;
+    }
+    if (hdr_end > params_.max_header_bytes)
+    {
+        fail(431, "request headers too large");
+        return;
+    }
+
+    http_request req;
+    size_t line_end = c.in.find("\r\n");
+    const std::string line = c.in.substr(0, line_end);
+    const size_t sp1 = line.find(' ');
+    const size_t sp2 = sp1 == std::string::npos ? std::string::npos : line.find(' ', sp1 + 1);
+    if (sp2 == std::string::npos)
+    {
+        fail(400, "malformed request line");
+        return;
+    }
+    req.method = line.substr(0, sp1);
+    const std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    const std::string version = line.substr(sp2 + 1);
+    if (version.compare(0, 5, "HTTP/") != 0)
+    {
+        fail(400, "malformed request line");
+        return;
+    }
+    const size_t q = target.find('?');
+    req.path = target.substr(0, q);
+    if (q != std::string::npos)
+        req.query = target.substr(q + 1);
+
+    size_t pos = line_end + 2;
+    while (pos < hdr_end)
+    {
+        line_end = c.in.find("\r\n", pos);
+        const std::string h = c.in.substr(pos, line_end - pos);
+        pos = line_end + 2;
+        const size_t colon = h.find(':');
+        if (colon == std::string::npos || colon == 0)
+        {
+            fail(400, "malformed header");
+            return;
+        }
+        req.headers.emplace_back(lower(h.substr(0, colon)), trim(h.substr(colon + 1)));
+    }
+
+    // HTTP/1.1 默认保持连接，1.0 要显式要求
+    const std::string *conn_hdr = req.header("connection");
+    const std::string conn_val = conn_hdr ? lower(*conn_hdr) : std::string();
+    const bool keep_alive = version == "HTTP/1.0" ? conn_val.find("keep-alive") != std::string::npos
+                                                  : conn_val.find("close") == std::string::npos;
+
+    if (req.header("transfer-encoding"))
+    {
+        fail(501, "chunked request bodies are not supported; send Content-Length");
+        return;
+    }
+    size_t body_len = 0;
+    if (const std::string *cl = req.header("content-length"))
+    {
+        char *endp = nullptr;
+        const unsigned long long v = std::strtoull(cl->c_str(), &endp, 10);
+        if (cl->empty() || !endp || *endp != '\0')
+        {
+            fail(400, "bad Content-Length");
+            return;
+        }
+        if (v > params_.max_body_bytes)
+        {
+            fail(413, "request body too large");
+            return;
+        }
+        body_len = (size_t)v;
+    }
+    const size_t total = hdr_end + 4 + body_len;
+    if (c.in.size() < total)
+    {
+        // curl 对较大的请求体会先等 100 Continue
+        const std::string *expect = req.header("expect");
+        if (expect && lower(*expect) == "100-continue" && !c.sent_continue)
+        {
+            c.wbuf += "HTTP/1.1 100 Continue\r\n\r\n";
+            c.sent_continue = true;
+        }
+        return;
+    }
+    req.body = c.in.substr(hdr_end + 4, body_len);
+    c.in.erase(0, total);
+    c.sent_continue = false;
+    req.remote = c.remote;
+    dispatch(c, std::move(req), keep_alive);
+}
+
+void http_server::dispatch(connection &c, http_request req, bool keep_alive)
+{
+    c.busy = true;
+    c.close_after = !keep_alive;
+
+    const route_entry *match = nullptr;
+    std::string allow;
+    for (const auto &r : routes_)
+    {
+        if (r.path != req.path)
+            continue;
+        if (r.method == req.method)
+        {
+            match = &r;
+            break;
+        }
+        allow += (allow.empty() ? "" : ", ") + r.method;
+    }
+    std::shared_ptr<http_response> resp(new http_response(c.st, match ? match->path : "unmatched", keep_alive));
+    if (!match)
+    {
+        if (allow.empty())
+            resp->send(404, "application/json", json_error_body("no such endpoint: " + req.path));
+        else
+            resp->send(405, "application/json", json_error_body("method not allowed"), {{"Allow", allow}});
+        return;
+    }
+
+    const http_handler *h = &match->handler;
+    {
+        std::lock_guard<std::mutex> lk(task_mtx_);
+        tasks_.push_back([h, req = std::move(req), resp]()
+                         {
+            try
+            {
+                (*h)(req, resp);
+            }
+            catch (const std::exception &e)
+            {
+                resp->send(500, "application/json", json_error_body(e.what()));
+            } });
+    }
+    task_cv_.notify_one();
+}
+
+void http_server::worker_main()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(task_mtx_);
+            task_cv_.wait(lk, [&]
+                          { return workers_stop_ || !tasks_.empty(); });
+            if (tasks_.empty())
+                return; // 停止且已做完
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void http_server::run()
+{
+    if (listen_fd_ == -1)
+        return;
+    {
+        std::lock_guard<std::mutex> lk(task_mtx_);
+        workers_stop_ = false;
+    }
+    for (int i = 0; i < std::max(1, params_.n_workers); ++i)
+        workers_.emplace_back([this]()
+                              { worker_main(); });
+
+    std::vector<pollfd> pfds;
+    while (!stopping_.load())
+    {
+        pfds.clear();
+        pfds.push_back({to_sock(listen_fd_), POLLIN, 0});
+        pfds.push_back({to_sock(wake_rd_), POLLIN, 0});
+        for (const auto &c : conns_)
+        {
+            short ev = 0;
+            if (!c->busy && !c->close_after)
+                ev |= POLLIN;
+            if (c->woff < c->wbuf.size())
+                ev |= POLLOUT;
+            pfds.push_back({c->fd, ev, 0});
+        }
+        if (sock_poll(pfds.data(), pfds.size(), 1000) < 0 && !sock_would_block())
+        {
+            std::cerr << "Warning: http_server: poll failed\n";
+            break;
+        }
+
+        if (pfds[1].revents)
+        {
+            waker_->pending.store(false);
+            char buf[256];
+            while (::recv(to_sock(wake_rd_), buf, (int)sizeof(buf), 0) > 0)
+            {
+            }
+        }
+        if (pfds[0].revents & POLLIN)
+        {
+            while (accept_one())
+            {
+            }
+        }
+
+        // pfds 只覆盖本轮开始时已有的连接；新接受的下一轮再 poll
+        const size_t n_polled = pfds.size() - 2;
+        const auto now = clock_type::now();
+        for (size_t i = 0; i < conns_.size(); ++i)
+        {
+            connection &c = *conns_[i];
+            const short rev = i < n_polled ? pfds[i + 2].revents : 0;
+            if (rev & (POLLERR | POLLNVAL))
+                c.dead = true;
+            else if (rev & (POLLIN | POLLHUP))
+            {
+                if (!c.busy && !c.close_after)
+                    on_readable(c);
+                else if (rev & POLLHUP)
+                    c.dead = true;
+            }
+            if (!c.dead)
+                flush(c);
+            if (!c.dead && !c.busy && c.wbuf.empty() &&
+                now - c.last > std::chrono::milliseconds(std::max(1, params_.keep_alive_ms)))
+                c.dead = true;
+        }
+
+        for (size_t i = 0; i < conns_.size();)
+        {
+            if (!conns_[i]->dead)
+            {
+                ++i;
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lk(conns_[i]->st->mtx);
+                conns_[i]->st->closed = true;
+                conns_[i]->st->out.clear();
+            }
+            sock_close(conns_[i]->fd);
+            conns_[i] = std::move(conns_.back());
+            conns_.pop_back();
+        }
+    }
+
+    for (auto &c : conns_)
+    {
+        {
+            std::lock_guard<std::mutex> lk(c->st->mtx);
+            c->st->closed = true;
+        }
+        sock_close(c->fd);
+    }
+    conns_.clear();
+    {
+        std::lock_guard<std::mutex> lk(task_mtx_);
+        workers_stop_ = true;
+    }
+    task_cv_.notify_all();
+    for (auto &t : workers_)
+        t.join();
+    workers_.clear();
+}
+
+std::string http_sse_event(const std::string &name, const std::string &data)
+{
+    std::string out;
+    if (!name.empty())
+        out += "event: " + name + "\n";
+    size_t i = 0;
+    for (;;)
+    {
+        const size_t nl = data.find('\n', i);
+        out += "data: ";
+        out.append(data, i, nl == std::string::npos ? std::string::npos : nl - i);
+        out += "\n";
+        if (nl == std::string::npos)
+            break;
+        i = nl + 1;
+    }
+    out += "\n";
+    return out;
+}
@@ -0,0 +1,144 @@
+// src/http_server.h
+// 进程内的 HTTP/1.1 服务端，只用系统 socket（POSIX / Winsock），不引入第三方库：
+// - 一个 I/O 线程用 poll（Windows 上为 WSAPoll）管理全部非阻塞连接：accept、读请求、写响应，keep-alive 复用连接；
+// - 请求读完后交给 n_workers 个工作线程执行 handler。handler 可以当场回包，也可以把 http_response 留给别的线程
+//   （例如 llm_pool 的完成回调）稍后回包，或者分块流式输出（SSE）；I/O 线程不会被任何 handler 卡住；
+// - 同一连接上的请求按顺序处理：上一个响应写完之前不解析下一个，管线化发来的请求留在读缓冲里。
+// 只实现本项目用到的子集：请求体按 Content-Length 读（不支持分块上传），没有 TLS，对外暴露时放在反向代理后面。
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using http_headers = std::vector<std::pair<std::string, std::string>>;
+
+struct http_request
+{
+    std::string method;
+    std::string path;    // 不含 ?query，未做 %XX 解码
+    std::string query;   // ? 之后的原文
+    http_headers headers; // 名字已转成小写
+    std::string body;
+    std::string remote;  // 对端地址
+
+    const std::string *header(const std::string &lower_name) const;
+    // query 里的参数（做 %XX 与 '+' 解码）；没有时返回 def
+    std::string param(const std::string &name, const std::string &def = std::string()) const;
+};
+
+struct http_conn_state;
+
+// 一次请求的响应写出端。线程安全，可以在任何线程里写；连接已断开时写入被丢弃。
+// 最后一个引用释放时还没回包的，自动回 500（流式已开始的补上结尾）
+class http_response
+{
+public:
+    ~http_response();
+
+    http_response(const http_response &) = delete;
+    http_response &operator=(const http_response &) = delete;
+
+    // 一次性回包（带 Content-Length）
+    void send(int status, const std::string &content_type, const std::string &body, const http_headers &extra = {});
+    // 流式：先写状态行与头（Transfer-Encoding: chunked），之后每次 write 一块，end 结束
+    void begin_stream(int status, const std::string &content_type, const http_headers &extra = {});
+    void write(const std::string &data);
+    void end();
+
+    // 对端已断开；长时间的流式输出可以据此提前收尾
+    bool closed() const;
+    bool started() const;
+
+private:
+    friend class http_server;
+    http_response(std::shared_ptr<http_conn_state> conn, std::string route, bool keep_alive);
+
+    void append_locked(const std::string &bytes);
+    void finish_locked(int status);
+
+    std::shared_ptr<http_conn_state> conn_;
+    std::string route_; // 指标的 route 标签（注册的路径；没匹配上为 "unmatched"）
+    bool keep_alive_ = true;
+    std::chrono::steady_clock::time_point t_start_;
+    int state_ = 0; // 0 未开始 / 1 流式中 / 2 已结束；由 conn_ 的锁保护
+    int status_ = 0;
+};
+
+using http_handler = std::function<void(const http_request &, std::shared_ptr<http_response>)>;
+
+struct http_server_params
+{
+    std::string host = "127.0.0.1";
+    int port = 8080;                 // 0 表示由系统挑一个空闲端口（listen 之后用 port() 取）
+    int n_workers = 4;
+    size_t max_header_bytes = 16 << 10;
+    size_t max_body_bytes = 8 << 20;
+    int keep_alive_ms = 30000;       // 空闲连接（含读到一半的请求）超过它就关掉
+    size_t max_connections = 1024;
+};
+
+class http_server
+{
+public:
+    explicit http_server(const http_server_params &params = http_server_params());
+    ~http_server();
+
+    http_server(const http_server &) = delete;
+    http_server &operator=(const http_server &) = delete;
+
+    // 按 method + path 精确匹配；须在 run() 之前登记
+    void route(const std::string &method, const std::string &path, http_handler handler);
+
+    bool listen(std::string &err);
+    int port() const { return port_; }
+
+    // I/O 循环（阻塞），直到 stop()；返回前等工作线程把已接到的请求执行完
+    void run();
+    // 线程安全，可以在信号处理之外的任何线程里调用
+    void stop();
+
+private:
+    struct route_entry
+    {
+        std::string method;
+        std::string path;
+        http_handler handler;
+    };
+    struct connection;
+
+    bool accept_one();
+    void on_readable(connection &c);
+    void flush(connection &c);
+    // 读缓冲里有完整请求就派给工作线程；有错时回错误并标记关闭
+    void try_dispatch(connection &c);
+    void dispatch(connection &c, http_request req, bool keep_alive);
+    void worker_main();
+
+    http_server_params params_;
+    std::vector<route_entry> routes_;
+    int port_ = 0;
+    intptr_t listen_fd_ = -1;
+    intptr_t wake_rd_ = -1;
+    std::shared_ptr<struct http_waker> waker_;
+    std::atomic<bool> stopping_{false};
+    std::vector<std::unique_ptr<connection>> conns_;
+
+    std::mutex task_mtx_;
+    std::condition_variable task_cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool workers_stop_ = false;
+    std::vector<std::thread> workers_;
+};
+
+// SSE 的一个事件："event: <name>\n"（name 为空时省略）+ 每行数据一个 "data: ...\n"，最后空一行
+std::string http_sse_event(const std::string &name, const std::string &data);
@@ -0,0 +1,144 @@
+// src/hybrid_search.cpp
+#include "hybrid_search.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+hybrid_searcher::hybrid_searcher(const bm25_segments &sparse, const vector_index &dense, llm_embedder &embedder,
+                                 const hybrid_params &params)
+    : sparse_(sparse), dense_(dense), embedder_(embedder), params_(params)
+{
+    worker_ = std::thread([this]()
+                          { worker_loop(); });
+}
+
+hybrid_searcher::~hybrid_searcher()
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        quit_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+void hybrid_searcher::worker_loop()
+{
+    std::unique_lock<std::mutex> lk(mtx_);
+    for (;;)
+    {
+        cv_.wait(lk, [this]()
+                 { return quit_ || has_task_; });
+        if (quit_)
+            return;
+        std::function<void()> task = std::move(task_);
+        has_task_ = false;
+        lk.unlock();
+        task();
+        lk.lock();
+        task_done_ = true;
+        cv_.notify_all();
+    }
+}
+
+std::vector<hybrid_hit> hybrid_searcher::search(const std::string &query, size_t top_k, std::string &err,
+                                                std::vector<float> *query_vec)
+{
+    const size_t n_cand = std::max(top_k, params_.n_candidates);
+
+    // 稠密一路：向量化 + HNSW，交给工作线程
+    std::vector<vec_hit> dense_hits;
+    std::vector<float> q;
+    std::string dense_err;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        task_ = [&]()
+        {
+            if (!embedder_.embed(query, q, dense_err))
+                return;
+            if (q.size() != dense_.dim())
+            {
+                dense_err = "query embedding dim does not match the vector index";
+                return;
+            }
+            dense_hits = dense_.search(q.data(), n_cand, params_.ef);
+        };
+        has_task_ = true;
+        task_done_ = false;
+    }
+    cv_.notify_all();
+
+    // 稀疏一路：在调用线程上同时进行
+    const std::vector<bm25_hit> sparse_hits = sparse_.search(query, n_cand);
+
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        cv_.wait(lk, [this]()
+                 { return task_done_; });
+    }
+
+    if (!dense_err.empty())
+    {
+        err = "dense retrieval failed, using BM25 only: " + dense_err;
+        q.clear();
+    }
+    if (query_vec)
+        *query_vec = std::move(q);
+    return hybrid_fuse(sparse_hits, dense_hits, dense_.params().metric, params_, top_k);
+}
+
+std::vector<hybrid_hit> hybrid_fuse(const std::vector<bm25_hit> &sparse, const std::vector<vec_hit> &dense,
+                                    vec_metric metric, const hybrid_params &params, size_t top_k)
+{
+    std::vector<hybrid_hit> hits;
+    std::unordered_map<int64_t, size_t> pos;
+    auto slot = [&](int64_t key) -> hybrid_hit &
+    {
+        auto it = pos.find(key);
+        if (it != pos.end())
+            return hits[it->second];
+        pos.emplace(key, hits.size());
+        hits.emplace_back();
+        hits.back().doc_key = key;
+        return hits.back();
+    };
+
+    float max_bm25 = 0.0f;
+    for (size_t i = 0; i < sparse.size(); ++i)
+    {
+        hybrid_hit &h = slot(sparse[i].doc_key);
+        h.bm25 = sparse[i].score;
+        h.sparse_rank = (int)i + 1;
+        max_bm25 = std::max(max_bm25, h.bm25);
+    }
+    float max_dense = 0.0f;
+    for (size_t i = 0; i < dense.size(); ++i)
+    {
+        hybrid_hit &h = slot(dense[i].doc_key);
+        h.dense = metric == vec_metric::ip ? -dense[i].distance : 1.0f / (1.0f + dense[i].distance);
+        h.dense_rank = (int)i + 1;
+        max_dense = std::max(max_dense, h.dense);
+    }
+
+    for (auto &h : hits)
+    {
+        if (params.fusion == hybrid_fusion::rrf)
+        {
+            h.score = (h.sparse_rank ? 1.0f / (params.rrf_k + (float)h.sparse_rank) : 0.0f) +
+                      (h.dense_rank ? 1.0f / (params.rrf_k + (float)h.dense_rank) : 0.0f);
+        }
+        else
+        {
+            // 与 rag_cli.py::normalize 相同：除以最大值，最大值 <= 0 时整路记 0
+            const float s = max_bm25 > 0.0f ? h.bm25 / max_bm25 : 0.0f;
+            const float d = (max_dense > 0.0f && h.dense_rank) ? std::max(0.0f, h.dense) / max_dense : 0.0f;
+            h.score = params.w_sparse * s + params.w_dense * d;
+        }
+    }
+
+    std::stable_sort(hits.begin(), hits.end(), [](const hybrid_hit &a, const hybrid_hit &b)
+                     { return a.score > b.score; });
+    if (hits.size() > top_k)
+        hits.resize(top_k);
+    return hits;
+}
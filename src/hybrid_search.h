@@ -0,0 +1,82 @@
+// src/hybrid_search.h
+// BM25 + 稠密向量的混合检索：两路检索同时跑（稠密一路含 query 向量化，放在常驻工作线程里），
+// 再用 RRF 或 rag_cli.py 式的“按最大值归一后加权”融合，输出按融合分数排序的 documents.id。
+// 尾延迟约等于两路中较慢的一路，而不是两者之和。
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bm25_segments.h"
+#include "llm_embed.h"
+#include "vector_index.h"
+
+enum class hybrid_fusion
+{
+    rrf,      // sum 1 / (rrf_k + rank)
+    weighted, // w_sparse * bm25 / max_bm25 + w_dense * sim / max_sim
+};
+
+struct hybrid_params
+{
+    hybrid_fusion fusion = hybrid_fusion::rrf;
+    float rrf_k = 60.0f;
+    float w_sparse = 0.5f;
+    float w_dense = 0.5f;
+    size_t n_candidates = 20; // 每一路取的候选数（至少为 top_k）
+    size_t ef = 0;            // HNSW ef，0 为索引默认值
+};
+
+struct hybrid_hit
+{
+    int64_t doc_key = 0;
+    float score = 0.0f;      // 融合分数
+    float bm25 = 0.0f;       // 不在 BM25 候选里时为 0
+    float dense = 0.0f;      // 相似度（ip 为内积，l2 为 1 / (1 + d)）；不在稠密候选里时为 0
+    int sparse_rank = 0;     // 1 起；0 表示不在该路候选里
+    int dense_rank = 0;
+};
+
+class hybrid_searcher
+{
+public:
+    // 三者由调用方持有，生命周期需覆盖 hybrid_searcher；embedder 只在本对象的工作线程里使用
+    hybrid_searcher(const bm25_segments &sparse, const vector_index &dense, llm_embedder &embedder,
+                    const hybrid_params &params = hybrid_params());
+    ~hybrid_searcher();
+
+    hybrid_searcher(const hybrid_searcher &) = delete;
+    hybrid_searcher &operator=(const hybrid_searcher &) = delete;
+
+    // 非线程安全（共用一个工作线程和 embedder）。稠密一路失败时退化为纯 BM25，并在 err 中说明。
+    // query_vec 非空时带回查询向量（稠密一路失败时为空）
+    std::vector<hybrid_hit> search(const std::string &query, size_t top_k, std::string &err,
+                                   std::vector<float> *query_vec = nullptr);
+
+    const hybrid_params &params() const { return params_; }
+
+private:
+    void worker_loop();
+
+    const bm25_segments &sparse_;
+    const vector_index &dense_;
+    llm_embedder &embedder_;
+    hybrid_params params_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::function<void()> task_;
+    bool has_task_ = false;
+    bool task_done_ = false;
+    bool quit_ = false;
+    std::thread worker_;
+};
+
+// 融合两路结果（已按各自分数排序）；暴露出来便于离线评估不同权重
+std::vector<hybrid_hit> hybrid_fuse(const std::vector<bm25_hit> &sparse, const std::vector<vec_hit> &dense,
+                                    vec_metric metric, const hybrid_params &params, size_t top_k);
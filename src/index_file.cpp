@@ -0,0 +1,164 @@
+// src/index_file.cpp
+#include "index_file.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+constexpr size_t k_align = 64;
+const char k_magic[8] = {'R', 'A', 'G', 'I', 'N', 'D', 'E', 'X'};
+
+inline uint64_t align_up(uint64_t v)
+{
+    return (v + k_align - 1) & ~(uint64_t)(k_align - 1);
+}
+
+void fill_tag(char dst[8], const std::string &tag)
+{
+    std::memset(dst, 0, 8);
+    std::memcpy(dst, tag.data(), tag.size() < 8 ? tag.size() : 8);
+}
+} // namespace
+
+void index_file_writer::add(const char *tag, const void *data, size_t size)
+{
+    sections_.push_back({tag, data, size});
+}
+
+bool index_file_writer::write(const std::string &path, uint32_t kind, std::string &err) const
+{
+    index_file_header h{};
+    std::memcpy(h.magic, k_magic, 8);
+    h.version = k_index_file_version;
+    h.byte_order = k_index_byte_order;
+    h.kind = kind;
+    h.n_sections = (uint32_t)sections_.size();
+
+    std::vector<index_file_section> table(sections_.size());
+    uint64_t off = align_up(sizeof(h) + table.size() * sizeof(index_file_section));
+    for (size_t i = 0; i < sections_.size(); ++i)
+    {
+        fill_tag(table[i].tag, sections_[i].tag);
+        table[i].offset = off;
+        table[i].size = sections_[i].size;
+        off = align_up(off + sections_[i].size);
+    }
+    h.file_size = off;
+
+    const std::string tmp = path + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+    {
+        err = "cannot write " + tmp;
+        return false;
+    }
+
+    static const char zeros[k_align] = {0};
+    bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1;
+    if (ok && !table.empty())
+        ok = std::fwrite(table.data(), sizeof(index_file_section), table.size(), f) == table.size();
+    uint64_t pos = sizeof(h) + table.size() * sizeof(index_file_section);
+    for (size_t i = 0; ok && i < sections_.size(); ++i)
+    {
+        const size_t pad = (size_t)(table[i].offset - pos);
+        if (pad)
+            ok = std::fwrite(zeros, 1, pad, f) == pad;
+        if (ok && sections_[i].size)
+            ok = std::fwrite(sections_[i].data, 1, sections_[i].size, f) == sections_[i].size;
+        pos = table[i].offset + sections_[i].size;
+    }
+    if (ok && pos < h.file_size)
+        ok = std::fwrite(zeros, 1, (size_t)(h.file_size - pos), f) == (size_t)(h.file_size - pos);
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok)
+    {
+        std::remove(tmp.c_str());
+        err = "write failed: " + tmp;
+        return false;
+    }
+
+#ifdef _WIN32
+    std::remove(path.c_str()); // Windows 上 rename 不覆盖已存在的文件
+#endif
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        err = "rename failed: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool index_file_reader::open(const std::string &path, uint32_t expected_kind, std::string &err)
+{
+    auto f = std::make_shared<mmap_file>();
+    if (!f->open(path, err))
+        return false;
+
+    const uint8_t *base = f->data();
+    const size_t size = f->size();
+    if (size < sizeof(index_file_header))
+    {
+        err = "truncated index file: " + path;
+        return false;
+    }
+    const index_file_header *h = (const index_file_header *)base;
+    if (std::memcmp(h->magic, k_magic, 8) != 0)
+    {
+        err = "not an index file: " + path;
+        return false;
+    }
+    if (h->byte_order != k_index_byte_order)
+    {
+        err = "index file has foreign byte order: " + path;
+        return false;
+    }
+    if (h->version != k_index_file_version)
+    {
+        err = "unsupported index version " + std::to_string(h->version) + ": " + path;
+        return false;
+    }
+    if (h->kind != expected_kind)
+    {
+        err = "wrong index kind: " + path;
+        return false;
+    }
+    if (h->file_size != size || sizeof(*h) + (uint64_t)h->n_sections * sizeof(index_file_section) > size)
+    {
+        err = "index file size mismatch (truncated?): " + path;
+        return false;
+    }
+
+    const index_file_section *sec = (const index_file_section *)(base + sizeof(*h));
+    for (uint32_t i = 0; i < h->n_sections; ++i)
+    {
+        if (sec[i].offset > size || sec[i].size > size - sec[i].offset)
+        {
+            err = "section out of range: " + path;
+            return false;
+        }
+    }
+
+    file_ = std::move(f);
+    sections_ = sec;
+    n_sections_ = h->n_sections;
+    return true;
+}
+
+bool index_file_reader::raw(const char *tag, const void *&data, size_t &size, std::string &err) const
+{
+    char want[8];
+    fill_tag(want, tag);
+    for (uint32_t i = 0; i < n_sections_; ++i)
+    {
+        if (std::memcmp(sections_[i].tag, want, 8) == 0)
+        {
+            data = file_->data() + sections_[i].offset;
+            size = (size_t)sections_[i].size;
+            return true;
+        }
+    }
+    err = std::string("missing section ") + tag;
+    return false;
+}
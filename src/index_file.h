@@ -0,0 +1,126 @@
+// src/index_file.h
+// 检索索引的磁盘格式：一个文件 = 文件头 + 区段表 + 若干 64 字节对齐的区段。
+// 区段内容就是内存里的定长数组原样落盘，打开时 mmap 后直接拿指针使用，不做解析也不拷贝。
+//
+//   [index_file_header][index_file_section x n_sections][pad][section 0][pad][section 1]...
+//
+// 只支持小端机器（x86 / ARM 默认都是）；文件头里的 byte_order 用于拒绝错误来源的文件。
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mmap_file.h"
+
+constexpr uint32_t k_index_file_version = 1;
+constexpr uint32_t k_index_byte_order = 0x01020304;
+
+// 索引种类（fourcc）
+constexpr uint32_t index_fourcc(char a, char b, char c, char d)
+{
+    return (uint32_t)(uint8_t)a | ((uint32_t)(uint8_t)b << 8) | ((uint32_t)(uint8_t)c << 16) | ((uint32_t)(uint8_t)d << 24);
+}
+constexpr uint32_t k_index_kind_bm25 = index_fourcc('B', 'M', '2', '5');
+constexpr uint32_t k_index_kind_vector = index_fourcc('V', 'E', 'C', '1');
+
+struct index_file_header
+{
+    char magic[8]; // "RAGINDEX"
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t kind;
+    uint32_t n_sections;
+    uint64_t file_size;
+};
+
+struct index_file_section
+{
+    char tag[8]; // 区段名，不足 8 字节补 0
+    uint64_t offset;
+    uint64_t size;
+};
+
+static_assert(sizeof(index_file_header) == 32, "index_file_header layout");
+static_assert(sizeof(index_file_section) == 24, "index_file_section layout");
+
+// 只读数组视图；指向 mmap 区域或构建期持有的 vector
+template <typename T>
+class array_view
+{
+public:
+    array_view() = default;
+    array_view(const T *data, size_t size) : data_(data), size_(size) {}
+    array_view(const std::vector<T> &v) : data_(v.data()), size_(v.size()) {}
+
+    const T *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const T &operator[](size_t i) const { return data_[i]; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+
+private:
+    const T *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+class index_file_writer
+{
+public:
+    // data 在 write() 之前必须保持有效
+    void add(const char *tag, const void *data, size_t size);
+
+    template <typename T>
+    void add(const char *tag, const std::vector<T> &v)
+    {
+        add(tag, v.data(), v.size() * sizeof(T));
+    }
+
+    // 先写临时文件再 rename，读端不会看到写了一半的索引
+    bool write(const std::string &path, uint32_t kind, std::string &err) const;
+
+private:
+    struct pending
+    {
+        std::string tag;
+        const void *data;
+        size_t size;
+    };
+    std::vector<pending> sections_;
+};
+
+class index_file_reader
+{
+public:
+    bool open(const std::string &path, uint32_t expected_kind, std::string &err);
+
+    // 取区段为 T 数组；区段不存在、大小不是 sizeof(T) 的整数倍或未对齐时返回 false
+    template <typename T>
+    bool get(const char *tag, array_view<T> &out, std::string &err) const
+    {
+        const void *p = nullptr;
+        size_t n = 0;
+        if (!raw(tag, p, n, err))
+            return false;
+        if (n % sizeof(T) != 0 || ((uintptr_t)p % alignof(T)) != 0)
+        {
+            err = std::string("bad size/alignment for section ") + tag;
+            return false;
+        }
+        out = array_view<T>((const T *)p, n / sizeof(T));
+        return true;
+    }
+
+    // 整个映射；调用方持有它即可让所有 array_view 保持有效
+    std::shared_ptr<const mmap_file> mapping() const { return file_; }
+
+private:
+    bool raw(const char *tag, const void *&data, size_t &size, std::string &err) const;
+
+    std::shared_ptr<mmap_file> file_;
+    const index_file_section *sections_ = nullptr;
+    uint32_t n_sections_ = 0;
+};
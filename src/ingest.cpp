@@ -0,0 +1,1029 @@
+// src/ingest.cpp
+#include "ingest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include <sqlite3.h>
+
+#include "bm25_index.h"
+#include "bounded_queue.h"
+#include "chunk_tokens.h"
+#include "cpu_tuning.h"
+#include "llm_embed.h"
+#include "text_tokenize.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+// 合法 UTF-8 序列的长度（拒绝过长编码与代理区，与 Python 的严格解码一致）；非法返回 0
+size_t utf8_valid_len(const unsigned char *s, size_t n)
+{
+    const unsigned char c = s[0];
+    if (c < 0x80)
+        return 1;
+    size_t len;
+    uint32_t cp;
+    if ((c & 0xE0) == 0xC0)
+    {
+        len = 2;
+        cp = c & 0x1F;
+    }
+    else if ((c & 0xF0) == 0xE0)
+    {
+        len = 3;
+        cp = c & 0x0F;
+    }
+    else if ((c & 0xF8) == 0xF0)
+    {
+        len = 4;
+        cp = c & 0x07;
+    }
+    else
+    {
+        return 0;
+    }
+    if (n < len)
+        return 0;
+    for (size_t i = 1; i < len; ++i)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+            return 0;
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    static const uint32_t k_min[5] = {0, 0, 0x80, 0x800, 0x10000};
+    if (cp < k_min[len] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+        return 0;
+    return len;
+}
+
+bool utf8_valid(const std::string &s)
+{
+    const unsigned char *p = (const unsigned char *)s.data();
+    for (size_t i = 0; i < s.size();)
+    {
+        const size_t len = utf8_valid_len(p + i, s.size() - i);
+        if (!len)
+            return false;
+        i += len;
+    }
+    return true;
+}
+
+std::string utf8_drop_invalid(const std::string &s)
+{
+    std::string out;
+    out.reserve(s.size());
+    const unsigned char *p = (const unsigned char *)s.data();
+    for (size_t i = 0; i < s.size();)
+    {
+        const size_t len = utf8_valid_len(p + i, s.size() - i);
+        if (!len)
+        {
+            ++i;
+            continue;
+        }
+        out.append(s, i, len);
+        i += len;
+    }
+    return out;
+}
+
+#ifdef _WIN32
+// 与 read_txt_md 的 gbk 回退对应
+bool gbk_to_utf8(const std::string &in, std::string &out)
+{
+    if (in.empty() || in.size() > (size_t)INT32_MAX)
+        return false;
+    const int wn = MultiByteToWideChar(936, MB_ERR_INVALID_CHARS, in.data(), (int)in.size(), nullptr, 0);
+    if (wn <= 0)
+        return false;
+    std::wstring w((size_t)wn, L'\0');
+    MultiByteToWideChar(936, MB_ERR_INVALID_CHARS, in.data(), (int)in.size(), &w[0], wn);
+    const int n = WideCharToMultiByte(CP_UTF8, 0, w.data(), wn, nullptr, 0, nullptr, nullptr);
+    if (n <= 0)
+        return false;
+    out.assign((size_t)n, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, w.data(), wn, &out[0], n, nullptr, nullptr);
+    return true;
+}
+#endif
+
+// Python str.isspace() 为真的码点
+bool is_py_space(uint32_t cp)
+{
+    if (cp == ' ' || (cp >= 0x09 && cp <= 0x0D) || (cp >= 0x1C && cp <= 0x1F))
+        return true;
+    if (cp < 0x85)
+        return false;
+    return cp == 0x85 || cp == 0xA0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 ||
+           cp == 0x2029 || cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+// str.strip()：返回 [b, e) 内去掉首尾空白后的字节区间
+void py_strip(const std::string &s, size_t &b, size_t &e)
+{
+    while (b < e)
+    {
+        uint32_t cp;
+        const size_t len = utf8_decode(s.data() + b, e - b, cp);
+        if (!is_py_space(cp))
+            break;
+        b += len;
+    }
+    while (e > b)
+    {
+        size_t start = e - 1;
+        while (start > b && ((unsigned char)s[start] & 0xC0) == 0x80)
+            --start;
+        uint32_t cp;
+        utf8_decode(s.data() + start, e - start, cp);
+        if (!is_py_space(cp))
+            break;
+        e = start;
+    }
+}
+
+std::string lower_ascii(std::string s)
+{
+    for (char &c : s)
+    {
+        if (c >= 'A' && c <= 'Z')
+            c = (char)(c - 'A' + 'a');
+    }
+    return s;
+}
+
+// ingest_files 表里的一行：上次入库时文件的样子
+struct file_state
+{
+    std::string hash;
+    int64_t size = 0;
+    int64_t mtime = 0;
+    int64_t n_chunks = 0;
+};
+
+// FNV-1a 64，十六进制；只用来判断文件内容是否变了
+std::string content_hash(const std::string &bytes)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : bytes)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return buf;
+}
+
+struct parsed_file
+{
+    bool ok = false;
+    bool unchanged = false; // 与 ingest_files 记录的一致，不用重新入库
+    bool invalid_utf8 = false;
+    std::string error;
+    std::string hash;
+    int64_t size = 0;
+    int64_t mtime = 0;
+    std::string doc_id;
+    std::string doc_type;
+    std::vector<ingest_chunk> chunks;
+};
+
+// prev 为该文件上次入库的记录（没有则为空）；大小和 mtime 都没变时连文件都不读
+parsed_file parse_file(const std::string &path, const ingest_params &params, const file_state *prev)
+{
+    parsed_file pf;
+    const fs::path p = fs::u8path(path);
+    pf.doc_id = p.filename().u8string();
+    const std::string ext = lower_ascii(p.extension().u8string());
+    pf.doc_type = ext.empty() ? "unknown" : ext.substr(1);
+    if (ext != ".txt" && ext != ".md")
+    {
+        pf.error = ext == ".pdf" ? "pdf is not supported by the native ingest (use python/ingest.py)" : "unsupported type";
+        return pf;
+    }
+
+    std::error_code ec;
+    pf.size = (int64_t)fs::file_size(p, ec);
+    pf.mtime = ec ? 0 : (int64_t)fs::last_write_time(p, ec).time_since_epoch().count();
+    if (prev && !params.rebuild && !ec && prev->size == pf.size && prev->mtime == pf.mtime)
+    {
+        pf.ok = pf.unchanged = true;
+        pf.hash = prev->hash;
+        return pf;
+    }
+
+    std::ifstream f(p, std::ios::binary);
+    if (!f)
+    {
+        pf.error = "failed to open";
+        return pf;
+    }
+    std::string raw((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    pf.hash = content_hash(raw);
+    if (prev && !params.rebuild && prev->hash == pf.hash)
+    {
+        // 只是 mtime 变了（touch、重新检出）
+        pf.ok = pf.unchanged = true;
+        return pf;
+    }
+    if (raw.size() >= 3 && raw.compare(0, 3, "\xEF\xBB\xBF") == 0)
+        raw.erase(0, 3);
+    if (!utf8_valid(raw))
+    {
+        std::string conv;
+#ifdef _WIN32
+        if (gbk_to_utf8(raw, conv))
+            raw.swap(conv);
+        else
+#endif
+        {
+            raw = utf8_drop_invalid(raw);
+            pf.invalid_utf8 = true;
+        }
+    }
+
+    pf.chunks = ingest_chunk_text(ingest_normalize_text(raw), params.chunk_size, params.chunk_overlap);
+    pf.ok = true;
+    return pf;
+}
+
+struct ingest_row
+{
+    int64_t id = 0;
+    std::string text;
+};
+
+struct embedded_batch
+{
+    std::vector<int64_t> ids;
+    std::vector<float> vecs; // ids.size() * dim
+};
+
+bool exec_sql(sqlite3 *db, const char *sql, std::string &err)
+{
+    char *msg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &msg) != SQLITE_OK)
+    {
+        err = std::string(sql) + ": " + (msg ? msg : sqlite3_errmsg(db));
+        sqlite3_free(msg);
+        return false;
+    }
+    return true;
+}
+
+// 与 SQLite.py::connect + init_schema 相同
+bool open_documents_db(const std::string &path, sqlite3 *&db, std::string &err)
+{
+    const fs::path parent = fs::u8path(path).parent_path();
+    std::error_code ec;
+    if (!parent.empty())
+        fs::create_directories(parent, ec);
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK)
+    {
+        err = "failed to open db: " + path + (db ? std::string(": ") + sqlite3_errmsg(db) : "");
+        return false;
+    }
+    return exec_sql(db, "PRAGMA journal_mode=WAL;", err) && exec_sql(db, "PRAGMA synchronous=NORMAL;", err) &&
+           exec_sql(db,
+                    "CREATE TABLE IF NOT EXISTS documents ("
+                    " id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                    " doc_id TEXT NOT NULL,"
+                    " doc_path TEXT NOT NULL,"
+                    " doc_type TEXT NOT NULL,"
+                    " chunk_id INTEGER NOT NULL,"
+                    " text TEXT NOT NULL,"
+                    " start_char INTEGER NOT NULL,"
+                    " end_char INTEGER NOT NULL,"
+                    " page_start INTEGER,"
+                    " page_end INTEGER,"
+                    " line_start INTEGER,"
+                    " line_end INTEGER,"
+                    " created_at INTEGER NOT NULL);",
+                    err) &&
+           exec_sql(db, "CREATE INDEX IF NOT EXISTS idx_docid_chunk ON documents(doc_id, chunk_id);", err) &&
+           exec_sql(db, "CREATE INDEX IF NOT EXISTS idx_docpath ON documents(doc_path);", err);
+}
+
+// 增量入库用的两张表：ingest_files 记录每个文件上次入库的状态；
+// ingest_pending 是已从 documents 删掉、但还没作为墓碑写进段目录的 id
+bool open_ingest_tables(sqlite3 *db, std::string &err)
+{
+    return exec_sql(db,
+                    "CREATE TABLE IF NOT EXISTS ingest_files ("
+                    " doc_path TEXT PRIMARY KEY,"
+                    " content_hash TEXT NOT NULL,"
+                    " size INTEGER NOT NULL,"
+                    " mtime INTEGER NOT NULL,"
+                    " n_chunks INTEGER NOT NULL,"
+                    " updated_at INTEGER NOT NULL);",
+                    err) &&
+           exec_sql(db, "CREATE TABLE IF NOT EXISTS ingest_pending (id INTEGER PRIMARY KEY);", err);
+}
+
+bool load_file_states(sqlite3 *db, std::unordered_map<std::string, file_state> &out, std::string &err)
+{
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT doc_path, content_hash, size, mtime, n_chunks FROM ingest_files", -1, &stmt, nullptr) !=
+        SQLITE_OK)
+    {
+        err = std::string("failed to prepare: ") + sqlite3_errmsg(db);
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const unsigned char *path = sqlite3_column_text(stmt, 0);
+        const unsigned char *hash = sqlite3_column_text(stmt, 1);
+        if (!path || !hash)
+            continue;
+        file_state &st = out[std::string((const char *)path, (size_t)sqlite3_column_bytes(stmt, 0))];
+        st.hash.assign((const char *)hash, (size_t)sqlite3_column_bytes(stmt, 1));
+        st.size = sqlite3_column_int64(stmt, 2);
+        st.mtime = sqlite3_column_int64(stmt, 3);
+        st.n_chunks = sqlite3_column_int64(stmt, 4);
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+// path 是否在 docs_dir 之下（按路径分量比较，docs 不会匹配 docs2/...）
+bool path_under(const std::string &path, const std::string &dir)
+{
+    const fs::path rel = fs::u8path(path).lexically_relative(fs::u8path(dir));
+    return !rel.empty() && *rel.begin() != "..";
+}
+
+double ms_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+} // namespace
+
+std::vector<std::string> ingest_list_docs(const std::string &docs_dir)
+{
+    std::vector<std::string> out;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(fs::u8path(docs_dir), ec), end; !ec && it != end; it.increment(ec))
+    {
+        if (!it->is_regular_file(ec))
+            continue;
+        const std::string ext = lower_ascii(it->path().extension().u8string());
+        if (ext == ".pdf" || ext == ".txt" || ext == ".md")
+            out.push_back(it->path().u8string());
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+std::string ingest_normalize_text(const std::string &raw)
+{
+    // 一趟完成 \r\n|\r → \n、[ \t]+ → " "、\n{3,} → \n\n，三类字符互不重叠，与逐条 re.sub 的结果相同
+    std::string out;
+    out.reserve(raw.size());
+    bool in_space = false;
+    int n_newlines = 0;
+    for (size_t i = 0; i < raw.size(); ++i)
+    {
+        char c = raw[i];
+        if (c == '\r')
+        {
+            if (i + 1 < raw.size() && raw[i + 1] == '\n')
+                ++i;
+            c = '\n';
+        }
+        if (c == ' ' || c == '\t')
+        {
+            n_newlines = 0;
+            if (!in_space)
+                out.push_back(' ');
+            in_space = true;
+            continue;
+        }
+        in_space = false;
+        if (c == '\n')
+        {
+            if (++n_newlines <= 2)
+                out.push_back('\n');
+            continue;
+        }
+        n_newlines = 0;
+        out.push_back(c);
+    }
+    size_t b = 0, e = out.size();
+    py_strip(out, b, e);
+    return out.substr(b, e - b);
+}
+
+std::vector<ingest_chunk> ingest_chunk_text(const std::string &text, size_t chunk_size, size_t chunk_overlap)
+{
+    std::vector<ingest_chunk> out;
+    if (chunk_size == 0 || chunk_overlap >= chunk_size)
+        return out;
+
+    // 码点下标 → 字节偏移
+    std::vector<size_t> off;
+    off.reserve(text.size() + 1);
+    for (size_t i = 0; i < text.size();)
+    {
+        off.push_back(i);
+        uint32_t cp;
+        i += utf8_decode(text.data() + i, text.size() - i, cp);
+    }
+    const size_t n = off.size();
+    off.push_back(text.size());
+
+    // 行号：text[:pos].count("\n") + 1；st、ed 都单调递增，各用一个游标累计
+    size_t st_cursor = 0, ed_cursor = 0;
+    int64_t st_lines = 0, ed_lines = 0;
+    auto count_to = [&](size_t &cursor, int64_t &lines, size_t byte_pos)
+    {
+        for (; cursor < byte_pos; ++cursor)
+            lines += text[cursor] == '\n';
+        return lines + 1;
+    };
+
+    size_t start = 0;
+    while (start < n)
+    {
+        const size_t end = std::min(n, start + chunk_size);
+        size_t b = off[start], e = off[end];
+        py_strip(text, b, e);
+        if (b < e)
+        {
+            ingest_chunk c;
+            c.chunk_id = (int)out.size();
+            c.text.assign(text, b, e - b);
+            c.start_char = (int64_t)start;
+            c.end_char = (int64_t)end;
+            c.line_start = count_to(st_cursor, st_lines, off[start]);
+            c.line_end = count_to(ed_cursor, ed_lines, off[end]);
+            out.push_back(std::move(c));
+        }
+        if (end == n)
+            break;
+        start = end - chunk_overlap;
+    }
+    return out;
+}
+
+namespace
+{
+// 段模式的收尾：新行写成一个段、墓碑写进 MANIFEST，再清掉 ingest_pending 并按策略合并。
+// 写 MANIFEST 之后、清 ingest_pending 之前崩溃只会让下次重复打同样的墓碑，没有副作用
+bool commit_segments(const ingest_params &params, bm25_segments &segs, std::vector<bm25_builder> &shards,
+                     const std::vector<int64_t> &tombstones, ingest_stats &stats, std::string &err)
+{
+    const auto t1 = std::chrono::steady_clock::now();
+    const bm25_builder added = bm25_builder::merge_shards(shards);
+    stats.merge_ms = ms_since(t1);
+
+    const auto t2 = std::chrono::steady_clock::now();
+    if ((added.size() || !tombstones.empty()) && !segs.add_segment(added, tombstones, err))
+        return false;
+    stats.save_ms = ms_since(t2);
+    stats.n_tombstones = tombstones.size();
+
+    if (!tombstones.empty())
+    {
+        sqlite3 *db = nullptr;
+        const bool ok = sqlite3_open_v2(params.db_path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK &&
+                        exec_sql(db, "DELETE FROM ingest_pending", err);
+        if (!ok && err.empty())
+            err = "failed to open db: " + params.db_path;
+        sqlite3_close(db);
+        if (!ok)
+            return false;
+    }
+
+    const auto t3 = std::chrono::steady_clock::now();
+    if (!segs.merge(params.merge, stats.n_merged, err))
+        return false;
+    stats.merge_ms += ms_since(t3);
+    stats.n_segments = segs.n_segments();
+    return true;
+}
+
+// 入库成功后给新行补上生成模型的 token 缓存（chunk_tokens.h）；没给 token_model_path 时什么都不做
+bool update_chunk_tokens(const ingest_params &params, const llama_model *model, int n_threads, ingest_stats &stats,
+                         std::string &err)
+{
+    if (!model)
+        return true;
+    const auto t = std::chrono::steady_clock::now();
+    chunk_tokens_stats st;
+    if (!chunk_tokens_update(params.db_path, llama_model_get_vocab(model), n_threads, st, err))
+        return false;
+    stats.n_token_rows = st.n_added;
+    stats.token_ms = ms_since(t);
+    return true;
+}
+} // namespace
+
+bool ingest_run(const ingest_params &params, ingest_stats &stats, std::string &err)
+{
+    stats = ingest_stats();
+    const auto t0 = std::chrono::steady_clock::now();
+
+    const std::vector<std::string> files = ingest_list_docs(params.docs_dir);
+    stats.n_files = files.size();
+    if (files.empty())
+    {
+        err = "no docs found in " + params.docs_dir;
+        return false;
+    }
+
+    sqlite3 *db = nullptr;
+    std::unordered_map<std::string, file_state> known;
+    if (!open_documents_db(params.db_path, db, err) || !open_ingest_tables(db, err) || !load_file_states(db, known, err))
+    {
+        sqlite3_close(db);
+        return false;
+    }
+    // 之后新插入的行 id 都大于它（AUTOINCREMENT）；不大于它且仍在表里的就是本次没动过的旧行
+    int64_t max_old_id = 0;
+    {
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "SELECT COALESCE(MAX(id), 0) FROM documents", -1, &stmt, nullptr) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_ROW)
+            max_old_id = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+
+    // 段模式：只索引各段里还没有的行（id > indexed_through），旧版本记墓碑
+    const bool want_segments = !params.segments_dir.empty();
+    bm25_segments segs;
+    int64_t indexed_through = 0;
+    if (want_segments)
+    {
+        if (!params.bm25_path.empty() || !params.vector_path.empty())
+            err = "segments_dir cannot be combined with bm25_path / vector_path (the vector index is not incremental)";
+        else if (segs.open(params.segments_dir, err, true) && !segs.is_dir())
+            err = "not a segment directory: " + params.segments_dir;
+        else if (err.empty() && segs.n_segments() && segs.tokenize().cjk != params.tokenize.cjk)
+            err = "tokenizer mode differs from the existing segments in " + params.segments_dir;
+        if (!err.empty())
+        {
+            sqlite3_close(db);
+            return false;
+        }
+        indexed_through = segs.max_key();
+    }
+
+    const bool want_bm25 = !params.bm25_path.empty() || want_segments;
+    const bool want_vec = !params.vector_path.empty();
+    llm_embedder embedder;
+    vector_index vindex;
+    if (want_vec)
+    {
+        llm_embed_params ep;
+        ep.model_path = params.embed_model_path;
+        vector_index_params vp = params.vector;
+        if (params.embed_model_path.empty())
+            err = "vector output needs an embedding model";
+        else if (embedder.load(ep, err))
+        {
+            vp.dim = (uint32_t)embedder.n_embd();
+            if (vindex.init(vp, err))
+                err.clear();
+        }
+        if (!err.empty())
+        {
+            sqlite3_close(db);
+            return false;
+        }
+    }
+
+    // 只加载词表（vocab_only，不读权重）；放在流水线之前，路径不对时尽早失败
+    std::unique_ptr<llama_model, void (*)(llama_model *)> token_model(nullptr, llama_free_model);
+    if (!params.token_model_path.empty())
+    {
+        llama_model_params mp = llama_model_default_params();
+        mp.vocab_only = true;
+        token_model.reset(llama_load_model_from_file(params.token_model_path.c_str(), mp));
+        if (!token_model)
+        {
+            err = "failed to load token model: " + params.token_model_path;
+            sqlite3_close(db);
+            return false;
+        }
+    }
+
+    const int n_cpu = cpu_count_available();
+    const int n_parse = params.n_parse_threads > 0 ? params.n_parse_threads : n_cpu;
+    const int n_index = want_bm25 ? (params.n_index_threads > 0 ? params.n_index_threads : n_cpu) : 0;
+
+    bounded_queue<ingest_row> index_q(params.queue_rows);
+    bounded_queue<ingest_row> embed_q(params.queue_rows);
+    bounded_queue<embedded_batch> vec_q(4);
+
+    // 任一阶段出错：记下第一条错误，关闭所有队列让其余线程尽快退出
+    std::mutex err_mtx;
+    std::atomic<bool> failed{false};
+    std::mutex win_mtx;
+    std::condition_variable win_cv;
+    auto fail = [&](const std::string &msg)
+    {
+        {
+            std::lock_guard<std::mutex> lk(err_mtx);
+            if (!failed.exchange(true))
+                err = msg;
+        }
+        index_q.close();
+        embed_q.close();
+        vec_q.close();
+        {
+            std::lock_guard<std::mutex> lk(win_mtx);
+        }
+        win_cv.notify_all();
+    };
+
+    // ---- 倒排分片 ----
+    std::vector<bm25_builder> shards((size_t)n_index, bm25_builder(params.tokenize));
+    std::atomic<size_t> n_indexed{0};
+    auto index_work = [&](size_t t)
+    {
+        ingest_row r;
+        while (index_q.pop(r))
+        {
+            shards[t].add_document(r.id, r.text);
+            ++n_indexed;
+        }
+    };
+    std::vector<std::thread> index_threads;
+    for (int t = 0; t < n_index; ++t)
+        index_threads.emplace_back(index_work, (size_t)t);
+
+    // ---- embedding 与建图 ----
+    std::atomic<size_t> n_embedded{0};
+    auto embed_work = [&]()
+    {
+        const size_t batch = (size_t)std::max(1, params.embed_batch);
+        std::vector<ingest_row> rows;
+        std::vector<std::string> texts;
+        auto flush = [&]() -> bool
+        {
+            if (rows.empty())
+                return true;
+            embedded_batch out;
+            texts.clear();
+            for (auto &r : rows)
+            {
+                out.ids.push_back(r.id);
+                texts.push_back(std::move(r.text));
+            }
+            rows.clear();
+            std::string eerr;
+            if (!embedder.embed_batch(texts, out.vecs, eerr))
+            {
+                fail("embedding failed: " + eerr);
+                return false;
+            }
+            return vec_q.push(std::move(out));
+        };
+        ingest_row r;
+        bool ok = true;
+        while (ok && embed_q.pop(r))
+        {
+            rows.push_back(std::move(r));
+            if (rows.size() >= batch)
+                ok = flush();
+        }
+        if (ok)
+            flush();
+        vec_q.close();
+    };
+    auto hnsw_work = [&]()
+    {
+        embedded_batch b;
+        const size_t dim = vindex.dim();
+        while (vec_q.pop(b))
+        {
+            for (size_t i = 0; i < b.ids.size(); ++i)
+            {
+                std::string verr;
+                if (!vindex.add(b.ids[i], b.vecs.data() + i * dim, verr))
+                {
+                    fail("vector index: " + verr);
+                    return;
+                }
+                ++n_embedded;
+            }
+        }
+    };
+    std::thread embed_thread, hnsw_thread;
+    if (want_vec)
+    {
+        embed_thread = std::thread(embed_work);
+        hnsw_thread = std::thread(hnsw_work);
+    }
+
+    auto emit = [&](int64_t id, const std::string &text) -> bool
+    {
+        if (want_bm25 && !index_q.push({id, text}))
+            return false;
+        if (want_vec && !embed_q.push({id, text}))
+            return false;
+        return true;
+    };
+
+    // ---- 解析：按需取下一个文件，但最多领先写库线程 window 个文件，限制在途内存 ----
+    const size_t window = (size_t)n_parse * 2;
+    std::vector<std::unique_ptr<parsed_file>> parsed(files.size());
+    size_t write_pos = 0;
+    std::atomic<size_t> next_file{0};
+    auto parse_work = [&]()
+    {
+        for (;;)
+        {
+            const size_t i = next_file++;
+            if (i >= files.size())
+                return;
+            {
+                std::unique_lock<std::mutex> lk(win_mtx);
+                win_cv.wait(lk, [&]
+                            { return failed || i < write_pos + window; });
+                if (failed)
+                    return;
+            }
+            const auto it = known.find(files[i]);
+            auto pf = std::make_unique<parsed_file>(parse_file(files[i], params, it == known.end() ? nullptr : &it->second));
+            {
+                std::lock_guard<std::mutex> lk(win_mtx);
+                parsed[i] = std::move(pf);
+            }
+            win_cv.notify_all();
+        }
+    };
+    std::vector<std::thread> parse_threads;
+    for (int t = 0; t < n_parse; ++t)
+        parse_threads.emplace_back(parse_work);
+
+    // ---- 写库（本线程）：按文件顺序，大事务批量提交 ----
+    sqlite3_stmt *del = nullptr, *ins = nullptr, *pend = nullptr, *upsert = nullptr, *forget = nullptr;
+    std::string serr;
+    if (sqlite3_prepare_v2(db, "DELETE FROM documents WHERE doc_path = ?", -1, &del, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO ingest_pending (id) SELECT id FROM documents WHERE doc_path = ?",
+                           -1, &pend, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+                           "INSERT OR REPLACE INTO ingest_files (doc_path, content_hash, size, mtime, n_chunks, updated_at)"
+                           " VALUES (?, ?, ?, ?, ?, ?)",
+                           -1, &upsert, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "DELETE FROM ingest_files WHERE doc_path = ?", -1, &forget, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+                           "INSERT INTO documents (doc_id, doc_path, doc_type, chunk_id, text, start_char, end_char,"
+                           " page_start, page_end, line_start, line_end, created_at)"
+                           " VALUES (?, ?, ?, ?, ?, ?, ?, NULL, NULL, ?, ?, ?)",
+                           -1, &ins, nullptr) != SQLITE_OK ||
+        !exec_sql(db, "BEGIN", serr))
+    {
+        fail(serr.empty() ? std::string("failed to prepare: ") + sqlite3_errmsg(db) : serr);
+    }
+    // 段模式下先把要删的 id 记进 ingest_pending（同一事务），写段时作为墓碑
+    auto delete_doc = [&](const std::string &path) -> bool
+    {
+        if (want_segments)
+        {
+            sqlite3_reset(pend);
+            sqlite3_bind_text(pend, 1, path.data(), (int)path.size(), SQLITE_STATIC);
+            if (sqlite3_step(pend) != SQLITE_DONE)
+                return false;
+        }
+        sqlite3_reset(del);
+        sqlite3_bind_text(del, 1, path.data(), (int)path.size(), SQLITE_STATIC);
+        return sqlite3_step(del) == SQLITE_DONE;
+    };
+
+    const sqlite3_int64 now = (sqlite3_int64)std::time(nullptr);
+    auto record_file = [&](const std::string &path, const parsed_file &pf, int64_t n_chunks) -> bool
+    {
+        sqlite3_reset(upsert);
+        sqlite3_bind_text(upsert, 1, path.data(), (int)path.size(), SQLITE_STATIC);
+        sqlite3_bind_text(upsert, 2, pf.hash.data(), (int)pf.hash.size(), SQLITE_STATIC);
+        sqlite3_bind_int64(upsert, 3, pf.size);
+        sqlite3_bind_int64(upsert, 4, pf.mtime);
+        sqlite3_bind_int64(upsert, 5, n_chunks);
+        sqlite3_bind_int64(upsert, 6, now);
+        return sqlite3_step(upsert) == SQLITE_DONE;
+    };
+    size_t rows_in_txn = 0;
+    for (size_t i = 0; i < files.size() && !failed; ++i)
+    {
+        std::unique_ptr<parsed_file> pf;
+        {
+            std::unique_lock<std::mutex> lk(win_mtx);
+            win_cv.wait(lk, [&]
+                        { return failed || parsed[i] != nullptr; });
+            if (failed)
+                break;
+            pf = std::move(parsed[i]);
+            write_pos = i + 1;
+        }
+        win_cv.notify_all();
+
+        const std::string &path = files[i];
+        if (pf->unchanged)
+        {
+            ++stats.n_unchanged;
+            const file_state &prev = known[path];
+            if (prev.mtime != pf->mtime && !record_file(path, *pf, prev.n_chunks))
+            {
+                fail(std::string("ingest_files update failed: ") + sqlite3_errmsg(db));
+                break;
+            }
+            continue;
+        }
+        if (params.rebuild && !delete_doc(path))
+        {
+            fail(std::string("delete failed: ") + sqlite3_errmsg(db));
+            break;
+        }
+        if (pf->invalid_utf8)
+            ++stats.n_invalid_utf8;
+        if (!pf->ok || pf->chunks.empty())
+        {
+            std::cerr << "[ingest] skip " << (pf->ok ? "empty" : pf->error) << ": " << path << "\n";
+            ++stats.n_skipped;
+            continue;
+        }
+        // 与 ingest.py 相同：每次都先清空该文件的旧块再插
+        if (!delete_doc(path))
+        {
+            fail(std::string("delete failed: ") + sqlite3_errmsg(db));
+            break;
+        }
+        for (const auto &c : pf->chunks)
+        {
+            sqlite3_reset(ins);
+            sqlite3_bind_text(ins, 1, pf->doc_id.data(), (int)pf->doc_id.size(), SQLITE_STATIC);
+            sqlite3_bind_text(ins, 2, path.data(), (int)path.size(), SQLITE_STATIC);
+            sqlite3_bind_text(ins, 3, pf->doc_type.data(), (int)pf->doc_type.size(), SQLITE_STATIC);
+            sqlite3_bind_int(ins, 4, c.chunk_id);
+            sqlite3_bind_text(ins, 5, c.text.data(), (int)c.text.size(), SQLITE_STATIC);
+            sqlite3_bind_int64(ins, 6, c.start_char);
+            sqlite3_bind_int64(ins, 7, c.end_char);
+            sqlite3_bind_int64(ins, 8, c.line_start);
+            sqlite3_bind_int64(ins, 9, c.line_end);
+            sqlite3_bind_int64(ins, 10, now);
+            if (sqlite3_step(ins) != SQLITE_DONE)
+            {
+                fail(std::string("insert failed: ") + sqlite3_errmsg(db));
+                break;
+            }
+            ++stats.n_chunks;
+            if (!emit(sqlite3_last_insert_rowid(db), c.text))
+                break;
+            if (++rows_in_txn >= params.commit_rows)
+            {
+                if (!exec_sql(db, "COMMIT", serr) || !exec_sql(db, "BEGIN", serr))
+                {
+                    fail(serr);
+                    break;
+                }
+                rows_in_txn = 0;
+            }
+        }
+        if (!failed && !record_file(path, *pf, (int64_t)pf->chunks.size()))
+            fail(std::string("ingest_files update failed: ") + sqlite3_errmsg(db));
+    }
+
+    // ---- 上次入库过、但已不在 docs_dir 里的文件：删掉它的行 ----
+    if (!failed)
+    {
+        const std::unordered_set<std::string> present(files.begin(), files.end());
+        std::vector<std::string> gone;
+        for (const auto &kv : known)
+        {
+            if (!present.count(kv.first) && path_under(kv.first, params.docs_dir))
+                gone.push_back(kv.first);
+        }
+        std::sort(gone.begin(), gone.end());
+        for (const auto &path : gone)
+        {
+            sqlite3_reset(forget);
+            sqlite3_bind_text(forget, 1, path.data(), (int)path.size(), SQLITE_STATIC);
+            if (!delete_doc(path) || sqlite3_step(forget) != SQLITE_DONE)
+            {
+                fail(std::string("delete failed: ") + sqlite3_errmsg(db));
+                break;
+            }
+            std::cerr << "[ingest] removed: " << path << "\n";
+            ++stats.n_removed;
+        }
+    }
+    if (!failed && !exec_sql(db, "COMMIT", serr))
+        fail(serr);
+    sqlite3_finalize(del);
+    sqlite3_finalize(ins);
+    sqlite3_finalize(pend);
+    sqlite3_finalize(upsert);
+    sqlite3_finalize(forget);
+
+    // ---- 未重新入库的旧行也要进索引；段模式下只补各段里还没有的 ----
+    if (!failed && (want_bm25 || want_vec) && max_old_id > indexed_through)
+    {
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "SELECT id, text FROM documents WHERE id > ? AND id <= ? ORDER BY id", -1, &stmt,
+                               nullptr) != SQLITE_OK)
+        {
+            fail(std::string("failed to prepare: ") + sqlite3_errmsg(db));
+        }
+        else
+        {
+            sqlite3_bind_int64(stmt, 1, indexed_through);
+            sqlite3_bind_int64(stmt, 2, max_old_id);
+            while (!failed && sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                const unsigned char *text = sqlite3_column_text(stmt, 1);
+                const std::string s = text ? std::string((const char *)text, (size_t)sqlite3_column_bytes(stmt, 1)) : "";
+                if (!emit(sqlite3_column_int64(stmt, 0), s))
+                    break;
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    std::vector<int64_t> tombstones;
+    if (!failed && want_segments)
+    {
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "SELECT id FROM ingest_pending ORDER BY id", -1, &stmt, nullptr) != SQLITE_OK)
+            fail(std::string("failed to prepare: ") + sqlite3_errmsg(db));
+        while (!failed && sqlite3_step(stmt) == SQLITE_ROW)
+            tombstones.push_back(sqlite3_column_int64(stmt, 0));
+        sqlite3_finalize(stmt);
+    }
+    if (failed)
+        exec_sql(db, "ROLLBACK", serr); // 出错时丢掉未提交的那一批，失败也无妨
+    sqlite3_close(db);
+
+    index_q.close();
+    embed_q.close();
+    {
+        std::lock_guard<std::mutex> lk(win_mtx);
+    }
+    win_cv.notify_all();
+    for (auto &t : parse_threads)
+        t.join();
+    for (auto &t : index_threads)
+        t.join();
+    if (embed_thread.joinable())
+        embed_thread.join();
+    if (hnsw_thread.joinable())
+        hnsw_thread.join();
+    stats.n_indexed = n_indexed;
+    stats.n_embedded = n_embedded;
+    stats.pipeline_ms = ms_since(t0);
+    if (failed)
+        return false;
+
+    if (want_segments)
+    {
+        return commit_segments(params, segs, shards, tombstones, stats, err) &&
+               update_chunk_tokens(params, token_model.get(), n_cpu, stats, err);
+    }
+
+    const auto t1 = std::chrono::steady_clock::now();
+    bm25_index index;
+    if (want_bm25)
+        index = bm25_builder::merge_shards(shards).build();
+    stats.merge_ms = ms_since(t1);
+
+    const auto t2 = std::chrono::steady_clock::now();
+    if (want_bm25)
+    {
+        const fs::path parent = fs::u8path(params.bm25_path).parent_path();
+        std::error_code ec;
+        if (!parent.empty())
+            fs::create_directories(parent, ec);
+        if (!index.save(params.bm25_path, err))
+            return false;
+    }
+    if (want_vec && !vindex.save(params.vector_path, err))
+        return false;
+    stats.save_ms = ms_since(t2);
+    return update_chunk_tokens(params, token_model.get(), n_cpu, stats, err);
+}
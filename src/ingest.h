@@ -0,0 +1,90 @@
+// src/ingest.h
+// 原生入库流水线：替代 python/ingest.py 的逐文件 “解析 → 切块 → 清旧 → 插入 → 提交”，
+// 以及最后整表重读、单线程重建 BM25 的做法。
+//
+//   解析线程 ×N ──(按文件序的重排窗口)──> 写库线程 ──> 有界队列 ──> 分词/倒排分片 ×M ──> 合并 → bm25.idx
+//                                                  └─> 有界队列 ──> embedding ──> 有界队列 ──> HNSW ──> vectors.idx
+//
+// - 解析：读文件、规整空白、按字符切块，规则与 python/SQLite.py 的 build_chunks_for_file 一致；
+// - 写库：唯一的 SQLite 连接，按文件顺序写，所以 documents.id 的分配与单线程跑一遍相同；大事务批量提交；
+// - 倒排：每个线程一个 bm25_builder 分片，最后 merge_shards，结果与 bm25_cli 从表里现建的索引逐字节相同；
+// - 向量：embedding 与建图各占一个阶段，和解析/写库/倒排同时进行（llama 的 decode 内部自己多线程）。
+// 本次没有重新入库的旧行也会流进倒排与向量阶段，输出覆盖整张表。
+//
+// 增量：ingest_files 表记录每个文件的大小、mtime 与内容哈希，未变的文件直接跳过（--rebuild 除外），
+// 已从 docs_dir 消失的文件删掉其行。给了 segments_dir 时 BM25 不再整表重建：只把新插入的行写成一个新段，
+// 被删/被替换的旧行在 ingest_pending 表里排队，随新段一起作为墓碑写进 MANIFEST，之后按 merge 策略合并。
+// 写库与写段之间崩溃也不会漏：下次运行会补上 id 大于各段最大 doc_key 的行和 ingest_pending 里的墓碑。
+// 只支持 .txt / .md；.pdf 需要 PyMuPDF，仍走 python/ingest.py。
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bm25_segments.h"
+#include "vector_index.h"
+
+struct ingest_params
+{
+    std::string docs_dir;
+    std::string db_path = "data/documents.db";
+    std::string bm25_path;    // 非空时输出 BM25 索引（整表）
+    std::string segments_dir; // 非空时增量更新该段目录（与 bm25_path、vector_path 互斥）
+    bm25_merge_policy merge;
+    tokenize_options tokenize; // BM25 的 CJK 切分方式，写进索引
+    std::string vector_path;  // 非空时输出向量索引（需要 embed_model_path）
+    std::string embed_model_path;
+    vector_index_params vector; // dim 由 embedding 模型决定
+    std::string token_model_path; // 非空时用该生成模型的词表预先切好每行的 token（chunk_tokens 表，见 evidence_pack.h）
+    bool rebuild = false;       // 与 ingest.py --rebuild 相同：解析前先删掉该文件的旧块；也不按哈希跳过
+
+    size_t chunk_size = 900; // 按 Unicode 字符计
+    size_t chunk_overlap = 150;
+
+    int n_parse_threads = 0; // 0 = 可用 CPU 数
+    int n_index_threads = 0; // 0 = 可用 CPU 数
+    size_t queue_rows = 4096;  // 每个有界队列的容量（行）
+    size_t commit_rows = 20000; // 每个事务最多插入的行数
+    int embed_batch = 256;      // 每次 embed_batch 的文本数
+};
+
+struct ingest_stats
+{
+    size_t n_files = 0;
+    size_t n_skipped = 0;   // 空文件或读取失败
+    size_t n_unchanged = 0; // 内容没变、跳过的文件
+    size_t n_removed = 0;   // 已从 docs_dir 消失、删掉了行的文件
+    size_t n_chunks = 0;    // 本次插入的行
+    size_t n_indexed = 0;   // 进入 BM25 的行（整表模式含未重新入库的旧行；段模式只有新行）
+    size_t n_embedded = 0;
+    size_t n_tombstones = 0;   // 本次写进段目录的墓碑
+    size_t n_segments = 0;     // 结束时的段数
+    size_t n_merged = 0;       // 本次合并重写的段数
+    size_t n_invalid_utf8 = 0; // 含非法 UTF-8、按字节丢弃过的文件数
+    double pipeline_ms = 0.0;  // 从开始到所有阶段结束
+    double merge_ms = 0.0;     // 合并分片 + 构建（段模式下含段合并）
+    double save_ms = 0.0;
+    size_t n_token_rows = 0;   // 本次写进 chunk_tokens 的行
+    double token_ms = 0.0;
+};
+
+struct ingest_chunk
+{
+    int chunk_id = 0;
+    std::string text;
+    int64_t start_char = 0;
+    int64_t end_char = 0;
+    int64_t line_start = 0;
+    int64_t line_end = 0;
+};
+
+// 调用前需已执行 llama_backend_init()（只有输出向量索引或给了 token_model_path 时才用到）
+bool ingest_run(const ingest_params &params, ingest_stats &stats, std::string &err);
+
+// docs_dir 下（递归）的 .txt / .md / .pdf，按路径排序；与 ingest.py::list_docs 相同
+std::vector<std::string> ingest_list_docs(const std::string &docs_dir);
+// 与 SQLite.py::normalize_text 相同：统一换行、合并空格和制表符、最多保留一个空行、去掉首尾空白
+std::string ingest_normalize_text(const std::string &raw);
+// 与 SQLite.py::chunk_text_by_chars 相同（偏移按 Unicode 字符），并附上 build_chunks_for_file 的行号估算
+std::vector<ingest_chunk> ingest_chunk_text(const std::string &text, size_t chunk_size, size_t chunk_overlap);
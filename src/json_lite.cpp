@@ -0,0 +1,435 @@
+// src/json_lite.cpp
+#include "json_lite.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+const json_value *json_value::find(const std::string &key) const
+{
+    if (kind != OBJECT)
+        return nullptr;
+    for (const auto &kv : obj)
+    {
+        if (kv.first == key)
+            return &kv.second;
+    }
+    return nullptr;
+}
+
+json_value &json_value::set(const std::string &key, json_value v)
+{
+    kind = OBJECT;
+    for (auto &kv : obj)
+    {
+        if (kv.first == key)
+        {
+            kv.second = std::move(v);
+            return kv.second;
+        }
+    }
+    obj.emplace_back(key, std::move(v));
+    return obj.back().second;
+}
+
+std::string json_value::get_string(const std::string &key, const std::string &def) const
+{
+    const json_value *v = find(key);
+    return (v && v->kind == STRING) ? v->str : def;
+}
+
+double json_value::get_number(const std::string &key, double def) const
+{
+    const json_value *v = find(key);
+    return (v && v->kind == NUMBER) ? v->num : def;
+}
+
+bool json_value::get_bool(const std::string &key, bool def) const
+{
+    const json_value *v = find(key);
+    return (v && v->kind == BOOL) ? v->b : def;
+}
+
+// ---------- parser ----------
+namespace
+{
+struct json_reader
+{
+    const std::string &s;
+    size_t i = 0;
+    std::string err;
+
+    explicit json_reader(const std::string &text) : s(text) {}
+
+    void skip_ws()
+    {
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r'))
+            ++i;
+    }
+
+    bool fail(const char *msg)
+    {
+        if (err.empty())
+            err = std::string(msg) + " at offset " + std::to_string(i);
+        return false;
+    }
+
+    bool literal(const char *lit)
+    {
+        size_t n = std::char_traits<char>::length(lit);
+        if (s.compare(i, n, lit) != 0)
+            return fail("invalid literal");
+        i += n;
+        return true;
+    }
+
+    static void append_utf8(std::string &out, uint32_t cp)
+    {
+        if (cp < 0x80)
+        {
+            out.push_back((char)cp);
+        }
+        else if (cp < 0x800)
+        {
+            out.push_back((char)(0xC0 | (cp >> 6)));
+            out.push_back((char)(0x80 | (cp & 0x3F)));
+        }
+        else if (cp < 0x10000)
+        {
+            out.push_back((char)(0xE0 | (cp >> 12)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back((char)(0x80 | (cp & 0x3F)));
+        }
+        else
+        {
+            out.push_back((char)(0xF0 | (cp >> 18)));
+            out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back((char)(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    bool hex4(uint32_t &cp)
+    {
+        if (i + 4 > s.size())
+            return fail("truncated \\u escape");
+        cp = 0;
+        for (int k = 0; k < 4; ++k)
+        {
+            char c = s[i++];
+            cp <<= 4;
+            if (c >= '0' && c <= '9')
+                cp |= (uint32_t)(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                cp |= (uint32_t)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                cp |= (uint32_t)(c - 'A' + 10);
+            else
+                return fail("bad hex digit");
+        }
+        return true;
+    }
+
+    bool parse_string(std::string &out)
+    {
+        ++i; // 跳过开头的 "
+        out.clear();
+        while (i < s.size())
+        {
+            char c = s[i++];
+            if (c == '"')
+                return true;
+            if (c != '\\')
+            {
+                out.push_back(c);
+                continue;
+            }
+            if (i >= s.size())
+                break;
+            char e = s[i++];
+            switch (e)
+            {
+            case '"':
+                out.push_back('"');
+                break;
+            case '\\':
+                out.push_back('\\');
+                break;
+            case '/':
+                out.push_back('/');
+                break;
+            case 'b':
+                out.push_back('\b');
+                break;
+            case 'f':
+                out.push_back('\f');
+                break;
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'u':
+            {
+                uint32_t cp = 0;
+                if (!hex4(cp))
+                    return false;
+                // UTF-16 代理对
+                if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < s.size() && s[i] == '\\' && s[i + 1] == 'u')
+                {
+                    i += 2;
+                    uint32_t lo = 0;
+                    if (!hex4(lo))
+                        return false;
+                    if (lo >= 0xDC00 && lo <= 0xDFFF)
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default:
+                return fail("bad escape");
+            }
+        }
+        return fail("unterminated string");
+    }
+
+    bool parse_number(json_value &out)
+    {
+        size_t start = i;
+        if (s[i] == '-')
+            ++i;
+        while (i < s.size() && ((s[i] >= '0' && s[i] <= '9') || s[i] == '.' || s[i] == 'e' ||
+                                s[i] == 'E' || s[i] == '+' || s[i] == '-'))
+            ++i;
+        std::string tok = s.substr(start, i - start);
+        char *end = nullptr;
+        double v = std::strtod(tok.c_str(), &end);
+        if (tok.empty() || end != tok.c_str() + tok.size())
+            return fail("bad number");
+        out = json_value::make_number(v);
+        return true;
+    }
+
+    bool parse_value(json_value &out, int depth)
+    {
+        if (depth > 64)
+            return fail("nesting too deep");
+        skip_ws();
+        if (i >= s.size())
+            return fail("unexpected end");
+        char c = s[i];
+        if (c == '{')
+        {
+            ++i;
+            out = json_value::make_object();
+            skip_ws();
+            if (i < s.size() && s[i] == '}')
+            {
+                ++i;
+                return true;
+            }
+            while (true)
+            {
+                skip_ws();
+                if (i >= s.size() || s[i] != '"')
+                    return fail("expected key");
+                std::string key;
+                if (!parse_string(key))
+                    return false;
+                skip_ws();
+                if (i >= s.size() || s[i] != ':')
+                    return fail("expected ':'");
+                ++i;
+                json_value v;
+                if (!parse_value(v, depth + 1))
+                    return false;
+                out.obj.emplace_back(std::move(key), std::move(v));
+                skip_ws();
+                if (i < s.size() && s[i] == ',')
+                {
+                    ++i;
+                    continue;
+                }
+                if (i < s.size() && s[i] == '}')
+                {
+                    ++i;
+                    return true;
+                }
+                return fail("expected ',' or '}'");
+            }
+        }
+        if (c == '[')
+        {
+            ++i;
+            out = json_value::make_array();
+            skip_ws();
+            if (i < s.size() && s[i] == ']')
+            {
+                ++i;
+                return true;
+            }
+            while (true)
+            {
+                json_value v;
+                if (!parse_value(v, depth + 1))
+                    return false;
+                out.arr.push_back(std::move(v));
+                skip_ws();
+                if (i < s.size() && s[i] == ',')
+                {
+                    ++i;
+                    continue;
+                }
+                if (i < s.size() && s[i] == ']')
+                {
+                    ++i;
+                    return true;
+                }
+                return fail("expected ',' or ']'");
+            }
+        }
+        if (c == '"')
+        {
+            out = json_value::make_string("");
+            return parse_string(out.str);
+        }
+        if (c == 't')
+        {
+            out = json_value::make_bool(true);
+            return literal("true");
+        }
+        if (c == 'f')
+        {
+            out = json_value::make_bool(false);
+            return literal("false");
+        }
+        if (c == 'n')
+        {
+            out = json_value::make_null();
+            return literal("null");
+        }
+        return parse_number(out);
+    }
+};
+} // namespace
+
+bool json_parse(const std::string &text, json_value &out, std::string &err)
+{
+    json_reader r(text);
+    if (!r.parse_value(out, 0))
+    {
+        err = r.err;
+        return false;
+    }
+    r.skip_ws();
+    if (r.i != text.size())
+    {
+        err = "trailing characters at offset " + std::to_string(r.i);
+        return false;
+    }
+    return true;
+}
+
+// ---------- writer ----------
+void json_escape_to(const std::string &s, std::string &out)
+{
+    out.push_back('"');
+    for (unsigned char c : s)
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20)
+            {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+                out += buf;
+            }
+            else
+            {
+                out.push_back((char)c);
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+void json_dump_to(const json_value &v, std::string &out)
+{
+    switch (v.kind)
+    {
+    case json_value::NUL:
+        out += "null";
+        break;
+    case json_value::BOOL:
+        out += v.b ? "true" : "false";
+        break;
+    case json_value::NUMBER:
+    {
+        if (!std::isfinite(v.num))
+        {
+            out += "null";
+            break;
+        }
+        char buf[32];
+        if (v.num == std::floor(v.num) && std::fabs(v.num) < 9.0e15)
+            std::snprintf(buf, sizeof(buf), "%.0f", v.num);
+        else
+            std::snprintf(buf, sizeof(buf), "%.6g", v.num);
+        out += buf;
+        break;
+    }
+    case json_value::STRING:
+        json_escape_to(v.str, out);
+        break;
+    case json_value::ARRAY:
+        out.push_back('[');
+        for (size_t k = 0; k < v.arr.size(); ++k)
+        {
+            if (k)
+                out.push_back(',');
+            json_dump_to(v.arr[k], out);
+        }
+        out.push_back(']');
+        break;
+    case json_value::OBJECT:
+        out.push_back('{');
+        for (size_t k = 0; k < v.obj.size(); ++k)
+        {
+            if (k)
+                out.push_back(',');
+            json_escape_to(v.obj[k].first, out);
+            out.push_back(':');
+            json_dump_to(v.obj[k].second, out);
+        }
+        out.push_back('}');
+        break;
+    }
+}
+
+std::string json_dump(const json_value &v)
+{
+    std::string out;
+    json_dump_to(v, out);
+    return out;
+}
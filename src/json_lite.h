@@ -0,0 +1,90 @@
+// src/json_lite.h
+// 极简 JSON：只覆盖 --serve 协议需要的部分（对象/数组/字符串/数字/布尔/null）。
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct json_value
+{
+    enum kind_t
+    {
+        NUL,
+        BOOL,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    kind_t kind = NUL;
+    bool b = false;
+    double num = 0.0;
+    std::string str;
+    std::vector<json_value> arr;
+    std::vector<std::pair<std::string, json_value>> obj; // 保持插入顺序
+
+    static json_value make_null() { return json_value(); }
+    static json_value make_bool(bool v)
+    {
+        json_value j;
+        j.kind = BOOL;
+        j.b = v;
+        return j;
+    }
+    static json_value make_number(double v)
+    {
+        json_value j;
+        j.kind = NUMBER;
+        j.num = v;
+        return j;
+    }
+    static json_value make_string(std::string v)
+    {
+        json_value j;
+        j.kind = STRING;
+        j.str = std::move(v);
+        return j;
+    }
+    static json_value make_array()
+    {
+        json_value j;
+        j.kind = ARRAY;
+        return j;
+    }
+    static json_value make_object()
+    {
+        json_value j;
+        j.kind = OBJECT;
+        return j;
+    }
+
+    bool is_null() const { return kind == NUL; }
+    bool is_string() const { return kind == STRING; }
+    bool is_number() const { return kind == NUMBER; }
+    bool is_array() const { return kind == ARRAY; }
+    bool is_object() const { return kind == OBJECT; }
+
+    // 对象成员查找；不存在返回 nullptr
+    const json_value *find(const std::string &key) const;
+
+    // 对象赋值（已存在则覆盖）
+    json_value &set(const std::string &key, json_value v);
+
+    // 带默认值的取值
+    std::string get_string(const std::string &key, const std::string &def = "") const;
+    double get_number(const std::string &key, double def) const;
+    bool get_bool(const std::string &key, bool def) const;
+};
+
+// 解析一整段 JSON 文本；失败时返回 false 并写入 err
+bool json_parse(const std::string &text, json_value &out, std::string &err);
+
+// 序列化为单行 JSON（UTF-8 原样输出，只转义控制字符/引号/反斜杠）
+std::string json_dump(const json_value &v);
+void json_dump_to(const json_value &v, std::string &out);
+
+// 把字符串按 JSON 字符串字面量规则追加到 out（含两侧引号）
+void json_escape_to(const std::string &s, std::string &out);
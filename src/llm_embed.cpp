@@ -0,0 +1,198 @@
+// src/llm_embed.cpp
+#include "llm_embed.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+llm_embedder::~llm_embedder()
+{
+    unload();
+}
+
+bool llm_embedder::load(const llm_embed_params &params, std::string &err)
+{
+    unload();
+    params_ = params;
+    params_.n_batch = std::max(8, params_.n_batch);
+    params_.n_seq_max = std::max(1, std::min(params_.n_seq_max, params_.n_batch));
+    if (params_.n_threads <= 0)
+        params_.n_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    llama_model_params mparams = llama_model_default_params();
+    model_ = llama_load_model_from_file(params_.model_path.c_str(), mparams);
+    if (!model_)
+    {
+        err = "Failed to load embedding model: " + params_.model_path;
+        return false;
+    }
+
+    // 非因果模型要求一条序列完整落在同一个 ubatch 里，所以 n_ubatch = n_batch
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx = (uint32_t)params_.n_batch;
+    cparams.n_batch = (uint32_t)params_.n_batch;
+    cparams.n_ubatch = (uint32_t)params_.n_batch;
+    cparams.n_seq_max = (uint32_t)params_.n_seq_max;
+    cparams.n_threads = params_.n_threads;
+    cparams.n_threads_batch = params_.n_threads;
+    cparams.embeddings = true;
+    cparams.pooling_type = LLAMA_POOLING_TYPE_UNSPECIFIED; // 用模型自带的 pooling
+
+    ctx_ = llama_new_context_with_model(model_, cparams);
+    if (!ctx_)
+    {
+        err = "Failed to create embedding context";
+        unload();
+        return false;
+    }
+    if (llama_pooling_type(ctx_) == LLAMA_POOLING_TYPE_NONE)
+    {
+        err = "embedding model has no pooling; per-sequence embeddings are unavailable";
+        unload();
+        return false;
+    }
+
+    vocab_ = llama_model_get_vocab(model_);
+    n_embd_ = llama_model_n_embd(model_);
+    batch_ = llama_batch_init(params_.n_batch, 0, 1);
+    batch_ready_ = true;
+    return true;
+}
+
+void llm_embedder::unload()
+{
+    if (batch_ready_)
+    {
+        llama_batch_free(batch_);
+        batch_ready_ = false;
+    }
+    if (ctx_)
+    {
+        llama_free(ctx_);
+        ctx_ = nullptr;
+    }
+    if (model_)
+    {
+        llama_free_model(model_);
+        model_ = nullptr;
+    }
+    vocab_ = nullptr;
+    n_embd_ = 0;
+}
+
+bool llm_embedder::tokenize(const std::string &text, std::vector<llama_token> &out) const
+{
+    // 与 llm_engine::tokenize 相同：先估一个大小，不够时按返回的准确个数重试；out 在各条文本之间复用
+    out.resize(text.size() / 2 + 16);
+    int n = llama_tokenize(vocab_, text.c_str(), (int)text.size(), out.data(), (int)out.size(),
+                           true /* add_special */, false /* parse_special */);
+    if (n < 0 && n != INT32_MIN)
+    {
+        out.resize((size_t)-n);
+        n = llama_tokenize(vocab_, text.c_str(), (int)text.size(), out.data(), (int)out.size(),
+                           true /* add_special */, false /* parse_special */);
+    }
+    if (n < 0)
+    {
+        out.clear();
+        return false;
+    }
+    out.resize(n);
+    return true;
+}
+
+bool llm_embedder::flush(const std::vector<size_t> &rows, std::vector<float> &out, std::string &err)
+{
+    if (rows.empty())
+        return true;
+
+    llama_kv_cache_clear(ctx_);
+    if (llama_decode(ctx_, batch_) != 0)
+    {
+        err = "llama_decode failed (embedding)";
+        return false;
+    }
+
+    for (size_t s = 0; s < rows.size(); ++s)
+    {
+        const float *e = llama_get_embeddings_seq(ctx_, (llama_seq_id)s);
+        float *dst = out.data() + rows[s] * (size_t)n_embd_;
+        if (!e)
+        {
+            err = "llama_get_embeddings_seq returned null";
+            return false;
+        }
+        std::memcpy(dst, e, sizeof(float) * (size_t)n_embd_);
+        if (params_.normalize)
+        {
+            double norm = 0.0;
+            for (int i = 0; i < n_embd_; ++i)
+                norm += (double)dst[i] * dst[i];
+            if (norm > 0.0)
+            {
+                const float inv = (float)(1.0 / std::sqrt(norm));
+                for (int i = 0; i < n_embd_; ++i)
+                    dst[i] *= inv;
+            }
+        }
+    }
+    batch_.n_tokens = 0;
+    return true;
+}
+
+bool llm_embedder::embed_batch(const std::vector<std::string> &texts, std::vector<float> &out, std::string &err)
+{
+    if (!ctx_)
+    {
+        err = "embedding model is not loaded";
+        return false;
+    }
+    out.assign(texts.size() * (size_t)n_embd_, 0.0f);
+
+    std::vector<llama_token> toks;
+    std::vector<size_t> rows; // 当前 batch 里第 s 条序列对应的输出行
+    batch_.n_tokens = 0;
+
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        if (!tokenize(texts[i], toks))
+        {
+            err = "Tokenize failed (embedding)";
+            return false;
+        }
+        if (toks.empty())
+            continue; // 空文本保持零向量
+        if ((int)toks.size() > params_.n_batch)
+        {
+            toks.resize(params_.n_batch);
+            ++n_truncated_;
+        }
+
+        // 装不下：先把已装入的序列 decode 掉
+        if (batch_.n_tokens + (int)toks.size() > params_.n_batch || (int)rows.size() >= params_.n_seq_max)
+        {
+            if (!flush(rows, out, err))
+                return false;
+            rows.clear();
+        }
+
+        const llama_seq_id seq = (llama_seq_id)rows.size();
+        for (size_t j = 0; j < toks.size(); ++j)
+        {
+            const int k = batch_.n_tokens++;
+            batch_.token[k] = toks[j];
+            batch_.pos[k] = (llama_pos)j;
+            batch_.n_seq_id[k] = 1;
+            batch_.seq_id[k][0] = seq;
+            batch_.logits[k] = true; // pooling 需要每个位置的输出
+        }
+        rows.push_back(i);
+    }
+    return flush(rows, out, err);
+}
+
+bool llm_embedder::embed(const std::string &text, std::vector<float> &out, std::string &err)
+{
+    return embed_batch(std::vector<std::string>(1, text), out, err);
+}
@@ -0,0 +1,57 @@
+// src/llm_embed.h
+// 用 llama.cpp 的 embedding 输出（开启 pooling）把文本变成向量：
+// - 入库：一批文本按 token 数装箱，多条序列塞进同一个 llama_batch，一次 decode 得到多条向量；
+// - 查询：同一个常驻上下文，单条文本一次 decode。
+// 输出默认做 L2 归一化，配合 vector_index 的 ip 度量即余弦相似度。
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+struct llm_embed_params
+{
+    std::string model_path;
+    int n_batch = 2048;  // 单次 decode 的 token 上限；单条文本超过它会被截断
+    int n_seq_max = 32;  // 单次 decode 最多装几条文本
+    int n_threads = 0;   // <= 0 时用全部硬件线程
+    bool normalize = true;
+};
+
+class llm_embedder
+{
+public:
+    llm_embedder() = default;
+    ~llm_embedder();
+
+    llm_embedder(const llm_embedder &) = delete;
+    llm_embedder &operator=(const llm_embedder &) = delete;
+
+    // 调用前需已执行 llama_backend_init()
+    bool load(const llm_embed_params &params, std::string &err);
+    void unload();
+
+    int n_embd() const { return n_embd_; }
+
+    // out 为 texts.size() * n_embd() 的行主序矩阵；非线程安全
+    bool embed_batch(const std::vector<std::string> &texts, std::vector<float> &out, std::string &err);
+    bool embed(const std::string &text, std::vector<float> &out, std::string &err);
+
+    // 截断发生的次数（累计），用来提示 n_batch 过小
+    size_t n_truncated() const { return n_truncated_; }
+
+private:
+    bool tokenize(const std::string &text, std::vector<llama_token> &out) const;
+    // 把 batch_ 中已装入的序列 decode，并把向量写到 out 的对应行
+    bool flush(const std::vector<size_t> &rows, std::vector<float> &out, std::string &err);
+
+    llm_embed_params params_;
+    llama_model *model_ = nullptr;
+    llama_context *ctx_ = nullptr;
+    const llama_vocab *vocab_ = nullptr;
+    llama_batch batch_{};
+    bool batch_ready_ = false;
+    int n_embd_ = 0;
+    size_t n_truncated_ = 0;
+};
@@ -0,0 +1,1395 @@
+// src/llm_engine.cpp
+#include "llm_engine.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "chunk_tokens.h"
+#include "cpu_tuning.h"
+#include "metrics.h"
+
+// ---------- stop sequence detector ----------
+const std::vector<std::string> &llm_default_stops()
+{
+    static const std::vector<std::string> stops = {
+        "\nHuman:", "\nUser:", "\nassistant:", "\nAssistant:",
+        "<|endoftext|>", "</s>", "<|im_end|>", "<|eot_id|>",
+        "\n\n", u8"。", u8"！", u8"？", "\n"};
+    return stops;
+}
+
+bool ends_with_any(const std::string &s, const std::vector<std::string> &stops)
+{
+    for (const auto &t : stops)
+    {
+        if (t.empty())
+            continue;
+        if (s.size() >= t.size() && s.compare(s.size() - t.size(), t.size(), t) == 0)
+            return true;
+    }
+    return false;
+}
+
+void trim_at_stop_first_occurrence(std::string &s, const std::vector<std::string> &stops)
+{
+    size_t cut = std::string::npos;
+    for (const auto &t : stops)
+    {
+        if (t.empty())
+            continue;
+        size_t pos = s.find(t);
+        if (pos != std::string::npos)
+            cut = std::min(cut, pos);
+    }
+    if (cut != std::string::npos)
+        s.resize(cut);
+}
+
+namespace
+{
+// 不超过 end 的最大位置，使 s[0, pos) 不以残缺的 UTF-8 字符结尾
+size_t utf8_safe_end(const std::string &s, size_t end)
+{
+    size_t i = end;
+    for (int k = 0; k < 4 && i > 0; ++k)
+    {
+        const unsigned char c = (unsigned char)s[i - 1];
+        if ((c & 0xC0) != 0x80)
+        {
+            // c 是首字节（或 ASCII）：看它要求的长度是否已经齐了
+            const size_t need = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+            return (end - (i - 1) >= need) ? end : i - 1;
+        }
+        --i;
+    }
+    return end;
+}
+
+double ms_between(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+{
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+} // namespace
+
+// ---------- force "one sentence" postprocess ----------
+size_t find_first_sentence_end_zh(const std::string &s)
+{
+    static const std::vector<std::string> ends = {u8"。", u8"！", u8"？"};
+    size_t best = std::string::npos;
+    for (const auto &e : ends)
+    {
+        size_t p = s.find(e);
+        if (p != std::string::npos)
+        {
+            size_t endpos = p + e.size();
+            best = (best == std::string::npos) ? endpos : std::min(best, endpos);
+        }
+    }
+    size_t nl = s.find('\n');
+    if (nl != std::string::npos)
+    {
+        best = (best == std::string::npos) ? nl : std::min(best, nl);
+    }
+    return best;
+}
+
+void normalize_one_sentence(std::string &s)
+{
+    s.erase(std::remove(s.begin(), s.end(), '\r'), s.end());
+
+    size_t cut = find_first_sentence_end_zh(s);
+    if (cut != std::string::npos)
+        s.resize(cut);
+
+    auto is_ws = [](unsigned char c)
+    { return c == ' ' || c == '\t' || c == '\n'; };
+    while (!s.empty() && is_ws((unsigned char)s.front()))
+        s.erase(s.begin());
+    while (!s.empty() && is_ws((unsigned char)s.back()))
+        s.pop_back();
+
+    for (char &c : s)
+    {
+        if (c == '\n' || c == '\t')
+            c = ' ';
+    }
+
+    std::string out;
+    out.reserve(s.size());
+    bool prev_space = false;
+    for (char c : s)
+    {
+        bool sp = (c == ' ');
+        if (sp)
+        {
+            if (!prev_space)
+                out.push_back(c);
+        }
+        else
+        {
+            out.push_back(c);
+        }
+        prev_space = sp;
+    }
+    s.swap(out);
+}
+
+size_t llm_kv_cache_bytes(const llama_model *model, uint32_t n_cells, ggml_type type_k, ggml_type type_v)
+{
+    // 每层每个 cell 存 K 和 V 各 n_embd_head * n_head_kv 个元素；GQA 模型 n_head_kv 比 n_head 少。
+    // 量化类型按块存储，一行的字节数用 ggml_row_size 算
+    const int64_t n_head = std::max(1, llama_model_n_head(model));
+    const int64_t n_embd_kv = (int64_t)llama_model_n_embd(model) / n_head * std::max(1, llama_model_n_head_kv(model));
+    const size_t per_cell = ggml_row_size(type_k, n_embd_kv) + ggml_row_size(type_v, n_embd_kv);
+    return (size_t)llama_model_n_layer(model) * n_cells * per_cell;
+}
+
+bool llm_parse_kv_type(const std::string &name, ggml_type &out)
+{
+    static const std::pair<const char *, ggml_type> types[] = {
+        {"f32", GGML_TYPE_F32},   {"f16", GGML_TYPE_F16},   {"bf16", GGML_TYPE_BF16}, {"q8_0", GGML_TYPE_Q8_0},
+        {"q5_1", GGML_TYPE_Q5_1}, {"q5_0", GGML_TYPE_Q5_0}, {"q4_1", GGML_TYPE_Q4_1}, {"q4_0", GGML_TYPE_Q4_0},
+    };
+    for (const auto &t : types)
+    {
+        if (name == t.first)
+        {
+            out = t.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool llm_parse_overflow(const std::string &name, llm_overflow &out)
+{
+    if (name == "fail")
+        out = llm_overflow::fail;
+    else if (name == "truncate")
+        out = llm_overflow::truncate;
+    else if (name == "shift")
+        out = llm_overflow::shift;
+    else
+        return false;
+    return true;
+}
+
+// ---------- engine ----------
+llm_engine::~llm_engine()
+{
+    unload();
+}
+
+bool llm_engine::load(const llm_engine_params &params, std::string &err)
+{
+    unload();
+    params_ = params;
+    if (params_.n_batch <= 0)
+        params_.n_batch = 512;
+    if (params_.n_batch > params_.n_ctx)
+        params_.n_batch = params_.n_ctx;
+    // 每一步至少要给每个活跃序列留一个 decode 位置
+    params_.n_parallel = std::max(1, std::min(params_.n_parallel, params_.n_batch));
+
+    const int n_cpu = cpu_count_available();
+    if (params_.n_threads <= 0)
+        params_.n_threads = std::max(1, n_cpu / 2);
+    if (params_.n_threads_batch <= 0)
+        params_.n_threads_batch = n_cpu;
+
+    llama_model_params mparams = llama_model_default_params();
+    mparams.use_mmap = params_.use_mmap;
+    mparams.use_mlock = params_.use_mlock;
+    model_ref_.reset(llama_load_model_from_file(params_.model_path.c_str(), mparams), llama_free_model);
+    if (!model_ref_)
+    {
+        err = "Failed to load model: " + params_.model_path;
+        return false;
+    }
+
+    if (!params_.draft_model_path.empty())
+    {
+        draft_ref_.reset(llama_load_model_from_file(params_.draft_model_path.c_str(), mparams), llama_free_model);
+        if (!draft_ref_)
+        {
+            err = "Failed to load draft model: " + params_.draft_model_path;
+            unload();
+            return false;
+        }
+        const llama_vocab *tv = llama_model_get_vocab(model_ref_.get());
+        const llama_vocab *dv = llama_model_get_vocab(draft_ref_.get());
+        if (llama_vocab_n_tokens(dv) != llama_vocab_n_tokens(tv) || llama_token_eos(dv) != llama_token_eos(tv))
+        {
+            err = "draft model vocab does not match the target model: " + params_.draft_model_path;
+            unload();
+            return false;
+        }
+        params_.n_draft = std::max(1, params_.n_draft);
+    }
+    vocab_id_ = llm_vocab_id(llama_model_get_vocab(model_ref_.get()));
+    return init_context(err);
+}
+
+bool llm_engine::attach(const llm_engine &base, std::string &err)
+{
+    if (!base.model_ref_)
+    {
+        err = "attach: base engine not loaded";
+        return false;
+    }
+    unload();
+    params_ = base.params_;
+    model_ref_ = base.model_ref_;
+    draft_ref_ = base.draft_ref_;
+    vocab_id_ = base.vocab_id_;
+    return init_context(err);
+}
+
+bool llm_engine::init_context(std::string &err)
+{
+    model_ = model_ref_.get();
+    draft_model_ = draft_ref_.get();
+
+    // KV cache 在所有序列间共享：公共前缀只占一份，其余按每序列 n_ctx 预留
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx = (uint32_t)params_.n_ctx * (uint32_t)params_.n_parallel;
+    cparams.n_batch = params_.n_batch;
+    cparams.n_seq_max = params_.n_parallel + 1; // k_prefix_seq + 每个 slot 一个
+    cparams.n_threads = params_.n_threads;
+    cparams.n_threads_batch = params_.n_threads_batch;
+    cparams.type_k = params_.type_k;
+    cparams.type_v = params_.type_v;
+    cparams.flash_attn = params_.flash_attn;
+    const bool v_quantized = params_.type_v != GGML_TYPE_F32 && params_.type_v != GGML_TYPE_F16 &&
+                             params_.type_v != GGML_TYPE_BF16;
+    if (v_quantized && !params_.flash_attn)
+    {
+        err = std::string("quantized V cache (") + ggml_type_name(params_.type_v) + ") requires flash attention";
+        unload();
+        return false;
+    }
+
+    ctx_ = llama_new_context_with_model(model_, cparams);
+    if (!ctx_)
+    {
+        err = "Failed to create context";
+        unload();
+        return false;
+    }
+    kv_bytes_ = llm_kv_cache_bytes(model_, llama_n_ctx(ctx_), params_.type_k, params_.type_v);
+
+    vocab_ = llama_model_get_vocab(model_);
+    default_stops_ = std::make_shared<const stop_matcher>(llm_default_stops());
+    batch_ = llama_batch_init(params_.n_batch, 0, 1);
+    batch_ready_ = true;
+
+    slots_.resize(params_.n_parallel);
+    for (int i = 0; i < params_.n_parallel; ++i)
+        slots_[i].seq = k_prefix_seq + 1 + i;
+
+    if (draft_model_)
+    {
+        // 与目标上下文同样的序列布局，seq id 一一对应
+        draft_ctx_ = llama_new_context_with_model(draft_model_, cparams);
+        if (!draft_ctx_)
+        {
+            err = "Failed to create draft context";
+            unload();
+            return false;
+        }
+        kv_bytes_ += llm_kv_cache_bytes(draft_model_, llama_n_ctx(draft_ctx_), params_.type_k, params_.type_v);
+        draft_batch_ = llama_batch_init(params_.n_batch, 0, 1);
+        draft_smpl_ = llama_sampler_chain_init(llama_sampler_chain_default_params());
+        llama_sampler_chain_add(draft_smpl_, llama_sampler_init_greedy());
+    }
+    return true;
+}
+
+void llm_engine::unload()
+{
+    for (auto &s : slots_)
+    {
+        if (s.smpl)
+            llama_sampler_free(s.smpl);
+    }
+    slots_.clear();
+    if (batch_ready_)
+    {
+        llama_batch_free(batch_);
+        batch_ready_ = false;
+    }
+    if (ctx_)
+    {
+        llama_free(ctx_);
+        ctx_ = nullptr;
+    }
+    if (draft_smpl_)
+    {
+        llama_sampler_free(draft_smpl_);
+        draft_smpl_ = nullptr;
+    }
+    if (draft_ctx_)
+    {
+        llama_batch_free(draft_batch_);
+        llama_free(draft_ctx_);
+        draft_ctx_ = nullptr;
+    }
+    // 权重由 attach 出来的其他引擎共用，最后一个引用释放时才真正卸载
+    model_ = nullptr;
+    model_ref_.reset();
+    draft_model_ = nullptr;
+    draft_ref_.reset();
+    kv_bytes_ = 0;
+    vocab_ = nullptr;
+    vocab_id_.clear();
+    prefix_text_.clear();
+    prefix_tokens_.clear();
+    prefix_ready_ = false;
+    default_stops_.reset();
+    custom_stops_key_.clear();
+    custom_stops_.reset();
+}
+
+size_t llm_engine::weights_bytes() const
+{
+    size_t n = model_ ? (size_t)llama_model_size(model_) : 0;
+    if (draft_model_)
+        n += (size_t)llama_model_size(draft_model_);
+    return n;
+}
+
+int llm_engine::kv_cells() const
+{
+    return ctx_ ? (int)llama_n_ctx(ctx_) : 0;
+}
+
+std::shared_ptr<const stop_matcher> llm_engine::stops_for(const llm_request &req)
+{
+    if (req.stops.empty())
+        return default_stops_;
+    if (!custom_stops_ || req.stops != custom_stops_key_)
+    {
+        custom_stops_key_ = req.stops;
+        custom_stops_ = std::make_shared<const stop_matcher>(req.stops);
+    }
+    return custom_stops_;
+}
+
+bool llm_engine::tokenize(std::string_view text, bool add_special, std::vector<llama_token> &out) const
+{
+    // out 是复用的缓冲，clear 不释放容量；大小估计与按准确个数重试见 llm_tokenize_append
+    out.clear();
+    return llm_tokenize_append(vocab_, text.data(), text.size(), add_special, out);
+}
+
+void llm_engine::detokenize(const llama_token *tokens, size_t n, std::string &out) const
+{
+    out.clear();
+    char buf[256];
+    for (size_t i = 0; i < n; ++i)
+    {
+        const int nb = llama_token_to_piece(vocab_, tokens[i], buf, (int)sizeof(buf), 0, false);
+        if (nb > 0)
+            out.append(buf, (size_t)nb);
+    }
+}
+
+bool llm_engine::prefill(const std::vector<llama_token> &tokens, llama_seq_id seq, llama_pos pos0)
+{
+    const int n_batch = params_.n_batch;
+    const int n_tokens = (int)tokens.size();
+
+    for (int start = 0; start < n_tokens; start += n_batch)
+    {
+        const int n = std::min(n_batch, n_tokens - start);
+
+        batch_.n_tokens = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            const int j = batch_.n_tokens;
+            batch_.token[j] = tokens[start + i];
+            batch_.pos[j] = pos0 + start + i;
+            batch_.seq_id[j][0] = seq;
+            batch_.n_seq_id[j] = 1;
+            batch_.logits[j] = (start + i == n_tokens - 1);
+            batch_.n_tokens++;
+        }
+
+        if (llama_decode(ctx_, batch_) != 0)
+            return false;
+    }
+    return true;
+}
+
+bool llm_engine::build_prompt(const llm_request &req, std::vector<llama_token> &suffix, int &evidence_begin,
+                              llm_result &res)
+{
+    // 4) system + user prompt (注入证据)
+    // 固定的 system 与格式说明放在最前面，作为可复用的公共前缀；证据与问题放在后面。
+    static const std::string system = u8"你是计算机专业课程助教，只能用中文回答。"
+                                      u8"输出必须满足："
+                                      u8"（1）只输出一句话；（2）必须是定义式；（3）不得出现“好的/请/根据/无法/示例”等套话；"
+                                      u8"（4）不得输出换行；（5）不得输出多余标点。";
+    static const std::string user_head = u8"请按以下格式回答：\n【定义】LR(0)项目集：<一句话定义>。\n";
+
+    // user / prompt 都是引擎复用的缓冲（只在调度线程里用），请求之间不重新分配
+    std::string &user = scratch_.user;
+    user.assign(user_head);
+    // 预先切好的证据在模板里先用一个占位符（私用区字符，正文里不会出现）顶着，tokenize 时在这里拼进证据 token
+    static const std::string_view evidence_slot = "\xEE\x80\x80";
+    const bool use_pieces = !req.evidence_pieces.empty();
+    if (use_pieces)
+    {
+        user += u8"以下是检索到的资料证据（回答必须基于这些证据，且不得编造）：\n";
+        user += evidence_slot;
+        user += "\n";
+    }
+    else if (!req.evidence.empty())
+    {
+        user += u8"以下是检索到的资料证据（回答必须基于这些证据，且不得编造）：\n";
+        user += req.evidence;
+        user += "\n";
+    }
+    user += u8"问题：";
+    user += req.question;
+
+    const llama_chat_message msgs[2] = {{"system", system.c_str()}, {"user", user.c_str()}};
+
+    // 模板只会加上角色标记，先按正文长度留余量；返回值大于缓冲时按准确长度再渲染一次
+    std::string &prompt = scratch_.prompt;
+    prompt.resize(std::max(prompt.capacity(), system.size() + user.size() + 256));
+    int pn = llama_chat_apply_template(nullptr /* 用 GGUF 元数据里的模板 */, msgs, 2, true /* add assistant prefix */,
+                                       prompt.data(), (int)prompt.size());
+    if (pn > (int)prompt.size())
+    {
+        prompt.resize((size_t)pn);
+        pn = llama_chat_apply_template(nullptr, msgs, 2, true, prompt.data(), (int)prompt.size());
+    }
+    if (pn < 0)
+    {
+        res.error_code = 6;
+        res.error = "llama_chat_apply_template failed";
+        return false;
+    }
+    prompt.resize(pn);
+    scratch_.t_templated = clock::now();
+
+    if (req.debug_prompt)
+    {
+        std::cerr << "\n[DEBUG PROMPT]\n"
+                  << prompt.substr(0, 1200) << "\n[/DEBUG PROMPT]\n";
+    }
+
+    // 模板渲染结果里 user_head 结束的位置就是公共前缀的边界；找不到时整段都当作后缀
+    size_t split = prompt.find(user_head);
+    split = (split == std::string::npos) ? 0 : split + user_head.size();
+
+    // 5) tokenize（前缀和后缀分别 tokenize，前缀 token 在请求之间原样复用）
+    const std::string_view view(prompt);
+    if (split == 0 || view.substr(0, split) != prefix_text_)
+    {
+        if (!tokenize(view.substr(0, split), true, prefix_tokens_))
+        {
+            prefix_text_.clear();
+            prefix_ready_ = false;
+            res.error_code = 4;
+            res.error = "Tokenize failed";
+            return false;
+        }
+        prefix_text_.assign(view.substr(0, split));
+        prefix_ready_ = false;
+    }
+
+    const size_t slot_pos = use_pieces ? prompt.find(evidence_slot, split) : std::string::npos;
+    bool tok_ok = true;
+    // 证据在 suffix 里的 token 区间；-1 表示不知道（按文本拼接时只在超长需要截断时才去算）
+    int ev_begin = -1, ev_end = -1;
+    if (slot_pos == std::string::npos)
+    {
+        if (use_pieces)
+        {
+            // 模板把占位符改写了（少见）：退回按文本拼接
+            std::string evidence;
+            for (const auto &p : req.evidence_pieces)
+                evidence += p.text;
+            std::string text(view.substr(split));
+            const size_t at = text.find(evidence_slot);
+            if (at != std::string::npos)
+                text.replace(at, evidence_slot.size(), evidence);
+            tok_ok = tokenize(text, prefix_tokens_.empty(), suffix);
+        }
+        else
+        {
+            tok_ok = tokenize(view.substr(split), prefix_tokens_.empty(), suffix);
+        }
+    }
+    else
+    {
+        // 占位符前后的模板文本各切一次，证据按块追加：有缓存 token 的直接拷贝，没有的现场切。
+        // 各块都以换行开头/结尾，在换行处拼接与整段 tokenize 的结果基本一致
+        tok_ok = tokenize(view.substr(split, slot_pos - split), prefix_tokens_.empty(), suffix);
+        ev_begin = (int)suffix.size();
+        for (size_t i = 0; tok_ok && i < req.evidence_pieces.size(); ++i)
+        {
+            const auto &p = req.evidence_pieces[i];
+            if (!p.tokens.empty())
+                suffix.insert(suffix.end(), p.tokens.begin(), p.tokens.end());
+            else if (!p.text.empty())
+                tok_ok = llm_tokenize_append(vocab_, p.text.data(), p.text.size(), false, suffix);
+        }
+        ev_end = (int)suffix.size();
+        if (tok_ok)
+        {
+            const std::string_view tail = view.substr(slot_pos + evidence_slot.size());
+            tok_ok = tokenize(tail, false, scratch_.tokens);
+            suffix.insert(suffix.end(), scratch_.tokens.begin(), scratch_.tokens.end());
+        }
+    }
+    if (!tok_ok)
+    {
+        res.error_code = 4;
+        res.error = "Tokenize failed";
+        return false;
+    }
+
+    const int n_prefix = (int)prefix_tokens_.size();
+    res.n_prompt_tokens = n_prefix + (int)suffix.size();
+
+    // 超长时（truncate / shift）从证据末尾（排序最靠后的证据）砍掉多出来的 token，保留前面的说明和最后的问题，
+    // 并给生成至少留 min(n_predict, n_ctx / 4) 个位置
+    const int n_reserve = std::min(req.n_predict, std::max(1, params_.n_ctx / 4));
+    if (params_.overflow != llm_overflow::fail && res.n_prompt_tokens + n_reserve > params_.n_ctx)
+    {
+        const size_t at = req.evidence.empty() ? std::string::npos : view.find(req.evidence, split);
+        if (ev_begin < 0 && at != std::string::npos)
+        {
+            // 按文本拼接的证据：分别切一下证据前后的文本，估出证据的 token 区间
+            std::vector<llama_token> &tmp = scratch_.tokens;
+            if (tokenize(view.substr(split, at - split), prefix_tokens_.empty(), tmp))
+                ev_begin = (int)tmp.size();
+            if (tokenize(view.substr(at + req.evidence.size()), false, tmp))
+                ev_end = (int)suffix.size() - (int)tmp.size();
+            if (ev_begin < 0 || ev_end < ev_begin)
+                ev_begin = ev_end = -1;
+        }
+        if (ev_begin >= 0)
+        {
+            const int n_cut = std::min(res.n_prompt_tokens + n_reserve - params_.n_ctx, ev_end - ev_begin);
+            suffix.erase(suffix.begin() + (ev_end - n_cut), suffix.begin() + ev_end);
+            res.n_truncated_tokens = n_cut;
+            res.n_prompt_tokens -= n_cut;
+        }
+    }
+    evidence_begin = std::max(ev_begin, 0);
+
+    if (suffix.empty() || res.n_prompt_tokens >= params_.n_ctx)
+    {
+        res.error_code = 5;
+        res.error = "prompt has " + std::to_string(res.n_prompt_tokens) + " tokens, context is " +
+                    std::to_string(params_.n_ctx);
+        return false;
+    }
+
+    // 公共前缀常驻在 k_prefix_seq 上，文本不变就不重算。
+    // 换前缀时只丢 k_prefix_seq：正在生成的序列已持有旧前缀那些 cell 的引用，不受影响。
+    if (!prefix_ready_)
+    {
+        llama_kv_cache_seq_rm(ctx_, k_prefix_seq, -1, -1);
+        if (n_prefix > 0 && !prefill(prefix_tokens_, k_prefix_seq, 0))
+        {
+            prefix_text_.clear();
+            prefix_tokens_.clear();
+            res.error_code = 5;
+            res.error = "llama_decode(prefix) failed";
+            return false;
+        }
+        prefix_ready_ = true;
+    }
+    else
+    {
+        res.n_cached_tokens = n_prefix;
+    }
+    return true;
+}
+
+bool llm_engine::autotune_threads(std::vector<int> candidates, std::vector<llm_thread_probe> &probes, std::string &err)
+{
+    probes.clear();
+    if (!ctx_ || slots_.empty())
+    {
+        err = "engine not loaded";
+        return false;
+    }
+    if (candidates.empty())
+    {
+        const int n_cpu = cpu_count_available();
+        for (int n : {n_cpu / 4, n_cpu / 2, (n_cpu * 3) / 4, n_cpu})
+        {
+            if (n >= 1 && std::find(candidates.begin(), candidates.end(), n) == candidates.end())
+                candidates.push_back(n);
+        }
+    }
+
+    // 固定的测试输入：约 128 个 token 的 prefill + 16 步单 token decode，借用空闲的第一个 slot 的序列
+    std::vector<llama_token> tokens;
+    const std::string text = u8"LR(0) 项目集是带点的产生式集合，用于构造 LR 分析表。";
+    while (tokens.size() < 128)
+    {
+        std::vector<llama_token> t;
+        if (!tokenize(text, false, t) || t.empty())
+        {
+            err = "tokenize failed";
+            return false;
+        }
+        tokens.insert(tokens.end(), t.begin(), t.end());
+    }
+    tokens.resize(std::min<size_t>(128, (size_t)params_.n_ctx / 2));
+    const int n_decode = 16;
+    const llama_seq_id seq = slots_[0].seq;
+
+    auto run_once = [&](llm_thread_probe &p) -> bool
+    {
+        llama_kv_cache_seq_rm(ctx_, seq, -1, -1);
+        const auto t0 = clock::now();
+        if (!prefill(tokens, seq, 0))
+            return false;
+        const auto t1 = clock::now();
+        for (int i = 0; i < n_decode; ++i)
+        {
+            batch_.n_tokens = 1;
+            batch_.token[0] = tokens[(size_t)i % tokens.size()];
+            batch_.pos[0] = (llama_pos)(tokens.size() + i);
+            batch_.seq_id[0][0] = seq;
+            batch_.n_seq_id[0] = 1;
+            batch_.logits[0] = true;
+            if (llama_decode(ctx_, batch_) != 0)
+                return false;
+        }
+        const auto t2 = clock::now();
+        llama_kv_cache_seq_rm(ctx_, seq, -1, -1);
+        p.prefill_tps = tokens.size() * 1000.0 / std::max(1e-3, ms_between(t0, t1));
+        p.decode_tps = n_decode * 1000.0 / std::max(1e-3, ms_between(t1, t2));
+        return true;
+    };
+
+    // 先跑一遍预热（缺页、权重进 cache），不计入结果
+    llm_thread_probe warm;
+    llama_set_n_threads(ctx_, params_.n_threads, params_.n_threads_batch);
+    if (!run_once(warm))
+    {
+        err = "llama_decode failed during autotune";
+        return false;
+    }
+
+    llm_thread_probe best_prefill, best_decode;
+    for (int n : candidates)
+    {
+        llm_thread_probe p;
+        p.n_threads = n;
+        llama_set_n_threads(ctx_, n, n);
+        if (!run_once(p))
+        {
+            err = "llama_decode failed during autotune";
+            llama_set_n_threads(ctx_, params_.n_threads, params_.n_threads_batch);
+            return false;
+        }
+        probes.push_back(p);
+        if (p.prefill_tps > best_prefill.prefill_tps)
+            best_prefill = p;
+        if (p.decode_tps > best_decode.decode_tps)
+            best_decode = p;
+    }
+
+    params_.n_threads = best_decode.n_threads;
+    params_.n_threads_batch = best_prefill.n_threads;
+    llama_set_n_threads(ctx_, params_.n_threads, params_.n_threads_batch);
+    if (draft_ctx_)
+        llama_set_n_threads(draft_ctx_, params_.n_threads, params_.n_threads_batch);
+    return true;
+}
+
+void llm_engine::submit(const llm_request &req, llm_done_fn on_done, llm_delta_fn on_delta)
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        queue_.push_back({req, std::move(on_done), std::move(on_delta), clock::now()});
+    }
+    cv_.notify_one();
+}
+
+void llm_engine::stop()
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+}
+
+void llm_engine::run()
+{
+    while (true)
+    {
+        if (step())
+            continue;
+
+        std::unique_lock<std::mutex> lk(mtx_);
+        cv_.wait(lk, [&]
+                 { return stopping_ || !queue_.empty(); });
+        if (queue_.empty() && stopping_)
+            break;
+    }
+}
+
+llm_result llm_engine::generate(const llm_request &req, llm_delta_fn on_delta)
+{
+    llm_result out;
+    if (!ctx_)
+    {
+        out.error_code = 3;
+        out.error = "engine not loaded";
+        return out;
+    }
+
+    bool done = false;
+    submit(req, [&](const llm_result &r)
+           {
+               out = r;
+               done = true; },
+           std::move(on_delta));
+    while (!done && step())
+    {
+    }
+    return out;
+}
+
+bool llm_engine::admit(slot &s, pending_request &p)
+{
+    s.req = std::move(p.req);
+    s.on_done = std::move(p.on_done);
+    s.on_delta = std::move(p.on_delta);
+    s.t_submit = p.t_submit;
+    s.t_admit = clock::now();
+    s.t_first = clock::time_point();
+    s.t_templated = s.t_built = clock::time_point();
+    s.res = llm_result();
+    s.out.clear();
+    s.n_streamed = 0;
+    s.stops = stops_for(s.req);
+    s.stop_state = 0;
+    s.deadline = s.req.policy.deadline_ms > 0 ? s.t_submit + std::chrono::milliseconds(s.req.policy.deadline_ms)
+                                              : clock::time_point::max();
+    if (s.t_admit >= s.deadline)
+    {
+        fail(s, 8, "deadline exceeded while queued");
+        return false;
+    }
+    s.n_prompt_done = 0;
+    s.next = -1;
+    s.i_batch = -1;
+    s.active = true;
+
+    const bool built = build_prompt(s.req, s.prompt, s.n_keep, s.res);
+    s.t_templated = scratch_.t_templated;
+    s.t_built = clock::now();
+    if (!built)
+    {
+        fail(s, s.res.error_code, s.res.error);
+        return false;
+    }
+
+    // 上一条请求的 KV 丢掉，再把公共前缀挂到本序列上
+    const int n_prefix = (int)prefix_tokens_.size();
+    llama_kv_cache_seq_rm(ctx_, s.seq, -1, -1);
+    if (n_prefix > 0)
+        llama_kv_cache_seq_cp(ctx_, k_prefix_seq, s.seq, -1, -1);
+    s.n_past = n_prefix;
+    s.n_keep += n_prefix;
+
+    // 生成长度不能超出剩余的上下文
+    s.n_gen_max = std::min(s.req.n_predict, params_.n_ctx - s.res.n_prompt_tokens);
+    if (s.req.policy.max_tokens > 0)
+        s.n_gen_max = std::min(s.n_gen_max, s.req.policy.max_tokens);
+    if (s.n_gen_max <= 0)
+    {
+        s.res.stop_reason = "length";
+        finish(s);
+        return false;
+    }
+
+    // 7) sampler chain；语法约束放在最前面，后面的 top-k/top-p 只在合法 token 里挑
+    s.smpl = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (!s.req.grammar.empty())
+    {
+        llama_sampler *g = llama_sampler_init_grammar(vocab_, s.req.grammar.c_str(), "root");
+        if (!g)
+        {
+            fail(s, 7, "failed to parse grammar");
+            return false;
+        }
+        llama_sampler_chain_add(s.smpl, g);
+    }
+    llama_sampler_chain_add(s.smpl, llama_sampler_init_top_k(s.req.top_k));
+    llama_sampler_chain_add(s.smpl, llama_sampler_init_top_p(s.req.top_p, 1));
+    llama_sampler_chain_add(s.smpl, llama_sampler_init_temp(s.req.temp));
+    llama_sampler_chain_add(s.smpl, llama_sampler_init_dist((uint32_t)s.req.seed));
+
+    s.spec = draft_ctx_ && draft_prefill(s);
+    // context shift：序列写满 n_ctx 时挪掉一段旧 token 继续生成，不再受剩余上下文限制（草稿 KV 不跟着挪，投机解码时不用）
+    if (params_.overflow == llm_overflow::shift && !s.spec)
+    {
+        s.n_gen_max = s.req.n_predict;
+        if (s.req.policy.max_tokens > 0)
+            s.n_gen_max = std::min(s.n_gen_max, s.req.policy.max_tokens);
+    }
+
+    s.out.reserve((size_t)s.req.n_predict * 6);
+    return true;
+}
+
+void llm_engine::release(slot &s)
+{
+    if (s.smpl)
+    {
+        llama_sampler_free(s.smpl);
+        s.smpl = nullptr;
+    }
+    llama_kv_cache_seq_rm(ctx_, s.seq, -1, -1);
+    if (draft_ctx_)
+        llama_kv_cache_seq_rm(draft_ctx_, s.seq, -1, -1);
+    s.spec = false;
+    s.draft_feed.clear();
+    s.drafted.clear();
+    s.active = false;
+    s.prompt.clear();
+    s.on_done = nullptr;
+    s.on_delta = nullptr;
+    s.stops.reset();
+}
+
+void llm_engine::record_timings(slot &s)
+{
+    s.res.queue_ms = ms_between(s.t_submit, s.t_admit);
+    if (s.t_built != clock::time_point())
+    {
+        s.res.template_ms = ms_between(s.t_admit, s.t_templated);
+        s.res.tokenize_ms = ms_between(s.t_templated, s.t_built);
+    }
+    if (s.t_first == clock::time_point())
+        return;
+    s.res.ttft_ms = ms_between(s.t_submit, s.t_first);
+    const double prefill_ms = ms_between(s.t_admit, s.t_first);
+    const int n_prefilled = s.res.n_prompt_tokens - s.res.n_cached_tokens;
+    if (prefill_ms > 0.0)
+        s.res.prefill_tps = n_prefilled * 1000.0 / prefill_ms;
+    const double decode_ms = ms_between(s.t_first, clock::now());
+    if (s.res.n_gen_tokens > 1 && decode_ms > 0.0)
+        s.res.decode_tps = (s.res.n_gen_tokens - 1) * 1000.0 / decode_ms;
+}
+
+namespace
+{
+struct llm_stage_metrics
+{
+    metric_histogram &queue = stage("queue");
+    metric_histogram &templ = stage("template");
+    metric_histogram &tokenize = stage("tokenize");
+    metric_histogram &prefill = stage("prefill");
+    metric_histogram &decode = stage("decode");
+    metric_histogram &ttft = metrics().histogram("llm_ttft_seconds", "Time to first token, excluding pool wait");
+    metric_counter &prompt_tokens = tokens("prompt");
+    metric_counter &cached_tokens = tokens("cached");
+    metric_counter &gen_tokens = tokens("generated");
+    metric_counter &truncated_tokens = tokens("truncated");
+
+    static metric_histogram &stage(const char *name)
+    {
+        return metrics().histogram("llm_stage_seconds", "Generation stage latency", {{"stage", name}});
+    }
+    static metric_counter &tokens(const char *kind)
+    {
+        return metrics().counter("llm_tokens_total", "Tokens processed by kind", {{"kind", kind}});
+    }
+};
+
+llm_stage_metrics &stage_metrics()
+{
+    static llm_stage_metrics m;
+    return m;
+}
+} // namespace
+
+void llm_engine::report(const slot &s)
+{
+    const llm_stage_metrics &m = stage_metrics();
+    const llm_result &r = s.res;
+    const clock::time_point t_end = clock::now();
+    m.queue.observe_ms(r.queue_ms);
+    metrics()
+        .counter("llm_requests_total", "Finished generation requests by error code (0 = ok)",
+                 {{"code", std::to_string(r.ok ? 0 : r.error_code)}})
+        .inc();
+    if (s.t_built != clock::time_point())
+    {
+        m.templ.observe_ms(r.template_ms);
+        m.tokenize.observe_ms(r.tokenize_ms);
+        m.prompt_tokens.inc((uint64_t)std::max(0, r.n_prompt_tokens));
+        m.cached_tokens.inc((uint64_t)std::max(0, r.n_cached_tokens));
+        m.truncated_tokens.inc((uint64_t)std::max(0, r.n_truncated_tokens));
+    }
+    m.gen_tokens.inc((uint64_t)std::max(0, r.n_gen_tokens));
+    const bool has_first = s.t_first != clock::time_point();
+    if (has_first)
+    {
+        m.prefill.observe_ms(ms_between(s.t_built, s.t_first));
+        m.decode.observe_ms(ms_between(s.t_first, t_end));
+        m.ttft.observe_ms(ms_between(s.t_submit, s.t_first));
+    }
+
+    const uint64_t tid = s.req.trace_id;
+    if (tid == 0 || !trace_enabled())
+        return;
+    trace_span("queue", "llm", tid, s.t_submit, s.t_admit);
+    if (s.t_built != clock::time_point())
+    {
+        trace_span("template", "llm", tid, s.t_admit, s.t_templated);
+        trace_span("tokenize", "llm", tid, s.t_templated, s.t_built,
+                   "{\"n_prompt\":" + std::to_string(r.n_prompt_tokens) +
+                       ",\"n_cached\":" + std::to_string(r.n_cached_tokens) + "}");
+    }
+    if (has_first)
+    {
+        trace_span("prefill", "llm", tid, s.t_built, s.t_first);
+        trace_span("decode", "llm", tid, s.t_first, t_end,
+                   "{\"n_gen\":" + std::to_string(r.n_gen_tokens) + ",\"stop\":\"" + r.stop_reason + "\"}");
+    }
+}
+
+void llm_engine::stream(slot &s, bool final)
+{
+    if (!s.on_delta)
+        return;
+    size_t end = s.out.size();
+    if (!final)
+        end -= std::min(end, s.stops->pending(s.stop_state));
+    end = utf8_safe_end(s.out, end);
+    if (end <= s.n_streamed)
+        return;
+    s.on_delta(s.out.substr(s.n_streamed, end - s.n_streamed));
+    s.n_streamed = end;
+}
+
+void llm_engine::fail(slot &s, int code, const std::string &msg)
+{
+    s.res.ok = false;
+    s.res.error_code = code;
+    s.res.error = msg;
+    record_timings(s);
+    report(s);
+    llm_done_fn cb = std::move(s.on_done);
+    llm_result res = std::move(s.res);
+    release(s);
+    if (cb)
+        cb(res);
+}
+
+void llm_engine::finish(slot &s)
+{
+    std::string &out = s.out;
+
+    // 解码时已经在第一个停止串处截断，这里不必再扫一遍
+    if (s.stops)
+        stream(s, true);
+    // 因长度或 deadline 截断时，末尾可能是半个 UTF-8 字符
+    out.resize(utf8_safe_end(out, out.size()));
+    record_timings(s);
+    normalize_one_sentence(out);
+
+    // 有语法约束时形状已经由解码保证，不再做“从 LR(0) 开始截”的补救
+    if (s.req.grammar.empty())
+    {
+        const std::string key = u8"LR(0)";
+        size_t p = out.find(key);
+        if (p != std::string::npos && p > 0)
+        {
+            out = out.substr(p);
+            normalize_one_sentence(out);
+        }
+    }
+
+    s.res.answer = out;
+    s.res.ok = true;
+    s.res.kv_seq_bytes = llama_state_seq_get_size(ctx_, s.seq);
+    report(s);
+    llm_done_fn cb = std::move(s.on_done);
+    llm_result res = std::move(s.res);
+    release(s);
+    if (cb)
+        cb(res);
+}
+
+llama_token llm_engine::sample_at(slot &s, int i_batch)
+{
+    // llama_sampler_sample 内部已经 accept 过；再 accept 一次会让语法状态多走一步
+    llama_token id = llama_sampler_sample(s.smpl, ctx_, i_batch);
+    if (s.t_first == clock::time_point())
+        s.t_first = clock::now();
+    return id;
+}
+
+bool llm_engine::sample_next(slot &s)
+{
+    return accept_token(s, sample_at(s, s.i_batch));
+}
+
+bool llm_engine::accept_token(slot &s, llama_token id)
+{
+    if (id == llama_token_eos(vocab_))
+    {
+        s.res.stop_reason = "eos";
+        return false;
+    }
+
+    char buf[4096];
+    int nb = llama_token_to_piece(vocab_, id, buf, (int)sizeof(buf), 0, true);
+    if (nb <= 0)
+    {
+        s.res.stop_reason = "eos";
+        return false;
+    }
+
+    const size_t pos = s.out.size();
+    s.out.append(buf, buf + nb);
+    s.res.n_gen_tokens++;
+
+    // 停止串可能跨 token，也可能落在一个 token 的中间；自动机状态跨 token 保留，只需喂入新字节
+    const size_t cut = s.stops->feed(s.stop_state, buf, (size_t)nb, pos);
+    if (cut != std::string::npos)
+    {
+        s.out.resize(cut);
+        s.res.stop_reason = "stop";
+        return false;
+    }
+
+    // 一句话策略：正文开始后、新字节里出现句末就停，保留句末标点；往回多看 2 字节以覆盖被切开的“。”
+    if (s.req.policy.one_sentence)
+    {
+        const size_t body = s.out.find_first_not_of(" \t\r\n");
+        if (body != std::string::npos)
+        {
+            const size_t from = std::max(body, pos > 2 ? pos - 2 : (size_t)0);
+            const size_t end = find_first_sentence_end_zh(s.out.substr(from));
+            if (end != std::string::npos)
+            {
+                s.out.resize(from + end);
+                s.res.stop_reason = "sentence";
+                return false;
+            }
+        }
+    }
+    if (s.res.n_gen_tokens >= s.n_gen_max)
+    {
+        s.res.stop_reason = "length";
+        return false;
+    }
+
+    stream(s, false);
+    s.next = id;
+    return true;
+}
+
+bool llm_engine::draft_prefill(slot &s)
+{
+    std::vector<llama_token> tokens = prefix_tokens_;
+    tokens.insert(tokens.end(), s.prompt.begin(), s.prompt.end());
+
+    llama_kv_cache_seq_rm(draft_ctx_, s.seq, -1, -1);
+    s.draft_feed.clear();
+    s.drafted.clear();
+    s.draft_n_past = 0;
+    for (size_t start = 0; start < tokens.size(); start += (size_t)params_.n_batch)
+    {
+        const size_t n = std::min((size_t)params_.n_batch, tokens.size() - start);
+        draft_batch_.n_tokens = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const int j = draft_batch_.n_tokens++;
+            draft_batch_.token[j] = tokens[start + i];
+            draft_batch_.pos[j] = (llama_pos)(start + i);
+            draft_batch_.seq_id[j][0] = s.seq;
+            draft_batch_.n_seq_id[j] = 1;
+            draft_batch_.logits[j] = false; // 第一次起草时才需要 logits
+        }
+        if (llama_decode(draft_ctx_, draft_batch_) != 0)
+        {
+            std::cerr << "Warning: draft prefill failed, decoding without speculation\n";
+            llama_kv_cache_seq_rm(draft_ctx_, s.seq, -1, -1);
+            return false;
+        }
+    }
+    s.draft_n_past = (int)tokens.size();
+    return true;
+}
+
+void llm_engine::draft_step(int batch_room)
+{
+    std::vector<slot *> todo;
+    for (auto &s : slots_)
+    {
+        s.drafted.clear();
+        if (s.active && s.spec && s.next >= 0)
+            todo.push_back(&s);
+    }
+    if (todo.empty())
+        return;
+
+    // 每条序列的草稿长度：不超过 n_draft、剩余生成预算（留一个给目标模型自己的 token），并平分 batch 余量
+    const int per_slot = std::max(0, batch_room / (int)todo.size());
+    std::vector<int> budget(todo.size());
+    for (size_t k = 0; k < todo.size(); ++k)
+    {
+        slot &s = *todo[k];
+        budget[k] = std::min({params_.n_draft, s.n_gen_max - s.res.n_gen_tokens - 1, per_slot});
+    }
+
+    // 第一轮：补喂 draft_feed + next；之后每轮每条序列一个 token
+    std::vector<int> idx(todo.size(), -1);
+    for (int round = 0;; ++round)
+    {
+        draft_batch_.n_tokens = 0;
+        auto add = [&](llama_token tok, llama_pos pos, llama_seq_id seq, bool logits)
+        {
+            const int j = draft_batch_.n_tokens++;
+            draft_batch_.token[j] = tok;
+            draft_batch_.pos[j] = pos;
+            draft_batch_.seq_id[j][0] = seq;
+            draft_batch_.n_seq_id[j] = 1;
+            draft_batch_.logits[j] = logits;
+            return j;
+        };
+        for (size_t k = 0; k < todo.size(); ++k)
+        {
+            slot &s = *todo[k];
+            idx[k] = -1;
+            if ((int)s.drafted.size() >= budget[k])
+                continue;
+            if (round == 0)
+            {
+                if (draft_batch_.n_tokens + (int)s.draft_feed.size() + 1 > params_.n_batch)
+                {
+                    budget[k] = 0;
+                    continue;
+                }
+                for (llama_token t : s.draft_feed)
+                    add(t, s.draft_n_past++, s.seq, false);
+                s.draft_feed.clear();
+                idx[k] = add(s.next, s.draft_n_past++, s.seq, true);
+            }
+            else
+            {
+                // 上一轮起草的 token 是 EOS 时不再往后起草
+                if (s.drafted.back() == llama_token_eos(vocab_))
+                {
+                    budget[k] = (int)s.drafted.size();
+                    continue;
+                }
+                idx[k] = add(s.drafted.back(), s.draft_n_past++, s.seq, true);
+            }
+        }
+        if (draft_batch_.n_tokens == 0)
+            break;
+
+        if (llama_decode(draft_ctx_, draft_batch_) != 0)
+        {
+            // 草稿失败不影响正确性：这些序列退回普通解码
+            std::cerr << "Warning: draft decode failed, decoding without speculation\n";
+            for (slot *s : todo)
+            {
+                s->spec = false;
+                s->drafted.clear();
+                llama_kv_cache_seq_rm(draft_ctx_, s->seq, -1, -1);
+            }
+            return;
+        }
+        for (size_t k = 0; k < todo.size(); ++k)
+        {
+            if (idx[k] >= 0)
+                todo[k]->drafted.push_back(llama_sampler_sample(draft_smpl_, draft_ctx_, idx[k]));
+        }
+    }
+}
+
+bool llm_engine::verify_draft(slot &s)
+{
+    // 本步 batch：next 在 base，草稿 d1..dK 在 base+1..base+K，每个位置都有 logits
+    const int n_drafted = (int)s.drafted.size();
+    const int base = s.n_past - 1 - n_drafted;
+    s.res.n_draft_tokens += n_drafted;
+
+    int j = 0;
+    for (;; ++j)
+    {
+        const llama_token id = sample_at(s, s.i_batch + j);
+        if (!accept_token(s, id))
+            return false;
+        if (j < n_drafted && id == s.drafted[j])
+            continue;
+        break;
+    }
+    s.res.n_draft_accepted += j;
+
+    // 目标 KV 只保留 next + 已接受的 j 个草稿；s.next 是目标模型在第 j 位自己采到的 token
+    llama_kv_cache_seq_rm(ctx_, s.seq, base + j + 1, -1);
+    s.n_past = base + j + 1;
+
+    // 草稿 KV 里有 next, d1..d(K-1)（dK 从未喂进去）
+    if (j < n_drafted)
+    {
+        llama_kv_cache_seq_rm(draft_ctx_, s.seq, base + j + 1, -1);
+        s.draft_n_past = base + j + 1;
+    }
+    else
+    {
+        s.draft_feed.assign(1, s.drafted.back());
+    }
+    s.drafted.clear();
+    return true;
+}
+
+bool llm_engine::context_shift(slot &s)
+{
+    // 与 llama.cpp 的 context shift 相同：保留前 n_keep 个位置（公共前缀 + 证据之前的说明），
+    // 丢掉其后的一半，再把后面的位置整体前移。移动的都是本序列自己的 cell，公共前缀不受影响
+    const int n_keep = std::min(s.n_keep, s.n_past);
+    const int n_discard = (s.n_past - n_keep) / 2;
+    if (n_discard <= 0)
+        return false;
+    llama_kv_cache_seq_rm(ctx_, s.seq, n_keep, n_keep + n_discard);
+    llama_kv_cache_seq_add(ctx_, s.seq, n_keep + n_discard, s.n_past, -n_discard);
+    s.n_past -= n_discard;
+    ++s.res.n_ctx_shifts;
+    return true;
+}
+
+int llm_engine::expire(clock::time_point now)
+{
+    int n = 0;
+    for (auto &s : slots_)
+    {
+        if (!s.active || now < s.deadline)
+            continue;
+        if (s.res.n_gen_tokens > 0)
+        {
+            // 解码中途到点：已生成的部分作为结果返回
+            s.res.stop_reason = "deadline";
+            finish(s);
+        }
+        else
+        {
+            fail(s, 8, "deadline exceeded during prefill");
+        }
+        ++n;
+    }
+    return n;
+}
+
+bool llm_engine::step()
+{
+    // 0) 到点的请求先结束，腾出 slot
+    const int n_expired = expire(clock::now());
+
+    // 1) 空闲 slot 接纳排队的请求
+    for (auto &s : slots_)
+    {
+        if (s.active)
+            continue;
+        pending_request p;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (queue_.empty())
+                break;
+            p = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        admit(s, p);
+    }
+
+    // 2) 组 batch：先放所有解码中序列的下一个 token，剩余容量给 prompt 分片（chunked prefill）
+    batch_.n_tokens = 0;
+    auto add = [&](llama_token tok, llama_pos pos, llama_seq_id seq, bool logits)
+    {
+        const int j = batch_.n_tokens++;
+        batch_.token[j] = tok;
+        batch_.pos[j] = pos;
+        batch_.seq_id[j][0] = seq;
+        batch_.n_seq_id[j] = 1;
+        batch_.logits[j] = logits;
+        return j;
+    };
+
+    if (draft_ctx_)
+    {
+        int n_decoding = 0;
+        for (const auto &s : slots_)
+            n_decoding += (s.active && s.next >= 0) ? 1 : 0;
+        draft_step(params_.n_batch - n_decoding);
+    }
+
+    std::vector<slot *> in_batch;
+    for (auto &s : slots_)
+    {
+        s.i_batch = -1;
+        if (s.active && s.next >= 0 && s.n_past >= params_.n_ctx && !context_shift(s))
+        {
+            s.res.stop_reason = "length";
+            finish(s);
+            continue;
+        }
+        if (s.active && s.next >= 0)
+        {
+            s.i_batch = add(s.next, s.n_past++, s.seq, true);
+            if (s.spec && s.drafted.empty())
+                s.draft_feed.push_back(s.next); // 本步没起草，草稿 KV 之后补上这个 token
+            s.next = -1;
+            for (llama_token t : s.drafted)
+                add(t, s.n_past++, s.seq, true);
+            in_batch.push_back(&s);
+        }
+    }
+    for (auto &s : slots_)
+    {
+        if (!s.active || s.n_prompt_done >= s.prompt.size() || batch_.n_tokens >= params_.n_batch)
+            continue;
+        while (s.n_prompt_done < s.prompt.size() && batch_.n_tokens < params_.n_batch)
+        {
+            const bool last = (s.n_prompt_done + 1 == s.prompt.size());
+            const int j = add(s.prompt[s.n_prompt_done++], s.n_past++, s.seq, last);
+            if (last)
+                s.i_batch = j;
+        }
+        in_batch.push_back(&s);
+    }
+
+    if (batch_.n_tokens == 0)
+        return n_expired > 0;
+
+    // 3) decode
+    if (llama_decode(ctx_, batch_) != 0)
+    {
+        for (slot *s : in_batch)
+            fail(*s, 5, "llama_decode failed");
+        return true;
+    }
+
+    // 4) 采样
+    for (slot *s : in_batch)
+    {
+        if (s->i_batch < 0)
+            continue;
+        const bool more = s->drafted.empty() ? sample_next(*s) : verify_draft(*s);
+        if (!more)
+            finish(*s);
+    }
+    kv_used_.store(llama_get_kv_cache_used_cells(ctx_), std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,326 @@
+// src/llm_engine.h
+// 把 llm_cli 的“加载模型 → 建上下文 → 拼 prompt → 生成”拆成可复用的引擎，
+// 这样 --serve 常驻进程只加载一次模型，之后处理多条请求。
+//
+// 引擎内部是一个连续批处理调度器：同一个 llama_context 里最多 n_parallel 条请求，
+// 每条占一个 seq_id；每一步把所有活跃请求的下一个 token（以及新请求的 prompt 分片）
+// 打包进同一个 llama_batch，一条请求结束后空出的 slot 立刻接纳排队中的请求。
+//
+// 可选的投机解码：给出同词表的小草稿模型时，每一步先用草稿模型为每条解码中的序列贪心起草 n_draft 个 token，
+// 目标模型在同一次 llama_decode 里把它们和正常的下一个 token 一起算出 logits，再用该请求自己的采样器逐位采样，
+// 与草稿一致就继续、不一致就停下。接受的 token 就是目标模型自己采出来的，所以采样参数与停止串的语义不变。
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "llama.h"
+#include "stop_matcher.h"
+
+// prompt 装不下（或没给生成留出位置）时怎么办
+enum class llm_overflow
+{
+    fail,     // 报错（error_code 5），默认
+    truncate, // 从证据末尾砍掉多出来的 token，保留说明与问题
+    shift,    // truncate，且生成写满 n_ctx 时做 context shift（丢掉证据的前一半，后面的位置前移）继续生成
+};
+
+struct llm_engine_params
+{
+    std::string model_path;
+    int n_ctx = 2048;   // 每条序列可用的上下文长度
+    int n_batch = 512;  // 单次 llama_decode 的 token 上限
+    int n_parallel = 1; // 同时解码的序列数
+
+    // CPU 调优：0 表示按可用 CPU 推算（decode 用一半，假设开了超线程；prefill 用全部）
+    int n_threads = 0;       // decode 线程数
+    int n_threads_batch = 0; // prefill 线程数
+    bool use_mmap = true;
+    bool use_mlock = false; // 把模型页锁在内存里，内存紧张时不被换出（需要足够的 RLIMIT_MEMLOCK）
+
+    std::string draft_model_path; // 非空时启用投机解码（须与主模型同一词表，如 Qwen2.5-0.5B 配 3B）
+    int n_draft = 8;              // 每步最多起草的 token 数
+
+    // KV cache 的存储类型：q8_0 约为 f16 的一半、q4_0 约为 0.28，同样内存可多开几倍的并发序列。
+    // V 量化需要 flash attention（llama.cpp 的限制）；草稿上下文用同样的设置
+    ggml_type type_k = GGML_TYPE_F16;
+    ggml_type type_v = GGML_TYPE_F16;
+    bool flash_attn = false;
+    llm_overflow overflow = llm_overflow::fail;
+};
+
+// 回答策略：什么时候可以停。默认对应现在的“一句话定义”输出
+struct llm_answer_policy
+{
+    int max_tokens = 0;       // token 预算，0 表示只受 n_predict 限制
+    bool one_sentence = true; // 一句话写完（句末标点或换行，见 find_first_sentence_end_zh）立即停，不再等停止串
+    int deadline_ms = 0;      // 从 submit 起算的延迟上限，0 不限；到点时已生成的部分照常返回
+};
+
+// 装好预算的一段证据（evidence_pack.h）：tokens 非空时直接拼进 prompt 的 token 序列，否则现场 tokenize text
+struct llm_evidence_piece
+{
+    std::string text;
+    std::vector<llama_token> tokens;
+};
+
+struct llm_request
+{
+    std::string question;
+    std::string evidence; // 已经选好的证据文本（可为空）
+    std::vector<llm_evidence_piece> evidence_pieces; // 非空时代替 evidence：按顺序拼接，预先切好的 token 不再重新 tokenize
+
+    int n_predict = 64;
+    float temp = 0.2f;
+    int top_k = 40;
+    float top_p = 0.9f;
+    int seed = 42;
+    bool debug_prompt = false;
+
+    std::vector<std::string> stops; // 为空时用 llm_default_stops()
+    std::string grammar;            // GBNF（根规则 root）；非空时加进采样链，边解码边约束输出形状
+    llm_answer_policy policy;
+    uint64_t trace_id = 0; // 非 0 时把排队 / 模板 / tokenize / prefill / decode 各段写进追踪（metrics.h）
+};
+
+struct llm_result
+{
+    bool ok = false;
+    int error_code = 0; // 与 llm_cli 的退出码保持一致（4 tokenize / 5 decode / 6 template / 7 grammar / 8 deadline / 9 overloaded）
+    std::string error;
+    std::string answer;
+    int n_prompt_tokens = 0;
+    int n_cached_tokens = 0; // 复用 KV 前缀、无需重新 prefill 的 token 数
+    int n_gen_tokens = 0;
+    std::string stop_reason; // eos / stop / sentence / length / deadline
+    int n_draft_tokens = 0;    // 草稿模型起草的 token 数
+    int n_draft_accepted = 0;  // 其中被目标模型接受的个数
+    int n_truncated_tokens = 0; // prompt 超长时从证据里砍掉的 token 数（llm_overflow::truncate / shift）
+    int n_ctx_shifts = 0;       // 生成中做过的 context shift 次数
+    size_t kv_seq_bytes = 0;    // 结束时该序列实际占用的 KV 字节数（llama_state_seq_get_size，含共用的公共前缀）
+
+    // 计时：ttft 从 submit 算起（含排队）；prefill 只计本请求实际送进 KV 的后缀 token
+    double queue_ms = 0.0;
+    double ttft_ms = 0.0;
+    double prefill_tps = 0.0;
+    double decode_tps = 0.0; // 第一个 token 之后的生成速度
+    double template_ms = 0.0; // 渲染聊天模板
+    double tokenize_ms = 0.0; // 切 token、拼预切好的证据与超长截断
+};
+
+// autotune_threads 的一组测量结果
+struct llm_thread_probe
+{
+    int n_threads = 0;
+    double prefill_tps = 0.0;
+    double decode_tps = 0.0;
+};
+
+// 请求完成回调；在调度线程里调用
+using llm_done_fn = std::function<void(const llm_result &)>;
+// 流式输出回调；在调度线程里调用。delta 是已确认不含停止串、且按 UTF-8 字符边界切好的原始生成文本，
+// 全部 delta 拼起来是截断到停止串之前的原始输出；llm_result::answer 另外做了单句规整，两者不一定相同
+using llm_delta_fn = std::function<void(const std::string &delta)>;
+
+class llm_engine
+{
+public:
+    llm_engine() = default;
+    ~llm_engine();
+
+    llm_engine(const llm_engine &) = delete;
+    llm_engine &operator=(const llm_engine &) = delete;
+
+    // 调用前需已执行 llama_backend_init()
+    bool load(const llm_engine_params &params, std::string &err);
+    // 在 base 已加载的权重（含草稿模型）上再建一个上下文：参数与 base 相同，只多一份 KV cache。
+    // base 之后 unload 也不影响本引擎，权重在最后一个引用释放时才卸载
+    bool attach(const llm_engine &base, std::string &err);
+    void unload();
+
+    // 线程安全：把请求放进等待队列，由 run()/generate() 所在线程调度
+    void submit(const llm_request &req, llm_done_fn on_done, llm_delta_fn on_delta = nullptr);
+
+    // 调度循环：没有请求时阻塞等待，直到 stop() 且队列与活跃请求全部处理完
+    void run();
+    void stop();
+
+    // 单次问答（阻塞）；不要与 run() 同时使用。
+    // 请求之间不共享对话状态，只复用 system + 格式说明这段公共前缀的 KV
+    llm_result generate(const llm_request &req, llm_delta_fn on_delta = nullptr);
+
+    // 启动时在空闲序列上对每个候选线程数测一次 prefill 与单 token decode 的速度，
+    // 两者各取最快的设进上下文（草稿上下文同步）。须在 run()/generate() 之前调用；candidates 为空时自动生成
+    bool autotune_threads(std::vector<int> candidates, std::vector<llm_thread_probe> &probes, std::string &err);
+
+    const llm_engine_params &params() const { return params_; }
+
+    // 内存占用：权重（mmap，attach 出来的引擎之间共用一份）与本上下文的 KV cache（含草稿上下文），按模型超参估算
+    size_t weights_bytes() const;
+    size_t kv_bytes() const { return kv_bytes_; }
+    // KV cache 的总格数与上一步结束时占用的格数（线程安全，指标导出用）
+    int kv_cells() const;
+    int kv_used_cells() const { return kv_used_.load(std::memory_order_relaxed); }
+    const llama_model *model() const { return model_; }
+
+    // 词表与其指纹（chunk_tokens.h）；load 之后有效
+    const llama_vocab *vocab() const { return vocab_; }
+    const std::string &vocab_id() const { return vocab_id_; }
+    // 线程安全（只读词表）。结果覆盖 out
+    bool tokenize(std::string_view text, bool add_special, std::vector<llama_token> &out) const;
+    void detokenize(const llama_token *tokens, size_t n, std::string &out) const;
+
+private:
+    static constexpr llama_seq_id k_prefix_seq = 0; // 常驻的公共前缀；slot i 使用 seq i + 1
+
+    using clock = std::chrono::steady_clock;
+
+    struct pending_request
+    {
+        llm_request req;
+        llm_done_fn on_done;
+        llm_delta_fn on_delta;
+        clock::time_point t_submit;
+    };
+
+    struct slot
+    {
+        llama_seq_id seq = 0;
+        bool active = false;
+
+        llm_request req;
+        llm_done_fn on_done;
+        llm_result res;
+
+        std::vector<llama_token> prompt; // 本请求要 prefill 的后缀 token
+        size_t n_prompt_done = 0;        // 其中已送进 KV 的个数
+        int n_past = 0;                  // 该序列已占用的位置数
+        int n_gen_max = 0;               // 本请求允许生成的 token 数
+        int n_keep = 0;                  // context shift 时保留的位置数：公共前缀 + 证据之前的说明
+        llama_token next = -1;           // 已采样、下一步要送入 decode 的 token
+        int i_batch = -1;                // 本步 batch 中需要采样的位置，-1 表示本步不采样
+
+        llama_sampler *smpl = nullptr;
+        std::string out;
+
+        llm_delta_fn on_delta;
+        size_t n_streamed = 0; // out 中已经推给 on_delta 的字节数
+
+        std::shared_ptr<const stop_matcher> stops;
+        uint32_t stop_state = 0;
+
+        bool spec = false;                   // 本请求使用草稿模型
+        int draft_n_past = 0;                // 草稿模型上该序列已占用的位置数
+        std::vector<llama_token> draft_feed; // 下次起草前要先补进草稿 KV 的 token（上一步全部接受时的最后一个草稿）
+        std::vector<llama_token> drafted;    // 本步起草、等待验证的 token
+
+        clock::time_point t_submit, t_admit, t_first;
+        clock::time_point t_templated, t_built; // 模板渲染完、后缀 token 就绪
+        clock::time_point deadline; // 未设 deadline_ms 时为 time_point::max()
+    };
+
+    // 一次调度：接纳新请求 + 一次 llama_decode + 采样；没有可做的事时返回 false
+    bool step();
+    bool admit(slot &s, pending_request &p);
+    void finish(slot &s);
+    void fail(slot &s, int code, const std::string &msg);
+    void release(slot &s);
+    // 从 i_batch 采样一个 token 并处理 EOS / stop / 长度上限；返回 false 表示该请求已结束
+    bool sample_next(slot &s);
+    // 处理一个已采样的 token：追加输出、停止串、长度上限；返回 false 表示该请求已结束
+    bool accept_token(slot &s, llama_token id);
+    // 序列写满 n_ctx 时挪掉一段旧 token；没有可挪的返回 false
+    bool context_shift(slot &s);
+    // 已到 deadline 的请求就地结束；返回结束的个数
+    int expire(clock::time_point now);
+    llama_token sample_at(slot &s, int i_batch);
+
+    // 投机解码：草稿模型上 prefill 本请求的完整 prompt
+    bool draft_prefill(slot &s);
+    // 为所有解码中的 spec slot 起草；batch_room 为目标 batch 里可给草稿用的位置数
+    void draft_step(int batch_room);
+    // 逐位验证 s.drafted；返回 false 表示该请求已结束
+    bool verify_draft(slot &s);
+    // 把 out 中可以确定的新内容推给 on_delta；final 为 true 时不再为停止串前缀留尾巴
+    void stream(slot &s, bool final);
+    void record_timings(slot &s);
+    // 请求结束时把各阶段耗时与 token 数记进指标，需要时写追踪
+    void report(const slot &s);
+
+    std::shared_ptr<const stop_matcher> stops_for(const llm_request &req);
+
+    // 渲染模板，拆出公共前缀（需要时重算其 KV）与本请求的后缀 token；evidence_begin 为证据在后缀里的起点
+    bool build_prompt(const llm_request &req, std::vector<llama_token> &suffix, int &evidence_begin, llm_result &res);
+    // load / attach 共用：在 model_ref_ / draft_ref_ 上建上下文、batch 与 slot
+    bool init_context(std::string &err);
+    // 把 tokens 以 n_batch 为单位分片送入 seq，位置从 pos0 开始；只有最后一个 token 计算 logits
+    bool prefill(const std::vector<llama_token> &tokens, llama_seq_id seq, llama_pos pos0);
+
+    llm_engine_params params_;
+    std::shared_ptr<llama_model> model_ref_;
+    std::shared_ptr<llama_model> draft_ref_;
+    size_t kv_bytes_ = 0;
+    llama_model *model_ = nullptr;
+    llama_context *ctx_ = nullptr;
+    const llama_vocab *vocab_ = nullptr;
+    std::string vocab_id_;
+    llama_batch batch_{};
+    bool batch_ready_ = false;
+
+    std::vector<slot> slots_;
+
+    llama_model *draft_model_ = nullptr;
+    llama_context *draft_ctx_ = nullptr;
+    llama_batch draft_batch_{};
+    llama_sampler *draft_smpl_ = nullptr; // 贪心
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<pending_request> queue_;
+    bool stopping_ = false;
+    std::atomic<int> kv_used_{0};
+
+    // build_prompt 的复用缓冲：常驻进程里每条请求都要拼一遍 user 和渲染后的 prompt，
+    // 留着上一次的容量，稳定后不再向分配器要内存
+    struct prompt_scratch
+    {
+        std::string user;
+        std::string prompt;
+        std::vector<llama_token> tokens;
+        clock::time_point t_templated;
+    };
+    prompt_scratch scratch_;
+
+    // 公共前缀：模板渲染后 user_head 之前的全部文本，及其 token
+    std::string prefix_text_;
+    std::vector<llama_token> prefix_tokens_;
+    bool prefix_ready_ = false; // prefix_tokens_ 已在 k_prefix_seq 上 prefill
+
+    // 默认停止串的匹配器在 load 时编译一次；自定义停止串只缓存最近一组（同一前端通常反复传同一组）
+    std::shared_ptr<const stop_matcher> default_stops_;
+    std::vector<std::string> custom_stops_key_;
+    std::shared_ptr<const stop_matcher> custom_stops_;
+};
+
+// n_cells 个位置的 KV cache 字节数，按层数、n_embd、GQA 的 n_head_kv 与 K/V 的存储类型估算
+size_t llm_kv_cache_bytes(const llama_model *model, uint32_t n_cells, ggml_type type_k = GGML_TYPE_F16,
+                          ggml_type type_v = GGML_TYPE_F16);
+// 命令行取值：f32 / f16 / bf16 / q8_0 / q5_1 / q5_0 / q4_1 / q4_0；fail / truncate / shift
+bool llm_parse_kv_type(const std::string &name, ggml_type &out);
+bool llm_parse_overflow(const std::string &name, llm_overflow &out);
+
+// ---------- 输出后处理（一次性 CLI 与常驻模式共用） ----------
+const std::vector<std::string> &llm_default_stops();
+bool ends_with_any(const std::string &s, const std::vector<std::string> &stops);
+void trim_at_stop_first_occurrence(std::string &s, const std::vector<std::string> &stops);
+size_t find_first_sentence_end_zh(const std::string &s);
+void normalize_one_sentence(std::string &s);
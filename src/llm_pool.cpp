@@ -0,0 +1,337 @@
+// src/llm_pool.cpp
+#include "llm_pool.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "metrics.h"
+
+llm_pool::~llm_pool()
+{
+    stop();
+}
+
+size_t llm_pool::weights_bytes_locked(const llm_engine *extra) const
+{
+    // attach 出来的上下文与 base 用同一个 llama_model，权重只算一次
+    std::unordered_set<const llama_model *> seen;
+    size_t total = 0;
+    auto add = [&](const llm_engine *e)
+    {
+        if (e && seen.insert(e->model()).second)
+            total += e->weights_bytes();
+    };
+    for (const auto &c : contexts_)
+        add(c->engine);
+    add(extra);
+    return total;
+}
+
+bool llm_pool::check_budget(const llm_engine &added, std::string &err) const
+{
+    if (params_.mem_budget_bytes == 0)
+        return true;
+    size_t total = weights_bytes_locked(&added) + added.kv_bytes();
+    for (const auto &c : contexts_)
+        total += c->engine->kv_bytes();
+    if (total > params_.mem_budget_bytes)
+    {
+        err = "memory budget exceeded: weights + KV would need " + std::to_string(total >> 20) + " MiB, budget is " +
+              std::to_string(params_.mem_budget_bytes >> 20) + " MiB";
+        return false;
+    }
+    return true;
+}
+
+bool llm_pool::add_engine(const std::string &name, llm_engine &engine, std::string &err)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (started_)
+    {
+        err = "llm_pool: cannot add contexts after start()";
+        return false;
+    }
+    if (!check_budget(engine, err))
+        return false;
+    auto c = std::make_unique<context>();
+    c->model = name;
+    c->engine = &engine;
+    contexts_.push_back(std::move(c));
+    return true;
+}
+
+bool llm_pool::add_model(const std::string &name, const llm_engine_params &params, std::string &err)
+{
+    auto e = std::make_unique<llm_engine>();
+    if (!e->load(params, err))
+        return false;
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (started_)
+    {
+        err = "llm_pool: cannot add contexts after start()";
+        return false;
+    }
+    if (!check_budget(*e, err))
+        return false;
+    auto c = std::make_unique<context>();
+    c->model = name;
+    c->engine = e.get();
+    c->owned = std::move(e);
+    contexts_.push_back(std::move(c));
+    return true;
+}
+
+bool llm_pool::add_contexts(const std::string &name, int n, std::string &err)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (started_)
+    {
+        err = "llm_pool: cannot add contexts after start()";
+        return false;
+    }
+    const llm_engine *base = nullptr;
+    for (const auto &c : contexts_)
+    {
+        if (c->model == name)
+        {
+            base = c->engine;
+            break;
+        }
+    }
+    if (!base)
+    {
+        err = "llm_pool: unknown model: " + name;
+        return false;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        auto e = std::make_unique<llm_engine>();
+        if (!e->attach(*base, err) || !check_budget(*e, err))
+            return false;
+        auto c = std::make_unique<context>();
+        c->model = name;
+        c->engine = e.get();
+        c->owned = std::move(e);
+        contexts_.push_back(std::move(c));
+    }
+    return true;
+}
+
+bool llm_pool::has_model(const std::string &name) const
+{
+    return engine(name) != nullptr;
+}
+
+llm_engine *llm_pool::engine(const std::string &name) const
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    for (const auto &c : contexts_)
+    {
+        if (name.empty() || c->model == name)
+            return c->engine;
+    }
+    return nullptr;
+}
+
+llm_pool::context *llm_pool::pick_locked(const std::string &model)
+{
+    // 同一模型里挑在跑请求最少的上下文，KV 压力最小
+    context *best = nullptr;
+    for (const auto &c : contexts_)
+    {
+        if (c->model != model || c->n_running >= c->engine->params().n_parallel)
+            continue;
+        if (!best || c->n_running < best->n_running)
+            best = c.get();
+    }
+    return best;
+}
+
+void llm_pool::dispatch_locked(std::vector<queued> &expired)
+{
+    static metric_histogram &wait_hist =
+        metrics().histogram("llm_pool_wait_seconds", "Time a request waits in the pool queue before dispatch");
+    const clock::time_point now = clock::now();
+    for (size_t i = 0; i < queue_.size();)
+    {
+        queued &q = queue_[i];
+        const double waited_ms = std::chrono::duration<double, std::milli>(now - q.t_submit).count();
+        if (q.req.policy.deadline_ms > 0 && waited_ms >= q.req.policy.deadline_ms)
+        {
+            expired.push_back(std::move(q));
+            queue_.erase(queue_.begin() + (std::ptrdiff_t)i);
+            ++n_expired_;
+            continue;
+        }
+        context *c = pick_locked(q.pr.model);
+        if (!c)
+        {
+            ++i; // 该模型没有空位；后面别的模型的请求仍可派发
+            continue;
+        }
+
+        // 排队时间计入结果的 queue_ms / ttft_ms；deadline 只剩下没用掉的部分
+        wait_hist.observe_ms(waited_ms);
+        if (q.req.trace_id != 0 && trace_enabled())
+            trace_span("pool_queue", "llm", q.req.trace_id, q.t_submit, now,
+                       "{\"priority\":" + std::to_string(q.pr.priority) + "}");
+        if (q.req.policy.deadline_ms > 0)
+            q.req.policy.deadline_ms = std::max(1, q.req.policy.deadline_ms - (int)waited_ms);
+        llm_done_fn cb = std::move(q.on_done);
+        c->engine->submit(q.req,
+                          [this, c, cb, waited_ms](const llm_result &r)
+                          {
+                              on_finished(c);
+                              if (!cb)
+                                  return;
+                              llm_result out = r;
+                              out.queue_ms += waited_ms;
+                              out.ttft_ms += waited_ms;
+                              cb(out);
+                          },
+                          std::move(q.on_delta));
+        ++c->n_running;
+        ++n_running_;
+        queue_.erase(queue_.begin() + (std::ptrdiff_t)i);
+    }
+}
+
+void llm_pool::expire_all(std::vector<queued> &expired)
+{
+    for (auto &q : expired)
+    {
+        llm_result r;
+        r.error_code = 8;
+        r.error = "deadline exceeded while queued";
+        r.stop_reason = "deadline";
+        if (q.on_done)
+            q.on_done(r);
+    }
+    expired.clear();
+}
+
+void llm_pool::on_finished(context *c)
+{
+    std::vector<queued> expired;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        --c->n_running;
+        ++c->n_done;
+        --n_running_;
+        ++n_done_;
+        dispatch_locked(expired);
+        if (queue_.empty() && n_running_ == 0)
+            idle_cv_.notify_all();
+    }
+    expire_all(expired);
+}
+
+void llm_pool::submit(const llm_pool_request &pr, const llm_request &req, llm_done_fn on_done, llm_delta_fn on_delta)
+{
+    std::vector<queued> expired;
+    llm_done_fn reject;
+    llm_result rr;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        queued q;
+        q.pr = pr;
+        if (q.pr.model.empty() && !contexts_.empty())
+            q.pr.model = contexts_.front()->model;
+        const bool known = std::any_of(contexts_.begin(), contexts_.end(), [&](const std::unique_ptr<context> &c)
+                                       { return c->model == q.pr.model; });
+        if (!known)
+        {
+            rr.error_code = 3;
+            rr.error = "unknown model: " + pr.model;
+            reject = std::move(on_done);
+        }
+        else
+        {
+            q.req = req;
+            q.on_done = std::move(on_done);
+            q.on_delta = std::move(on_delta);
+            q.t_submit = clock::now();
+            q.order = next_order_++;
+            // 插到同优先级的末尾
+            auto at = std::upper_bound(queue_.begin(), queue_.end(), q, [](const queued &a, const queued &b)
+                                       { return a.pr.priority != b.pr.priority ? a.pr.priority > b.pr.priority
+                                                                               : a.order < b.order; });
+            queue_.insert(at, std::move(q));
+            dispatch_locked(expired);
+            // 仍然放不下：丢掉优先级最低、最晚到的那一个（可能就是刚进来的这个）
+            if (queue_.size() > params_.max_queue)
+            {
+                rr.error_code = 9;
+                rr.error = "server overloaded: queue is full";
+                rr.stop_reason = "shed";
+                reject = std::move(queue_.back().on_done);
+                queue_.pop_back();
+                ++n_shed_;
+            }
+        }
+        if (queue_.empty() && n_running_ == 0)
+            idle_cv_.notify_all();
+    }
+    expire_all(expired);
+    if (reject)
+        reject(rr);
+}
+
+void llm_pool::start()
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (started_)
+        return;
+    started_ = true;
+    for (auto &c : contexts_)
+    {
+        llm_engine *e = c->engine;
+        c->thread = std::thread([e]()
+                                { e->run(); });
+    }
+}
+
+void llm_pool::stop()
+{
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        if (!started_)
+            return;
+        idle_cv_.wait(lk, [&]
+                      { return queue_.empty() && n_running_ == 0; });
+        started_ = false;
+        for (auto &c : contexts_)
+            c->engine->stop();
+    }
+    for (auto &c : contexts_)
+    {
+        if (c->thread.joinable())
+            c->thread.join();
+    }
+}
+
+llm_pool_stats llm_pool::stats() const
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    llm_pool_stats st;
+    st.n_queued = queue_.size();
+    st.n_running = n_running_;
+    st.n_done = n_done_;
+    st.n_shed = n_shed_;
+    st.n_expired = n_expired_;
+    st.weights_bytes = weights_bytes_locked(nullptr);
+    for (const auto &c : contexts_)
+    {
+        llm_pool_context_stats cs;
+        cs.model = c->model;
+        cs.n_parallel = c->engine->params().n_parallel;
+        cs.n_running = c->n_running;
+        cs.kv_bytes = c->engine->kv_bytes();
+        cs.kv_cells = c->engine->kv_cells();
+        cs.kv_used_cells = c->engine->kv_used_cells();
+        cs.n_done = c->n_done;
+        st.kv_bytes += cs.kv_bytes;
+        st.contexts.push_back(cs);
+    }
+    return st;
+}
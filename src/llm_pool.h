@@ -0,0 +1,133 @@
+// src/llm_pool.h
+// 一个进程里的多个上下文、多个模型：常驻服务按名字挂若干 llm_engine（例如 3B 回答模型与 0.5B 路由模型），
+// 同一模型的多个上下文用 llm_engine::attach 共用一份 mmap 的权重，每个上下文只多一份 KV cache。
+//
+// - 准入：加上下文时按 权重（每个模型算一次）+ 全部 KV 对照 mem_budget_bytes，超出就拒绝，不会在运行中 OOM；
+// - 调度：请求先进池子的优先级队列（priority 大的先，同级先来先服务），哪个上下文有空 slot 就派过去，
+//   同一模型里挑正在跑的请求最少的上下文；引擎内部仍是各自的连续批处理；
+// - 限流：排队数到 max_queue 时新请求直接以 error_code 9 拒绝（load shedding）；
+//   设了 deadline_ms 的请求在队列里等到超时就以 8 结束，派出去时把剩余时间交给引擎。
+// 每个上下文一个调度线程（llm_engine::run），回调在这些线程里调用。
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llm_engine.h"
+
+struct llm_pool_params
+{
+    size_t max_queue = 64;       // 等待派发的请求上限，超过即拒绝
+    size_t mem_budget_bytes = 0; // 权重 + KV 的上限，0 不限
+};
+
+struct llm_pool_request
+{
+    std::string model; // 为空时用第一个注册的模型
+    int priority = 0;  // 大的先调度
+};
+
+struct llm_pool_context_stats
+{
+    std::string model;
+    int n_parallel = 0;
+    int n_running = 0;
+    size_t kv_bytes = 0;
+    int kv_cells = 0;      // KV cache 总格数
+    int kv_used_cells = 0; // 其中已占用的（上一步结束时）
+    uint64_t n_done = 0;
+};
+
+struct llm_pool_stats
+{
+    size_t n_queued = 0;
+    size_t n_running = 0;
+    uint64_t n_done = 0;
+    uint64_t n_shed = 0;    // 队列满被拒绝
+    uint64_t n_expired = 0; // 排队时超过 deadline
+    size_t weights_bytes = 0;
+    size_t kv_bytes = 0;
+    std::vector<llm_pool_context_stats> contexts;
+};
+
+class llm_pool
+{
+public:
+    explicit llm_pool(const llm_pool_params &params = llm_pool_params()) : params_(params) {}
+    ~llm_pool();
+
+    llm_pool(const llm_pool &) = delete;
+    llm_pool &operator=(const llm_pool &) = delete;
+
+    // 登记一个已加载的引擎作为 name 模型的一个上下文（不接管生命期，须比池子活得久）
+    bool add_engine(const std::string &name, llm_engine &engine, std::string &err);
+    // 加载一个新模型，作为 name 的第一个上下文（由池子持有）
+    bool add_model(const std::string &name, const llm_engine_params &params, std::string &err);
+    // 在 name 已有的上下文上再 attach n 个共用权重的上下文
+    bool add_contexts(const std::string &name, int n, std::string &err);
+
+    bool has_model(const std::string &name) const;
+    // 第一个上下文（取词表、参数用）；没有该模型时返回 nullptr
+    llm_engine *engine(const std::string &name = std::string()) const;
+
+    // 线程安全。on_done 可能在调用线程里直接调用（拒绝、模型不存在时）
+    void submit(const llm_pool_request &pr, const llm_request &req, llm_done_fn on_done,
+                llm_delta_fn on_delta = nullptr);
+
+    // 每个上下文起一个调度线程
+    void start();
+    // 等队列与在跑的请求全部完成后停掉所有调度线程
+    void stop();
+
+    llm_pool_stats stats() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct context
+    {
+        std::string model;
+        llm_engine *engine = nullptr;
+        std::unique_ptr<llm_engine> owned;
+        int n_running = 0;
+        uint64_t n_done = 0;
+        std::thread thread;
+    };
+
+    struct queued
+    {
+        llm_pool_request pr;
+        llm_request req;
+        llm_done_fn on_done;
+        llm_delta_fn on_delta;
+        clock::time_point t_submit;
+        uint64_t order = 0;
+    };
+
+    bool check_budget(const llm_engine &added, std::string &err) const;
+    size_t weights_bytes_locked(const llm_engine *extra) const;
+    context *pick_locked(const std::string &model);
+    // 把能派的请求都派出去；超时的请求移到 expired，由调用方在锁外回调
+    void dispatch_locked(std::vector<queued> &expired);
+    void on_finished(context *c);
+    static void expire_all(std::vector<queued> &expired);
+
+    llm_pool_params params_;
+    mutable std::mutex mtx_;
+    std::condition_variable idle_cv_;
+    std::vector<std::unique_ptr<context>> contexts_;
+    std::vector<queued> queue_; // 按 (priority 降序, order 升序) 有序
+    uint64_t next_order_ = 0;
+    bool started_ = false;
+
+    size_t n_running_ = 0;
+    uint64_t n_done_ = 0;
+    uint64_t n_shed_ = 0;
+    uint64_t n_expired_ = 0;
+};
@@ -0,0 +1,207 @@
+// src/llm_rerank.cpp
+#include "llm_rerank.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "chunk_tokens.h"
+
+llm_reranker::~llm_reranker()
+{
+    unload();
+}
+
+bool llm_reranker::load(const llm_rerank_params &params, std::string &err)
+{
+    unload();
+    params_ = params;
+    params_.max_pair_tokens = std::max(16, params_.max_pair_tokens);
+    params_.n_batch = std::max(params_.max_pair_tokens, params_.n_batch);
+    params_.n_seq_max = std::max(1, std::min(params_.n_seq_max, params_.n_batch / params_.max_pair_tokens));
+    if (params_.n_threads <= 0)
+        params_.n_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    llama_model_params mparams = llama_model_default_params();
+    model_ = llama_load_model_from_file(params_.model_path.c_str(), mparams);
+    if (!model_)
+    {
+        err = "Failed to load rerank model: " + params_.model_path;
+        return false;
+    }
+
+    // 与 llm_embedder 相同：非因果模型要求一条序列完整落在同一个 ubatch 里
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx = (uint32_t)params_.n_batch;
+    cparams.n_batch = (uint32_t)params_.n_batch;
+    cparams.n_ubatch = (uint32_t)params_.n_batch;
+    cparams.n_seq_max = (uint32_t)params_.n_seq_max;
+    cparams.n_threads = params_.n_threads;
+    cparams.n_threads_batch = params_.n_threads;
+    cparams.embeddings = true;
+    cparams.pooling_type = LLAMA_POOLING_TYPE_RANK;
+
+    ctx_ = llama_new_context_with_model(model_, cparams);
+    if (!ctx_)
+    {
+        err = "Failed to create rerank context";
+        unload();
+        return false;
+    }
+    if (llama_pooling_type(ctx_) != LLAMA_POOLING_TYPE_RANK)
+    {
+        err = "rerank model has no rank head (pooling type rank): " + params_.model_path;
+        unload();
+        return false;
+    }
+    llama_set_abort_callback(ctx_, &llm_reranker::on_abort, this);
+
+    vocab_ = llama_model_get_vocab(model_);
+    batch_ = llama_batch_init(params_.n_batch, 0, 1);
+    batch_ready_ = true;
+    return true;
+}
+
+void llm_reranker::unload()
+{
+    if (batch_ready_)
+    {
+        llama_batch_free(batch_);
+        batch_ready_ = false;
+    }
+    if (ctx_)
+    {
+        llama_free(ctx_);
+        ctx_ = nullptr;
+    }
+    if (model_)
+    {
+        llama_free_model(model_);
+        model_ = nullptr;
+    }
+    vocab_ = nullptr;
+}
+
+bool llm_reranker::on_abort(void *self)
+{
+    llm_reranker *r = (llm_reranker *)self;
+    if (r->has_deadline_ && std::chrono::steady_clock::now() >= r->deadline_)
+        r->aborted_ = true;
+    return r->aborted_;
+}
+
+bool llm_reranker::tokenize(const std::string &text, bool add_special, std::vector<llama_token> &out) const
+{
+    out.clear();
+    return llm_tokenize_append(vocab_, text.data(), text.size(), add_special, out);
+}
+
+bool llm_reranker::flush(const std::vector<size_t> &rows, std::vector<float> &scores, std::string &err)
+{
+    if (rows.empty())
+        return true;
+    if (on_abort(this))
+        return false; // tokenize 或上一批已经用完预算
+
+    llama_kv_cache_clear(ctx_);
+    const int rc = llama_decode(ctx_, batch_);
+    batch_.n_tokens = 0;
+    if (aborted_)
+        return false;
+    if (rc != 0)
+    {
+        err = "llama_decode failed (rerank)";
+        return false;
+    }
+
+    for (size_t s = 0; s < rows.size(); ++s)
+    {
+        // rank pooling 每条序列只输出一个 logit
+        const float *e = llama_get_embeddings_seq(ctx_, (llama_seq_id)s);
+        if (!e)
+        {
+            err = "llama_get_embeddings_seq returned null (rerank)";
+            return false;
+        }
+        scores[rows[s]] = 1.0f / (1.0f + std::exp(-e[0]));
+    }
+    return true;
+}
+
+bool llm_reranker::score(const std::string &query, const std::vector<const std::string *> &docs,
+                         std::vector<float> &scores, int budget_ms, bool &timed_out, std::string &err)
+{
+    timed_out = false;
+    scores.assign(docs.size(), 0.0f);
+    if (!ctx_)
+    {
+        err = "rerank model is not loaded";
+        return false;
+    }
+    has_deadline_ = budget_ms > 0;
+    deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(budget_ms);
+    aborted_ = false;
+
+    if (!tokenize(query, true /* BOS */, q_toks_))
+    {
+        err = "Tokenize failed (rerank query)";
+        return false;
+    }
+    // 问题占不满单对上限的一半，证据至少留一半
+    const size_t q_max = (size_t)params_.max_pair_tokens / 2;
+    if (q_toks_.size() > q_max)
+        q_toks_.resize(q_max);
+    q_toks_.push_back(llama_token_eos(vocab_));
+    q_toks_.push_back(llama_vocab_sep(vocab_));
+
+    std::vector<size_t> rows;
+    batch_.n_tokens = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < docs.size(); ++i)
+    {
+        if (!tokenize(*docs[i], false, d_toks_))
+        {
+            err = "Tokenize failed (rerank document)";
+            ok = false;
+            break;
+        }
+        const size_t d_max = (size_t)params_.max_pair_tokens - q_toks_.size() - 1;
+        if (d_toks_.size() > d_max)
+            d_toks_.resize(d_max);
+        d_toks_.push_back(llama_token_eos(vocab_));
+        const int n_pair = (int)(q_toks_.size() + d_toks_.size());
+
+        if (batch_.n_tokens + n_pair > params_.n_batch || (int)rows.size() >= params_.n_seq_max)
+        {
+            ok = flush(rows, scores, err);
+            rows.clear();
+            if (!ok)
+                break;
+        }
+
+        const llama_seq_id seq = (llama_seq_id)rows.size();
+        int pos = 0;
+        for (const std::vector<llama_token> *part : {&q_toks_, &d_toks_})
+        {
+            for (llama_token t : *part)
+            {
+                const int k = batch_.n_tokens++;
+                batch_.token[k] = t;
+                batch_.pos[k] = (llama_pos)pos++;
+                batch_.n_seq_id[k] = 1;
+                batch_.seq_id[k][0] = seq;
+                batch_.logits[k] = true; // pooling 需要每个位置的输出
+            }
+        }
+        rows.push_back(i);
+    }
+    if (ok)
+        ok = flush(rows, scores, err);
+    batch_.n_tokens = 0;
+    // 只有真被中断才算超时；最后一批刚好在预算线之后算完的结果照用
+    timed_out = aborted_;
+    has_deadline_ = false;
+    if (timed_out)
+        err = "rerank budget of " + std::to_string(budget_ms) + " ms exceeded";
+    return ok;
+}
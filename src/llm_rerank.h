@@ -0,0 +1,58 @@
+// src/llm_rerank.h
+// 交叉编码器重排：用 llama.cpp 的 rank pooling（bge-reranker 一类的 GGUF）给 (问题, 证据) 成对打分。
+// - 每一对按 [BOS] 问题 [EOS][SEP] 证据 [EOS] 拼成一条序列，N 对塞进同一个 llama_batch，一次 decode 得到 N 个分数；
+// - 有延迟预算：decode 途中由 abort 回调检查截止时间，超时就中断并返回 false，调用方退回启发式排序。
+// 非线程安全，与 llm_embedder 一样由 rag_pipeline 独占。
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+struct llm_rerank_params
+{
+    std::string model_path;
+    int n_batch = 4096;        // 单次 decode 的 token 上限；一批装不下的对分几次 decode
+    int n_seq_max = 16;        // 单次 decode 最多装几对
+    int max_pair_tokens = 512; // 单对的 token 上限，超出只截证据部分
+    int n_threads = 0;         // <= 0 时用全部硬件线程
+};
+
+class llm_reranker
+{
+public:
+    llm_reranker() = default;
+    ~llm_reranker();
+
+    llm_reranker(const llm_reranker &) = delete;
+    llm_reranker &operator=(const llm_reranker &) = delete;
+
+    // 调用前需已执行 llama_backend_init()；模型没有 rank 输出头时失败
+    bool load(const llm_rerank_params &params, std::string &err);
+    void unload();
+
+    // scores[i] 为 docs[i] 的相关度（logit 过 sigmoid，0..1，越大越相关）。
+    // budget_ms > 0 时超过预算即中断，返回 false 且 timed_out = true
+    bool score(const std::string &query, const std::vector<const std::string *> &docs, std::vector<float> &scores,
+               int budget_ms, bool &timed_out, std::string &err);
+
+private:
+    bool tokenize(const std::string &text, bool add_special, std::vector<llama_token> &out) const;
+    // 把 batch_ 中已装入的对 decode，分数写到 scores 的对应下标
+    bool flush(const std::vector<size_t> &rows, std::vector<float> &scores, std::string &err);
+    static bool on_abort(void *self);
+
+    llm_rerank_params params_;
+    llama_model *model_ = nullptr;
+    llama_context *ctx_ = nullptr;
+    const llama_vocab *vocab_ = nullptr;
+    llama_batch batch_{};
+    bool batch_ready_ = false;
+    std::vector<llama_token> q_toks_, d_toks_;
+
+    bool has_deadline_ = false;
+    bool aborted_ = false;
+    std::chrono::steady_clock::time_point deadline_;
+};
@@ -0,0 +1,383 @@
+// src/metrics.cpp
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+namespace
+{
+void append_escaped(std::string &out, const std::string &s, bool quote)
+{
+    // HELP 只转义 \ 与换行，标签值另外转义双引号
+    for (char c : s)
+    {
+        if (c == '\\')
+            out += "\\\\";
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '"' && quote)
+            out += "\\\"";
+        else
+            out += c;
+    }
+}
+
+void append_number(std::string &out, double v)
+{
+    char buf[32];
+    if (std::isinf(v))
+        out += v > 0 ? "+Inf" : "-Inf";
+    else if (std::isnan(v))
+        out += "NaN";
+    else if (v == std::floor(v) && std::fabs(v) < 1e15)
+    {
+        std::snprintf(buf, sizeof(buf), "%.0f", v);
+        out += buf;
+    }
+    else
+    {
+        std::snprintf(buf, sizeof(buf), "%.9g", v);
+        out += buf;
+    }
+}
+
+// name{k="v",...,extra_k="extra_v"}
+void append_series(std::string &out, const std::string &name, const char *suffix, const metric_labels &labels,
+                   const char *extra_k = nullptr, const std::string &extra_v = std::string())
+{
+    out += name;
+    out += suffix;
+    if (labels.empty() && !extra_k)
+        return;
+    out += '{';
+    bool first = true;
+    for (const auto &kv : labels)
+    {
+        if (!first)
+            out += ',';
+        first = false;
+        out += kv.first;
+        out += "=\"";
+        append_escaped(out, kv.second, true);
+        out += '"';
+    }
+    if (extra_k)
+    {
+        if (!first)
+            out += ',';
+        out += extra_k;
+        out += "=\"";
+        out += extra_v;
+        out += '"';
+    }
+    out += '}';
+}
+
+const char *type_name(metric_type t)
+{
+    switch (t)
+    {
+    case metric_type::counter:
+        return "counter";
+    case metric_type::gauge:
+        return "gauge";
+    case metric_type::histogram:
+        return "histogram";
+    }
+    return "untyped";
+}
+} // namespace
+
+// ---------- metric_histogram ----------
+metric_histogram::metric_histogram(std::vector<double> bounds) : bounds_(std::move(bounds))
+{
+    std::sort(bounds_.begin(), bounds_.end());
+    counts_.reset(new std::atomic<uint64_t>[bounds_.size() + 1]);
+    for (size_t i = 0; i <= bounds_.size(); ++i)
+        counts_[i].store(0, std::memory_order_relaxed);
+}
+
+void metric_histogram::observe(double v)
+{
+    // le 语义：落在第一个 >= v 的上界里
+    const size_t i = (size_t)(std::lower_bound(bounds_.begin(), bounds_.end(), v) - bounds_.begin());
+    counts_[i].fetch_add(1, std::memory_order_relaxed);
+    double cur = sum_.load(std::memory_order_relaxed);
+    while (!sum_.compare_exchange_weak(cur, cur + v, std::memory_order_relaxed))
+    {
+    }
+}
+
+const std::vector<double> &metric_seconds_bounds()
+{
+    static const std::vector<double> bounds = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                                               0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0};
+    return bounds;
+}
+
+// ---------- metrics_registry ----------
+metrics_registry::family *metrics_registry::family_locked(const std::string &name, const std::string &help,
+                                                          metric_type type)
+{
+    for (auto &f : families_)
+    {
+        if (f->name == name)
+        {
+            if (f->type != type)
+            {
+                std::cerr << "Warning: metric " << name << " registered as " << type_name(f->type) << ", not "
+                          << type_name(type) << "\n";
+                return nullptr;
+            }
+            return f.get();
+        }
+    }
+    families_.push_back(std::unique_ptr<family>(new family()));
+    family *f = families_.back().get();
+    f->name = name;
+    f->help = help;
+    f->type = type;
+    return f;
+}
+
+metrics_registry::series *metrics_registry::find_locked(family &f, const metric_labels &labels)
+{
+    for (auto &s : f.series_list)
+    {
+        if (s->labels == labels)
+            return s.get();
+    }
+    return nullptr;
+}
+
+metric_counter &metrics_registry::counter(const std::string &name, const std::string &help,
+                                          const metric_labels &labels)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    family *f = family_locked(name, help, metric_type::counter);
+    if (f)
+    {
+        if (series *found = find_locked(*f, labels))
+            return *found->counter;
+    }
+    std::unique_ptr<series> s(new series());
+    s->labels = labels;
+    s->counter.reset(new metric_counter());
+    std::vector<std::unique_ptr<series>> &dst = f ? f->series_list : orphans_;
+    dst.push_back(std::move(s));
+    return *dst.back()->counter;
+}
+
+metric_histogram &metrics_registry::histogram(const std::string &name, const std::string &help,
+                                              const metric_labels &labels, const std::vector<double> &bounds)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    family *f = family_locked(name, help, metric_type::histogram);
+    if (f)
+    {
+        if (series *found = find_locked(*f, labels))
+            return *found->histogram;
+    }
+    std::unique_ptr<series> s(new series());
+    s->labels = labels;
+    s->histogram.reset(new metric_histogram(bounds));
+    std::vector<std::unique_ptr<series>> &dst = f ? f->series_list : orphans_;
+    dst.push_back(std::move(s));
+    return *dst.back()->histogram;
+}
+
+uint64_t metrics_registry::add_callback(const std::string &name, const std::string &help, metric_type type,
+                                        const metric_labels &labels, std::function<double()> fn)
+{
+    if (type == metric_type::histogram)
+        return 0; // 回调只能给出一个数
+    std::lock_guard<std::mutex> lk(mtx_);
+    family *f = family_locked(name, help, type);
+    if (!f)
+        return 0;
+    std::unique_ptr<series> s(new series());
+    s->labels = labels;
+    s->fn = std::make_shared<std::function<double()>>(std::move(fn));
+    s->id = next_id_++;
+    f->series_list.push_back(std::move(s));
+    return f->series_list.back()->id;
+}
+
+void metrics_registry::remove_callback(uint64_t id)
+{
+    if (id == 0)
+        return;
+    std::lock_guard<std::mutex> rlk(render_mtx_);
+    std::lock_guard<std::mutex> lk(mtx_);
+    for (auto &f : families_)
+    {
+        auto &v = f->series_list;
+        v.erase(std::remove_if(v.begin(), v.end(), [id](const std::unique_ptr<series> &s)
+                               { return s->id == id; }),
+                v.end());
+    }
+}
+
+std::string metrics_registry::render() const
+{
+    std::lock_guard<std::mutex> rlk(render_mtx_);
+
+    // 先在锁内拍一份快照：回调可能去拿别的锁（例如 llm_pool），不能在持有注册表锁时调用
+    struct row
+    {
+        const metric_labels *labels;
+        const metric_counter *counter;
+        const metric_histogram *histogram;
+        std::shared_ptr<std::function<double()>> fn;
+    };
+    struct fam
+    {
+        const family *f;
+        std::vector<row> rows;
+    };
+    std::vector<fam> snap;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        snap.reserve(families_.size());
+        for (const auto &f : families_)
+        {
+            fam fm{f.get(), {}};
+            for (const auto &s : f->series_list)
+                fm.rows.push_back({&s->labels, s->counter.get(), s->histogram.get(), s->fn});
+            snap.push_back(std::move(fm));
+        }
+    }
+    // 族与序列只增不减（回调序列的注销与导出互斥），锁外读它们的名字和标签是安全的
+
+    std::string out;
+    out.reserve(4096);
+    for (const auto &fm : snap)
+    {
+        if (fm.rows.empty())
+            continue;
+        const family &f = *fm.f;
+        out += "# HELP ";
+        out += f.name;
+        out += ' ';
+        append_escaped(out, f.help, false);
+        out += "\n# TYPE ";
+        out += f.name;
+        out += ' ';
+        out += type_name(f.type);
+        out += '\n';
+        for (const auto &r : fm.rows)
+        {
+            if (r.histogram)
+            {
+                const metric_histogram &h = *r.histogram;
+                uint64_t cum = 0;
+                std::string le;
+                for (size_t i = 0; i <= h.bounds().size(); ++i)
+                {
+                    cum += h.bucket(i);
+                    le.clear();
+                    append_number(le, i < h.bounds().size() ? h.bounds()[i] : INFINITY);
+                    append_series(out, f.name, "_bucket", *r.labels, "le", le);
+                    out += ' ';
+                    append_number(out, (double)cum);
+                    out += '\n';
+                }
+                append_series(out, f.name, "_sum", *r.labels);
+                out += ' ';
+                append_number(out, h.sum());
+                out += '\n';
+                // _count 取各桶之和，与 +Inf 桶一致
+                append_series(out, f.name, "_count", *r.labels);
+                out += ' ';
+                append_number(out, (double)cum);
+                out += '\n';
+                continue;
+            }
+            append_series(out, f.name, "", *r.labels);
+            out += ' ';
+            append_number(out, r.counter ? (double)r.counter->value() : (*r.fn)());
+            out += '\n';
+        }
+    }
+    return out;
+}
+
+metrics_registry &metrics()
+{
+    static metrics_registry reg;
+    return reg;
+}
+
+// ---------- 追踪 ----------
+namespace trace_detail
+{
+std::atomic<bool> enabled{false};
+}
+
+namespace
+{
+std::mutex g_trace_mtx;
+std::FILE *g_trace_file = nullptr;
+bool g_trace_first = true;
+std::chrono::steady_clock::time_point g_trace_origin;
+std::atomic<uint64_t> g_trace_next{1};
+} // namespace
+
+bool trace_open(const std::string &path, std::string &err)
+{
+    trace_close();
+    std::lock_guard<std::mutex> lk(g_trace_mtx);
+    g_trace_file = std::fopen(path.c_str(), "wb");
+    if (!g_trace_file)
+    {
+        err = "failed to open trace file: " + path;
+        return false;
+    }
+    std::fputs("[\n", g_trace_file);
+    g_trace_first = true;
+    g_trace_origin = std::chrono::steady_clock::now();
+    trace_detail::enabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void trace_close()
+{
+    std::lock_guard<std::mutex> lk(g_trace_mtx);
+    trace_detail::enabled.store(false, std::memory_order_relaxed);
+    if (!g_trace_file)
+        return;
+    std::fputs("\n]\n", g_trace_file);
+    std::fclose(g_trace_file);
+    g_trace_file = nullptr;
+}
+
+uint64_t trace_next_id()
+{
+    return g_trace_next.fetch_add(1, std::memory_order_relaxed);
+}
+
+void trace_span(const char *name, const char *cat, uint64_t tid, std::chrono::steady_clock::time_point t0,
+                std::chrono::steady_clock::time_point t1, const std::string &args)
+{
+    if (tid == 0 || !trace_enabled())
+        return;
+    char buf[256];
+    std::lock_guard<std::mutex> lk(g_trace_mtx);
+    if (!g_trace_file)
+        return;
+    // ts / dur 单位是微秒，从 trace_open 算起
+    const double ts = std::chrono::duration<double, std::micro>(t0 - g_trace_origin).count();
+    const double dur = std::chrono::duration<double, std::micro>(t1 - t0).count();
+    std::snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,\"ts\":%.1f,\"dur\":%.1f",
+                  g_trace_first ? "" : ",\n", name, cat, (unsigned long long)tid, ts, std::max(0.0, dur));
+    g_trace_first = false;
+    std::fputs(buf, g_trace_file);
+    if (!args.empty())
+    {
+        std::fputs(",\"args\":", g_trace_file);
+        std::fputs(args.c_str(), g_trace_file);
+    }
+    std::fputs("}", g_trace_file);
+}
@@ -0,0 +1,128 @@
+// src/metrics.h
+// 服务路径的内置观测：进程内的指标注册表（按 Prometheus 文本格式导出）与可选的逐请求追踪（Chrome trace JSON）。
+//
+// - 计数器与直方图都是原子变量，热路径上只做 fetch_add；取名字/标签找序列要加锁，调用方应把返回的引用留着复用；
+// - 已在别处统计好的量（缓存命中数、队列长度、KV 占用）用回调登记，导出时才取值；
+// - 追踪：trace_open 之后每条请求的各阶段写成一个 "ph":"X" 事件，tid 是请求的 trace id，
+//   用 chrome://tracing 或 Perfetto 打开即可按请求一行看到时间花在哪。
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using metric_labels = std::vector<std::pair<std::string, std::string>>;
+
+enum class metric_type
+{
+    counter,
+    gauge,
+    histogram,
+};
+
+class metric_counter
+{
+public:
+    void inc(uint64_t n = 1) { v_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return v_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> v_{0};
+};
+
+class metric_histogram
+{
+public:
+    // bounds 为各桶的上界（升序），最后另有一个 +Inf 桶
+    explicit metric_histogram(std::vector<double> bounds);
+
+    void observe(double v);
+    // 毫秒换成秒再记（Prometheus 的时间单位是秒）
+    void observe_ms(double ms) { observe(ms / 1000.0); }
+
+    const std::vector<double> &bounds() const { return bounds_; }
+    // 第 i 个桶（非累计）；i == bounds().size() 为 +Inf 桶
+    uint64_t bucket(size_t i) const { return counts_[i].load(std::memory_order_relaxed); }
+    double sum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<double> sum_{0.0};
+};
+
+// 延迟直方图的默认桶：0.5 ms 到 30 s
+const std::vector<double> &metric_seconds_bounds();
+
+class metrics_registry
+{
+public:
+    // 同名同标签返回同一个序列；引用在进程内一直有效（线程安全）
+    metric_counter &counter(const std::string &name, const std::string &help, const metric_labels &labels = {});
+    metric_histogram &histogram(const std::string &name, const std::string &help, const metric_labels &labels = {},
+                                const std::vector<double> &bounds = metric_seconds_bounds());
+
+    // 导出时调用 fn 取值（在导出线程里、不持有注册表的锁）；返回的 id 用于注销，
+    // fn 引用的对象销毁前必须先 remove_callback
+    uint64_t add_callback(const std::string &name, const std::string &help, metric_type type,
+                          const metric_labels &labels, std::function<double()> fn);
+    void remove_callback(uint64_t id);
+
+    // Prometheus 文本格式（version 0.0.4）：每个指标族一组 HELP/TYPE，直方图给出累计的 _bucket、_sum、_count
+    std::string render() const;
+
+private:
+    struct series
+    {
+        metric_labels labels;
+        std::unique_ptr<metric_counter> counter;
+        std::unique_ptr<metric_histogram> histogram;
+        std::shared_ptr<std::function<double()>> fn;
+        uint64_t id = 0;
+    };
+
+    struct family
+    {
+        std::string name;
+        std::string help;
+        metric_type type = metric_type::counter;
+        std::vector<std::unique_ptr<series>> series_list;
+    };
+
+    family *family_locked(const std::string &name, const std::string &help, metric_type type);
+    static series *find_locked(family &f, const metric_labels &labels);
+
+    mutable std::mutex mtx_;
+    mutable std::mutex render_mtx_; // 导出与注销回调互斥，回调注销后不会再被调用
+    std::vector<std::unique_ptr<family>> families_; // 按注册顺序导出
+    std::vector<std::unique_ptr<series>> orphans_;  // 与已注册的类型冲突的序列：照常可用，但不导出
+    uint64_t next_id_ = 1;
+};
+
+// 进程内唯一的注册表
+metrics_registry &metrics();
+
+// ---------- 追踪（Chrome trace event format） ----------
+namespace trace_detail
+{
+extern std::atomic<bool> enabled;
+}
+
+// 打开后写入的事件组成一个 JSON 数组；trace_close 时补上结尾（进程被杀时数组不完整，两个查看器都能容忍）
+bool trace_open(const std::string &path, std::string &err);
+void trace_close();
+inline bool trace_enabled()
+{
+    return trace_detail::enabled.load(std::memory_order_relaxed);
+}
+// 给一条请求分一个 trace id（从 1 开始）；0 表示不追踪
+uint64_t trace_next_id();
+// 记一段 [t0, t1]；cat 为 "rag" / "llm" 之类的分类，args 为空或一个 JSON 对象文本。未打开、tid 为 0 时什么都不做
+void trace_span(const char *name, const char *cat, uint64_t tid, std::chrono::steady_clock::time_point t0,
+                std::chrono::steady_clock::time_point t1, const std::string &args = std::string());
@@ -0,0 +1,149 @@
+// src/mmap_file.cpp
+#include "mmap_file.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mmap_file::~mmap_file()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool mmap_file::open(const std::string &path, std::string &err)
+{
+    close();
+
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+    std::wstring wpath(wlen > 0 ? wlen - 1 : 0, L'\0');
+    if (wlen > 1)
+        MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wpath[0], wlen);
+
+    HANDLE f = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (f == INVALID_HANDLE_VALUE)
+    {
+        err = "cannot open " + path;
+        return false;
+    }
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(f, &sz) || sz.QuadPart == 0)
+    {
+        CloseHandle(f);
+        err = "empty or unreadable file: " + path;
+        return false;
+    }
+    HANDLE m = CreateFileMappingW(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m)
+    {
+        CloseHandle(f);
+        err = "CreateFileMapping failed: " + path;
+        return false;
+    }
+    void *p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if (!p)
+    {
+        CloseHandle(m);
+        CloseHandle(f);
+        err = "MapViewOfFile failed: " + path;
+        return false;
+    }
+    file_ = f;
+    mapping_ = m;
+    data_ = (const uint8_t *)p;
+    size_ = (size_t)sz.QuadPart;
+    return true;
+}
+
+void mmap_file::close()
+{
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mapping_)
+        CloseHandle((HANDLE)mapping_);
+    if (file_)
+        CloseHandle((HANDLE)file_);
+    data_ = nullptr;
+    size_ = 0;
+    mapping_ = nullptr;
+    file_ = nullptr;
+}
+
+void mmap_file::advise_willneed(size_t offset, size_t len) const
+{
+    if (!data_ || offset >= size_)
+        return;
+    if (len > size_ - offset)
+        len = size_ - offset;
+    WIN32_MEMORY_RANGE_ENTRY r;
+    r.VirtualAddress = (PVOID)(data_ + offset);
+    r.NumberOfBytes = len;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &r, 0);
+}
+
+#else
+
+bool mmap_file::open(const std::string &path, std::string &err)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        err = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        err = "empty or unreadable file: " + path;
+        return false;
+    }
+    void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // 映射建立后 fd 可以关闭
+    if (p == MAP_FAILED)
+    {
+        err = "mmap failed: " + path;
+        return false;
+    }
+    // 倒排是随机访问，关掉顺序预读
+    madvise(p, (size_t)st.st_size, MADV_RANDOM);
+    data_ = (const uint8_t *)p;
+    size_ = (size_t)st.st_size;
+    return true;
+}
+
+void mmap_file::close()
+{
+    if (data_)
+        munmap((void *)data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+void mmap_file::advise_willneed(size_t offset, size_t len) const
+{
+    if (!data_ || offset >= size_)
+        return;
+    if (len > size_ - offset)
+        len = size_ - offset;
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t begin = offset & ~(page - 1);
+    madvise((void *)(data_ + begin), len + (offset - begin), MADV_WILLNEED);
+}
+
+#endif
@@ -0,0 +1,34 @@
+// src/mmap_file.h
+// 只读内存映射。多个进程映射同一个索引文件时共享 OS page cache，不各自持有副本。
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class mmap_file
+{
+public:
+    mmap_file() = default;
+    ~mmap_file();
+
+    mmap_file(const mmap_file &) = delete;
+    mmap_file &operator=(const mmap_file &) = delete;
+
+    bool open(const std::string &path, std::string &err);
+    void close();
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // 提示内核预读 [offset, offset+len)，适合词典、文档表这类每次查询都会访问的小区段
+    void advise_willneed(size_t offset, size_t len) const;
+
+private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void *file_ = nullptr;
+    void *mapping_ = nullptr;
+#endif
+};
@@ -0,0 +1,545 @@
+// src/rag_pipeline.cpp
+#include "rag_pipeline.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <iostream>
+
+#include <sqlite3.h>
+
+#include "metrics.h"
+#include "text_tokenize.h"
+
+namespace
+{
+struct rag_stage_metrics
+{
+    metric_histogram &search = metrics().histogram("rag_stage_seconds", "Retrieval stage latency", {{"stage", "search"}});
+    metric_histogram &fetch = metrics().histogram("rag_stage_seconds", "Retrieval stage latency", {{"stage", "fetch"}});
+    metric_histogram &rerank = metrics().histogram("rag_stage_seconds", "Retrieval stage latency", {{"stage", "rerank"}});
+    metric_histogram &cross = metrics().histogram("rag_stage_seconds", "Retrieval stage latency", {{"stage", "cross_encoder"}});
+    metric_counter &cross_ok = metrics().counter("rag_rerank_total", "Cross-encoder rerank runs; timeout / error keep the heuristic order", {{"result", "ok"}});
+    metric_counter &cross_timeout = metrics().counter("rag_rerank_total", "Cross-encoder rerank runs; timeout / error keep the heuristic order", {{"result", "timeout"}});
+    metric_counter &cross_error = metrics().counter("rag_rerank_total", "Cross-encoder rerank runs; timeout / error keep the heuristic order", {{"result", "error"}});
+};
+
+rag_stage_metrics &stage_metrics()
+{
+    static rag_stage_metrics m;
+    return m;
+}
+
+std::string ascii_lower(const std::string &s)
+{
+    std::string out = s;
+    for (char &c : out)
+        c = (char)std::tolower((unsigned char)c);
+    return out;
+}
+
+// 单个汉字的查询词（coverage 里视为噪声）
+bool is_single_cjk(const std::string &tok)
+{
+    uint32_t cp = 0;
+    return utf8_decode(tok.data(), tok.size(), cp) == tok.size() && is_cjk_unified(cp);
+}
+
+// 截取前 n 个码点
+std::string utf8_prefix(const std::string &s, size_t n_chars)
+{
+    size_t i = 0;
+    for (size_t k = 0; k < n_chars && i < s.size(); ++k)
+    {
+        uint32_t cp = 0;
+        i += utf8_decode(s.data() + i, s.size() - i, cp);
+    }
+    return s.substr(0, i);
+}
+
+void trim(std::string &s)
+{
+    const char *ws = " \t\r\n";
+    const size_t b = s.find_first_not_of(ws);
+    if (b == std::string::npos)
+    {
+        s.clear();
+        return;
+    }
+    s.erase(s.find_last_not_of(ws) + 1);
+    s.erase(0, b);
+}
+} // namespace
+
+rag_pipeline::~rag_pipeline()
+{
+    close();
+}
+
+bool rag_pipeline::open(const rag_params &params, std::string &err)
+{
+    close();
+    params_ = params;
+
+    evidence_store_params sp;
+    sp.db_path = params_.db_path;
+    sp.table = params_.table;
+    sp.text_col = "text";
+    sp.title_col = "doc_id";
+    if (!store_.open(sp, err))
+        return false;
+    if (params_.chunk_cache_bytes)
+    {
+        cache_.reset(new chunk_cache(params_.chunk_cache_bytes));
+        store_.set_cache(cache_.get());
+    }
+
+    if (!params_.index_path.empty())
+    {
+        if (!index_.open(params_.index_path, err))
+        {
+            close();
+            return false;
+        }
+    }
+    else if (!build_index(err))
+    {
+        close();
+        return false;
+    }
+
+    if (!params_.vector_index_path.empty() && !params_.embed_model_path.empty() && !open_dense(err))
+    {
+        close();
+        return false;
+    }
+
+    if (!params_.rerank_model_path.empty())
+    {
+        llm_rerank_params rp;
+        rp.model_path = params_.rerank_model_path;
+        rp.n_seq_max = (int)std::max<size_t>(params_.rerank_top_n, 1);
+        rp.n_batch = rp.n_seq_max * rp.max_pair_tokens; // 前 rerank_top_n 对一次 decode 装得下
+        reranker_.reset(new llm_reranker());
+        if (!reranker_->load(rp, err))
+        {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool rag_pipeline::open_dense(std::string &err)
+{
+    if (!vindex_.open(params_.vector_index_path, err))
+        return false;
+
+    llm_embed_params ep;
+    ep.model_path = params_.embed_model_path;
+    ep.n_seq_max = 1; // 查询时每次只有一条
+    embedder_.reset(new llm_embedder());
+    if (!embedder_->load(ep, err))
+        return false;
+    if ((uint32_t)embedder_->n_embd() != vindex_.dim())
+    {
+        err = "vector index dim " + std::to_string(vindex_.dim()) + " does not match embedding model n_embd " +
+              std::to_string(embedder_->n_embd());
+        return false;
+    }
+    hybrid_.reset(new hybrid_searcher(index_, vindex_, *embedder_, params_.hybrid));
+    return true;
+}
+
+void rag_pipeline::close()
+{
+    hybrid_.reset();
+    embedder_.reset();
+    reranker_.reset();
+    store_.close();
+    store_.set_cache(nullptr);
+    cache_.reset();
+}
+
+bool rag_pipeline::build_index(std::string &err)
+{
+    // 只在启动时走一次全表扫描，用单独的临时连接
+    sqlite3 *db = nullptr;
+    if (sqlite3_open_v2(params_.db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+    {
+        err = "failed to open db: " + params_.db_path;
+        if (db)
+            sqlite3_close(db);
+        return false;
+    }
+
+    const std::string sql = "SELECT id, text FROM " + params_.table + " ORDER BY id";
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        err = std::string("failed to prepare: ") + sqlite3_errmsg(db);
+        sqlite3_close(db);
+        return false;
+    }
+
+    bm25_builder builder;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const unsigned char *text = sqlite3_column_text(stmt, 1);
+        builder.add_document(sqlite3_column_int64(stmt, 0), text ? (const char *)text : "");
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    index_.reset(builder.build());
+    return true;
+}
+
+bool rag_pipeline::retrieve(const std::string &query, rag_retrieval &out, std::string &err, uint64_t trace_id)
+{
+    out = rag_retrieval();
+    if (!store_.is_open())
+    {
+        err = "rag_pipeline is not open";
+        return false;
+    }
+
+    const std::vector<std::string> q_tokens = tokenize_zh_en(query);
+
+    // 1) 召回：纯 BM25，或 BM25 + 稠密并行后融合
+    const auto t0 = std::chrono::steady_clock::now();
+    struct candidate
+    {
+        int64_t doc_key;
+        float bm25;
+        float retrieval;
+    };
+    std::vector<candidate> top;
+    if (hybrid_)
+    {
+        std::string herr;
+        for (const auto &h : hybrid_->search(query, params_.top_k, herr, &out.query_vec))
+            top.push_back({h.doc_key, h.bm25, h.score});
+        if (!herr.empty())
+            std::cerr << "Warning: " << herr << "\n";
+    }
+    else
+    {
+        // q_tokens 是单字切分（coverage/标题命中也用它）；索引用二元切分时按索引的方式重新切
+        const std::vector<bm25_hit> hits = index_.tokenize().cjk == tokenize_cjk::unigram
+                                               ? index_.search_tokens(q_tokens, params_.top_k)
+                                               : index_.search(query, params_.top_k);
+        for (const auto &h : hits)
+            top.push_back({h.doc_key, h.score, h.score});
+    }
+
+    float max_score = 0.0f;
+    for (const auto &c : top)
+        max_score = std::max(max_score, c.retrieval);
+
+    // 2) 一次取回全部候选的正文，再重排：召回分数为主，覆盖率辅助，标题命中加一点
+    std::vector<int64_t> ids;
+    ids.reserve(top.size());
+    for (const auto &c : top)
+        ids.push_back(c.doc_key);
+    const auto t1 = std::chrono::steady_clock::now();
+    std::vector<evidence_row> rows;
+    if (!store_.fetch(ids, rows, err))
+        return false;
+    const auto t2 = std::chrono::steady_clock::now();
+    out.search_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    out.fetch_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    rag_stage_metrics &m = stage_metrics();
+    m.search.observe_ms(out.search_ms);
+    m.fetch.observe_ms(out.fetch_ms);
+    if (trace_id != 0 && trace_enabled())
+    {
+        trace_span("search", "rag", trace_id, t0, t1, "{\"n_hits\":" + std::to_string(top.size()) + "}");
+        trace_span("fetch", "rag", trace_id, t1, t2);
+    }
+    // 重排 + 闸门 + 过滤；各个出口都记一次。交叉编码器另记一段，这里只到它开始之前
+    std::chrono::steady_clock::time_point t_cross;
+    bool cross_ran = false;
+    auto rerank_done = [&]()
+    {
+        const auto t3 = cross_ran ? t_cross : std::chrono::steady_clock::now();
+        m.rerank.observe_ms(std::chrono::duration<double, std::milli>(t3 - t2).count());
+        trace_span("rerank", "rag", trace_id, t2, t3);
+    };
+
+    out.hits.reserve(top.size());
+    size_t r = 0;
+    for (const auto &c : top)
+    {
+        // rows 与 ids 同序，只是缺失的 id 被跳过
+        if (r >= rows.size() || rows[r].id != c.doc_key)
+        {
+            std::cerr << "Warning: documents.id=" << c.doc_key << " not found in " << params_.table << "\n";
+            continue;
+        }
+        rag_hit hit;
+        hit.doc_key = c.doc_key;
+        hit.bm25 = c.bm25;
+        hit.retrieval = c.retrieval;
+        hit.title = std::move(rows[r].title);
+        hit.text = std::move(rows[r].text);
+        ++r;
+        hit.cov = rag_token_coverage(q_tokens, hit.text);
+        hit.title_hit = rag_title_hit(q_tokens, hit.title);
+        const float norm = max_score > 0.0f ? c.retrieval / max_score : 0.0f;
+        hit.final_score = params_.w_bm25 * norm + params_.w_cov * hit.cov + (hit.title_hit ? params_.w_title : 0.0f);
+        out.hits.push_back(std::move(hit));
+    }
+    std::stable_sort(out.hits.begin(), out.hits.end(), [](const rag_hit &a, const rag_hit &b)
+                     { return a.final_score > b.final_score; });
+
+    // 3) 强边界：硬术语必须在证据中出现
+    const std::vector<std::string> hard = rag_query_hard_terms(query);
+    if (!hard.empty())
+    {
+        std::string blob;
+        for (const auto &h : out.hits)
+        {
+            blob += h.title;
+            blob += "\n";
+            blob += h.text;
+            blob += "\n";
+        }
+        blob = ascii_lower(blob);
+        for (const auto &t : hard)
+        {
+            if (blob.find(t) == std::string::npos)
+            {
+                out.gate = rag_gate::hard_term_missing;
+                rerank_done();
+                return true;
+            }
+        }
+    }
+
+    // 4) 交叉编码器重排（可选）：只对过了闸门的请求做
+    if (reranker_)
+    {
+        t_cross = std::chrono::steady_clock::now();
+        cross_ran = true;
+        cross_rerank(query, out, trace_id);
+    }
+
+    // 5) 过滤：BM25 或 coverage 达标、或标题命中即可
+    for (const auto &h : out.hits)
+    {
+        if (h.bm25 >= params_.min_bm25 || h.cov >= params_.min_coverage || h.title_hit)
+            out.evidence.push_back(h);
+    }
+    if (out.reranked && params_.rerank_keep > 0 && out.evidence.size() > params_.rerank_keep)
+        out.evidence.resize(params_.rerank_keep);
+    if (out.evidence.empty())
+    {
+        out.gate = rag_gate::no_evidence;
+        rerank_done();
+        return true;
+    }
+
+    for (const auto &h : out.evidence)
+    {
+        out.evidence_text += "[chunk:" + std::to_string(h.doc_key) + "] " + h.title + "\n" + h.text + "\n\n";
+    }
+    out.gate = rag_gate::ok;
+    rerank_done();
+    return true;
+}
+
+void rag_pipeline::cross_rerank(const std::string &query, rag_retrieval &out, uint64_t trace_id)
+{
+    const size_t n = std::min(out.hits.size(), std::max<size_t>(params_.rerank_top_n, 1));
+    if (n == 0)
+        return;
+    std::vector<const std::string *> docs;
+    docs.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        docs.push_back(&out.hits[i].text);
+
+    std::vector<float> scores;
+    bool timed_out = false;
+    std::string err;
+    const auto t0 = std::chrono::steady_clock::now();
+    const bool ok = reranker_->score(query, docs, scores, params_.rerank_budget_ms, timed_out, err);
+    const auto t1 = std::chrono::steady_clock::now();
+    out.cross_rerank_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    rag_stage_metrics &m = stage_metrics();
+    m.cross.observe_ms(out.cross_rerank_ms);
+    (ok ? m.cross_ok : timed_out ? m.cross_timeout : m.cross_error).inc();
+    if (trace_id != 0 && trace_enabled())
+        trace_span("cross_encoder", "rag", trace_id, t0, t1,
+                   "{\"n_pairs\":" + std::to_string(n) + ",\"result\":\"" +
+                       (ok ? "ok" : timed_out ? "timeout" : "error") + "\"}");
+    if (!ok)
+    {
+        // 超时是预期内的退化，只计数；其他错误打一条警告
+        if (!timed_out)
+            std::cerr << "Warning: " << err << "\n";
+        return;
+    }
+
+    // 未打分的尾部在启发式排序里本来就靠后，丢掉，免得两种分数混排
+    out.hits.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        out.hits[i].rerank = scores[i];
+        out.hits[i].final_score = scores[i];
+    }
+    std::stable_sort(out.hits.begin(), out.hits.end(), [](const rag_hit &a, const rag_hit &b)
+                     { return a.final_score > b.final_score; });
+    out.reranked = true;
+}
+
+// ---------- 闸门与兜底 ----------
+const std::vector<std::string> &rag_hard_terms()
+{
+    static const std::vector<std::string> terms = {
+        "bm25", "faiss", "rerank", "embedding", "vector",
+        "flask", "python",
+        "std::format", "format", "printf",
+    };
+    return terms;
+}
+
+std::vector<std::string> rag_query_hard_terms(const std::string &query)
+{
+    const std::string ql = ascii_lower(query);
+    std::vector<std::string> out;
+    for (const auto &t : rag_hard_terms())
+    {
+        if (ql.find(t) != std::string::npos)
+            out.push_back(t);
+    }
+    return out;
+}
+
+float rag_token_coverage(const std::vector<std::string> &q_tokens, const std::string &text)
+{
+    const std::string t = ascii_lower(text);
+    int hit = 0, total = 0;
+    for (const auto &tok : q_tokens)
+    {
+        if (tok.empty() || is_single_cjk(tok))
+            continue;
+        ++total;
+        if (t.find(tok) != std::string::npos)
+            ++hit;
+    }
+    return total ? (float)hit / (float)total : 0.0f;
+}
+
+bool rag_title_hit(const std::vector<std::string> &q_tokens, const std::string &title)
+{
+    const std::string tl = ascii_lower(title);
+    for (const auto &tok : q_tokens)
+    {
+        // tokenize_zh_en 的多字节词只有英文/数字串，按字节长度判断即可
+        if (tok.size() >= 2 && !is_single_cjk(tok) && tl.find(tok) != std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+bool rag_has_citation(const std::string &answer)
+{
+    size_t pos = 0;
+    while ((pos = answer.find("[chunk:", pos)) != std::string::npos)
+    {
+        size_t i = pos + 7;
+        const size_t digits = i;
+        while (i < answer.size() && std::isdigit((unsigned char)answer[i]))
+            ++i;
+        if (i > digits && i < answer.size() && answer[i] == ']')
+            return true;
+        pos += 7;
+    }
+    return false;
+}
+
+std::string rag_citation_grammar(const std::vector<rag_hit> &evidence, int max_chars)
+{
+    std::vector<int64_t> ids;
+    for (const auto &h : evidence)
+    {
+        if (std::find(ids.begin(), ids.end(), h.doc_key) == ids.end())
+            ids.push_back(h.doc_key);
+    }
+    if (ids.empty())
+        return std::string();
+
+    std::string g;
+    g += u8"root ::= \"【定义】\" sent cite \"。\"\n";
+    // 单句：不含句末标点、换行、方括号和【】
+    g += u8"sent ::= [^。！？\\n\\r\\[\\]【】]{1," + std::to_string(std::max(max_chars, 1)) + "}\n";
+    g += "cite ::= ref ref?\n";
+    g += "ref ::= \"[chunk:\" id \"]\"\n";
+    g += "id ::= ";
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if (i)
+            g += " | ";
+        g += "\"" + std::to_string(ids[i]) + "\"";
+    }
+    g += "\n";
+    return g;
+}
+
+std::string rag_fallback_excerpt(const std::string &query, const std::vector<rag_hit> &evidence)
+{
+    if (evidence.empty())
+        return u8"证据不足";
+
+    const std::vector<std::string> q_tokens = tokenize_zh_en(query);
+    const std::vector<std::string> hard = rag_query_hard_terms(query);
+
+    // hard_ok 权重最大，避免摘到无关 chunk
+    const rag_hit *best = nullptr;
+    double best_score = 0.0;
+    for (const auto &h : evidence)
+    {
+        const std::string blob = ascii_lower(h.title + "\n" + h.text);
+        bool hard_ok = true;
+        for (const auto &t : hard)
+            hard_ok = hard_ok && blob.find(t) != std::string::npos;
+        const double s = 10.0 * (hard_ok ? 1.0 : 0.0) + 2.0 * (h.title_hit ? 1.0 : 0.0) + 3.0 * h.cov + 0.05 * h.bm25;
+        if (!best || s > best_score)
+        {
+            best = &h;
+            best_score = s;
+        }
+    }
+
+    std::string snippet = best->text;
+    trim(snippet);
+    snippet = utf8_prefix(snippet, 900);
+    trim(snippet);
+    return u8"结论：根据知识库摘录如下（模型未按引用格式输出，已自动改为摘录回答）。\n"
+           u8"- 来源：[chunk:" +
+           std::to_string(best->doc_key) + "] " + best->title + u8"\n摘录：\n" + snippet;
+}
+
+std::string rag_finalize_answer(const std::string &query, const rag_retrieval &rr, std::string &answer)
+{
+    if (rag_has_citation(answer))
+        return "ok";
+    answer = rag_fallback_excerpt(query, rr.evidence);
+    return "fallback_excerpt";
+}
+
+const char *rag_gate_name(rag_gate g)
+{
+    switch (g)
+    {
+    case rag_gate::ok:
+        return "ok";
+    case rag_gate::hard_term_missing:
+        return "hard_term_missing";
+    case rag_gate::no_evidence:
+        return "no_evidence";
+    }
+    return "unknown";
+}
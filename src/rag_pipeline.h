@@ -0,0 +1,146 @@
+// src/rag_pipeline.h
+// 进程内的检索链路：BM25 top-k → 覆盖率/标题重排 → 硬术语闸门 → 证据过滤 → 拼证据文本。
+// 规则与 python/rag_cli.py 的 main() 一一对应，llm_cli --query 用它替代 Python 侧的检索与子进程往返。
+// 同时给出向量索引和 embedding 模型时，第一步换成 hybrid_searcher（BM25 与稠密检索并行后融合）。
+// 给出 reranker 模型时，过了硬术语闸门的前几条再用交叉编码器成对打分、重新排序（llm_rerank.h）。
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bm25_segments.h"
+#include "chunk_cache.h"
+#include "evidence_store.h"
+#include "hybrid_search.h"
+#include "llm_rerank.h"
+
+struct rag_params
+{
+    std::string db_path = "data/documents.db";
+    std::string table = "documents"; // 表结构见 python/SQLite.py::init_schema
+    std::string index_path;          // bm25_cli --save 生成的索引，或 ingest_cli --segments 的段目录；为空时启动时从数据库现建
+
+    // 混合检索：两者都非空时启用（embed_cli 生成的向量索引 + 同一个 embedding 模型）
+    std::string vector_index_path;
+    std::string embed_model_path;
+    hybrid_params hybrid;
+
+    size_t top_k = 5;
+
+    // 候选证据的内存缓存（chunk_cache），0 表示关闭
+    size_t chunk_cache_bytes = 64ull << 20;
+
+    // 与 rag_cli.py 的阀门一致
+    float min_bm25 = 0.6f;
+    float min_coverage = 0.10f;
+
+    // final = w_bm25 * retrieval / max_retrieval + w_cov * cov + w_title * title_hit
+    float w_bm25 = 0.75f;
+    float w_cov = 0.25f;
+    float w_title = 0.08f;
+
+    // 交叉编码器重排（可选）：启发式排序后的前 rerank_top_n 条与问题成对打分，全部对一次 decode；
+    // 超过 rerank_budget_ms（0 不限）就中断、沿用启发式排序。重排成功时 final_score 换成 reranker 分数，
+    // 未打分的尾部丢弃，证据最多留 rerank_keep 条（0 不限）：排得更准，送进 prompt 的证据就可以更少
+    std::string rerank_model_path;
+    size_t rerank_top_n = 8;
+    int rerank_budget_ms = 80;
+    size_t rerank_keep = 3;
+};
+
+struct rag_hit
+{
+    int64_t doc_key = 0; // documents.id，也是引用里的 [chunk:N]
+    std::string title;   // documents.doc_id
+    std::string text;
+    float bm25 = 0.0f;      // 不在 BM25 候选里时为 0
+    float retrieval = 0.0f; // 第一步的排序分数：BM25，混合检索时为融合分数
+    float cov = 0.0f;
+    bool title_hit = false;
+    float final_score = 0.0f;
+    float rerank = 0.0f; // 交叉编码器分数（0..1）；没有重排时为 0
+};
+
+enum class rag_gate
+{
+    ok,
+    hard_term_missing, // 问题里的硬术语没有出现在证据中
+    no_evidence,       // 过滤后没有可用证据
+};
+
+struct rag_retrieval
+{
+    std::vector<rag_hit> hits;     // BM25 top-k，按 final_score 降序
+    std::vector<rag_hit> evidence; // 通过过滤、送进 prompt 的部分
+    std::string evidence_text;     // "[chunk:N] title\ntext\n" 逐条拼接
+    rag_gate gate = rag_gate::no_evidence;
+    std::vector<float> query_vec;  // 混合检索时的查询向量（答案缓存的近似查找用），否则为空
+    bool reranked = false;         // hits 的顺序与 final_score 来自交叉编码器
+
+    // 各阶段耗时（毫秒）：召回（含查询向量）、取证据正文；infer_demo 的基准用
+    double search_ms = 0.0;
+    double fetch_ms = 0.0;
+    double cross_rerank_ms = 0.0; // 交叉编码器打分（含超时中断的那次）
+};
+
+class rag_pipeline
+{
+public:
+    rag_pipeline() = default;
+    ~rag_pipeline();
+
+    rag_pipeline(const rag_pipeline &) = delete;
+    rag_pipeline &operator=(const rag_pipeline &) = delete;
+
+    bool open(const rag_params &params, std::string &err);
+    void close();
+
+    // 非线程安全：内部复用同一个 evidence_store。各阶段耗时记进 rag_stage_seconds 直方图；
+    // trace_id 非 0 时另外写 search / fetch / rerank 三段追踪（metrics.h）
+    bool retrieve(const std::string &query, rag_retrieval &out, std::string &err, uint64_t trace_id = 0);
+
+    const rag_params &params() const { return params_; }
+    const bm25_segments &index() const { return index_; }
+    bool hybrid_enabled() const { return hybrid_ != nullptr; }
+    bool rerank_enabled() const { return reranker_ != nullptr; }
+    const chunk_cache *cache() const { return cache_.get(); }
+
+private:
+    bool build_index(std::string &err);
+    bool open_dense(std::string &err);
+    // 对 out.hits 的前 rerank_top_n 条打分并重排；超时或出错时不动 hits
+    void cross_rerank(const std::string &query, rag_retrieval &out, uint64_t trace_id);
+
+    rag_params params_;
+    bm25_segments index_;
+    vector_index vindex_;
+    std::unique_ptr<llm_embedder> embedder_;
+    std::unique_ptr<hybrid_searcher> hybrid_;
+    std::unique_ptr<llm_reranker> reranker_;
+    std::unique_ptr<chunk_cache> cache_;
+    evidence_store store_;
+};
+
+// ---------- 闸门与兜底（与 rag_cli.py 同名函数对应） ----------
+const std::vector<std::string> &rag_hard_terms();
+std::vector<std::string> rag_query_hard_terms(const std::string &query);
+float rag_token_coverage(const std::vector<std::string> &q_tokens, const std::string &text);
+bool rag_title_hit(const std::vector<std::string> &q_tokens, const std::string &title);
+// 回答里是否带 [chunk:N] 引用
+bool rag_has_citation(const std::string &answer);
+// 约束解码用的 GBNF："【定义】<一句话>[chunk:N]。"，N 只能取送进 prompt 的证据 id（最多引用两条）。
+// max_chars 限制句子长度，应小于 n_predict，保证引用能在生成上限内写出来
+std::string rag_citation_grammar(const std::vector<rag_hit> &evidence, int max_chars);
+// 模型没按格式引用时，改为摘录最相关的一条证据
+std::string rag_fallback_excerpt(const std::string &query, const std::vector<rag_hit> &evidence);
+// 生成结果必须带 [chunk:N] 引用，否则改为摘录回答；返回 reason（ok / fallback_excerpt）
+std::string rag_finalize_answer(const std::string &query, const rag_retrieval &rr, std::string &answer);
+// 约束里的句子长度上限：给 "【定义】" 和引用留出 token，剩下的按一个汉字约一个 token 估
+inline int rag_grammar_chars(int n_predict)
+{
+    return n_predict - 16 < 16 ? 16 : n_predict - 16;
+}
+// 闸门结果的名字，也是回包里的 reason
+const char *rag_gate_name(rag_gate g);
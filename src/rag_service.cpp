@@ -0,0 +1,230 @@
+// src/rag_service.cpp
+#include "rag_service.h"
+
+#include <chrono>
+#include <memory>
+
+#include "metrics.h"
+
+void rag_service::set_pipeline(rag_pipeline *rag, evidence_packer *packer)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    rag_ = rag;
+    packer_ = packer;
+}
+
+bool rag_service::has_pipeline() const
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    return rag_ != nullptr;
+}
+
+std::string rag_service::model_id(const llm_engine &engine)
+{
+    std::lock_guard<std::mutex> lk(ids_mtx_);
+    auto it = model_ids_.find(&engine);
+    if (it == model_ids_.end())
+        it = model_ids_.emplace(&engine, answer_cache_model_id(engine.params().model_path)).first;
+    return it->second;
+}
+
+bool rag_service::search(const std::string &query, rag_retrieval &out, std::string &err, uint64_t trace_id)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!rag_)
+    {
+        err = "no retrieval pipeline (start with --db/--index)";
+        return false;
+    }
+    return rag_->retrieve(query, out, err, trace_id);
+}
+
+void rag_service::answer(const std::string &query, const llm_pool_request &pr, llm_request req, rag_answer_fn on_done,
+                         llm_delta_fn on_delta)
+{
+    rag_answer a;
+    const llm_engine *target = pool_.engine(pr.model);
+    if (!target)
+    {
+        a.error_code = 3;
+        a.error = "unknown model: " + pr.model;
+        on_done(a);
+        return;
+    }
+
+    auto rr = std::make_shared<rag_retrieval>();
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::string err;
+        if (!rag_)
+            err = "no retrieval pipeline (start with --db/--index)";
+        else if (!rag_->retrieve(query, *rr, err, req.trace_id) && err.empty())
+            err = "retrieve failed";
+        if (!err.empty())
+        {
+            a.error_code = 3;
+            a.error = err;
+            on_done(a);
+            return;
+        }
+        // 缓存的 token 按主模型的词表切好，换了词表不同的模型就按文本送
+        a.packed = rr->gate == rag_gate::ok && packer_ && packer_->compatible(*target);
+        if (a.packed)
+        {
+            const auto t0 = std::chrono::steady_clock::now();
+            packer_->pack(*rr, req, a.pack);
+            trace_span("pack", "rag", req.trace_id, t0, std::chrono::steady_clock::now());
+        }
+        else
+            req.evidence = rr->evidence_text;
+    }
+    for (const auto &h : rr->evidence)
+        a.chunks.push_back(h.doc_key);
+
+    if (rr->gate != rag_gate::ok)
+    {
+        a.ok = true;
+        a.answer = u8"证据不足";
+        a.reason = rag_gate_name(rr->gate);
+        rag_count_answer(a.reason, false);
+        on_done(a);
+        return;
+    }
+    req.question = query;
+    if (params_.grammar)
+        req.grammar = rag_citation_grammar(rr->evidence, rag_grammar_chars(req.n_predict));
+
+    const answer_cache_key akey = rag_answer_key(model_id(*target), req, *rr);
+    answer_cache *answers = answers_;
+    if (answers)
+    {
+        answer_cache_entry cached;
+        a.cached = answers->lookup(akey, rr->query_vec, cached);
+        if (a.cached != answer_cache_hit::miss)
+        {
+            a.ok = true;
+            a.answer = cached.answer;
+            a.reason = cached.reason;
+            rag_count_answer(a.reason, true);
+            on_done(a);
+            return;
+        }
+    }
+
+    pool_.submit(pr, req, [a, rr, query, akey, answers, on_done](const llm_result &r) mutable
+                 {
+        a.generated = true;
+        a.result = r;
+        a.ok = r.ok;
+        if (r.ok)
+        {
+            a.answer = r.answer;
+            a.reason = rag_finalize_answer(query, *rr, a.answer);
+            if (answers && rag_answer_cacheable(r))
+                answers->store(akey, rr->query_vec, {a.answer, a.reason});
+            rag_count_answer(a.reason, false);
+        }
+        else
+        {
+            a.error_code = r.error_code;
+            a.error = r.error;
+        }
+        on_done(a); },
+                 std::move(on_delta));
+}
+
+answer_cache_key rag_answer_key(const std::string &model_id, const llm_request &req, const rag_retrieval &rr)
+{
+    answer_cache_key key;
+    key.query = req.question;
+    for (const auto &h : rr.evidence)
+        key.chunk_ids.push_back(h.doc_key);
+    key.model = model_id;
+    key.temp = req.temp;
+    key.top_k = req.top_k;
+    key.top_p = req.top_p;
+    key.seed = req.seed;
+    key.n_predict = req.n_predict;
+    key.max_tokens = req.policy.max_tokens;
+    key.one_sentence = req.policy.one_sentence;
+    key.grammar = req.grammar;
+    return key;
+}
+
+bool rag_answer_cacheable(const llm_result &r)
+{
+    // 截止时间或长度上限截断的答案多半没写完（常被改成摘录兜底），不能给后来不受限的请求复用
+    return r.ok && r.stop_reason != "deadline" && r.stop_reason != "length";
+}
+
+void rag_count_answer(const std::string &reason, bool cached)
+{
+    metrics()
+        .counter("rag_answers_total", "RAG answers by reason; hard_term_missing / no_evidence are short-circuits",
+                 {{"reason", reason}, {"cached", cached ? "1" : "0"}})
+        .inc();
+}
+
+void llm_result_to_json(const llm_result &r, json_value &out)
+{
+    out.set("n_prompt", json_value::make_number(r.n_prompt_tokens));
+    out.set("n_cached", json_value::make_number(r.n_cached_tokens));
+    out.set("n_gen", json_value::make_number(r.n_gen_tokens));
+    out.set("stop_reason", json_value::make_string(r.stop_reason));
+    out.set("ttft_ms", json_value::make_number(r.ttft_ms));
+    out.set("prefill_tps", json_value::make_number(r.prefill_tps));
+    out.set("decode_tps", json_value::make_number(r.decode_tps));
+    if (r.n_draft_tokens > 0)
+    {
+        out.set("n_draft", json_value::make_number(r.n_draft_tokens));
+        out.set("n_draft_accepted", json_value::make_number(r.n_draft_accepted));
+    }
+    if (r.n_truncated_tokens > 0)
+        out.set("n_truncated", json_value::make_number(r.n_truncated_tokens));
+    if (r.n_ctx_shifts > 0)
+        out.set("n_ctx_shifts", json_value::make_number(r.n_ctx_shifts));
+    out.set("kv_seq_kib", json_value::make_number((double)(r.kv_seq_bytes >> 10)));
+    out.set("template_ms", json_value::make_number(r.template_ms));
+    out.set("tokenize_ms", json_value::make_number(r.tokenize_ms));
+}
+
+void rag_answer_to_json(const rag_answer &a, json_value &out)
+{
+    if (!a.ok && !a.generated && a.chunks.empty())
+    {
+        // 检索之前就失败了（未知模型、没有检索链路）
+        out.set("ok", json_value::make_bool(false));
+        out.set("error", json_value::make_string(a.error));
+        out.set("code", json_value::make_number(a.error_code));
+        return;
+    }
+    json_value chunks = json_value::make_array();
+    for (int64_t id : a.chunks)
+        chunks.arr.push_back(json_value::make_number((double)id));
+    out.set("chunks", chunks);
+    if (a.packed)
+    {
+        out.set("evidence_tokens", json_value::make_number(a.pack.n_tokens));
+        if (a.pack.n_truncated + a.pack.n_dropped > 0)
+        {
+            out.set("evidence_truncated", json_value::make_number(a.pack.n_truncated));
+            out.set("evidence_dropped", json_value::make_number(a.pack.n_dropped));
+        }
+    }
+    out.set("ok", json_value::make_bool(a.ok));
+    if (!a.ok)
+    {
+        out.set("error", json_value::make_string(a.error));
+        out.set("code", json_value::make_number(a.error_code));
+        return;
+    }
+    out.set("answer", json_value::make_string(a.answer));
+    out.set("reason", json_value::make_string(a.reason));
+    if (a.cached != answer_cache_hit::miss)
+    {
+        out.set("cached", json_value::make_string(a.cached == answer_cache_hit::exact ? "exact" : "near"));
+        out.set("n_gen", json_value::make_number(0));
+    }
+    else if (a.generated)
+        llm_result_to_json(a.result, out);
+}
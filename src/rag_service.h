@@ -0,0 +1,91 @@
+// src/rag_service.h
+// 一条 "query" 请求在进程内的完整流程：检索 → 闸门 → 按预算装证据 → 查答案缓存 → 交给 llm_pool 生成 → 引用检查与摘录兜底。
+// llm_cli --serve 与 rag_server 共用，两边回包的字段一致。
+//
+// rag_pipeline 与 evidence_packer 都不是线程安全的，检索和装证据在一把锁里做（都是毫秒级）；生成异步交给池子。
+// 入库后可以用 set_pipeline 换上重新打开的检索链路，换的时候等进行中的检索做完。
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "answer_cache.h"
+#include "evidence_pack.h"
+#include "json_lite.h"
+#include "llm_pool.h"
+#include "rag_pipeline.h"
+
+struct rag_service_params
+{
+    bool grammar = true; // 用 rag_citation_grammar 约束输出
+};
+
+struct rag_answer
+{
+    bool ok = false;
+    int error_code = 0; // 同 llm_result::error_code；3 也用于未知模型 / 没有检索链路
+    std::string error;
+    std::string answer;
+    std::string reason; // ok / fallback_excerpt / hard_term_missing / no_evidence（后两者回答为“证据不足”）
+    answer_cache_hit cached = answer_cache_hit::miss;
+    std::vector<int64_t> chunks; // 送进 prompt 的证据 id
+    bool packed = false;         // 证据按 token 预算装入（pack 有效）
+    evidence_pack_stats pack;
+    bool generated = false; // 走了生成（result 有效）
+    llm_result result;
+};
+
+using rag_answer_fn = std::function<void(const rag_answer &)>;
+
+class rag_service
+{
+public:
+    rag_service(llm_pool &pool, const rag_service_params &params) : pool_(pool), params_(params) {}
+
+    rag_service(const rag_service &) = delete;
+    rag_service &operator=(const rag_service &) = delete;
+
+    // 都可为空（此时 query 请求回错）；返回时旧的检索链路已经没人在用，调用方可以销毁它
+    void set_pipeline(rag_pipeline *rag, evidence_packer *packer);
+    void set_answer_cache(answer_cache *answers) { answers_ = answers; }
+    bool has_pipeline() const;
+
+    // 线程安全。只检索，不生成
+    bool search(const std::string &query, rag_retrieval &out, std::string &err, uint64_t trace_id = 0);
+
+    // 线程安全。检索与装证据在调用线程里做；出错、闸门不通过或命中答案缓存时 on_done 直接在调用线程里调用，
+    // 否则交给池子，on_done 在调度线程里调用。req 的 question / evidence / grammar 由本函数设置
+    void answer(const std::string &query, const llm_pool_request &pr, llm_request req, rag_answer_fn on_done,
+                llm_delta_fn on_delta = nullptr);
+
+private:
+    // 答案缓存键里的模型：按实际处理请求的引擎算，每个引擎只算一次
+    std::string model_id(const llm_engine &engine);
+
+    llm_pool &pool_;
+    rag_service_params params_;
+    answer_cache *answers_ = nullptr;
+
+    std::mutex ids_mtx_;
+    std::unordered_map<const llm_engine *, std::string> model_ids_;
+
+    mutable std::mutex mtx_; // 保护 rag_ / packer_ 及其使用
+    rag_pipeline *rag_ = nullptr;
+    evidence_packer *packer_ = nullptr;
+};
+
+// 问题 + 送进 prompt 的证据 id + 模型 + 采样参数与长度策略
+answer_cache_key rag_answer_key(const std::string &model_id, const llm_request &req, const rag_retrieval &rr);
+// 生成完整结束（非 deadline / length 截断）的结果才写进答案缓存
+bool rag_answer_cacheable(const llm_result &r);
+// rag_answers_total{reason, cached} 加一
+void rag_count_answer(const std::string &reason, bool cached);
+
+// 回包字段：生成的 token 数、停止原因与各项计时
+void llm_result_to_json(const llm_result &r, json_value &out);
+// ok / answer / reason / chunks / evidence_* / cached，生成过的另带 llm_result_to_json 的字段；失败时 error / code
+void rag_answer_to_json(const rag_answer &a, json_value &out);
@@ -0,0 +1,102 @@
+// src/stop_matcher.cpp
+#include "stop_matcher.h"
+
+#include <algorithm>
+#include <deque>
+
+stop_matcher::stop_matcher(const std::vector<std::string> &stops)
+{
+    // 字节分类：只给停止串里出现过的字节单独编号，转移表宽度随之缩小
+    for (const auto &t : stops)
+    {
+        for (unsigned char c : t)
+        {
+            if (!byte_class_[c])
+                byte_class_[c] = (uint8_t)n_classes_++;
+        }
+    }
+
+    constexpr uint32_t k_none = UINT32_MAX;
+    next_.assign(n_classes_, k_none);
+    depth_.assign(1, 0);
+    out_len_.assign(1, 0);
+
+    // 1) trie
+    for (const auto &t : stops)
+    {
+        if (t.empty())
+            continue;
+        uint32_t v = 0;
+        for (unsigned char c : t)
+        {
+            uint32_t &to = next_[(size_t)v * n_classes_ + byte_class_[c]];
+            if (to == k_none)
+            {
+                to = (uint32_t)depth_.size();
+                depth_.push_back(depth_[v] + 1);
+                out_len_.push_back(0);
+                next_.resize(next_.size() + n_classes_, k_none); // 可能使 to 失效，下面不再使用它
+            }
+            v = next_[(size_t)v * n_classes_ + byte_class_[c]];
+        }
+        out_len_[v] = (uint32_t)t.size();
+        max_len_ = std::max(max_len_, t.size());
+        ++n_patterns_;
+    }
+
+    // 2) BFS 补全失配转移，得到完整 DFA；终止信息沿 fail 链合并（取最长，对应最早起点）
+    std::vector<uint32_t> fail(depth_.size(), 0);
+    std::deque<uint32_t> q;
+    for (uint32_t c = 0; c < n_classes_; ++c)
+    {
+        uint32_t &to = next_[c];
+        if (to == k_none)
+            to = 0;
+        else
+            q.push_back(to);
+    }
+    while (!q.empty())
+    {
+        const uint32_t v = q.front();
+        q.pop_front();
+        out_len_[v] = std::max(out_len_[v], out_len_[fail[v]]);
+        for (uint32_t c = 0; c < n_classes_; ++c)
+        {
+            uint32_t &to = next_[(size_t)v * n_classes_ + c];
+            const uint32_t via_fail = next_[(size_t)fail[v] * n_classes_ + c];
+            if (to == k_none)
+            {
+                to = via_fail;
+            }
+            else
+            {
+                fail[to] = via_fail;
+                q.push_back(to);
+            }
+        }
+    }
+}
+
+size_t stop_matcher::feed(uint32_t &state, const char *data, size_t n, size_t pos) const
+{
+    if (n_patterns_ == 0)
+        return std::string::npos;
+    uint32_t v = state;
+    for (size_t i = 0; i < n; ++i)
+    {
+        v = next_[(size_t)v * n_classes_ + byte_class_[(unsigned char)data[i]]];
+        if (out_len_[v])
+        {
+            state = v;
+            return pos + i + 1 - out_len_[v];
+        }
+    }
+    state = v;
+    return std::string::npos;
+}
+
+size_t stop_matcher::find(const std::string &s) const
+{
+    uint32_t state = 0;
+    return feed(state, s.data(), s.size(), 0);
+}
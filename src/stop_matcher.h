@@ -0,0 +1,40 @@
+// src/stop_matcher.h
+// 停止串的多模式匹配（Aho–Corasick，按字节建成完整的 DFA）。
+// 解码循环里每个 token 的 piece 只需把新字节喂进去一次，状态跨 token 保留，
+// 所以被切在两个 token 之间的 UTF-8 字符或停止串也能正确识别；总开销与输出长度成线性，与停止串个数无关。
+// 编译后的匹配器只读，可被多个序列共用；每个序列只持有一个 uint32_t 状态。
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class stop_matcher
+{
+public:
+    stop_matcher() = default;
+    explicit stop_matcher(const std::vector<std::string> &stops);
+
+    bool empty() const { return n_patterns_ == 0; }
+    size_t max_len() const { return max_len_; }
+
+    // 从 state 继续喂入 data[0, n)，pos 是 data[0] 在整段输出中的偏移。
+    // 命中时返回该停止串在整段输出中的起点并停止推进；否则返回 npos
+    size_t feed(uint32_t &state, const char *data, size_t n, size_t pos) const;
+
+    // 当前状态对应的已读后缀长度：这段后缀是某个停止串的前缀，流式输出时需要先扣住
+    size_t pending(uint32_t state) const { return state < depth_.size() ? depth_[state] : 0; }
+
+    // 整段扫描：最早结束的那个停止串的起点，没有时为 npos
+    size_t find(const std::string &s) const;
+
+private:
+    size_t n_patterns_ = 0;
+    size_t max_len_ = 0;
+    uint32_t n_classes_ = 1;
+    uint8_t byte_class_[256] = {}; // 未出现在任何停止串中的字节都归入 0 类
+    std::vector<uint32_t> next_;   // [node * n_classes_ + class]
+    std::vector<uint32_t> depth_;
+    std::vector<uint32_t> out_len_; // 以该节点结尾的最长停止串长度，0 表示不是终止状态
+};
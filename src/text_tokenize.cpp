@@ -0,0 +1,329 @@
+// src/text_tokenize.cpp
+#include "text_tokenize.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAG_TOK_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define RAG_TOK_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+size_t utf8_decode(const char *s, size_t n, uint32_t &cp)
+{
+    const unsigned char c = (unsigned char)s[0];
+    if (c < 0x80)
+    {
+        cp = c;
+        return 1;
+    }
+
+    size_t len = 0;
+    uint32_t v = 0;
+    if ((c & 0xE0) == 0xC0)
+    {
+        len = 2;
+        v = c & 0x1F;
+    }
+    else if ((c & 0xF0) == 0xE0)
+    {
+        len = 3;
+        v = c & 0x0F;
+    }
+    else if ((c & 0xF8) == 0xF0)
+    {
+        len = 4;
+        v = c & 0x07;
+    }
+    else
+    {
+        cp = 0xFFFD;
+        return 1;
+    }
+    if (len > n)
+    {
+        cp = 0xFFFD;
+        return 1;
+    }
+    for (size_t k = 1; k < len; ++k)
+    {
+        const unsigned char cc = (unsigned char)s[k];
+        if ((cc & 0xC0) != 0x80)
+        {
+            cp = 0xFFFD;
+            return 1;
+        }
+        v = (v << 6) | (cc & 0x3F);
+    }
+    cp = v;
+    return len;
+}
+
+namespace
+{
+inline bool is_word_ascii(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z');
+}
+
+inline bool is_upper_ascii(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z';
+}
+
+#if defined(RAG_TOK_SSE2) || defined(RAG_TOK_NEON)
+inline uint32_t ctz32(uint32_t x)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (uint32_t)i;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
+// 一块 16 字节的分类结果，每字节一位
+struct ascii_block
+{
+    uint32_t word;  // [A-Za-z0-9]
+    uint32_t upper; // [A-Z]
+    uint32_t high;  // >= 0x80
+};
+
+#if defined(RAG_TOK_SSE2)
+inline ascii_block classify16(const char *p)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    // 有符号比较：>= 0x80 的字节是负数，落不进任何 ASCII 区间
+    auto in_range = [](__m128i x, char lo, char hi)
+    {
+        return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8((char)(lo - 1))),
+                             _mm_cmplt_epi8(x, _mm_set1_epi8((char)(hi + 1))));
+    };
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    const __m128i upper = in_range(v, 'A', 'Z');
+    const __m128i word = _mm_or_si128(in_range(lower, 'a', 'z'), in_range(v, '0', '9'));
+    return {(uint32_t)_mm_movemask_epi8(word), (uint32_t)_mm_movemask_epi8(upper), (uint32_t)_mm_movemask_epi8(v)};
+}
+#else
+inline uint32_t movemask_u8(uint8x16_t m)
+{
+    static const uint8_t k_bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t b = vandq_u8(m, vld1q_u8(k_bits));
+    return (uint32_t)vaddv_u8(vget_low_u8(b)) | ((uint32_t)vaddv_u8(vget_high_u8(b)) << 8);
+}
+
+inline ascii_block classify16(const char *p)
+{
+    const uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    auto in_range = [](uint8x16_t x, uint8_t lo, uint8_t hi)
+    {
+        return vcleq_u8(vsubq_u8(x, vdupq_n_u8(lo)), vdupq_n_u8((uint8_t)(hi - lo)));
+    };
+    const uint8x16_t lower = vorrq_u8(v, vdupq_n_u8(0x20));
+    const uint8x16_t upper = in_range(v, 'A', 'Z');
+    const uint8x16_t word = vorrq_u8(in_range(lower, 'a', 'z'), in_range(v, '0', '9'));
+    return {movemask_u8(word), movemask_u8(upper), movemask_u8(vcgeq_u8(v, vdupq_n_u8(0x80)))};
+}
+#endif
+#endif
+
+class tokenizer
+{
+public:
+    tokenizer(std::string_view text, token_arena &out, const tokenize_options &opts)
+        : s_(text.data()), n_(text.size()), out_(out), cjk_(opts.cjk)
+    {
+        out_.tokens.clear();
+        out_.bytes.clear();
+        // 小写拷贝的总长不超过原文；先预留好，之后追加不会扩容，已输出的 string_view 不会失效
+        out_.bytes.reserve(n_);
+    }
+
+    void run()
+    {
+        size_t i = 0;
+        while (i < n_)
+        {
+            if ((unsigned char)s_[i] < 0x80)
+            {
+                end_cjk_run();
+                i = scan_ascii(i);
+                continue;
+            }
+            end_word(i);
+            uint32_t cp = 0;
+            const size_t len = utf8_decode(s_ + i, n_ - i, cp);
+            if (is_cjk_unified(cp))
+                add_cjk(i, len);
+            else
+                end_cjk_run();
+            i += len;
+        }
+        end_word(n_);
+        end_cjk_run();
+    }
+
+private:
+    // 从 i 开始处理连续的 ASCII 字节，返回第一个非 ASCII 字节（或结尾）的位置
+    size_t scan_ascii(size_t i)
+    {
+#if defined(RAG_TOK_SSE2) || defined(RAG_TOK_NEON)
+        while (i + 16 <= n_)
+        {
+            const ascii_block b = classify16(s_ + i);
+            const uint32_t limit = b.high ? ctz32(b.high) : 16;
+            const uint32_t limit_mask = (1u << limit) - 1;
+            const uint32_t word = b.word & limit_mask;
+            uint32_t pos = 0;
+            while (pos < limit)
+            {
+                const uint32_t from = ~0u << pos;
+                if (word_b_ != npos)
+                {
+                    const uint32_t stop = ~word & limit_mask & from;
+                    const uint32_t e = stop ? ctz32(stop) : limit;
+                    if (b.upper & from & ((1u << e) - 1))
+                        word_upper_ = true;
+                    if (!stop)
+                        break;
+                    end_word(i + e);
+                    pos = e;
+                }
+                else
+                {
+                    const uint32_t start = word & from;
+                    if (!start)
+                        break;
+                    pos = ctz32(start);
+                    word_b_ = i + pos;
+                    word_upper_ = false;
+                }
+            }
+            i += limit;
+            if (limit < 16)
+                return i;
+        }
+#endif
+        for (; i < n_; ++i)
+        {
+            const unsigned char c = (unsigned char)s_[i];
+            if (c >= 0x80)
+                break;
+            if (is_word_ascii(c))
+            {
+                if (word_b_ == npos)
+                {
+                    word_b_ = i;
+                    word_upper_ = false;
+                }
+                word_upper_ |= is_upper_ascii(c);
+            }
+            else
+            {
+                end_word(i);
+            }
+        }
+        return i;
+    }
+
+    void end_word(size_t e)
+    {
+        if (word_b_ == npos)
+            return;
+        const size_t len = e - word_b_;
+        if (!word_upper_)
+        {
+            out_.tokens.emplace_back(s_ + word_b_, len);
+        }
+        else
+        {
+            const size_t off = out_.bytes.size();
+            for (size_t k = word_b_; k < e; ++k)
+            {
+                const char c = s_[k];
+                out_.bytes.push_back(is_upper_ascii((unsigned char)c) ? (char)(c - 'A' + 'a') : c);
+            }
+            out_.tokens.emplace_back(out_.bytes.data() + off, len);
+        }
+        word_b_ = npos;
+    }
+
+    void add_cjk(size_t b, size_t len)
+    {
+        if (cjk_ != tokenize_cjk::bigram)
+            out_.tokens.emplace_back(s_ + b, len);
+        // 相邻的两个汉字在原文里是连续的，二元词也直接指向原文
+        if (cjk_ != tokenize_cjk::unigram && run_len_ > 0)
+            out_.tokens.emplace_back(s_ + prev_b_, b + len - prev_b_);
+        ++run_len_;
+        prev_b_ = b;
+        prev_len_ = len;
+    }
+
+    void end_cjk_run()
+    {
+        if (cjk_ == tokenize_cjk::bigram && run_len_ == 1)
+            out_.tokens.emplace_back(s_ + prev_b_, prev_len_);
+        run_len_ = 0;
+    }
+
+    static constexpr size_t npos = (size_t)-1;
+
+    const char *s_;
+    size_t n_;
+    token_arena &out_;
+    tokenize_cjk cjk_;
+
+    size_t word_b_ = npos; // 当前英文/数字词的起点
+    bool word_upper_ = false;
+    size_t run_len_ = 0; // 当前连续汉字数
+    size_t prev_b_ = 0;
+    size_t prev_len_ = 0;
+};
+} // namespace
+
+void tokenize_zh_en(std::string_view text, token_arena &out, const tokenize_options &opts)
+{
+    tokenizer(text, out, opts).run();
+}
+
+std::vector<std::string> tokenize_zh_en(const std::string &text, const tokenize_options &opts)
+{
+    token_arena arena;
+    tokenize_zh_en(text, arena, opts);
+    std::vector<std::string> out;
+    out.reserve(arena.tokens.size());
+    for (const auto &t : arena.tokens)
+        out.emplace_back(t);
+    return out;
+}
+
+bool tokenize_parse_cjk(const std::string &name, tokenize_cjk &out)
+{
+    if (name == "unigram")
+        out = tokenize_cjk::unigram;
+    else if (name == "bigram")
+        out = tokenize_cjk::bigram;
+    else if (name == "both")
+        out = tokenize_cjk::both;
+    else
+        return false;
+    return true;
+}
+
+const char *tokenize_isa()
+{
+#if defined(RAG_TOK_SSE2)
+    return "sse2";
+#elif defined(RAG_TOK_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,50 @@
+// src/text_tokenize.h
+// 与 python/BM25.py::tokenize_zh_en 相同的切分规则，保证 C++ 与 Python 的 BM25 分数可比：
+// - 英文/数字：小写后按 [a-z0-9]+ 连续串切分
+// - 中文：[一-鿿] 每个汉字单独成词
+//
+// 单趟解码 UTF-8；纯 ASCII 段按 16 字节一块用 SSE2/NEON 分类，再按位掩码找词边界。
+// 词以 string_view 输出：本来就是小写的英文词、汉字与相邻汉字组成的二元词直接指向原文，
+// 只有含大写字母的词才拷进 token_arena 自带的缓冲区。可选的 CJK 二元切分不需要词典，能提高中文查询的精度。
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class tokenize_cjk : uint32_t
+{
+    unigram = 0, // 每个汉字一个词（与 Python 相同，默认）
+    bigram = 1,  // 相邻汉字两两成词；孤立的单个汉字仍按单字输出（与 Lucene CJKBigramFilter 相同）
+    both = 2,    // 单字与二元词都输出
+};
+
+struct tokenize_options
+{
+    tokenize_cjk cjk = tokenize_cjk::unigram;
+};
+
+// 可复用的输出：tokens 指向原文或 bytes，在下一次 tokenize 或原文释放之前有效
+struct token_arena
+{
+    std::string bytes; // 需要改写（小写）的词
+    std::vector<std::string_view> tokens;
+};
+
+void tokenize_zh_en(std::string_view text, token_arena &out, const tokenize_options &opts = tokenize_options());
+std::vector<std::string> tokenize_zh_en(const std::string &text, const tokenize_options &opts = tokenize_options());
+
+// 解析命令行的 unigram / bigram / both；不认识返回 false
+bool tokenize_parse_cjk(const std::string &name, tokenize_cjk &out);
+
+// 当前编译进来的 ASCII 快速路径（"sse2" / "neon" / "scalar"），打日志用
+const char *tokenize_isa();
+
+// 解码一个 UTF-8 码点；非法字节按单字节 U+FFFD 处理。返回消耗的字节数（>= 1）
+size_t utf8_decode(const char *s, size_t n, uint32_t &cp);
+
+inline bool is_cjk_unified(uint32_t cp)
+{
+    return cp >= 0x4E00 && cp <= 0x9FFF;
+}
@@ -0,0 +1,363 @@
+// src/vec_kernels.cpp
+#include "vec_kernels.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#define RAG_VEC_AVX512 1
+#include <immintrin.h>
+#elif defined(__AVX2__) && (defined(_MSC_VER) || (defined(__FMA__) && defined(__F16C__)))
+// MSVC 的 /arch:AVX2 同时启用 FMA/F16C，但不定义对应的宏
+#define RAG_VEC_AVX2 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define RAG_VEC_NEON 1
+#include <arm_neon.h>
+#endif
+
+// ---------- fp16 <-> fp32（标量，round-to-nearest-even） ----------
+uint16_t vec_fp32_to_fp16(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, 4);
+    const uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7FFFFF;
+    int32_t exp = (int32_t)((x >> 23) & 0xFF);
+
+    if (exp == 0xFF) // inf / nan
+        return (uint16_t)(sign | 0x7C00 | (mant ? 0x200 : 0));
+
+    exp = exp - 127 + 15;
+    if (exp >= 0x1F) // 上溢
+        return (uint16_t)(sign | 0x7C00);
+    if (exp <= 0)
+    {
+        // 半精度非规格化数
+        if (exp < -10)
+            return (uint16_t)sign;
+        mant |= 0x800000;
+        const int shift = 14 - exp;
+        uint32_t h = mant >> shift;
+        const uint32_t rem = mant & ((1u << shift) - 1);
+        const uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1)))
+            ++h;
+        return (uint16_t)(sign | h);
+    }
+
+    uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+    const uint32_t rem = mant & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        ++h; // 进位到指数位时自然变成下一档（最大值进位后为 inf）
+    return (uint16_t)(sign | h);
+}
+
+float vec_fp16_to_fp32(uint16_t h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t x;
+    if (exp == 0)
+    {
+        if (mant == 0)
+        {
+            x = sign;
+        }
+        else
+        {
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400))
+            {
+                mant <<= 1;
+                --exp;
+            }
+            x = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+        }
+    }
+    else if (exp == 0x1F)
+    {
+        x = sign | 0x7F800000 | (mant << 13);
+    }
+    else
+    {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, 4);
+    return f;
+}
+
+void vec_f32_to_f16(const float *src, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = vec_fp32_to_fp16(src[i]);
+}
+
+void vec_f16_to_f32(const uint16_t *src, float *dst, size_t n)
+{
+    size_t i = 0;
+#if defined(RAG_VEC_AVX512)
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(src + i))));
+#elif defined(RAG_VEC_AVX2)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+#endif
+    for (; i < n; ++i)
+        dst[i] = vec_fp16_to_fp32(src[i]);
+}
+
+float vec_quantize_i8(const float *src, int8_t *dst, size_t n)
+{
+    float max_abs = 0.0f;
+    for (size_t i = 0; i < n; ++i)
+        max_abs = std::fmax(max_abs, std::fabs(src[i]));
+    if (max_abs == 0.0f)
+    {
+        std::memset(dst, 0, n);
+        return 0.0f;
+    }
+    const float scale = max_abs / 127.0f;
+    const float inv = 1.0f / scale;
+    for (size_t i = 0; i < n; ++i)
+    {
+        float q = std::nearbyint(src[i] * inv);
+        q = q > 127.0f ? 127.0f : (q < -127.0f ? -127.0f : q);
+        dst[i] = (int8_t)q;
+    }
+    return scale;
+}
+
+// ---------- 点积内核 ----------
+#if defined(RAG_VEC_AVX512)
+
+const char *vec_kernels_isa()
+{
+    return "avx512";
+}
+
+float vec_dot_f32(const float *a, const float *b, size_t n)
+{
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16)
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    if (i < n)
+    {
+        const __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+float vec_dot_f16_f32(const uint16_t *a, const float *b, size_t n)
+{
+    __m512 acc = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m512 va = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(a + i)));
+        acc = _mm512_fmadd_ps(va, _mm512_loadu_ps(b + i), acc);
+    }
+    float sum = _mm512_reduce_add_ps(acc);
+    for (; i < n; ++i)
+        sum += vec_fp16_to_fp32(a[i]) * b[i];
+    return sum;
+}
+
+int32_t vec_dot_i8(const int8_t *a, const int8_t *b, size_t n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        const __m512i va = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(a + i)));
+        const __m512i vb = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(b + i)));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(va, vb));
+    }
+    int32_t sum = _mm512_reduce_add_epi32(acc);
+    for (; i < n; ++i)
+        sum += (int32_t)a[i] * (int32_t)b[i];
+    return sum;
+}
+
+#elif defined(RAG_VEC_AVX2)
+
+namespace
+{
+inline float hsum256(__m256 v)
+{
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+inline int32_t hsum256_epi32(__m256i v)
+{
+    __m128i lo = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(lo);
+}
+} // namespace
+
+const char *vec_kernels_isa()
+{
+    return "avx2";
+}
+
+float vec_dot_f32(const float *a, const float *b, size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    float sum = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+float vec_dot_f16_f32(const uint16_t *a, const float *b, size_t n)
+{
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 va = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(a + i)));
+        acc = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + i), acc);
+    }
+    float sum = hsum256(acc);
+    for (; i < n; ++i)
+        sum += vec_fp16_to_fp32(a[i]) * b[i];
+    return sum;
+}
+
+int32_t vec_dot_i8(const int8_t *a, const int8_t *b, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+        const __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    int32_t sum = hsum256_epi32(acc);
+    for (; i < n; ++i)
+        sum += (int32_t)a[i] * (int32_t)b[i];
+    return sum;
+}
+
+#elif defined(RAG_VEC_NEON)
+
+const char *vec_kernels_isa()
+{
+    return "neon";
+}
+
+float vec_dot_f32(const float *a, const float *b, size_t n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+float vec_dot_f16_f32(const uint16_t *a, const float *b, size_t n)
+{
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const float32x4_t va = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(a + i)));
+        acc = vfmaq_f32(acc, va, vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(acc);
+    for (; i < n; ++i)
+        sum += vec_fp16_to_fp32(a[i]) * b[i];
+    return sum;
+}
+
+int32_t vec_dot_i8(const int8_t *a, const int8_t *b, size_t n)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const int8x16_t va = vld1q_s8(a + i);
+        const int8x16_t vb = vld1q_s8(b + i);
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+    }
+    int32_t sum = vaddvq_s32(acc);
+    for (; i < n; ++i)
+        sum += (int32_t)a[i] * (int32_t)b[i];
+    return sum;
+}
+
+#else
+
+const char *vec_kernels_isa()
+{
+    return "scalar";
+}
+
+float vec_dot_f32(const float *a, const float *b, size_t n)
+{
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i)
+        s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+float vec_dot_f16_f32(const uint16_t *a, const float *b, size_t n)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i)
+        sum += vec_fp16_to_fp32(a[i]) * b[i];
+    return sum;
+}
+
+int32_t vec_dot_i8(const int8_t *a, const int8_t *b, size_t n)
+{
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += (int32_t)a[i] * (int32_t)b[i];
+    return sum;
+}
+
+#endif
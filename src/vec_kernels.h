@@ -0,0 +1,25 @@
+// src/vec_kernels.h
+// 向量索引用的距离内核：f32 / fp16 / int8 三种存储。
+// 指令集在编译期选择（RAG_NATIVE 打开时按本机 -march=native）：
+// AVX-512 > AVX2(+FMA/F16C) > NEON > 标量。L2 统一用 |a|^2 + |b|^2 - 2<a,b>，内核只需要点积。
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 当前编译进来的实现名（"avx512" / "avx2" / "neon" / "scalar"），打日志用
+const char *vec_kernels_isa();
+
+float vec_dot_f32(const float *a, const float *b, size_t n);
+// a 为 fp16 存储，b 为 f32 查询
+float vec_dot_f16_f32(const uint16_t *a, const float *b, size_t n);
+int32_t vec_dot_i8(const int8_t *a, const int8_t *b, size_t n);
+
+void vec_f32_to_f16(const float *src, uint16_t *dst, size_t n);
+void vec_f16_to_f32(const uint16_t *src, float *dst, size_t n);
+
+// 对称量化：x ≈ scale * q，q ∈ [-127, 127]；返回 scale（全零向量返回 0）
+float vec_quantize_i8(const float *src, int8_t *dst, size_t n);
+
+uint16_t vec_fp32_to_fp16(float f);
+float vec_fp16_to_fp32(uint16_t h);
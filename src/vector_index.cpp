@@ -0,0 +1,600 @@
+// src/vector_index.cpp
+#include "vector_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <thread>
+
+#include "vec_kernels.h"
+
+namespace
+{
+constexpr uint32_t k_max_level = 16;
+
+// 每线程一个访问标记表；epoch 自增代替每次清零
+struct visited_list
+{
+    std::vector<uint32_t> tags;
+    uint32_t epoch = 0;
+
+    void begin(size_t n)
+    {
+        if (tags.size() < n)
+            tags.resize(n, 0);
+        if (++epoch == 0)
+        {
+            std::fill(tags.begin(), tags.end(), 0);
+            epoch = 1;
+        }
+    }
+    bool visit(uint32_t i)
+    {
+        if (tags[i] == epoch)
+            return false;
+        tags[i] = epoch;
+        return true;
+    }
+};
+
+visited_list &tls_visited()
+{
+    thread_local visited_list v;
+    return v;
+}
+
+using cand = std::pair<float, uint32_t>;
+
+struct farther_first
+{
+    bool operator()(const cand &a, const cand &b) const { return a.first < b.first; }
+};
+struct nearer_first
+{
+    bool operator()(const cand &a, const cand &b) const { return a.first > b.first; }
+};
+} // namespace
+
+struct vector_index::store
+{
+    std::vector<int64_t> keys;
+    std::vector<uint8_t> codes;
+    std::vector<float> scales;
+    std::vector<float> norms;
+    std::vector<uint8_t> levels;
+    std::vector<uint32_t> level0;
+    std::vector<uint32_t> upper_off;
+    std::vector<uint32_t> upper;
+};
+
+bool vector_index::init(const vector_index_params &params, std::string &err)
+{
+    if (params.dim == 0)
+    {
+        err = "vector dim must be > 0";
+        return false;
+    }
+    if (params.M < 2)
+    {
+        err = "HNSW M must be >= 2";
+        return false;
+    }
+    params_ = params;
+    M0_ = params.M * 2;
+    switch (params.storage)
+    {
+    case vec_storage::f32:
+        code_size_ = params.dim * 4;
+        break;
+    case vec_storage::f16:
+        code_size_ = params.dim * 2;
+        break;
+    case vec_storage::i8:
+        code_size_ = params.dim;
+        break;
+    }
+    entry_ = 0;
+    max_level_ = 0;
+    rng_.seed(params.seed);
+
+    own_ = std::make_shared<store>();
+    storage_ = own_;
+    bind_views();
+    return true;
+}
+
+void vector_index::bind_views()
+{
+    keys_ = own_->keys;
+    codes_ = own_->codes;
+    scales_ = own_->scales;
+    norms_ = own_->norms;
+    levels_ = own_->levels;
+    level0_ = own_->level0;
+    upper_off_ = own_->upper_off;
+    upper_ = own_->upper;
+}
+
+// ---------- 距离 ----------
+void vector_index::prepare(const float *vec, query &q) const
+{
+    const size_t d = params_.dim;
+    q.f.assign(vec, vec + d);
+    q.norm = vec_dot_f32(vec, vec, d);
+    if (params_.storage == vec_storage::i8)
+    {
+        q.q8.resize(d);
+        q.q8_scale = vec_quantize_i8(vec, q.q8.data(), d);
+    }
+}
+
+void vector_index::prepare_node(uint32_t node, query &q) const
+{
+    const size_t d = params_.dim;
+    const uint8_t *code = codes_.data() + (size_t)node * code_size_;
+    q.f.resize(d);
+    switch (params_.storage)
+    {
+    case vec_storage::f32:
+        std::memcpy(q.f.data(), code, d * sizeof(float));
+        break;
+    case vec_storage::f16:
+        vec_f16_to_f32((const uint16_t *)code, q.f.data(), d);
+        break;
+    case vec_storage::i8:
+        q.q8.assign((const int8_t *)code, (const int8_t *)code + d);
+        q.q8_scale = scales_[node];
+        for (size_t i = 0; i < d; ++i)
+            q.f[i] = q.q8_scale * (float)q.q8[i];
+        break;
+    }
+    q.norm = norms_[node];
+}
+
+float vector_index::distance(const query &q, uint32_t node) const
+{
+    const size_t d = params_.dim;
+    const uint8_t *code = codes_.data() + (size_t)node * code_size_;
+    float dot = 0.0f;
+    switch (params_.storage)
+    {
+    case vec_storage::f32:
+        dot = vec_dot_f32((const float *)code, q.f.data(), d);
+        break;
+    case vec_storage::f16:
+        dot = vec_dot_f16_f32((const uint16_t *)code, q.f.data(), d);
+        break;
+    case vec_storage::i8:
+        dot = (float)vec_dot_i8((const int8_t *)code, q.q8.data(), d) * (scales_[node] * q.q8_scale);
+        break;
+    }
+    if (params_.metric == vec_metric::ip)
+        return -dot;
+    return std::max(0.0f, q.norm + norms_[node] - 2.0f * dot);
+}
+
+// ---------- 图 ----------
+const uint32_t *vector_index::links(uint32_t node, uint32_t level) const
+{
+    if (level == 0)
+        return level0_.data() + (size_t)node * (M0_ + 1);
+    return upper_.data() + upper_off_[node] + (size_t)(level - 1) * (params_.M + 1);
+}
+
+uint32_t *vector_index::links_mut(uint32_t node, uint32_t level)
+{
+    if (level == 0)
+        return own_->level0.data() + (size_t)node * (M0_ + 1);
+    return own_->upper.data() + own_->upper_off[node] + (size_t)(level - 1) * (params_.M + 1);
+}
+
+uint32_t vector_index::greedy(const query &q, uint32_t ep, uint32_t from_level, uint32_t to_level) const
+{
+    float best = distance(q, ep);
+    for (uint32_t lc = from_level; lc > to_level; --lc)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            const uint32_t *l = links(ep, lc);
+            for (uint32_t j = 1; j <= l[0]; ++j)
+            {
+                const float d = distance(q, l[j]);
+                if (d < best)
+                {
+                    best = d;
+                    ep = l[j];
+                    changed = true;
+                }
+            }
+        }
+    }
+    return ep;
+}
+
+std::vector<vector_index::cand> vector_index::search_layer(const query &q, uint32_t ep, size_t ef, uint32_t level) const
+{
+    visited_list &vis = tls_visited();
+    vis.begin(keys_.size());
+
+    std::priority_queue<cand, std::vector<cand>, nearer_first> frontier;
+    std::priority_queue<cand, std::vector<cand>, farther_first> best;
+
+    const float d0 = distance(q, ep);
+    vis.visit(ep);
+    frontier.push({d0, ep});
+    best.push({d0, ep});
+
+    while (!frontier.empty())
+    {
+        const cand c = frontier.top();
+        if (c.first > best.top().first && best.size() >= ef)
+            break;
+        frontier.pop();
+
+        const uint32_t *l = links(c.second, level);
+        for (uint32_t j = 1; j <= l[0]; ++j)
+        {
+            const uint32_t nb = l[j];
+            if (!vis.visit(nb))
+                continue;
+            const float d = distance(q, nb);
+            if (best.size() < ef || d < best.top().first)
+            {
+                frontier.push({d, nb});
+                best.push({d, nb});
+                if (best.size() > ef)
+                    best.pop();
+            }
+        }
+    }
+
+    std::vector<cand> out(best.size());
+    for (size_t i = out.size(); i-- > 0;)
+    {
+        out[i] = best.top();
+        best.pop();
+    }
+    return out;
+}
+
+std::vector<uint32_t> vector_index::select_neighbors(const std::vector<cand> &sorted, size_t max_m) const
+{
+    std::vector<uint32_t> out;
+    if (sorted.size() <= max_m)
+    {
+        for (const auto &c : sorted)
+            out.push_back(c.second);
+        return out;
+    }
+
+    std::vector<query> picked;
+    picked.reserve(max_m);
+    for (const auto &c : sorted)
+    {
+        if (out.size() >= max_m)
+            break;
+        bool good = true;
+        for (const auto &r : picked)
+        {
+            if (distance(r, c.second) < c.first)
+            {
+                good = false;
+                break;
+            }
+        }
+        if (good)
+        {
+            out.push_back(c.second);
+            picked.emplace_back();
+            prepare_node(c.second, picked.back());
+        }
+    }
+    return out;
+}
+
+void vector_index::connect(uint32_t from, uint32_t to, uint32_t level)
+{
+    const uint32_t max_m = level == 0 ? M0_ : params_.M;
+    uint32_t *l = links_mut(from, level);
+    if (l[0] < max_m)
+    {
+        l[++l[0]] = to;
+        return;
+    }
+
+    // 邻居表已满：连同新节点一起按启发式重选
+    query base;
+    prepare_node(from, base);
+    std::vector<cand> cs;
+    cs.reserve(max_m + 1);
+    cs.push_back({distance(base, to), to});
+    for (uint32_t j = 1; j <= l[0]; ++j)
+        cs.push_back({distance(base, l[j]), l[j]});
+    std::sort(cs.begin(), cs.end());
+
+    const std::vector<uint32_t> keep = select_neighbors(cs, max_m);
+    l[0] = (uint32_t)keep.size();
+    for (size_t j = 0; j < keep.size(); ++j)
+        l[j + 1] = keep[j];
+}
+
+bool vector_index::add(int64_t doc_key, const float *vec, std::string &err)
+{
+    if (!own_)
+    {
+        err = params_.dim ? "vector index opened from file is read-only" : "vector index is not initialized";
+        return false;
+    }
+
+    const size_t d = params_.dim;
+    const uint32_t node = (uint32_t)own_->keys.size();
+
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    const double ml = 1.0 / std::log((double)params_.M);
+    const uint32_t level = std::min(k_max_level, (uint32_t)(-std::log(1.0 - uni(rng_)) * ml));
+
+    // 1) 存向量
+    own_->keys.push_back(doc_key);
+    own_->codes.resize(own_->codes.size() + code_size_);
+    uint8_t *code = own_->codes.data() + (size_t)node * code_size_;
+    switch (params_.storage)
+    {
+    case vec_storage::f32:
+        std::memcpy(code, vec, d * sizeof(float));
+        break;
+    case vec_storage::f16:
+        vec_f32_to_f16(vec, (uint16_t *)code, d);
+        break;
+    case vec_storage::i8:
+        own_->scales.push_back(vec_quantize_i8(vec, (int8_t *)code, d));
+        break;
+    }
+    own_->norms.push_back(0.0f);
+    own_->levels.push_back((uint8_t)level);
+    own_->level0.resize(own_->level0.size() + M0_ + 1, 0);
+    own_->upper_off.push_back((uint32_t)own_->upper.size());
+    own_->upper.resize(own_->upper.size() + (size_t)level * (params_.M + 1), 0);
+    bind_views();
+
+    // 范数按反量化后的向量计算，与查询时的点积口径一致
+    query q;
+    prepare_node(node, q);
+    own_->norms[node] = vec_dot_f32(q.f.data(), q.f.data(), d);
+    prepare(vec, q);
+
+    if (node == 0)
+    {
+        entry_ = 0;
+        max_level_ = level;
+        return true;
+    }
+
+    // 2) 从入口逐层下降，在 level 及以下各层连边
+    uint32_t ep = greedy(q, entry_, max_level_, level);
+    for (uint32_t lc = std::min(level, max_level_) + 1; lc-- > 0;)
+    {
+        const std::vector<cand> w = search_layer(q, ep, params_.ef_construction, lc);
+        const std::vector<uint32_t> nbs = select_neighbors(w, lc == 0 ? M0_ : params_.M);
+
+        uint32_t *l = links_mut(node, lc);
+        l[0] = (uint32_t)nbs.size();
+        for (size_t j = 0; j < nbs.size(); ++j)
+        {
+            l[j + 1] = nbs[j];
+            connect(nbs[j], node, lc);
+        }
+        ep = w.front().second;
+    }
+
+    if (level > max_level_)
+    {
+        entry_ = node;
+        max_level_ = level;
+    }
+    return true;
+}
+
+// ---------- 查询 ----------
+std::vector<vec_hit> vector_index::search(const float *vec, size_t top_k, size_t ef) const
+{
+    std::vector<vec_hit> out;
+    if (keys_.empty() || top_k == 0)
+        return out;
+
+    query q;
+    prepare(vec, q);
+    const uint32_t ep = greedy(q, entry_, max_level_, 0);
+    const std::vector<cand> w = search_layer(q, ep, std::max(top_k, ef ? ef : (size_t)params_.ef_search), 0);
+
+    out.reserve(std::min(top_k, w.size()));
+    for (size_t i = 0; i < w.size() && i < top_k; ++i)
+        out.push_back({keys_[w[i].second], w[i].first});
+    return out;
+}
+
+std::vector<vec_hit> vector_index::search_exact(const float *vec, size_t top_k) const
+{
+    std::vector<vec_hit> out;
+    if (keys_.empty() || top_k == 0)
+        return out;
+
+    query q;
+    prepare(vec, q);
+    std::priority_queue<cand, std::vector<cand>, farther_first> best;
+    for (uint32_t i = 0; i < (uint32_t)keys_.size(); ++i)
+    {
+        const float d = distance(q, i);
+        if (best.size() < top_k)
+            best.push({d, i});
+        else if (d < best.top().first)
+        {
+            best.pop();
+            best.push({d, i});
+        }
+    }
+
+    out.resize(best.size());
+    for (size_t i = out.size(); i-- > 0;)
+    {
+        out[i] = {keys_[best.top().second], best.top().first};
+        best.pop();
+    }
+    return out;
+}
+
+void vector_index::search_batch(const float *queries, size_t n_queries, size_t top_k,
+                                std::vector<std::vector<vec_hit>> &out, int n_threads, size_t ef) const
+{
+    out.assign(n_queries, {});
+    if (n_threads <= 0)
+        n_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    n_threads = (int)std::min<size_t>((size_t)n_threads, n_queries);
+
+    auto work = [&](size_t t)
+    {
+        for (size_t i = t; i < n_queries; i += (size_t)n_threads)
+            out[i] = search(queries + i * params_.dim, top_k, ef);
+    };
+    if (n_threads <= 1)
+    {
+        work(0);
+        return;
+    }
+    std::vector<std::thread> pool;
+    pool.reserve((size_t)n_threads);
+    for (int t = 0; t < n_threads; ++t)
+        pool.emplace_back(work, (size_t)t);
+    for (auto &th : pool)
+        th.join();
+}
+
+// ---------- 落盘 ----------
+bool vector_index::save(const std::string &path, std::string &err) const
+{
+    vector_index_meta meta{};
+    meta.dim = params_.dim;
+    meta.metric = (uint32_t)params_.metric;
+    meta.storage = (uint32_t)params_.storage;
+    meta.M = params_.M;
+    meta.M0 = M0_;
+    meta.ef_construction = params_.ef_construction;
+    meta.ef_search = params_.ef_search;
+    meta.max_level = max_level_;
+    meta.n = keys_.size();
+    meta.entry = entry_;
+    meta.code_size = code_size_;
+
+    index_file_writer w;
+    w.add("META", &meta, sizeof(meta));
+    w.add("DOCKEYS", keys_.data(), keys_.size() * sizeof(int64_t));
+    w.add("CODES", codes_.data(), codes_.size());
+    w.add("SCALES", scales_.data(), scales_.size() * sizeof(float));
+    w.add("NORMS", norms_.data(), norms_.size() * sizeof(float));
+    w.add("LEVELS", levels_.data(), levels_.size());
+    w.add("LEVEL0", level0_.data(), level0_.size() * sizeof(uint32_t));
+    w.add("UPOFF", upper_off_.data(), upper_off_.size() * sizeof(uint32_t));
+    w.add("UPPER", upper_.data(), upper_.size() * sizeof(uint32_t));
+    return w.write(path, k_index_kind_vector, err);
+}
+
+bool vector_index::open(const std::string &path, std::string &err)
+{
+    index_file_reader r;
+    if (!r.open(path, k_index_kind_vector, err))
+        return false;
+
+    array_view<vector_index_meta> meta;
+    vector_index idx;
+    if (!r.get("META", meta, err) || meta.size() != 1 ||
+        !r.get("DOCKEYS", idx.keys_, err) ||
+        !r.get("CODES", idx.codes_, err) ||
+        !r.get("SCALES", idx.scales_, err) ||
+        !r.get("NORMS", idx.norms_, err) ||
+        !r.get("LEVELS", idx.levels_, err) ||
+        !r.get("LEVEL0", idx.level0_, err) ||
+        !r.get("UPOFF", idx.upper_off_, err) ||
+        !r.get("UPPER", idx.upper_, err))
+    {
+        if (err.empty())
+            err = "bad META section";
+        return false;
+    }
+
+    const vector_index_meta &m = meta[0];
+    const size_t n = (size_t)m.n;
+    const bool i8 = m.storage == (uint32_t)vec_storage::i8;
+    const uint32_t elem = m.storage == (uint32_t)vec_storage::f32 ? 4 : (m.storage == (uint32_t)vec_storage::f16 ? 2 : 1);
+    if (m.dim == 0 || m.code_size != m.dim * elem || m.metric > 1 || m.storage > 2 || m.M < 2 || m.M0 != m.M * 2 ||
+        idx.keys_.size() != n || idx.codes_.size() != n * m.code_size || idx.norms_.size() != n ||
+        idx.scales_.size() != (i8 ? n : 0) || idx.levels_.size() != n || idx.upper_off_.size() != n ||
+        idx.level0_.size() != n * (m.M0 + 1) || (n && m.entry >= n) || m.max_level > k_max_level)
+    {
+        err = "inconsistent section sizes: " + path;
+        return false;
+    }
+
+    idx.params_.dim = m.dim;
+    idx.params_.metric = (vec_metric)m.metric;
+    idx.params_.storage = (vec_storage)m.storage;
+    idx.params_.M = m.M;
+    idx.params_.ef_construction = m.ef_construction;
+    idx.params_.ef_search = m.ef_search;
+    idx.M0_ = m.M0;
+    idx.code_size_ = m.code_size;
+    idx.entry_ = m.entry;
+    idx.max_level_ = m.max_level;
+    idx.storage_ = r.mapping();
+    if (!idx.check_links(err))
+    {
+        err += ": " + path;
+        return false;
+    }
+
+    *this = std::move(idx);
+    return true;
+}
+
+bool vector_index::check_links(std::string &err) const
+{
+    const size_t n = keys_.size();
+    if (n && levels_[entry_] != max_level_)
+    {
+        err = "entry node is not on the top level";
+        return false;
+    }
+    // 第 lc 层的邻居自身也必须在第 lc 层及以上，greedy / search_layer 才能接着取它的邻居表
+    auto check = [&](const uint32_t *l, uint32_t max_m, uint32_t level)
+    {
+        if (l[0] > max_m)
+            return false;
+        for (uint32_t j = 1; j <= l[0]; ++j)
+        {
+            if (l[j] >= n || levels_[l[j]] < level)
+                return false;
+        }
+        return true;
+    };
+    for (size_t i = 0; i < n; ++i)
+    {
+        const uint32_t node_level = levels_[i];
+        if (node_level > max_level_ ||
+            upper_off_[i] > upper_.size() ||
+            (size_t)node_level * (params_.M + 1) > upper_.size() - upper_off_[i])
+        {
+            err = "corrupt level entry for node " + std::to_string(i);
+            return false;
+        }
+        for (uint32_t lc = 0; lc <= node_level; ++lc)
+        {
+            if (!check(links((uint32_t)i, lc), lc == 0 ? M0_ : params_.M, lc))
+            {
+                err = "corrupt neighbour list for node " + std::to_string(i) + " at level " + std::to_string(lc);
+                return false;
+            }
+        }
+    }
+    return true;
+}
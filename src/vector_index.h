@@ -0,0 +1,135 @@
+// src/vector_index.h
+// 稠密向量检索：替代 python/FAISS.py 里演示用的 IndexFlatL2。
+//
+// - 存储：f32 / fp16 / int8（每向量一个对称 scale），距离内核见 vec_kernels.h。
+// - 结构：HNSW 图。第 0 层每个节点 2M 个邻居，上层 M 个，邻居表是定长数组，
+//   和 bm25_index 一样整块落盘到 index_file，open() 后直接在 mmap 上查询。
+// - 结果按 documents.id 返回，可以直接交给 load_context_from_sqlite_by_ids 取证据。
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "index_file.h"
+
+enum class vec_metric : uint32_t
+{
+    l2 = 0, // 平方欧氏距离
+    ip = 1, // 内积（向量已归一化时即余弦相似度）
+};
+
+enum class vec_storage : uint32_t
+{
+    f32 = 0,
+    f16 = 1,
+    i8 = 2,
+};
+
+struct vector_index_params
+{
+    uint32_t dim = 0;
+    vec_metric metric = vec_metric::ip;
+    vec_storage storage = vec_storage::f16;
+
+    uint32_t M = 16;                // 上层每个节点的邻居数；第 0 层为 2M
+    uint32_t ef_construction = 200; // 建图时的候选集大小
+    uint32_t ef_search = 64;        // 查询时的默认候选集大小
+    uint32_t seed = 42;
+};
+
+struct vec_hit
+{
+    int64_t doc_key = 0; // SQLite documents.id
+    float distance = 0.0f; // 越小越近：l2 为平方距离，ip 为 -<q, x>
+};
+
+// 落盘的 META 区段
+struct vector_index_meta
+{
+    uint32_t dim;
+    uint32_t metric;
+    uint32_t storage;
+    uint32_t M;
+    uint32_t M0;
+    uint32_t ef_construction;
+    uint32_t ef_search;
+    uint32_t max_level;
+    uint64_t n;
+    uint32_t entry;
+    uint32_t code_size;
+};
+
+class vector_index
+{
+public:
+    bool init(const vector_index_params &params, std::string &err);
+
+    // vec 为 dim 个 float；open() 得到的索引是只读的
+    bool add(int64_t doc_key, const float *vec, std::string &err);
+
+    size_t size() const { return keys_.size(); }
+    uint32_t dim() const { return params_.dim; }
+    const vector_index_params &params() const { return params_; }
+
+    // ef = 0 时使用 params().ef_search；线程安全
+    std::vector<vec_hit> search(const float *query, size_t top_k, size_t ef = 0) const;
+    // 暴力扫描，用于小库和召回率对照
+    std::vector<vec_hit> search_exact(const float *query, size_t top_k) const;
+    // queries 为 n_queries * dim 的行主序矩阵；n_threads <= 0 时用全部硬件线程
+    void search_batch(const float *queries, size_t n_queries, size_t top_k,
+                      std::vector<std::vector<vec_hit>> &out, int n_threads = 0, size_t ef = 0) const;
+
+    bool save(const std::string &path, std::string &err) const;
+    bool open(const std::string &path, std::string &err);
+
+private:
+    struct store; // 建图期持有的数组
+    struct query  // 预处理过的查询向量
+    {
+        std::vector<float> f;
+        std::vector<int8_t> q8;
+        float q8_scale = 0.0f;
+        float norm = 0.0f; // |q|^2
+    };
+    using cand = std::pair<float, uint32_t>; // (distance, node)
+
+    void prepare(const float *vec, query &q) const;
+    void prepare_node(uint32_t node, query &q) const;
+    float distance(const query &q, uint32_t node) const;
+
+    const uint32_t *links(uint32_t node, uint32_t level) const;
+    uint32_t *links_mut(uint32_t node, uint32_t level);
+
+    uint32_t greedy(const query &q, uint32_t ep, uint32_t from_level, uint32_t to_level) const;
+    // 返回按距离升序排列的至多 ef 个候选
+    std::vector<cand> search_layer(const query &q, uint32_t ep, size_t ef, uint32_t level) const;
+    // HNSW 启发式选邻居：离基点近、且不被已选邻居“遮挡”的候选优先
+    std::vector<uint32_t> select_neighbors(const std::vector<cand> &sorted, size_t max_m) const;
+    void connect(uint32_t from, uint32_t to, uint32_t level);
+
+    void bind_views();
+    // open() 时对邻居表做一遍越界检查：层数、邻居个数与 id 都要在范围内，否则查询会读出映射之外
+    bool check_links(std::string &err) const;
+
+    vector_index_params params_;
+    uint32_t M0_ = 0;
+    uint32_t code_size_ = 0; // 每个向量的字节数
+    uint32_t entry_ = 0;
+    uint32_t max_level_ = 0;
+    std::mt19937 rng_;
+
+    std::shared_ptr<store> own_;          // 建图期非空
+    std::shared_ptr<const void> storage_; // own_ 或 index_file 的映射
+
+    array_view<int64_t> keys_;      // 节点 -> documents.id
+    array_view<uint8_t> codes_;     // n * code_size
+    array_view<float> scales_;      // int8 存储的每向量 scale
+    array_view<float> norms_;       // 存储向量（反量化后）的 |x|^2
+    array_view<uint8_t> levels_;    // 节点所在最高层
+    array_view<uint32_t> level0_;   // n * (1 + M0)：[count][邻居...]
+    array_view<uint32_t> upper_off_; // 节点第 1 层邻居表在 upper_ 中的下标
+    array_view<uint32_t> upper_;    // 每个节点 level 个 (1 + M) 的邻居表
+};